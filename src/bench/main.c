@@ -0,0 +1,693 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * darktable-bench: headless throughput numbers for regression gating.
+ *
+ *  - every iop's process() on synthetic and (with --image) real float buffers,
+ *    at several sizes and openmp thread counts,
+ *  - end-to-end dt_imageio_export_with_flags() of --image with every --xmp,
+ *  - with --codecs instead of the above, the codecs for compressed thumbnails:
+ *    size, quality and encode/decode speed, to choose cache_compression.
+ *
+ * opencl is always disabled. every measurement is repeated --runs times after
+ * one warm-up run and reported as one tab separated line with min, median,
+ * mean and standard deviation of the wall time, and megapixels per second
+ * derived from the median.
+ */
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/image_compression.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
+#include "common/exif.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+#include "squish/csquish.h"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libintl.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+typedef struct dt_bench_t
+{
+  GArray *sizes;    // megapixels, float
+  GArray *threads;  // int
+  int runs;
+  gchar **iops;     // only these, NULL for all
+  gboolean skip_iops;
+  gboolean codecs;
+}
+dt_bench_t;
+
+typedef struct dt_bench_stats_t
+{
+  double min, median, mean, stddev;
+}
+dt_bench_stats_t;
+
+static void
+usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--sizes <megapixels,...>] [--threads <n,...>] [--runs <n>] [--iops <op,...>|none]\n", progname);
+  fprintf(stderr, "       [--image <input file> [--xmp <xmp file>]... [--format <jpg|png|tif|pfm|...>]] [--codecs]\n");
+  fprintf(stderr, "       prints one line per measurement: kind, name, input, megapixels, threads, runs,\n");
+  fprintf(stderr, "       min/median/mean/stddev in ms and megapixels per second of the median run\n");
+  fprintf(stderr, "       --codecs compares the thumbnail codecs instead: codec, input, megapixels, threads,\n");
+  fprintf(stderr, "       bits per pixel, psnr in dB, median encode and decode ms and decoded megapixels per second\n");
+}
+
+static GArray *
+_bench_parse_list(const char *arg, const gboolean integer)
+{
+  GArray *a = g_array_new(FALSE, FALSE, integer ? sizeof(int) : sizeof(float));
+  gchar **tokens = g_strsplit(arg, ",", -1);
+  for(gchar **t = tokens; *t; t++)
+  {
+    if(integer)
+    {
+      const int v = atoi(*t);
+      if(v > 0) g_array_append_val(a, v);
+    }
+    else
+    {
+      const float v = g_ascii_strtod(*t, NULL);
+      if(v > 0.0f) g_array_append_val(a, v);
+    }
+  }
+  g_strfreev(tokens);
+  return a;
+}
+
+static int
+_bench_cmp_double(const void *a, const void *b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/** summary of n timings, sorts t. */
+static void
+_bench_stats(double *t, const int n, dt_bench_stats_t *s)
+{
+  qsort(t, n, sizeof(double), _bench_cmp_double);
+  s->min = t[0];
+  s->median = (n & 1) ? t[n/2] : 0.5*(t[n/2-1] + t[n/2]);
+  double sum = 0.0;
+  for(int k=0; k<n; k++) sum += t[k];
+  s->mean = sum / n;
+  double var = 0.0;
+  for(int k=0; k<n; k++) var += (t[k] - s->mean)*(t[k] - s->mean);
+  s->stddev = n > 1 ? sqrt(var / (n - 1)) : 0.0;
+}
+
+static void
+_bench_print(const char *kind, const char *name, const char *input, const double mpix, const int threads,
+             const int runs, const dt_bench_stats_t *s)
+{
+  printf("%s\t%s\t%s\t%.2f\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.2f\n", kind, name, input, mpix, threads, runs,
+         1e3*s->min, 1e3*s->median, 1e3*s->mean, 1e3*s->stddev, s->median > 0.0 ? mpix / s->median : 0.0);
+  fflush(stdout);
+}
+
+/** 3:2 image with about mpix megapixels. */
+static void
+_bench_dimensions(const float mpix, int *wd, int *ht)
+{
+  *wd = MAX(4, (int)(sqrtf(mpix * 1e6f * 1.5f) / 4) * 4);
+  *ht = MAX(4, (int)(*wd / 1.5f / 4) * 4);
+}
+
+/** smooth gradients with some deterministic noise, values in [0, 1]. */
+static void
+_bench_fill_synthetic(float *buf, const int wd, const int ht)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(buf) firstprivate(wd, ht) schedule(static)
+#endif
+  for(int j=0; j<ht; j++)
+  {
+    uint32_t state = 0x9e3779b9u * (j + 1);
+    for(int i=0; i<wd; i++)
+    {
+      float *px = buf + 4*((size_t)j*wd + i);
+      for(int c=0; c<3; c++)
+      {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        const float noise = (state & 0xffff) * (0.1f/0xffff);
+        px[c] = CLAMP(0.9f * (c == 0 ? i/(float)wd : c == 1 ? j/(float)ht : 0.5f) + noise, 0.0f, 1.0f);
+      }
+      px[3] = 0.0f;
+    }
+  }
+}
+
+/** fills dst from src, repeating it if src is smaller. */
+static void
+_bench_fill_from(float *dst, const int wd, const int ht, const float *src, const int src_wd, const int src_ht)
+{
+  for(int j=0; j<ht; j++)
+    for(int i=0; i<wd; i+=src_wd)
+      memcpy(dst + 4*((size_t)j*wd + i), src + 4*(size_t)(j % src_ht)*src_wd, sizeof(float)*4*MIN(src_wd, wd - i));
+}
+
+/** imports file into the in-memory library, returns the image id or 0. */
+static int32_t
+_bench_import(const char *filename)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  return dt_image_import(filmid, filename, TRUE);
+}
+
+/** the image developed with its own history, scaled to about mpix megapixels. float rgba, free with free(). */
+static float *
+_bench_develop(const int32_t imgid, const float mpix, int *wd, int *ht)
+{
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  dt_dev_load_image(&dev, imgid);
+  float *out = NULL;
+  dt_dev_pixelpipe_t pipe;
+  if(buf.buf && dt_dev_pixelpipe_init_export(&pipe, dev.image_storage.width, dev.image_storage.height, IMAGEIO_RGB | IMAGEIO_FLOAT))
+  {
+    dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+    dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+    dt_dev_pixelpipe_synch_all(&pipe, &dev);
+    dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+    const double scale = fmin(1.0, sqrt(mpix * 1e6 / ((double)pipe.processed_width * pipe.processed_height)));
+    *wd = scale*pipe.processed_width + .5;
+    *ht = scale*pipe.processed_height + .5;
+    if(!dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, *wd, *ht, scale))
+    {
+      out = (float *)dt_alloc_align(64, sizeof(float)*4*(*wd)*(*ht));
+      // callers fall back to synthetic input if we return NULL:
+      if(out) memcpy(out, pipe.backbuf, sizeof(float)*4*(*wd)*(*ht));
+    }
+    dt_dev_pixelpipe_cleanup(&pipe);
+  }
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return out;
+}
+
+static gboolean
+_bench_iop_wanted(const dt_bench_t *b, const char *op)
+{
+  if(!b->iops) return TRUE;
+  for(gchar **t = b->iops; *t; t++)
+    if(!strcmp(*t, op)) return TRUE;
+  return FALSE;
+}
+
+/** runs process() of all modules that take float rgba input with their default parameters. */
+static void
+_bench_iops(const dt_bench_t *b, const float *real, const int real_wd, const int real_ht)
+{
+  float max_mpix = 0.0f;
+  for(int s=0; s<b->sizes->len; s++) max_mpix = MAX(max_mpix, g_array_index(b->sizes, float, s));
+  int max_wd, max_ht;
+  _bench_dimensions(max_mpix, &max_wd, &max_ht);
+
+  // a non-raw float image, so that the modules before demosaic disable themselves:
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_image_init(&dev.image_storage);
+  dev.image_storage.width = max_wd;
+  dev.image_storage.height = max_ht;
+  dev.image_storage.bpp = 4*sizeof(float);
+  dev.image_storage.flags = DT_IMAGE_HDR;
+  dev.iop = dt_iop_load_modules(&dev);
+
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_export(&pipe, max_wd, max_ht, IMAGEIO_RGB | IMAGEIO_FLOAT))
+  {
+    fprintf(stderr, "[bench] could not allocate the pixelpipe\n");
+    dt_dev_cleanup(&dev);
+    return;
+  }
+  dt_dev_pixelpipe_set_input(&pipe, &dev, NULL, max_wd, max_ht, 1.0);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+
+  double *t = (double *)malloc(sizeof(double)*b->runs);
+  for(int s=0; s<b->sizes->len; s++)
+  {
+    int wd, ht;
+    _bench_dimensions(g_array_index(b->sizes, float, s), &wd, &ht);
+    const double mpix = wd*(double)ht*1e-6;
+    dt_dev_pixelpipe_set_input(&pipe, &dev, NULL, wd, ht, 1.0);
+    dt_dev_pixelpipe_get_dimensions(&pipe, &dev, wd, ht, &pipe.processed_width, &pipe.processed_height);
+
+    for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes))
+    {
+      dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+      dt_iop_module_t *module = piece->module;
+      if(!module->process || !_bench_iop_wanted(b, module->op)) continue;
+      // modules that can't work on this input switch themselves off in commit_params:
+      piece->enabled = 1;
+      dt_iop_commit_params(module, module->default_params, module->default_blendop_params, &pipe, piece);
+      if(!piece->enabled || module->output_bpp(module, &pipe, piece) != 4*sizeof(float)) continue;
+
+      const dt_iop_roi_t roi_out = { 0, 0, wd, ht, 1.0f };
+      dt_iop_roi_t roi_in = roi_out;
+      module->modify_roi_in(module, piece, &roi_out, &roi_in);
+      float *in = (float *)dt_alloc_align(64, sizeof(float)*4*MAX(1, roi_in.width)*MAX(1, roi_in.height));
+      float *out = (float *)dt_alloc_align(64, sizeof(float)*4*wd*ht);
+      if(!in || !out)
+      {
+        fprintf(stderr, "[bench] out of memory for `%s' at %.1f megapixels\n", module->op, mpix);
+        free(in);
+        free(out);
+        continue;
+      }
+
+      for(int r=0; r<(real ? 2 : 1); r++)
+      {
+        if(r) _bench_fill_from(in, roi_in.width, roi_in.height, real, real_wd, real_ht);
+        else  _bench_fill_synthetic(in, roi_in.width, roi_in.height);
+        for(int th=0; th<b->threads->len; th++)
+        {
+          const int threads = g_array_index(b->threads, int, th);
+#ifdef _OPENMP
+          omp_set_num_threads(threads);
+#endif
+          module->process(module, piece, in, out, &roi_in, &roi_out); // warm up
+          for(int k=0; k<b->runs; k++)
+          {
+            const double start = dt_get_wtime();
+            module->process(module, piece, in, out, &roi_in, &roi_out);
+            t[k] = dt_get_wtime() - start;
+          }
+          dt_bench_stats_t stats;
+          _bench_stats(t, b->runs, &stats);
+          _bench_print("iop", module->op, r ? "real" : "synthetic", mpix, threads, b->runs, &stats);
+        }
+      }
+      free(in);
+      free(out);
+    }
+  }
+  free(t);
+#ifdef _OPENMP
+  omp_set_num_threads(dt_get_num_threads());
+#endif
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+}
+
+/** full exports of imgid, history taken from xmp if given. */
+static void
+_bench_export(const dt_bench_t *b, const int32_t imgid, const char *xmp, const char *ext)
+{
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(ext);
+  if(!format)
+  {
+    fprintf(stderr, "[bench] unknown format `%s'\n", ext);
+    return;
+  }
+  int32_t id = imgid;
+  if(xmp)
+  {
+    // every xmp gets its own copy, so the histories don't pile up:
+    id = dt_image_duplicate(imgid);
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    dt_exif_xmp_read(image, xmp, 1);
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+  const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+  const double mpix = cimg->width*(double)cimg->height*1e-6;
+  dt_image_cache_read_release(darktable.image_cache, cimg);
+
+  int size = 0;
+  dt_imageio_module_data_t *fdata = format->get_params(format, &size);
+  if(!fdata)
+  {
+    fprintf(stderr, "[bench] failed to get parameters from format `%s'\n", ext);
+    return;
+  }
+  fdata->max_width = fdata->max_height = 0;
+  fdata->style[0] = '\0';
+  gchar *basename = g_strdup_printf("darktable-bench-%d.%s", (int)getpid(), format->extension(fdata));
+  gchar *filename = g_build_filename(g_get_tmp_dir(), basename, NULL);
+  g_free(basename);
+
+  double *t = (double *)malloc(sizeof(double)*b->runs);
+  int failed = dt_imageio_export_with_flags(id, filename, format, fdata, 1, 0, TRUE, 0, NULL);
+  for(int k=0; k<b->runs && !failed; k++)
+  {
+    const double start = dt_get_wtime();
+    failed = dt_imageio_export_with_flags(id, filename, format, fdata, 1, 0, TRUE, 0, NULL);
+    t[k] = dt_get_wtime() - start;
+  }
+  g_unlink(filename);
+  if(failed) fprintf(stderr, "[bench] export of `%s' failed\n", xmp ? xmp : "default history");
+  else
+  {
+    dt_bench_stats_t stats;
+    _bench_stats(t, b->runs, &stats);
+    gchar *name = xmp ? g_path_get_basename(xmp) : g_strdup("default");
+    _bench_print("export", name, ext, mpix, dt_get_num_threads(), b->runs, &stats);
+    g_free(name);
+  }
+  free(t);
+  g_free(filename);
+  format->free_params(format, fdata);
+}
+
+typedef enum dt_bench_codec_t
+{
+  DT_BENCH_CODEC_OFF = 0,       // 8-bit rgba as the thumbnail cache keeps it without compression
+  DT_BENCH_CODEC_DXT1_FAST,     // cache_compression "low quality (fast)": squish range fit
+  DT_BENCH_CODEC_DXT1_HIGH,     // cache_compression "high quality (slow)": squish cluster fit
+  DT_BENCH_CODEC_DXT1_SQUISH,   // the same blocks, decoded by squish instead of dt_image_uncompress_dxt1()
+  DT_BENCH_CODEC_HDR,           // dt_image_compress() on float rgb
+  DT_BENCH_CODEC_COUNT
+}
+dt_bench_codec_t;
+
+static const char *_bench_codec_name[DT_BENCH_CODEC_COUNT] = { "off", "dxt1-fast", "dxt1-high", "dxt1-high-squish", "hdr" };
+static const int _bench_codec_bpp[DT_BENCH_CODEC_COUNT] = { 32, 4, 4, 4, 8 };
+
+typedef struct dt_bench_codec_buffers_t
+{
+  int wd, ht;
+  uint8_t *rgba, *rgba_out;
+  float *rgb, *rgb_out;
+  uint8_t *blocks;
+}
+dt_bench_codec_buffers_t;
+
+static void
+_bench_codec_encode(const dt_bench_codec_t c, dt_bench_codec_buffers_t *b)
+{
+  switch(c)
+  {
+    case DT_BENCH_CODEC_OFF:
+      memcpy(b->blocks, b->rgba, sizeof(uint8_t)*4*b->wd*b->ht);
+      break;
+    case DT_BENCH_CODEC_DXT1_FAST:
+      squish_compress_image(b->rgba, b->wd, b->ht, b->blocks, squish_dxt1 | squish_colour_range_fit);
+      break;
+    case DT_BENCH_CODEC_DXT1_HIGH:
+    case DT_BENCH_CODEC_DXT1_SQUISH:
+      squish_compress_image(b->rgba, b->wd, b->ht, b->blocks, squish_dxt1);
+      break;
+    default:
+      dt_image_compress(b->rgb, b->blocks, b->wd, b->ht);
+      break;
+  }
+}
+
+static void
+_bench_codec_decode(const dt_bench_codec_t c, dt_bench_codec_buffers_t *b)
+{
+  switch(c)
+  {
+    case DT_BENCH_CODEC_OFF:
+      memcpy(b->rgba_out, b->blocks, sizeof(uint8_t)*4*b->wd*b->ht);
+      break;
+    case DT_BENCH_CODEC_DXT1_FAST:
+    case DT_BENCH_CODEC_DXT1_HIGH:
+      dt_image_uncompress_dxt1(b->blocks, b->rgba_out, b->wd, b->ht);
+      break;
+    case DT_BENCH_CODEC_DXT1_SQUISH:
+      squish_decompress_image(b->rgba_out, b->wd, b->ht, b->blocks, squish_dxt1);
+      break;
+    default:
+      dt_image_uncompress(b->blocks, b->rgb_out, b->wd, b->ht);
+      break;
+  }
+}
+
+/** peak signal to noise ratio of the decoded image against the codec's input, in dB with a peak of 1. */
+static double
+_bench_codec_psnr(const dt_bench_codec_t c, const dt_bench_codec_buffers_t *b)
+{
+  const size_t n = (size_t)b->wd*b->ht;
+  double sum = 0.0;
+  for(size_t k=0; k<n; k++)
+    for(int ch=0; ch<3; ch++)
+    {
+      const double d = c == DT_BENCH_CODEC_HDR ? b->rgb_out[3*k+ch] - b->rgb[3*k+ch]
+                                               : (b->rgba_out[4*k+ch] - b->rgba[4*k+ch]) / 255.0;
+      sum += d*d;
+    }
+  return sum > 0.0 ? 10.0*log10(3*n / sum) : INFINITY;
+}
+
+/** size, quality and speed of the thumbnail codecs. */
+static void
+_bench_codecs(const dt_bench_t *b, const float *real, const int real_wd, const int real_ht)
+{
+  double *t = (double *)malloc(sizeof(double)*b->runs);
+  for(int s=0; s<b->sizes->len; s++)
+  {
+    dt_bench_codec_buffers_t buf;
+    _bench_dimensions(g_array_index(b->sizes, float, s), &buf.wd, &buf.ht);
+    const double mpix = buf.wd*(double)buf.ht*1e-6;
+    const size_t n = (size_t)buf.wd*buf.ht;
+    float *in = (float *)dt_alloc_align(64, sizeof(float)*4*n);
+    buf.rgba = (uint8_t *)dt_alloc_align(64, sizeof(uint8_t)*4*n);
+    buf.rgba_out = (uint8_t *)dt_alloc_align(64, sizeof(uint8_t)*4*n);
+    buf.rgb = (float *)dt_alloc_align(64, sizeof(float)*3*n);
+    buf.rgb_out = (float *)dt_alloc_align(64, sizeof(float)*3*n);
+    buf.blocks = (uint8_t *)dt_alloc_align(64, sizeof(uint8_t)*4*n);
+    if(!in || !buf.rgba || !buf.rgba_out || !buf.rgb || !buf.rgb_out || !buf.blocks)
+    {
+      fprintf(stderr, "[bench] out of memory for the codecs at %.1f megapixels\n", mpix);
+      free(in); free(buf.rgba); free(buf.rgba_out); free(buf.rgb); free(buf.rgb_out); free(buf.blocks);
+      continue;
+    }
+
+    for(int r=0; r<(real ? 2 : 1); r++)
+    {
+      if(r) _bench_fill_from(in, buf.wd, buf.ht, real, real_wd, real_ht);
+      else  _bench_fill_synthetic(in, buf.wd, buf.ht);
+      for(size_t k=0; k<n; k++)
+      {
+        for(int c=0; c<3; c++)
+        {
+          buf.rgb[3*k+c] = in[4*k+c];
+          buf.rgba[4*k+c] = CLAMP(in[4*k+c], 0.0f, 1.0f)*255.0f + 0.5f;
+        }
+        buf.rgba[4*k+3] = 255;
+      }
+
+      for(int th=0; th<b->threads->len; th++)
+      {
+        const int threads = g_array_index(b->threads, int, th);
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+        for(int c=0; c<DT_BENCH_CODEC_COUNT; c++)
+        {
+          dt_bench_stats_t enc, dec;
+          _bench_codec_encode(c, &buf); // warm up
+          for(int k=0; k<b->runs; k++)
+          {
+            const double start = dt_get_wtime();
+            _bench_codec_encode(c, &buf);
+            t[k] = dt_get_wtime() - start;
+          }
+          _bench_stats(t, b->runs, &enc);
+          _bench_codec_decode(c, &buf);
+          for(int k=0; k<b->runs; k++)
+          {
+            const double start = dt_get_wtime();
+            _bench_codec_decode(c, &buf);
+            t[k] = dt_get_wtime() - start;
+          }
+          _bench_stats(t, b->runs, &dec);
+          printf("%s\t%s\t%.2f\t%d\t%d\t%.2f\t%.3f\t%.3f\t%.2f\n", _bench_codec_name[c], r ? "real" : "synthetic",
+                 mpix, threads, _bench_codec_bpp[c], _bench_codec_psnr(c, &buf), 1e3*enc.median, 1e3*dec.median,
+                 dec.median > 0.0 ? mpix / dec.median : 0.0);
+          fflush(stdout);
+        }
+      }
+    }
+    free(in); free(buf.rgba); free(buf.rgba_out); free(buf.rgb); free(buf.rgb_out); free(buf.blocks);
+  }
+  free(t);
+#ifdef _OPENMP
+  omp_set_num_threads(dt_get_num_threads());
+#endif
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain (GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+  textdomain (GETTEXT_PACKAGE);
+
+  // no display needed:
+  gtk_init_check (&argc, &arg);
+
+  dt_bench_t b;
+  b.sizes = NULL;
+  b.threads = NULL;
+  b.runs = 5;
+  b.iops = NULL;
+  b.skip_iops = FALSE;
+  b.codecs = FALSE;
+  const char *image = NULL, *ext = "jpeg";
+  GPtrArray *xmps = g_ptr_array_new();
+
+  for(int k=1; k<argc; k++)
+  {
+    if(!strcmp(arg[k], "--codecs"))
+      b.codecs = TRUE;
+    else if(!strcmp(arg[k], "--help") || argc <= k+1)
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    else if(!strcmp(arg[k], "--sizes"))
+    {
+      if(b.sizes) g_array_free(b.sizes, TRUE);
+      b.sizes = _bench_parse_list(arg[++k], FALSE);
+    }
+    else if(!strcmp(arg[k], "--threads"))
+    {
+      if(b.threads) g_array_free(b.threads, TRUE);
+      b.threads = _bench_parse_list(arg[++k], TRUE);
+    }
+    else if(!strcmp(arg[k], "--runs"))
+      b.runs = CLAMP(atoi(arg[++k]), 1, 1000);
+    else if(!strcmp(arg[k], "--iops"))
+    {
+      k++;
+      if(!strcmp(arg[k], "none")) b.skip_iops = TRUE;
+      else
+      {
+        g_strfreev(b.iops);
+        b.iops = g_strsplit(arg[k], ",", -1);
+      }
+    }
+    else if(!strcmp(arg[k], "--image"))
+      image = arg[++k];
+    else if(!strcmp(arg[k], "--xmp"))
+      g_ptr_array_add(xmps, arg[++k]);
+    else if(!strcmp(arg[k], "--format"))
+    {
+      ext = arg[++k];
+      if(!strcmp(ext, "jpg")) ext = "jpeg";
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  char *m_arg[] = {"darktable-bench", "--library", ":memory:", "--disable-opencl", NULL};
+  // init dt without gui:
+  if(dt_init(4, m_arg, 0)) exit(1);
+
+  if(!b.sizes) b.sizes = _bench_parse_list("1,4,12", FALSE);
+  if(!b.threads)
+  {
+    gchar *all = g_strdup_printf("1,%d", dt_get_num_threads());
+    b.threads = _bench_parse_list(all, TRUE);
+    g_free(all);
+  }
+  if(!b.sizes->len || !b.threads->len)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  int32_t imgid = 0;
+  if(image && !(imgid = _bench_import(image)))
+  {
+    fprintf(stderr, "[bench] can't open file %s\n", image);
+    exit(1);
+  }
+
+  if(b.codecs)
+  {
+    float *real = NULL;
+    int real_wd = 0, real_ht = 0;
+    if(imgid)
+    {
+      float max_mpix = 0.0f;
+      for(int s=0; s<b.sizes->len; s++) max_mpix = MAX(max_mpix, g_array_index(b.sizes, float, s));
+      real = _bench_develop(imgid, max_mpix, &real_wd, &real_ht);
+      if(!real) fprintf(stderr, "[bench] could not develop %s, using synthetic input only\n", image);
+    }
+    printf("codec\tinput\tmpix\tthreads\tbits_per_pixel\tpsnr_db\tencode_ms\tdecode_ms\tdecode_mpix_per_s\n");
+    _bench_codecs(&b, real, real_wd, real_ht);
+    free(real);
+  }
+  else printf("kind\tname\tinput\tmpix\tthreads\truns\tmin_ms\tmedian_ms\tmean_ms\tstddev_ms\tmpix_per_s\n");
+
+  if(!b.skip_iops && !b.codecs)
+  {
+    float *real = NULL;
+    int real_wd = 0, real_ht = 0;
+    if(imgid)
+    {
+      float max_mpix = 0.0f;
+      for(int s=0; s<b.sizes->len; s++) max_mpix = MAX(max_mpix, g_array_index(b.sizes, float, s));
+      real = _bench_develop(imgid, max_mpix, &real_wd, &real_ht);
+      if(!real) fprintf(stderr, "[bench] could not develop %s, using synthetic input only\n", image);
+    }
+    _bench_iops(&b, real, real_wd, real_ht);
+    free(real);
+  }
+
+  if(imgid && !b.codecs)
+  {
+    if(xmps->len == 0) _bench_export(&b, imgid, NULL, ext);
+    for(int k=0; k<xmps->len; k++)
+      _bench_export(&b, imgid, g_ptr_array_index(xmps, k), ext);
+  }
+
+  g_ptr_array_free(xmps, TRUE);
+  g_strfreev(b.iops);
+  g_array_free(b.sizes, TRUE);
+  g_array_free(b.threads, TRUE);
+
+  dt_cleanup();
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
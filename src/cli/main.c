@@ -38,6 +38,7 @@
 #include "common/history.h"
 
 #include <sys/time.h>
+#include <pthread.h>
 #include <unistd.h>
 int usleep(useconds_t usec);
 #include <inttypes.h>
@@ -47,6 +48,216 @@ static void
 usage(const char* progname)
 {
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max height>,--bpp <bpp>,--hq <0|1|true|false> --verbose]\n", progname);
+  fprintf(stderr, "       %s --batch [--jobs <concurrent exports>] [<input file> <xmp file|-> <output file> ...] [options as above]\n", progname);
+  fprintf(stderr, "       --profile <json file> and --profile-trace <chrome trace file> record where the pixelpipe spends its time\n");
+  fprintf(stderr, "       without file triples, --batch reads one `<input file> [<xmp file>] <output file>' per line from stdin (tab separated)\n");
+}
+
+/** one input file to be exported to one output file. */
+typedef struct dt_cli_job_t
+{
+  gchar *input, *xmp, *output;
+  int32_t imgid;
+  int result;
+  double time;
+}
+dt_cli_job_t;
+
+/** the jobs shared between the export threads of a batch. */
+typedef struct dt_cli_batch_t
+{
+  dt_cli_job_t *jobs;
+  int32_t num_jobs;
+  int32_t next;
+  int width, height;
+  gboolean high_quality;
+  dt_imageio_module_storage_t *storage;
+}
+dt_cli_batch_t;
+
+static void
+_cli_add_job(GArray *jobs, const char *input, const char *xmp, const char *output)
+{
+  dt_cli_job_t job = {0};
+  job.input = g_strdup(input);
+  job.xmp = (xmp && strcmp(xmp, "-")) ? g_strdup(xmp) : NULL;
+  job.output = g_strdup(output);
+  g_array_append_val(jobs, job);
+}
+
+/** reads `input [xmp] output' lines, fields separated by tabs, or by blanks if there are no tabs. */
+static int
+_cli_read_manifest(FILE *f, GArray *jobs)
+{
+  char line[3*DT_MAX_PATH_LEN];
+  int lineno = 0;
+  while(fgets(line, sizeof(line), f))
+  {
+    lineno++;
+    g_strstrip(line);
+    if(line[0] == '\0' || line[0] == '#') continue;
+    gchar **tokens = g_strsplit_set(line, strchr(line, '\t') ? "\t" : " ", -1);
+    const char *field[3] = { NULL, NULL, NULL };
+    int cnt = 0;
+    for(gchar **t = tokens; *t; t++)
+    {
+      if(**t == '\0') continue;
+      if(cnt < 3) field[cnt] = *t;
+      cnt++;
+    }
+    if(cnt == 2) _cli_add_job(jobs, field[0], NULL, field[1]);
+    else if(cnt == 3) _cli_add_job(jobs, field[0], field[1], field[2]);
+    else
+    {
+      fprintf(stderr, _("error: can't parse line %d of the job list"), lineno);
+      fprintf(stderr, "\n");
+      g_strfreev(tokens);
+      return 1;
+    }
+    g_strfreev(tokens);
+  }
+  return 0;
+}
+
+/** imports the input of a job and applies its xmp. returns the image id or 0. */
+static int32_t
+_cli_import(dt_cli_job_t *job, GHashTable *used, gboolean verbose)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(job->input);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  int32_t id = dt_image_import(filmid, job->input, TRUE);
+  if(!id)
+  {
+    fprintf(stderr, _("error: can't open file %s"), job->input);
+    fprintf(stderr, "\n");
+    return 0;
+  }
+
+  // the same input with another history must not overwrite the first one while it's exported:
+  if(g_hash_table_lookup(used, GINT_TO_POINTER(id)))
+    id = dt_image_duplicate(id);
+  g_hash_table_insert(used, GINT_TO_POINTER(id), GINT_TO_POINTER(1));
+
+  // attach xmp, if requested:
+  if(job->xmp)
+  {
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    dt_exif_xmp_read(image, job->xmp, 1);
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+
+  // print the history stack
+  if(verbose)
+  {
+    gchar *history = dt_history_get_items_as_string(id);
+    if(history)
+      printf("%s\n", history);
+    else
+      printf("[%s]\n", _("empty history stack"));
+    g_free(history);
+  }
+  return id;
+}
+
+/** exports one image to output_filename, the format is taken from the extension. returns 0 on success. */
+static int
+_cli_export(dt_imageio_module_storage_t *storage, const int32_t id, const char *output_filename,
+            const int width, const int height, const gboolean high_quality)
+{
+  // try to find out the export format from the output_filename
+  gchar *filename = g_strdup(output_filename);
+  char *ext = filename + strlen(filename);
+  while(ext > filename && *ext != '.') ext--;
+  *ext = '\0';
+  ext++;
+
+  if(!strcmp(ext, "jpg"))
+    ext = "jpeg";
+
+  // init the export data structures
+  int size = 0, dat_size = 0;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *sdata, *fdata;
+
+  format = dt_imageio_get_format_by_name(ext);
+  if(format == NULL)
+  {
+    fprintf(stderr, _("unknown extension '.%s'"), ext);
+    fprintf(stderr, "\n");
+    g_free(filename);
+    return 1;
+  }
+
+  sdata = storage->get_params(storage, &size);
+  if(sdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+    g_free(filename);
+    return 1;
+  }
+
+  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night any longer ...
+  g_strlcpy((char*)sdata, filename, DT_MAX_PATH_LEN);
+  // all is good now, the last line didn't happen.
+  g_free(filename);
+
+  fdata = format->get_params(format, &dat_size);
+  if(fdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    storage->free_params(storage, sdata);
+    return 1;
+  }
+
+  uint32_t w,h,fw,fh,sw,sh;
+  fw=fh=sw=sh=0;
+  storage->dimension(storage, &sw, &sh);
+  format->dimension(format, &fw, &fh);
+
+  if( sw==0 || fw==0) w=sw>fw?sw:fw;
+  else w=sw<fw?sw:fw;
+
+  if( sh==0 || fh==0) h=sh>fh?sh:fh;
+  else h=sh<fh?sh:fh;
+
+  fdata->max_width  = width;
+  fdata->max_height = height;
+  fdata->max_width = (w!=0 && fdata->max_width >w)?w:fdata->max_width;
+  fdata->max_height = (h!=0 && fdata->max_height >h)?h:fdata->max_height;
+  fdata->style[0] = '\0';
+
+  //TODO: add a callback to set the bpp without going through the config
+
+  const int res = storage->store(sdata, id, format, fdata, 1, 1, high_quality);
+
+  // cleanup time
+  if(storage->finalize_store) storage->finalize_store(storage, sdata);
+  storage->free_params(storage, sdata);
+  format->free_params(format, fdata);
+  return res;
+}
+
+static void *
+_cli_export_worker(void *arg)
+{
+  dt_cli_batch_t *b = (dt_cli_batch_t *)arg;
+  int k;
+  while((k = __sync_fetch_and_add(&b->next, 1)) < b->num_jobs)
+  {
+    dt_cli_job_t *job = b->jobs + k;
+    if(!job->imgid) continue;
+    const double start = dt_get_wtime();
+    job->result = _cli_export(b->storage, job->imgid, job->output, b->width, b->height, b->high_quality);
+    job->time = dt_get_wtime() - start;
+    printf("%s: %s (%.3f s)\n", job->output, job->result ? _("failed") : _("done"), job->time);
+    fflush(stdout);
+  }
+  return NULL;
 }
 
 int main(int argc, char *arg[])
@@ -59,16 +270,15 @@ int main(int argc, char *arg[])
 
   // parse command line arguments
 
-  char *image_filename = NULL;
-  char *xmp_filename = NULL;
-  char *output_filename = NULL;
-  int file_counter = 0;
+  GPtrArray *files = g_ptr_array_new();
   int width = 0, height = 0, bpp = 0;
-  gboolean verbose = FALSE, high_quality = TRUE;
+  int num_pipes = 1;
+  gboolean verbose = FALSE, high_quality = TRUE, batch = FALSE;
+  char *profile = NULL, *profile_trace = NULL;
 
   for(int k=1; k<argc; k++)
   {
-    if(arg[k][0] == '-')
+    if(arg[k][0] == '-' && arg[k][1] != '\0')
     {
       if(!strcmp(arg[k], "--help"))
       {
@@ -112,6 +322,40 @@ int main(int argc, char *arg[])
         }
         g_free(str);
       }
+      else if(!strcmp(arg[k], "--batch"))
+      {
+        batch = TRUE;
+      }
+      else if(!strcmp(arg[k], "--jobs"))
+      {
+        if(++k >= argc)
+        {
+          fprintf(stderr, "%s: %s\n", _("Missing argument for"), arg[k-1]);
+          usage(arg[0]);
+          exit(1);
+        }
+        num_pipes = CLAMP(atoi(arg[k]), 1, 64);
+      }
+      else if(!strcmp(arg[k], "--profile"))
+      {
+        if(++k >= argc)
+        {
+          fprintf(stderr, "%s: %s\n", _("Missing argument for"), arg[k-1]);
+          usage(arg[0]);
+          exit(1);
+        }
+        profile = arg[k];
+      }
+      else if(!strcmp(arg[k], "--profile-trace"))
+      {
+        if(++k >= argc)
+        {
+          fprintf(stderr, "%s: %s\n", _("Missing argument for"), arg[k-1]);
+          usage(arg[0]);
+          exit(1);
+        }
+        profile_trace = arg[k];
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -120,149 +364,137 @@ int main(int argc, char *arg[])
     }
     else
     {
-      if(file_counter == 0)
-        image_filename = arg[k];
-      else if(file_counter == 1)
-        xmp_filename = arg[k];
-      else if(file_counter == 2)
-        output_filename = arg[k];
-      file_counter++;
+      g_ptr_array_add(files, arg[k]);
     }
   }
 
-  if(file_counter < 2 || file_counter > 3)
+  GArray *jobs = g_array_new(FALSE, TRUE, sizeof(dt_cli_job_t));
+  if(batch)
   {
-    usage(arg[0]);
-    exit(1);
+    if(files->len == 0)
+    {
+      if(_cli_read_manifest(stdin, jobs)) exit(1);
+    }
+    else if(files->len % 3 == 0)
+    {
+      for(int k=0; k<files->len; k+=3)
+        _cli_add_job(jobs, g_ptr_array_index(files, k), g_ptr_array_index(files, k+1), g_ptr_array_index(files, k+2));
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    if(jobs->len == 0)
+    {
+      fprintf(stderr, "%s\n", _("nothing to export"));
+      exit(1);
+    }
   }
-  else if(file_counter == 2)
+  else if(files->len == 2)
   {
     // no xmp file given
-    output_filename = xmp_filename;
-    xmp_filename = NULL;
+    _cli_add_job(jobs, g_ptr_array_index(files, 0), NULL, g_ptr_array_index(files, 1));
   }
-
-  // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
+  else if(files->len == 3)
   {
-    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
+    _cli_add_job(jobs, g_ptr_array_index(files, 0), g_ptr_array_index(files, 1), g_ptr_array_index(files, 2));
   }
-
-  char *m_arg[] = {"darktable-cli", "--library", ":memory:", NULL};
-  // init dt without gui:
-  if(dt_init(3, m_arg, 0)) exit(1);
-
-  dt_film_t film;
-  int id = 0;
-  int filmid = 0;
-
-  gchar *directory = g_path_get_dirname(image_filename);
-  filmid = dt_film_new(&film, directory);
-  id = dt_image_import(filmid, image_filename, TRUE);
-  if(!id)
+  else
   {
-    fprintf(stderr, _("error: can't open file %s"), image_filename);
-    fprintf(stderr, "\n");
+    usage(arg[0]);
     exit(1);
   }
-  g_free(directory);
+  g_ptr_array_free(files, TRUE);
 
-  // attach xmp, if requested:
-  if(xmp_filename)
+  for(int k=0; k<jobs->len; k++)
   {
-    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
-    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
-    dt_exif_xmp_read(image, xmp_filename, 1);
-    // don't write new xmp:
-    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
-    dt_image_cache_read_release(darktable.image_cache, image);
+    // the output file already exists, so there will be a sequence number added
+    const dt_cli_job_t *job = &g_array_index(jobs, dt_cli_job_t, k);
+    if(g_file_test(job->output, G_FILE_TEST_EXISTS))
+      fprintf(stderr, "%s: %s\n", job->output, _("output file already exists, it will get renamed"));
   }
 
-  // print the history stack
-  if(verbose)
+  char *m_arg[] = {"darktable-cli", "--library", ":memory:", NULL, NULL, NULL, NULL, NULL};
+  int m_argc = 3;
+  if(profile)
   {
-    gchar *history = dt_history_get_items_as_string(id);
-    if(history)
-      printf("%s\n", history);
-    else
-      printf("[%s]\n", _("empty history stack"));
+    m_arg[m_argc++] = "--profile";
+    m_arg[m_argc++] = profile;
   }
+  if(profile_trace)
+  {
+    m_arg[m_argc++] = "--profile-trace";
+    m_arg[m_argc++] = profile_trace;
+  }
+  // init dt without gui:
+  if(dt_init(m_argc, m_arg, 0)) exit(1);
 
-  // try to find out the export format from the output_filename
-  char *ext = output_filename + strlen(output_filename);
-  while(ext > output_filename && *ext != '.') ext--;
-  *ext = '\0';
-  ext++;
-
-  if(!strcmp(ext, "jpg"))
-    ext = "jpeg";
-
-  // init the export data structures
-  int size = 0, dat_size = 0;
-  dt_imageio_module_format_t *format;
-  dt_imageio_module_storage_t *storage;
-  dt_imageio_module_data_t *sdata, *fdata;
-
-  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
+  dt_imageio_module_storage_t *storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
   if(storage == NULL)
   {
     fprintf(stderr, "%s\n", _("cannot find disk storage module. please check your installation, something seems to be broken."));
     exit(1);
   }
 
-  sdata = storage->get_params(storage, &size);
-  if(sdata == NULL)
+  // the database only has one writer, import everything up front.
+  GHashTable *used = g_hash_table_new(g_direct_hash, g_direct_equal);
+  int failed = 0;
+  for(int k=0; k<jobs->len; k++)
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
-    exit(1);
+    dt_cli_job_t *job = &g_array_index(jobs, dt_cli_job_t, k);
+    job->imgid = _cli_import(job, used, verbose);
+    if(!job->imgid)
+    {
+      if(!batch) exit(1);
+      failed++;
+    }
   }
+  g_hash_table_destroy(used);
 
-  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night any longer ...
-  g_strlcpy((char*)sdata, output_filename, DT_MAX_PATH_LEN);
-  // all is good now, the last line didn't happen.
-
-  format = dt_imageio_get_format_by_name(ext);
-  if(format == NULL)
+  if(!batch)
   {
-    fprintf(stderr, _("unknown extension '.%s'"), ext);
-    fprintf(stderr, "\n");
-    exit(1);
+    const dt_cli_job_t *job = &g_array_index(jobs, dt_cli_job_t, 0);
+    if(_cli_export(storage, job->imgid, job->output, width, height, high_quality)) exit(1);
   }
-
-  fdata = format->get_params(format, &dat_size);
-  if(fdata == NULL)
+  else
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
-    exit(1);
+    // all exports share this one instance, each thread runs its own pipeline.
+    dt_cli_batch_t b;
+    b.jobs = (dt_cli_job_t *)jobs->data;
+    b.num_jobs = jobs->len;
+    b.next = 0;
+    b.width = width;
+    b.height = height;
+    b.high_quality = high_quality;
+    b.storage = storage;
+
+    const double start = dt_get_wtime();
+    num_pipes = MIN(num_pipes, b.num_jobs);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * num_pipes);
+    for(int k=0; k<num_pipes; k++)
+      pthread_create(&threads[k], NULL, _cli_export_worker, &b);
+    for(int k=0; k<num_pipes; k++)
+      pthread_join(threads[k], NULL);
+    free(threads);
+
+    for(int k=0; k<b.num_jobs; k++)
+      if(b.jobs[k].imgid && b.jobs[k].result) failed++;
+    printf(_("exported %d of %d images in %.3f s"), b.num_jobs - failed, b.num_jobs, dt_get_wtime() - start);
+    printf("\n");
   }
 
-  uint32_t w,h,fw,fh,sw,sh;
-  fw=fh=sw=sh=0;
-  storage->dimension(storage, &sw, &sh);
-  format->dimension(format, &fw, &fh);
-
-  if( sw==0 || fw==0) w=sw>fw?sw:fw;
-  else w=sw<fw?sw:fw;
-
-  if( sh==0 || fh==0) h=sh>fh?sh:fh;
-  else h=sh<fh?sh:fh;
-
-  fdata->max_width  = width;
-  fdata->max_height = height;
-  fdata->max_width = (w!=0 && fdata->max_width >w)?w:fdata->max_width;
-  fdata->max_height = (h!=0 && fdata->max_height >h)?h:fdata->max_height;
-  fdata->style[0] = '\0';
-
-  //TODO: add a callback to set the bpp without going through the config
-
-  storage->store(sdata, id, format, fdata, 1, 1, high_quality);
-
-  // cleanup time
-  if(storage->finalize_store) storage->finalize_store(storage, sdata);
-  storage->free_params(storage, sdata);
-  format->free_params(format, fdata);
+  for(int k=0; k<jobs->len; k++)
+  {
+    dt_cli_job_t *job = &g_array_index(jobs, dt_cli_job_t, k);
+    g_free(job->input);
+    g_free(job->xmp);
+    g_free(job->output);
+  }
+  g_array_free(jobs, TRUE);
 
   dt_cleanup();
+  return failed ? 1 : 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -30,16 +30,25 @@
 
 #include <sys/select.h>
 
-// this implements a concurrent LRU cache using
-// a concurrent doubly linked list
-// and a hopscotch hashmap, source following the paper and
+// this implements a concurrent cache using
+// a hopscotch hashmap, source following the paper and
 // the additional material (GPLv2+ c++ concurrency package source)
 // `Hopscotch Hashing' by Maurice Herlihy, Nir Shavit and Moran Tzafrir
+//
+// eviction approximates segmented lru by the clock algorithm: a hit sets the used bit
+// of its bucket (under the segment lock it holds anyway), and garbage collection
+// sweeps a hand over the table. new entries which haven't been used again by the time
+// the hand comes by are removed, those which have are kept and removed on the next pass
+// if they weren't used in between. entries used on both passes become hot. hot entries
+// are only aged by the hand while they take more than DT_CACHE_HOT_RATIO of the space,
+// and survive as many unused turns as their weight says.
 
 #define DT_CACHE_NULL_DELTA SHRT_MIN
 #define DT_CACHE_EMPTY_HASH -1
 #define DT_CACHE_EMPTY_KEY  -1
 #define DT_CACHE_EMPTY_DATA  NULL
+#define DT_CACHE_DEFAULT_WEIGHT 1
+#define DT_CACHE_HOT_RATIO 0.75f
 
 
 typedef struct dt_cache_bucket_t
@@ -48,12 +57,12 @@ typedef struct dt_cache_bucket_t
   int16_t  next_delta;
   int16_t  read;   // number of readers
   int16_t  write;  // number of writers (0 or 1)
-  int32_t  lru;    // for garbage collection: lru list
-  int32_t  mru;
+  int8_t   used;   // for garbage collection: used since the clock hand last passed
+  int8_t   level;  // -1 new, 0 cold, > 0 hot: turns of the clock hand it survives unused
+  int16_t  weight; // level of a hot entry, by how expensive it is to recreate
   int32_t  cost;   // cost associated with this entry (such as byte size)
   uint32_t hash;   // hash of the element
   uint32_t key;    // key of the element
-  // due to alignment, we waste 32 bits here
   void*    data;   // actual data
 }
 dt_cache_bucket_t;
@@ -62,6 +71,9 @@ typedef struct dt_cache_segment_t
 {
   uint32_t timestamp;
   uint32_t lock;
+  // statistics, counted under the lock:
+  uint64_t hits;
+  uint64_t misses;
 }
 dt_cache_segment_t;
 
@@ -147,11 +159,12 @@ remove_key(dt_cache_t *cache,
   }
   // else: crucially don't release the data pointer (not for dynamic nor static allocation a good idea)
   // key_bucket->data = DT_CACHE_EMPTY_DATA;
-  key_bucket->hash = DT_CACHE_EMPTY_HASH;
   key_bucket->key  = DT_CACHE_EMPTY_KEY;
 
   // keep track of cost
   add_cost(cache, -key_bucket->cost);
+  if(key_bucket->level > 0)
+    __sync_fetch_and_add(&cache->hot_cost, -key_bucket->cost);
 
   if(prev_key_bucket == NULL)
   {
@@ -169,6 +182,9 @@ remove_key(dt_cache_t *cache,
   }
   segment->timestamp ++;
   key_bucket->next_delta = DT_CACHE_NULL_DELTA;
+  // only now the bucket may be claimed by an insert, possibly from another segment:
+  __sync_synchronize();
+  key_bucket->hash = DT_CACHE_EMPTY_HASH;
 }
 
 // unexposed helpers to increase the read lock count.
@@ -240,6 +256,9 @@ add_key_to_beginning_of_list(
   free_bucket->key  = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->used   = 0;
+  free_bucket->level  = -1;
+  free_bucket->weight = DT_CACHE_DEFAULT_WEIGHT;
 
   if(keys_bucket->first_delta == 0)
   {
@@ -279,6 +298,9 @@ add_key_to_end_of_list(
   free_bucket->key  = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->used   = 0;
+  free_bucket->level  = -1;
+  free_bucket->weight = DT_CACHE_DEFAULT_WEIGHT;
   free_bucket->next_delta = DT_CACHE_NULL_DELTA;
 
   if(last_bucket == NULL)
@@ -348,7 +370,7 @@ void
 dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threads, int32_t cache_line_size, int32_t cost_quota)
 {
   const uint32_t adj_num_threads = nearest_power_of_two(num_threads);
-  // FIXME: if switching this on, lru lists need to move, too! (because they work by bucket and not by key)
+  // FIXME: if switching this on, cost and clock state need to move, too! (because they work by bucket and not by key)
   cache->optimize_cacheline = 0;//1;
   // No cache_mask offsetting required when not optimizing for cachelines --RAM
   cache->cache_mask = cache->optimize_cacheline ?
@@ -373,7 +395,9 @@ dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threa
 
   cache->cost = 0;
   cache->cost_quota = cost_quota;
-  cache->lru_lock = 0;
+  cache->hot_cost = 0;
+  cache->clock_hand = 0;
+  cache->evictions = 0;
   cache->allocate = NULL;
   cache->allocate_data = NULL;
   cache->cleanup = NULL;
@@ -383,6 +407,8 @@ dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threa
   {
     cache->segments[k].timestamp = 0;
     cache->segments[k].lock = 0;
+    cache->segments[k].hits = 0;
+    cache->segments[k].misses = 0;
   }
   for(int k=0; k<num_buckets; k++)
   {
@@ -393,10 +419,10 @@ dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threa
     cache->table[k].data        = DT_CACHE_EMPTY_DATA;
     cache->table[k].read        = 0;
     cache->table[k].write       = 0;
-    cache->table[k].lru         = -2;
-    cache->table[k].mru         = -2;
+    cache->table[k].used        = 0;
+    cache->table[k].level       = -1;
+    cache->table[k].weight      = DT_CACHE_DEFAULT_WEIGHT;
   }
-  cache->lru = cache->mru = -1;
 #ifndef DT_UNIT_TEST
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
@@ -495,67 +521,6 @@ dt_cache_percent_keys_in_cache_line(const dt_cache_t *const cache)
 }
 #endif
 
-// rip out at entry from the lru list.
-// must already hold the lock!
-void
-lru_remove(dt_cache_t        *cache,
-           dt_cache_bucket_t *bucket)
-{
-  if(bucket->mru >= -1 && bucket->lru >= -1)
-  {
-    if(bucket->lru == -1) cache->lru   = bucket->mru;
-    else cache->table[bucket->lru].mru = bucket->mru;
-    if(bucket->mru == -1) cache->mru   = bucket->lru;
-    else cache->table[bucket->mru].lru = bucket->lru;
-  }
-  // mark as not in the list:
-  bucket->mru = bucket->lru = -2;
-}
-
-// insert an entry, must already hold the lock!
-void
-lru_insert(dt_cache_t        *cache,
-           dt_cache_bucket_t *bucket)
-{
-  // could use the segment locks for better scalability.
-  // would need to roll back changes in proximity after all (up to) three locks have been obtained.
-  const int idx = bucket - cache->table;
-
-  // only if it's not in front already:
-  if(cache->mru != idx)
-  {
-    // rip out bucket from lru list, if it's still in there:
-    lru_remove(cache, bucket);
-
-    // re-attach to most recently used end:
-    bucket->mru = -1;
-    bucket->lru = cache->mru;
-    if(cache->mru >= 0)
-      cache->table[cache->mru].mru = idx;
-    cache->mru = idx;
-    // be consistent if cache was empty before:
-    if(cache->lru == -1) cache->lru = idx;
-  }
-}
-
-void
-lru_remove_locked(dt_cache_t        *cache,
-                  dt_cache_bucket_t *bucket)
-{
-  dt_cache_lock(&cache->lru_lock);
-  lru_remove(cache, bucket);
-  dt_cache_unlock(&cache->lru_lock);
-}
-
-void
-lru_insert_locked(dt_cache_t        *cache,
-                  dt_cache_bucket_t *bucket)
-{
-  dt_cache_lock(&cache->lru_lock);
-  lru_insert(cache, bucket);
-  dt_cache_unlock(&cache->lru_lock);
-}
-
 int
 dt_cache_for_all(
   dt_cache_t *cache,
@@ -563,60 +528,17 @@ dt_cache_for_all(
   void *user_data)
 {
   // this is not thread safe.
-  //dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->mru;
-  while(curr >= 0)
+  for(int k=0; k<=cache->bucket_mask; k++)
   {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY)
+    if(cache->table[k].key != DT_CACHE_EMPTY_KEY)
     {
-      const int err = process(cache->table[curr].key, cache->table[curr].data, user_data);
+      const int err = process(cache->table[k].key, cache->table[k].data, user_data);
       if(err) return err;
     }
-    if(curr == cache->lru) break;
-    int32_t next = cache->table[curr].lru;
-    assert(cache->table[next].mru == curr);
-    curr = next;
   }
-  //dt_cache_unlock(&cache->lru_lock);
   return 0;
 }
 
-// does a consistency check of the lru list.
-// returns how many entries it finds.
-// hangs infinitely if the list has cycles.
-int32_t
-lru_check_consistency(dt_cache_t *cache)
-{
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->lru;
-  int32_t cnt = 1;
-  while(curr >= 0 && curr != cache->mru)
-  {
-    int32_t next = cache->table[curr].mru;
-    assert(cache->table[next].lru == curr);
-    curr = next;
-    cnt++;
-  }
-  dt_cache_unlock(&cache->lru_lock);
-  return cnt;
-}
-int32_t
-lru_check_consistency_reverse(dt_cache_t *cache)
-{
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->mru;
-  int32_t cnt = 1;
-  while(curr >= 0 && curr != cache->lru)
-  {
-    int32_t next = cache->table[curr].lru;
-    assert(cache->table[next].mru == curr);
-    curr = next;
-    cnt++;
-  }
-  dt_cache_unlock(&cache->lru_lock);
-  return cnt;
-}
-
 
 // return read locked bucket, or NULL if it's not already there.
 // never attempt to allocate a new slot.
@@ -642,14 +564,16 @@ dt_cache_read_testget(
     {
       void *rc = compare_bucket->data;
       int err = dt_cache_bucket_read_testlock(compare_bucket);
+      // give it a second chance when the clock hand comes by:
+      if(!compare_bucket->used) compare_bucket->used = 1;
+      if(!err) segment->hits++;
       dt_cache_unlock(&segment->lock);
       if(err) return NULL;
-      // move this to the  most recently used slot, too:
-      lru_insert_locked(cache, compare_bucket);
       return rc;
     }
     next_delta = compare_bucket->next_delta;
   }
+  segment->misses++;
   dt_cache_unlock(&segment->lock);
   return NULL;
 }
@@ -691,11 +615,12 @@ retry_cache_full:
       {
         void *rc = compare_bucket->data;
         int err = dt_cache_bucket_read_testlock(compare_bucket);
+        // give it a second chance when the clock hand comes by:
+        if(!compare_bucket->used) compare_bucket->used = 1;
+        if(!err) segment->hits++;
         dt_cache_unlock(&segment->lock);
         // actually all good, just we couldn't get a lock on the bucket.
         if(err) goto wait;
-        // move this to the  most recently used slot, too:
-        lru_insert_locked(cache, compare_bucket);
         // found and locked:
         return rc;
       }
@@ -734,8 +659,8 @@ wait:
         dt_cache_bucket_read_lock(free_bucket);
         add_key_to_beginning_of_list(cache, start_bucket, free_bucket, hash, key);
         void *data = free_bucket->data;
+        segment->misses++;
         dt_cache_unlock(&segment->lock);
-        lru_insert_locked(cache, free_bucket);
         return data;
       }
       ++free_bucket;
@@ -753,25 +678,18 @@ wait:
   dt_cache_bucket_t *free_max_bucket = start_bucket + (cache->cache_mask + 1);
   while (free_max_bucket <= max_bucket)
   {
-    if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH)
+    // this could walk outside the range where the segment lock is valid.
+    // that's why the empty bucket is claimed atomically before we touch it.
+    if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH &&
+       __sync_bool_compare_and_swap(&free_max_bucket->hash, DT_CACHE_EMPTY_HASH, hash))
     {
-      dt_cache_lock(&cache->lru_lock);
-      if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH)
-      {
-        // try that again if it's still empty
-        dt_cache_bucket_read_lock(free_max_bucket);
-        add_key_to_end_of_list(cache, start_bucket, free_max_bucket, hash, key, last_bucket);
-        void *data = free_max_bucket->data;
-        dt_cache_unlock(&segment->lock);
-        lru_insert(cache, free_max_bucket);
-        dt_cache_unlock(&cache->lru_lock);
-        return data;
-      }
-      dt_cache_unlock(&cache->lru_lock);
+      dt_cache_bucket_read_lock(free_max_bucket);
+      add_key_to_end_of_list(cache, start_bucket, free_max_bucket, hash, key, last_bucket);
+      void *data = free_max_bucket->data;
+      segment->misses++;
+      dt_cache_unlock(&segment->lock);
+      return data;
     }
-    // this could walk outside the range where the segment lock is valid.
-    // that's why we abuse the lru lock above to shield grabbing a new bucket
-    // at this stage.
     ++free_max_bucket;
   }
 
@@ -782,20 +700,15 @@ wait:
   dt_cache_bucket_t *free_min_bucket = start_bucket - (cache->cache_mask + 1);
   while (free_min_bucket >= min_bucket)
   {
-    if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH)
+    if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH &&
+       __sync_bool_compare_and_swap(&free_min_bucket->hash, DT_CACHE_EMPTY_HASH, hash))
     {
-      dt_cache_lock(&cache->lru_lock);
-      if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH)
-      {
-        dt_cache_bucket_read_lock(free_min_bucket);
-        add_key_to_end_of_list(cache, start_bucket, free_min_bucket, hash, key, last_bucket);
-        void *data = free_min_bucket->data;
-        dt_cache_unlock(&segment->lock);
-        lru_insert(cache, free_min_bucket);
-        dt_cache_unlock(&cache->lru_lock);
-        return data;
-      }
-      dt_cache_unlock(&cache->lru_lock);
+      dt_cache_bucket_read_lock(free_min_bucket);
+      add_key_to_end_of_list(cache, start_bucket, free_min_bucket, hash, key, last_bucket);
+      void *data = free_min_bucket->data;
+      segment->misses++;
+      dt_cache_unlock(&segment->lock);
+      return data;
     }
     --free_min_bucket;
   }
@@ -806,23 +719,6 @@ wait:
   // goto wait;
 }
 
-int
-dt_cache_remove_bucket(dt_cache_t *cache, const uint32_t num)
-{
-  const uint32_t hash = num;
-  dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
-
-  dt_cache_bucket_t *const curr_bucket = cache->table + (hash & cache->bucket_mask);
-  const uint32_t key = curr_bucket->key;
-  dt_cache_unlock(&segment->lock);
-  // actually remove by key
-  if(key != DT_CACHE_EMPTY_KEY)
-    return dt_cache_remove(cache, key);
-  else
-    return 2;
-}
-
 int
 dt_cache_remove(dt_cache_t *cache, const uint32_t key)
 {
@@ -855,9 +751,7 @@ dt_cache_remove(dt_cache_t *cache, const uint32_t key)
       remove_key(cache, segment, start_bucket, curr_bucket, last_bucket, hash);
       if(cache->optimize_cacheline)
         optimize_cacheline_use(cache, segment, curr_bucket);
-      // put back into unused part of the cache: remove from lru list.
       dt_cache_unlock(&segment->lock);
-      lru_remove_locked(cache, curr_bucket);
       // fprintf(stderr, "[cache remove] freeing %d for %u\n", cost, key);
       return 0;
     }
@@ -868,153 +762,126 @@ dt_cache_remove(dt_cache_t *cache, const uint32_t key)
   return 1;
 }
 
-#if 0
-// debug helper functions, in case we want a big fat lock for dt_cache_gc():
-static int
-dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
+// the clock hand passes the bucket: ages the entry in it and returns its key
+// if it should be removed, DT_CACHE_EMPTY_KEY otherwise.
+static uint32_t
+clock_visit(dt_cache_t *cache, dt_cache_bucket_t *const bucket, const int32_t hot_quota)
 {
+  // peek without the lock. buckets only change under the lock of the segment their key belongs to:
+  const uint32_t key = bucket->key;
+  if(key == DT_CACHE_EMPTY_KEY) return DT_CACHE_EMPTY_KEY;
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
   dt_cache_lock(&segment->lock);
 
-  dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
-  dt_cache_bucket_t *last_bucket = NULL;
-  dt_cache_bucket_t *curr_bucket = start_bucket;
-  int16_t next_delta = curr_bucket->first_delta;
-  while(1)
+  uint32_t evict = DT_CACHE_EMPTY_KEY;
+  if(bucket->key != key || bucket->hash != hash || bucket->read || bucket->write)
   {
-    if(next_delta == DT_CACHE_NULL_DELTA)
-    {
-      // fprintf(stderr, "[cache remove] key not found %u!\n", key);
-      dt_cache_unlock(&segment->lock);
-      return 1;
-    }
-    curr_bucket += next_delta;
-
-    if(hash == curr_bucket->hash && key == curr_bucket->key)
+    // replaced in the meantime, or in use.
+  }
+  else if(bucket->level < 0)
+  {
+    // new entry. being used again right after it was inserted (every redraw while it's
+    // on screen, say) doesn't tell us much yet, so it has to survive another turn to become hot:
+    if(bucket->used)
     {
-      if(curr_bucket->read || curr_bucket->write)
-      {
-        // fprintf(stderr, "[cache remove] key still in use %u!\n", key);
-        dt_cache_unlock(&segment->lock);
-        return 1;
-      }
-      void *rc = curr_bucket->data;
-      const int32_t cost = curr_bucket->cost;
-      remove_key(cache, segment, start_bucket, curr_bucket, last_bucket, hash);
-      if(cache->optimize_cacheline)
-        optimize_cacheline_use(cache, segment, curr_bucket);
-      // put back into unused part of the cache: remove from lru list.
-      dt_cache_unlock(&segment->lock);
-      lru_remove(cache, curr_bucket);
-      // clean up the user data
-      if(cache->cleanup)
-        cache->cleanup(cache->cleanup_data, key, rc);
-      // keep track of cost
-      add_cost(cache, -cost);
-      // fprintf(stderr, "[cache remove] freeing %d for %u\n", cost, key);
-      return 0;
+      bucket->used = 0;
+      bucket->level = 0;
     }
-    last_bucket = curr_bucket;
-    next_delta = curr_bucket->next_delta;
+    else evict = key;
+  }
+  else if(bucket->used)
+  {
+    // used since the last turn, (re)gain full protection:
+    bucket->used = 0;
+    if(bucket->level == 0)
+      __sync_fetch_and_add(&cache->hot_cost, bucket->cost);
+    bucket->level = bucket->weight;
+  }
+  else if(bucket->level == 0)
+  {
+    evict = key;
+  }
+  else if(cache->hot_cost > hot_quota)
+  {
+    // too many hot entries, they start to age:
+    if(--bucket->level == 0)
+      __sync_fetch_and_add(&cache->hot_cost, -bucket->cost);
   }
-  dt_cache_unlock(&segment->lock);
-  return 1;
-}
-
-static int
-dt_cache_remove_bucket_no_lru_lock(dt_cache_t *cache, const uint32_t num)
-{
-  // dt_cache_remove works on key, not bucket number, so translate that:
-  const uint32_t hash = num;
-  dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
 
-  dt_cache_bucket_t *const curr_bucket = cache->table + (hash & cache->bucket_mask);
-  const uint32_t key = curr_bucket->key;
   dt_cache_unlock(&segment->lock);
-  // actually remove by key
-  if(key != DT_CACHE_EMPTY_KEY)
-    return dt_cache_remove_no_lru_lock(cache, key);
-  else
-    return 2;
+  return evict;
 }
-#endif
 
 int32_t
 dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-#if 0
-  if(1)//cache->bucket_mask <= 4)
-  {
-    const int fwd = lru_check_consistency(cache);
-    const int bwd = lru_check_consistency_reverse(cache);
-    const int cnt = dt_cache_size(cache);
-    fprintf(stderr, "[cache gc] pre consistency: %d %d %d\n", fwd, bwd, cnt);
-    dt_cache_print_locked(cache);
-    fprintf(stderr, "[cache gc] current cost: %u/%u\n", cache->cost, cache->cost_quota);
-  }
-#endif
-  // sorry, bfl
-  // dt_cache_lock(&cache->lru_lock);
-  int32_t curr;
-  // get least recently used bucket
-  dt_cache_lock(&cache->lru_lock);
-  curr = cache->lru;
-  dt_cache_unlock(&cache->lru_lock);
-  int i = 0;
+  const uint32_t num_buckets = cache->bucket_mask + 1;
+  // hot entries may take this much, the rest is for new ones to prove themselves:
+  const int32_t hot_quota = DT_CACHE_HOT_RATIO * fill_ratio * cache->cost_quota;
+  uint32_t i = 0;
   // while still too full:
   while(cache->cost > fill_ratio * cache->cost_quota)
   {
-    // this i has to be > parallel threads * sane amount to work on for start up times to work
-    // we want to allow at least that many entries in the cache before we start cleaning up
-    if(curr < 0 || i > (1<<cache->segment_shift))
-    {
-      // damn, we walked the whole list and not enough free space,
-      // can you believe this? yell out:
-      if(cache->cost > fill_ratio * cache->cost_quota)
-      {
-        // dt_cache_unlock(&cache->lru_lock);
-        // fprintf(stderr, "[cache gc] failed to free space!\n");
-        // dt_cache_print_locked(cache);
-        return 1;
-      }
-      break;
-    }
-    // fprintf(stderr, "[cache gc] from %u to %u\n", cache->cost, (uint32_t)(0.8*cache->cost_quota));
-
-    // remove it. takes care of lru, cost, user cleanup, and hashtable
-    // this could run into keys being concurrently removed, and will not remove these,
-    // nor alter the lru list in that case (could be interleaved with the other thread
-    // who is currently doing that)
-    //
-    // in the very unlikely case the bucket in question got just removed,
-    // and the lru not cleaned up yet, but another image already occupies that slot...
-    // it will be read locked and we go on. very worst case we clean up the wrong image.
-    const int err = dt_cache_remove_bucket(cache, curr);
-    // =const int err = dt_cache_remove_bucket_no_lru_lock(cache, curr);
-    if(err)
+    // new entries leave after two turns of the clock hand, hot ones after
+    // as many more as their weight. if that wasn't enough, everything that's
+    // left is locked. can you believe this?
+    if(i >= (DT_CACHE_MAX_WEIGHT + 2) * num_buckets) return 1;
+    i++;
+
+    // concurrent collectors share the hand, each one advancing it by a bucket at a time.
+    // the hand visits the buckets in scrambled order (odd multiplier, so still all of them
+    // once per turn), or the freed buckets would cluster behind it and inserts far away from
+    // there had to walk long distances to find space:
+    const uint32_t hand = __sync_fetch_and_add(&cache->clock_hand, 1);
+    const uint32_t curr = (hand * 0x9e3779b1u) & cache->bucket_mask;
+    const uint32_t key = clock_visit(cache, cache->table + curr, hot_quota);
+    // remove it. takes care of cost, user cleanup, and hashtable.
+    // fails if somebody locked it in the meantime, then it stays.
+    if(key != DT_CACHE_EMPTY_KEY && !dt_cache_remove(cache, key))
+      __sync_fetch_and_add(&cache->evictions, 1);
+  }
+  return 0;
+}
+
+void
+dt_cache_set_weight(dt_cache_t *cache, const uint32_t key, const int32_t weight)
+{
+  const uint32_t hash = key;
+  dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
+
+  dt_cache_lock(&segment->lock);
+
+  dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
+  dt_cache_bucket_t *compare_bucket = start_bucket;
+  int16_t next_delta = compare_bucket->first_delta;
+  while(next_delta != DT_CACHE_NULL_DELTA)
+  {
+    compare_bucket += next_delta;
+    if(hash == compare_bucket->hash && (key == compare_bucket->key))
     {
-      // fprintf(stderr, "[cache gc] remove failed %d\n", err);
-      // in case we failed, try next entry
-      dt_cache_lock(&cache->lru_lock);
-      curr = cache->table[curr].mru;
-      dt_cache_unlock(&cache->lru_lock);
+      assert(compare_bucket->read > 0);
+      compare_bucket->weight = weight < 1 ? 1 : (weight > DT_CACHE_MAX_WEIGHT ? DT_CACHE_MAX_WEIGHT : weight);
+      if(compare_bucket->level > compare_bucket->weight) compare_bucket->level = compare_bucket->weight;
+      dt_cache_unlock(&segment->lock);
+      return;
     }
-    i++;
+    next_delta = compare_bucket->next_delta;
   }
-  // dt_cache_unlock(&cache->lru_lock);
-#if 0
-  if(cache->bucket_mask <= 4)
+  dt_cache_unlock(&segment->lock);
+  fprintf(stderr, "[cache] set_weight: bucket for key %u not found!\n", key);
+}
+
+void
+dt_cache_get_stats(const dt_cache_t *const cache, dt_cache_stats_t *stats)
+{
+  stats->hits = stats->misses = 0;
+  for(int k=0; k<=cache->segment_mask; k++)
   {
-    const int fwd = lru_check_consistency(cache);
-    const int bwd = lru_check_consistency_reverse(cache);
-    const int cnt = dt_cache_size(cache);
-    fprintf(stderr, "[cache gc] consistency: %d %d %d\n", fwd, bwd, cnt);
-    dt_cache_print(cache);
+    stats->hits   += cache->segments[k].hits;
+    stats->misses += cache->segments[k].misses;
   }
-#endif
-  return 0;
+  stats->evictions = cache->evictions;
 }
 
 void
@@ -1114,6 +981,8 @@ dt_cache_realloc(dt_cache_t *cache, const uint32_t key, const int32_t cost, void
       const int32_t cost_diff = cost - compare_bucket->cost;
       compare_bucket->cost = cost;
       add_cost(cache, cost_diff);
+      if(compare_bucket->level > 0)
+        __sync_fetch_and_add(&cache->hot_cost, cost_diff);
       dt_cache_unlock(&segment->lock);
       return;
     }
@@ -1165,49 +1034,17 @@ void dt_cache_print(dt_cache_t *cache)
       fprintf(stderr, "[cache] bucket %d is empty with locks r %d w %d\n",
               k, cache->table[k].read, cache->table[k].write);
   }
-  fprintf(stderr, "[cache] lru entries:\n");
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->lru;
-  while(curr >= 0)
-  {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY)
-      fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d\n",
-              curr, (cache->table[curr].key & 0x1fffffff)+1, cache->table[curr].read, cache->table[curr].write);
-    else
-    {
-      fprintf(stderr, "[cache] bucket %d is empty with locks r %d w %d\n",
-              curr, cache->table[curr].read, cache->table[curr].write);
-      // this list should only ever contain valid buffers.
-      assert(0);
-    }
-    if(curr == cache->mru) break;
-    int32_t next = cache->table[curr].mru;
-    assert(cache->table[next].lru == curr);
-    curr = next;
-  }
-  dt_cache_unlock(&cache->lru_lock);
 }
 
 void dt_cache_print_locked(dt_cache_t *cache)
 {
-  fprintf(stderr, "[cache] locked lru entries:\n");
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->lru;
-  int32_t i = 0;
-  while(curr >= 0)
+  fprintf(stderr, "[cache] locked entries:\n");
+  for(int k=0; k<=cache->bucket_mask; k++)
   {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY && (cache->table[curr].read || cache->table[curr].write))
-    {
-      fprintf(stderr, "[cache] bucket[%d|%d] holds key %u with locks r %d w %d\n",
-              i, curr, (cache->table[curr].key & 0x1fffffff)+1, cache->table[curr].read, cache->table[curr].write);
-    }
-    if(curr == cache->mru) break;
-    int32_t next = cache->table[curr].mru;
-    assert(cache->table[next].lru == curr);
-    curr = next;
-    i++;
+    if(cache->table[k].key != DT_CACHE_EMPTY_KEY && (cache->table[k].read || cache->table[k].write))
+      fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d\n",
+              k, (cache->table[k].key & 0x1fffffff)+1, cache->table[k].read, cache->table[k].write);
   }
-  dt_cache_unlock(&cache->lru_lock);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
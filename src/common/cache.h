@@ -24,6 +24,9 @@
 struct dt_cache_segment_t;
 struct dt_cache_bucket_t;
 
+// hot entries survive at most this many turns of the clock unused, see dt_cache_set_weight():
+#define DT_CACHE_MAX_WEIGHT 8
+
 typedef struct dt_cache_t
 {
   uint32_t segment_shift;
@@ -32,13 +35,18 @@ typedef struct dt_cache_t
   struct dt_cache_segment_t *segments;
   struct dt_cache_bucket_t  *table;
 
-  int32_t lru, mru;
   int cache_mask;
   int optimize_cacheline;
   int cost;
   int cost_quota;
-  // one fat lru lock, no use locking segments and possibly rolling back changes.
-  uint32_t lru_lock;
+  // cost of the hot entries, which have been used again after the clock hand passed them once.
+  // they only age while they take more than their share of the quota, so scanning once through
+  // more entries than fit doesn't evict them.
+  int hot_cost;
+  // position of the clock hand sweeping the table for garbage collection.
+  // there is no global lru list, so cache hits only ever lock their segment.
+  uint32_t clock_hand;
+  uint64_t evictions;
 
   // callback functions for cache misses/garbage collection
   // allocate should return != 0 if a write lock on alloc is needed.
@@ -51,6 +59,14 @@ typedef struct dt_cache_t
 }
 dt_cache_t;
 
+typedef struct dt_cache_stats_t
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+}
+dt_cache_stats_t;
+
 
 void dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threads, int32_t cache_line_size, int32_t optimize_cacheline);
 void dt_cache_cleanup(dt_cache_t *cache);
@@ -92,11 +108,18 @@ void*   dt_cache_read_testget(dt_cache_t *cache, const uint32_t key);
 int32_t dt_cache_contains(const dt_cache_t *const cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the end of the lru list, until the fill ratio
-// of the hashtable goes below the given parameter, in terms
+// removes entries not used since the clock hand last passed them, until
+// the fill ratio of the hashtable goes below the given parameter, in terms
 // of the user defined cost measure.
 int32_t dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
+// sets how expensive the entry is to recreate, in turns of the clock it survives unused once it
+// is hot (1..DT_CACHE_MAX_WEIGHT, default 1). requires a lock on the entry.
+void dt_cache_set_weight(dt_cache_t *cache, const uint32_t key, const int32_t weight);
+
+// sums up the hit, miss and eviction counters. not synchronized, only use this for statistics.
+void dt_cache_get_stats(const dt_cache_t *const cache, dt_cache_stats_t *stats);
+
 // returns the number of elements currently stored in the cache.
 // O(N), where N is the total capacity. don't use!
 uint32_t dt_cache_size(const dt_cache_t *const cache);
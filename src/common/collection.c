@@ -38,12 +38,19 @@
 /* Stores the collection query, returns 1 if changed.. */
 static int _dt_collection_store (const dt_collection_t *collection, gchar *query);
 
+/* bumped by dt_collection_invalidate(), collections compare it to the generation of their ids */
+static int _dt_collection_generation = 0;
+
 const dt_collection_t *
 dt_collection_new (const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc (sizeof (dt_collection_t));
   memset (collection,0,sizeof (dt_collection_t));
 
+  dt_pthread_mutex_init(&collection->lock, NULL);
+  collection->offsets = g_hash_table_new(g_direct_hash, g_direct_equal);
+  collection->generation = -1;
+
   /* initialize collection context*/
   if (clone)   /* if clone is provided let's copy it into this context */
   {
@@ -66,6 +73,9 @@ dt_collection_free (const dt_collection_t *collection)
     g_free (collection->query);
   if (collection->where_ext)
     g_free (collection->where_ext);
+  g_hash_table_destroy(collection->offsets);
+  free(collection->ids);
+  dt_pthread_mutex_destroy(&((dt_collection_t *)collection)->lock);
   g_free ((dt_collection_t *)collection);
 }
 
@@ -139,6 +149,11 @@ dt_collection_update (const dt_collection_t *collection)
   query = dt_util_dstrcat(query, "%s %s%s", selq, sq?sq:"", (collection->params.query_flags&COLLECTION_QUERY_USE_LIMIT)?" "LIMIT_QUERY:"");
   result = _dt_collection_store(collection, query);
 
+  /* the ids have to be read again, even if only the expanded group changed */
+  dt_pthread_mutex_lock(&((dt_collection_t *)collection)->lock);
+  ((dt_collection_t *)collection)->generation = -1;
+  dt_pthread_mutex_unlock(&((dt_collection_t *)collection)->lock);
+
   /* free memory used */
   if (sq)
     g_free(sq);
@@ -350,34 +365,68 @@ _dt_collection_store (const dt_collection_t *collection, gchar *query)
   return 1;
 }
 
-uint32_t dt_collection_get_count(const dt_collection_t *collection)
+void dt_collection_invalidate()
 {
-  sqlite3_stmt *stmt = NULL;
-  uint32_t count=1;
-  const gchar *query = dt_collection_get_query(collection);
-  gchar *count_query = NULL;
+  __sync_fetch_and_add(&_dt_collection_generation, 1);
+}
 
-  gchar *fq = g_strstr_len(query, strlen(query), "from");
-  if ((collection->params.query_flags&COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
-    count_query = dt_util_dstrcat(NULL, "select count(images.id) from images %s", collection->where_ext);
-  else
-    count_query = dt_util_dstrcat(count_query, "select count(id) %s", fq);
+/* reads the ids of the query if they are outdated, needs the lock. */
+static void _dt_collection_materialize(dt_collection_t *collection, const gchar *query)
+{
+  const int generation = __sync_fetch_and_add(&_dt_collection_generation, 0);
+  if(collection->generation == generation) return;
+
+  collection->count = 0;
+  g_hash_table_remove_all(collection->offsets);
+  if(!query || query[0] == '\0') return;
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
-  if ((collection->params.query_flags&COLLECTION_QUERY_USE_LIMIT) &&
-      !(collection->params.query_flags&COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(collection->params.query_flags&COLLECTION_QUERY_USE_LIMIT)
   {
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
   }
-
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-    count = sqlite3_column_int(stmt, 0);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(collection->count == collection->alloc)
+    {
+      collection->alloc = MAX(1024, 2*collection->alloc);
+      collection->ids = (int32_t *)realloc(collection->ids, sizeof(int32_t)*collection->alloc);
+    }
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    collection->ids[collection->count++] = imgid;
+    if(!g_hash_table_lookup(collection->offsets, GINT_TO_POINTER(imgid)))
+      g_hash_table_insert(collection->offsets, GINT_TO_POINTER(imgid), GINT_TO_POINTER(collection->count));
+  }
   sqlite3_finalize(stmt);
-  g_free(count_query);
+  collection->generation = generation;
+  dt_print(DT_DEBUG_SQL, "[collection] read %d images\n", collection->count);
+}
+
+uint32_t dt_collection_get_count(const dt_collection_t *collection)
+{
+  const gchar *query = dt_collection_get_query(collection);
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->lock);
+  _dt_collection_materialize(c, query);
+  const uint32_t count = c->count;
+  dt_pthread_mutex_unlock(&c->lock);
   return count;
 }
 
+uint32_t dt_collection_get_ids(const dt_collection_t *collection, uint32_t offset, uint32_t count, int32_t *ids)
+{
+  const gchar *query = dt_collection_get_query(collection);
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->lock);
+  _dt_collection_materialize(c, query);
+  const uint32_t cnt = offset < c->count ? MIN(count, c->count - offset) : 0;
+  if(cnt) memcpy(ids, c->ids + offset, sizeof(int32_t)*cnt);
+  dt_pthread_mutex_unlock(&c->lock);
+  return cnt;
+}
+
 uint32_t dt_collection_get_selected_count (const dt_collection_t *collection)
 {
   sqlite3_stmt *stmt = NULL;
@@ -662,35 +711,15 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 
 int dt_collection_image_offset(int imgid)
 {
-  const gchar *qin = dt_collection_get_query (darktable.collection);
-  int offset = 0;
-  sqlite3_stmt *stmt;
-
-  if(qin)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1,  0);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-
-    gboolean found = FALSE;
-
-    while (sqlite3_step (stmt) == SQLITE_ROW)
-    {
-      int id = sqlite3_column_int(stmt, 0);
-      if (imgid == id)
-      {
-        found = TRUE;
-        break;
-      }
-      offset++;
-    }
-
-    if (!found)
-      offset = 0;
-
-    sqlite3_finalize(stmt);
-  }
-  return offset;
+  const gchar *query = dt_collection_get_query (darktable.collection);
+  if(!query) return 0;
+  dt_collection_t *c = (dt_collection_t *)darktable.collection;
+  dt_pthread_mutex_lock(&c->lock);
+  _dt_collection_materialize(c, query);
+  // offset + 1, or 0 if not found:
+  const int offset = GPOINTER_TO_INT(g_hash_table_lookup(c->offsets, GINT_TO_POINTER(imgid)));
+  dt_pthread_mutex_unlock(&c->lock);
+  return MAX(0, offset - 1);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -18,6 +18,8 @@
 #ifndef DT_COLLECTION_H
 #define DT_COLLECTION_H
 
+#include "common/dtpthread.h"
+
 #include <inttypes.h>
 #include <glib.h>
 
@@ -107,6 +109,13 @@ typedef struct dt_collection_t
   gchar *where_ext;
   dt_collection_params_t params;
   dt_collection_params_t store;
+
+  /* the result of the query, read once and kept until the query or the images change */
+  dt_pthread_mutex_t lock;
+  int32_t *ids;
+  uint32_t count, alloc;
+  GHashTable *offsets;  // imgid -> offset + 1
+  int generation;       // of dt_collection_invalidate() the ids are current for, -1 if outdated
 }
 dt_collection_t;
 
@@ -154,6 +163,11 @@ gchar *dt_collection_get_sort_query(const dt_collection_t *collection);
 
 /** get the count of query */
 uint32_t dt_collection_get_count (const dt_collection_t *collection);
+/** copies up to count image ids of the collection, starting at offset, into ids. @return the number of ids copied. */
+uint32_t dt_collection_get_ids (const dt_collection_t *collection, uint32_t offset, uint32_t count, int32_t *ids);
+/** tells all collections that the images changed in a way they might filter or sort on (rating,
+    tags, labels, history, import, removal...). their results are read again when asked for next. */
+void dt_collection_invalidate ();
 
 /** get selected image ids order as current selection. */
 GList *dt_collection_get_selected (const dt_collection_t *collection);
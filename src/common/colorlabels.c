@@ -15,6 +15,7 @@
     You should have received a copy of the GNU General Public License
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include "common/collection.h"
 #include "common/darktable.h"
 #include "common/image_cache.h"
 #include "common/debug.h"
@@ -27,6 +28,7 @@
 void dt_colorlabels_remove_labels_selection ()
 {
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from color_labels where imgid in (select imgid from selected_images)", NULL, NULL, NULL);
+  dt_collection_invalidate();
 }
 
 void dt_colorlabels_remove_labels (const int imgid)
@@ -36,6 +38,7 @@ void dt_colorlabels_remove_labels (const int imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_invalidate();
 }
 
 void dt_colorlabels_set_label (const int imgid, const int color)
@@ -46,6 +49,7 @@ void dt_colorlabels_set_label (const int imgid, const int color)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_invalidate();
 }
 
 void dt_colorlabels_remove_label (const int imgid, const int color)
@@ -56,6 +60,7 @@ void dt_colorlabels_remove_label (const int imgid, const int color)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_invalidate();
 }
 
 
@@ -82,6 +87,7 @@ void dt_colorlabels_toggle_label_selection (const int color)
 
   // clean up
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.color_labels_temp", NULL, NULL, NULL);
+  dt_collection_invalidate();
 }
 
 void dt_colorlabels_toggle_label (const int imgid, const int color)
@@ -108,6 +114,7 @@ void dt_colorlabels_toggle_label (const int imgid, const int color)
     sqlite3_finalize(stmt2);
   }
   sqlite3_finalize(stmt);
+  dt_collection_invalidate();
 }
 
 gboolean dt_colorlabels_key_accel_callback(GtkAccelGroup *accel_group,
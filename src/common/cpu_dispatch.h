@@ -0,0 +1,95 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_CPU_DISPATCH_H
+#define DT_CPU_DISPATCH_H
+
+#include "common/darktable.h"
+
+/**
+ * runtime selection between kernels compiled for different instruction sets.
+ *
+ * the build targets sse2, so a kernel written in plain c is compiled once more for
+ * avx2 and for avx-512, and the best copy the cpu supports is picked when the module
+ * initializes. write the kernel as DT_CPU_KERNEL and let DT_CPU_CLONES() stamp out
+ * the wider copies:
+ *
+ *   DT_CPU_KERNEL void scale_row(float *const restrict buf, const int n, const float s)
+ *   {
+ *     for(int k=0; k<n; k++) buf[k] *= s;
+ *   }
+ *   DT_CPU_CLONES(scale_row, (float *const restrict buf, const int n, const float s), (buf, n, s))
+ *
+ *   // in init_global():
+ *   gd->scale_row = DT_CPU_SELECT(scale_row);
+ *
+ * kernels return void and must not contain openmp pragmas: the parallel regions are
+ * outlined before the kernel is inlined into its copies and would stay sse2. run them
+ * per row (or per block) and parallelize around the call instead.
+ *
+ * hand written intrinsics can use DT_CPU_TARGET_AVX2 and DT_CPU_TARGET_AVX512 on their
+ * own functions and check dt_cpu_simd_level().
+ */
+
+typedef enum dt_cpu_simd_level_t
+{
+  DT_CPU_SIMD_SSE2   = 0,
+  DT_CPU_SIMD_AVX2   = 1, // avx2 and fma
+  DT_CPU_SIMD_AVX512 = 2  // avx-512 foundation, on top of the above
+}
+dt_cpu_simd_level_t;
+
+/** widest instruction set we may use, as detected by dt_init() and limited by simd_instruction_set. */
+static inline dt_cpu_simd_level_t dt_cpu_simd_level()
+{
+  const uint32_t avx2 = DT_CPU_FLAG_AVX2 | DT_CPU_FLAG_FMA;
+  if((darktable.cpu_flags & avx2) != avx2) return DT_CPU_SIMD_SSE2;
+  if(darktable.cpu_flags & DT_CPU_FLAG_AVX512F) return DT_CPU_SIMD_AVX512;
+  return DT_CPU_SIMD_AVX2;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+
+#define DT_CPU_TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define DT_CPU_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+
+#define DT_CPU_KERNEL static inline __attribute__((always_inline))
+
+#define DT_CPU_CLONES(name, params, args)                                      \
+  static DT_CPU_TARGET_AVX2   void name##_avx2   params { name args; }         \
+  static DT_CPU_TARGET_AVX512 void name##_avx512 params { name args; }
+
+#define DT_CPU_SELECT(name)                                                    \
+  (dt_cpu_simd_level() >= DT_CPU_SIMD_AVX512 ? name##_avx512 :                 \
+   dt_cpu_simd_level() >= DT_CPU_SIMD_AVX2   ? name##_avx2   : name)
+
+#else
+
+// compiler can't target other instruction sets per function, only the default build is used:
+#define DT_CPU_TARGET_AVX2
+#define DT_CPU_TARGET_AVX512
+#define DT_CPU_KERNEL static inline
+#define DT_CPU_CLONES(name, params, args)
+#define DT_CPU_SELECT(name) (name)
+
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
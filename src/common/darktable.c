@@ -36,8 +36,11 @@
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/similarity.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
+#include "develop/pixelpipe_cache.h"
+#include "develop/pixelpipe_profile.h"
 #include "libs/lib.h"
 #include "views/view.h"
 #include "control/control.h"
@@ -75,6 +78,9 @@
 #ifdef _OPENMP
 #  include <omp.h>
 #endif
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#endif
 
 darktable_t darktable;
 const char dt_supported_extensions[] = "3fr,arw,bay,bmq,cap,cine,cr2,crw,cs1,dc2,dcr,dng,erf,fff,exr,ia,iiq,jpeg,jpg,k25,kc2,kdc,mdc,mef,mos,mrw,nef,nrw,orf,pef,pfm,pxn,qtk,raf,raw,rdc,rw2,rwl,sr2,srf,srw,sti,tif,tiff,x3f,png"
@@ -88,7 +94,7 @@ const char dt_supported_extensions[] = "3fr,arw,bay,bmq,cap,cine,cr2,crw,cs1,dc2
 
 static int usage(const char *argv0)
 {
-  printf("usage: %s [-d {all,cache,camctl,control,dev,fswatch,lighttable,memory,nan,opencl,perf,pwstorage,sql}] [IMG_1234.{RAW,..}|image_folder/]", argv0);
+  printf("usage: %s [-d {all,cache,camctl,control,dev,fswatch,lighttable,memory,nan,opencl,perf,pwstorage,sql,sqlprofile}] [IMG_1234.{RAW,..}|image_folder/]", argv0);
 #ifdef HAVE_OPENCL
   printf(" [--disable-opencl]");
 #endif
@@ -99,6 +105,8 @@ static int usage(const char *argv0)
   printf(" [--configdir <user config directory>]");
   printf(" [--cachedir <user config directory>]");
   printf(" [--localedir <locale directory>]");
+  printf(" [--profile <json file>]");
+  printf(" [--profile-trace <chrome trace file>]");
   printf("\n");
   return 1;
 }
@@ -251,6 +259,61 @@ darktable will now close down.\n\n%s"),message);
 }
 #endif
 
+// fills darktable.cpu_flags, these pick the kernels compiled for wider instruction sets (see common/cpu_dispatch.h).
+static void _dt_detect_cpu()
+{
+  uint32_t flags = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int ax, bx, cx, dx;
+  if(__get_cpuid(1, &ax, &bx, &cx, &dx))
+  {
+    if((dx >> 25) & 1) flags |= DT_CPU_FLAG_SSE;
+    if((dx >> 26) & 1) flags |= DT_CPU_FLAG_SSE2;
+    if(cx & 1)         flags |= DT_CPU_FLAG_SSE3;
+    if((cx >> 19) & 1) flags |= DT_CPU_FLAG_SSE4_1;
+
+    // the wide registers can only be used if the os saves them on context switches:
+    uint64_t xcr0 = 0;
+    if((cx >> 27) & 1)
+    {
+      unsigned int lo, hi;
+      __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+      xcr0 = ((uint64_t)hi << 32) | lo;
+    }
+    const int os_avx    = (xcr0 & 0x06) == 0x06; // sse and avx state
+    const int os_avx512 = (xcr0 & 0xe6) == 0xe6; // plus opmask and upper zmm state
+    if(os_avx && ((cx >> 28) & 1)) flags |= DT_CPU_FLAG_AVX;
+    if(os_avx && ((cx >> 12) & 1)) flags |= DT_CPU_FLAG_FMA;
+
+    if(__get_cpuid_max(0, NULL) >= 7)
+    {
+      __cpuid_count(7, 0, ax, bx, cx, dx);
+      if(os_avx    && ((bx >>  5) & 1)) flags |= DT_CPU_FLAG_AVX2;
+      if(os_avx512 && ((bx >> 16) & 1)) flags |= DT_CPU_FLAG_AVX512F;
+    }
+  }
+#endif
+
+  // allow to step down, to compare the code paths or to rule out a broken one:
+  gchar *limit = dt_conf_get_string("simd_instruction_set");
+  if(limit && !strcmp(limit, "sse2"))
+    flags &= ~(DT_CPU_FLAG_AVX | DT_CPU_FLAG_AVX2 | DT_CPU_FLAG_FMA | DT_CPU_FLAG_AVX512F);
+  else if(limit && !strcmp(limit, "avx2"))
+    flags &= ~DT_CPU_FLAG_AVX512F;
+  g_free(limit);
+  darktable.cpu_flags = flags;
+
+  dt_print(DT_DEBUG_PERF, "[dt_init] simd extensions:%s%s%s%s%s%s%s%s\n",
+           (flags & DT_CPU_FLAG_SSE)     ? " sse"     : "",
+           (flags & DT_CPU_FLAG_SSE2)    ? " sse2"    : "",
+           (flags & DT_CPU_FLAG_SSE3)    ? " sse3"    : "",
+           (flags & DT_CPU_FLAG_SSE4_1)  ? " sse4.1"  : "",
+           (flags & DT_CPU_FLAG_AVX)     ? " avx"     : "",
+           (flags & DT_CPU_FLAG_AVX2)    ? " avx2"    : "",
+           (flags & DT_CPU_FLAG_FMA)     ? " fma"     : "",
+           (flags & DT_CPU_FLAG_AVX512F) ? " avx512f" : "");
+}
+
 gboolean dt_supported_image(const gchar *filename)
 {
   gboolean supported = FALSE;
@@ -448,6 +511,8 @@ int dt_init(int argc, char *argv[], const int init_gui)
   char *tmpdirFromCommand = NULL;
   char *configdirFromCommand = NULL;
   char *cachedirFromCommand = NULL;
+  char *profileFromCommand = NULL;
+  char *profileTraceFromCommand = NULL;
 
   darktable.num_openmp_threads = 1;
 #ifdef _OPENMP
@@ -500,6 +565,14 @@ int dt_init(int argc, char *argv[], const int init_gui)
       {
         bindtextdomain (GETTEXT_PACKAGE, argv[++k]);
       }
+      else if(!strcmp(argv[k], "--profile") && argc > k+1)
+      {
+        profileFromCommand = argv[++k];
+      }
+      else if(!strcmp(argv[k], "--profile-trace") && argc > k+1)
+      {
+        profileTraceFromCommand = argv[++k];
+      }
       else if(argv[k][1] == 'd' && argc > k+1)
       {
         if(!strcmp(argv[k+1], "all"))             darktable.unmuted = 0xffffffff;   // enable all debug information
@@ -512,6 +585,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
         else if(!strcmp(argv[k+1], "pwstorage"))  darktable.unmuted |= DT_DEBUG_PWSTORAGE; // pwstorage module
         else if(!strcmp(argv[k+1], "opencl"))     darktable.unmuted |= DT_DEBUG_OPENCL;    // gpu accel via opencl
         else if(!strcmp(argv[k+1], "sql"))        darktable.unmuted |= DT_DEBUG_SQL; // SQLite3 queries
+        else if(!strcmp(argv[k+1], "sqlprofile")) darktable.unmuted |= DT_DEBUG_SQL_PROFILE; // time spent per SQLite3 statement
         else if(!strcmp(argv[k+1], "memory"))     darktable.unmuted |= DT_DEBUG_MEMORY; // some stats on mem usage now and then.
         else if(!strcmp(argv[k+1], "lighttable")) darktable.unmuted |= DT_DEBUG_LIGHTTABLE; // lighttable related stuff.
         else if(!strcmp(argv[k+1], "nan"))        darktable.unmuted |= DT_DEBUG_NAN; // check for NANs when processing the pipe.
@@ -573,6 +647,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
 
   // thread-safe init:
   dt_exif_init();
+  dt_similarity_init();
   char datadir[DT_MAX_PATH_LEN];
   dt_loc_get_user_config_dir (datadir,DT_MAX_PATH_LEN);
   char filename[DT_MAX_PATH_LEN];
@@ -583,6 +658,9 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(darktable.conf, 0, sizeof(dt_conf_t));
   dt_conf_init(darktable.conf, filename);
 
+  // before anything selects its kernels:
+  _dt_detect_cpu();
+
   // set the interface language
   const gchar* lang = dt_conf_get_string("ui_last/gui_language");
   if(lang != NULL && lang[0] != '\0')
@@ -719,6 +797,14 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(darktable.mipmap_cache, 0, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  darktable.pixelpipe_cache = (dt_dev_pixelpipe_cache_global_t *)malloc(sizeof(dt_dev_pixelpipe_cache_global_t));
+  memset(darktable.pixelpipe_cache, 0, sizeof(dt_dev_pixelpipe_cache_global_t));
+  dt_dev_pixelpipe_cache_global_init(darktable.pixelpipe_cache, (size_t)MAX(0, dt_conf_get_int("pixelpipe_cache_memory")) << 20);
+
+  darktable.pixelpipe_profile = NULL;
+  if(profileFromCommand || profileTraceFromCommand)
+    darktable.pixelpipe_profile = dt_dev_pixelpipe_profile_init(profileFromCommand, profileTraceFromCommand);
+
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
@@ -837,6 +923,11 @@ void dt_cleanup()
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  dt_dev_pixelpipe_cache_global_cleanup(darktable.pixelpipe_cache);
+  free(darktable.pixelpipe_cache);
+  // writes the profile, if requested:
+  dt_dev_pixelpipe_profile_cleanup(darktable.pixelpipe_profile);
+  darktable.pixelpipe_profile = NULL;
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
@@ -854,6 +945,7 @@ void dt_cleanup()
 #endif
   dt_pwstorage_destroy(darktable.pwstorage);
   dt_fswatch_destroy(darktable.fswatch);
+  dt_similarity_cleanup();
 
 #ifdef HAVE_GRAPHICSMAGICK
   DestroyMagick();
@@ -945,6 +1037,7 @@ void dt_configure_defaults()
     fprintf(stderr, "[defaults] setting high quality defaults\n");
     dt_conf_set_int("worker_threads", 8);
     dt_conf_set_int("cache_memory", 1u<<30);
+    dt_conf_set_int("pixelpipe_cache_memory", 1024);
     dt_conf_set_int("plugins/lighttable/thumbnail_width", 1300);
     dt_conf_set_int("plugins/lighttable/thumbnail_height", 1000);
     dt_conf_set_bool("plugins/lighttable/low_quality_thumbnails", FALSE);
@@ -954,6 +1047,7 @@ void dt_configure_defaults()
     fprintf(stderr, "[defaults] setting very conservative defaults\n");
     dt_conf_set_int("worker_threads", 1);
     dt_conf_set_int("cache_memory", 200u<<20);
+    dt_conf_set_int("pixelpipe_cache_memory", 0);
     dt_conf_set_int("host_memory_limit", 500);
     dt_conf_set_int("singlebuffer_limit", 8);
     dt_conf_set_int("plugins/lighttable/thumbnail_width", 800);
@@ -124,6 +124,8 @@ struct dt_control_t;
 struct dt_develop_t;
 struct dt_mipmap_cache_t;
 struct dt_image_cache_t;
+struct dt_dev_pixelpipe_cache_global_t;
+struct dt_dev_pixelpipe_profile_t;
 struct dt_lib_t;
 struct dt_conf_t;
 struct dt_points_t;
@@ -144,13 +146,19 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_SQL = 256,
   DT_DEBUG_MEMORY = 512,
   DT_DEBUG_LIGHTTABLE = 1024,
-  DT_DEBUG_NAN = 2048
+  DT_DEBUG_NAN = 2048,
+  DT_DEBUG_SQL_PROFILE = 4096
 }
 dt_debug_thread_t;
 
 #define DT_CPU_FLAG_SSE    1
 #define DT_CPU_FLAG_SSE2   2
 #define DT_CPU_FLAG_SSE3   4
+#define DT_CPU_FLAG_SSE4_1 8
+#define DT_CPU_FLAG_AVX    16
+#define DT_CPU_FLAG_AVX2   32
+#define DT_CPU_FLAG_FMA    64
+#define DT_CPU_FLAG_AVX512F 128
 
 typedef struct darktable_t
 {
@@ -171,6 +179,8 @@ typedef struct darktable_t
   struct dt_gui_gtk_t            *gui;
   struct dt_mipmap_cache_t       *mipmap_cache;
   struct dt_image_cache_t        *image_cache;
+  struct dt_dev_pixelpipe_cache_global_t *pixelpipe_cache;
+  struct dt_dev_pixelpipe_profile_t *pixelpipe_profile; // NULL unless --profile or --profile-trace was given
   struct dt_bauhaus_t            *bauhaus;
   const struct dt_database_t     *db;
   const struct dt_fswatch_t      *fswatch;
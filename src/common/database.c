@@ -37,12 +37,40 @@ typedef struct dt_database_t
 
   /* ondisk DB */
   sqlite3 *handle;
+
+  /* the connection is shared by all threads, so is its transaction.
+     dt_database_begin() holds this (recursive) lock until the matching commit. */
+  dt_pthread_mutex_t transaction_mutex;
+  int transaction_depth;
+
+  /* statement statistics, only with -d sqlprofile */
+  dt_pthread_mutex_t profile_mutex;
+  GHashTable *profile;      // sql text -> dt_database_profile_t
+  GHashTable *profile_rows; // sqlite3_stmt -> rows returned by the current run
+  double slow_query;        // in seconds
 } dt_database_t;
 
+typedef struct dt_database_profile_t
+{
+  gchar *sql;
+  const char *file;         // where it was prepared, if it went through the DT_DEBUG_SQLITE3 macros
+  int line;
+  uint64_t count, rows, slow;
+  double time, max;         // in seconds
+}
+dt_database_profile_t;
+
+// how many of the most expensive statements are listed on exit:
+#define DT_DATABASE_PROFILE_TOP 40
+
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
 
+/* statement statistics for -d sqlprofile */
+static void _database_profile_init(dt_database_t *db);
+static void _database_profile_cleanup(dt_database_t *db);
+
 /* delete old mipmaps files */
 static void _database_delete_mipmaps_files();
 
@@ -86,6 +114,11 @@ dt_database_t *dt_database_init(char *alternative)
   dt_database_t *db = (dt_database_t *)g_malloc(sizeof(dt_database_t));
   memset(db,0,sizeof(dt_database_t));
   db->dbfilename = g_strdup(dbfilename);
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  dt_pthread_mutex_init(&db->transaction_mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
   db->is_new_database = FALSE;
 
   /* test if databasefile is available */
@@ -126,16 +159,36 @@ dt_database_t *dt_database_init(char *alternative)
   sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
 
+  if(darktable.unmuted & DT_DEBUG_SQL_PROFILE) _database_profile_init(db);
+
   g_free(dbname);
   return db;
 }
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  if(db->profile) _database_profile_cleanup((dt_database_t *)db);
   sqlite3_close(db->handle);
+  dt_pthread_mutex_destroy(&((dt_database_t *)db)->transaction_mutex);
   g_free((dt_database_t *)db);
 }
 
+void dt_database_begin(const struct dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->transaction_mutex);
+  if(d->transaction_depth++ == 0)
+    sqlite3_exec(d->handle, "BEGIN", NULL, NULL, NULL);
+}
+
+void dt_database_commit(const struct dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(--d->transaction_depth == 0)
+    sqlite3_exec(d->handle, "COMMIT", NULL, NULL, NULL);
+  dt_pthread_mutex_unlock(&d->transaction_mutex);
+}
+
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
   return db->handle;
@@ -202,6 +255,157 @@ gboolean dt_database_get_already_locked(const dt_database_t *db)
   return db->already_locked;
 }
 
+// the entry for sql, created if needed. needs profile_mutex.
+static dt_database_profile_t *_database_profile_entry(dt_database_t *db, const char *sql)
+{
+  dt_database_profile_t *p = g_hash_table_lookup(db->profile, sql);
+  if(!p)
+  {
+    p = (dt_database_profile_t *)g_malloc0(sizeof(dt_database_profile_t));
+    p->sql = g_strdup(sql);
+    g_hash_table_insert(db->profile, p->sql, p);
+  }
+  return p;
+}
+
+void dt_database_profile_site(const dt_database_t *db, const char *sql, const char *file, int line)
+{
+  if(!db || !db->profile || !sql) return;
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->profile_mutex);
+  dt_database_profile_t *p = _database_profile_entry(d, sql);
+  p->file = file;
+  p->line = line;
+  dt_pthread_mutex_unlock(&d->profile_mutex);
+}
+
+// accounts one run of a statement. needs profile_mutex.
+static void _database_profile_add(dt_database_t *db, const char *sql, const double time, const uint64_t rows)
+{
+  if(!sql) return;
+  dt_database_profile_t *p = _database_profile_entry(db, sql);
+  p->count++;
+  p->rows += rows;
+  p->time += time;
+  p->max = MAX(p->max, time);
+  if(time >= db->slow_query)
+  {
+    p->slow++;
+    dt_print(DT_DEBUG_SQL_PROFILE, "[sql] slow query: %.1f ms, %" PRIu64 " rows, %s:%d: %s\n",
+             1000.0*time, rows, p->file ? p->file : "?", p->line, sql);
+  }
+}
+
+#if SQLITE_VERSION_NUMBER >= 3014000
+// sqlite >= 3.14 tells us about every row, too:
+static int _database_profile_trace(unsigned type, void *data, void *p, void *x)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  sqlite3_stmt *stmt = (sqlite3_stmt *)p;
+  dt_pthread_mutex_lock(&db->profile_mutex);
+  if(type == SQLITE_TRACE_ROW)
+  {
+    const uint64_t rows = GPOINTER_TO_SIZE(g_hash_table_lookup(db->profile_rows, stmt));
+    g_hash_table_insert(db->profile_rows, stmt, GSIZE_TO_POINTER(rows + 1));
+  }
+  else if(type == SQLITE_TRACE_PROFILE)
+  {
+    const uint64_t rows = GPOINTER_TO_SIZE(g_hash_table_lookup(db->profile_rows, stmt));
+    g_hash_table_remove(db->profile_rows, stmt);
+    _database_profile_add(db, sqlite3_sql(stmt), 1e-9 * *(sqlite3_int64 *)x, rows);
+  }
+  dt_pthread_mutex_unlock(&db->profile_mutex);
+  return 0;
+}
+#else
+static void _database_profile_callback(void *data, const char *sql, sqlite3_uint64 ns)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  dt_pthread_mutex_lock(&db->profile_mutex);
+  _database_profile_add(db, sql, 1e-9 * ns, 0);
+  dt_pthread_mutex_unlock(&db->profile_mutex);
+}
+#endif
+
+static void _database_profile_free(gpointer data)
+{
+  dt_database_profile_t *p = (dt_database_profile_t *)data;
+  g_free(p->sql);
+  g_free(p);
+}
+
+static gint _database_profile_sort(gconstpointer a, gconstpointer b)
+{
+  const dt_database_profile_t *pa = (const dt_database_profile_t *)a;
+  const dt_database_profile_t *pb = (const dt_database_profile_t *)b;
+  return pa->time < pb->time ? 1 : (pa->time > pb->time ? -1 : 0);
+}
+
+static void _database_profile_init(dt_database_t *db)
+{
+  dt_pthread_mutex_init(&db->profile_mutex, NULL);
+  db->profile = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _database_profile_free);
+  db->profile_rows = g_hash_table_new(g_direct_hash, g_direct_equal);
+  db->slow_query = 1e-3 * dt_conf_get_int("database_slow_query_ms");
+#if SQLITE_VERSION_NUMBER >= 3014000
+  sqlite3_trace_v2(db->handle, SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW, _database_profile_trace, db);
+#else
+  sqlite3_profile(db->handle, _database_profile_callback, db);
+#endif
+}
+
+// prints the statements which took the most time, and how sqlite runs the slow ones.
+static void _database_profile_cleanup(dt_database_t *db)
+{
+#if SQLITE_VERSION_NUMBER >= 3014000
+  sqlite3_trace_v2(db->handle, 0, NULL, NULL);
+#else
+  sqlite3_profile(db->handle, NULL, NULL);
+#endif
+
+  GList *list = g_list_sort(g_hash_table_get_values(db->profile), _database_profile_sort);
+  double total = 0.0;
+  for(GList *l = list; l; l = g_list_next(l)) total += ((dt_database_profile_t *)l->data)->time;
+  dt_print(DT_DEBUG_SQL_PROFILE, "[sql] %u statements, %.3f s in total. most expensive:\n",
+           g_hash_table_size(db->profile), total);
+  dt_print(DT_DEBUG_SQL_PROFILE, "[sql]   total ms     runs  mean ms   max ms       rows  slow  statement\n");
+  int k = 0;
+  for(GList *l = list; l && k < DT_DATABASE_PROFILE_TOP; l = g_list_next(l), k++)
+  {
+    const dt_database_profile_t *p = (const dt_database_profile_t *)l->data;
+    dt_print(DT_DEBUG_SQL_PROFILE, "[sql] %10.1f %8" PRIu64 " %8.3f %8.1f %10" PRIu64 " %5" PRIu64 "  %s:%d: %s\n",
+             1000.0*p->time, p->count, 1000.0*p->time/MAX(p->count, 1), 1000.0*p->max, p->rows, p->slow,
+             p->file ? p->file : "?", p->line, p->sql);
+  }
+
+  // explain the slow ones. tracing is off, so these don't count themselves:
+  for(GList *l = list; l; l = g_list_next(l))
+  {
+    const dt_database_profile_t *p = (const dt_database_profile_t *)l->data;
+    if(!p->slow) continue;
+    sqlite3_stmt *stmt;
+    gchar *query = g_strdup_printf("explain query plan %s", p->sql);
+    // temporary tables might be gone by now, just skip those:
+    if(sqlite3_prepare_v2(db->handle, query, -1, &stmt, NULL) == SQLITE_OK)
+    {
+      dt_print(DT_DEBUG_SQL_PROFILE, "[sql] plan of %s:%d: %s\n", p->file ? p->file : "?", p->line, p->sql);
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+        dt_print(DT_DEBUG_SQL_PROFILE, "[sql]   %s\n", detail ? detail : "");
+      }
+      sqlite3_finalize(stmt);
+    }
+    g_free(query);
+  }
+
+  g_list_free(list);
+  g_hash_table_destroy(db->profile_rows);
+  g_hash_table_destroy(db->profile);
+  db->profile = NULL;
+  dt_pthread_mutex_destroy(&db->profile_mutex);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
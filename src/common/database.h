@@ -33,6 +33,14 @@ gboolean dt_database_is_new(const struct dt_database_t *db);
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
 gboolean dt_database_get_already_locked(const struct dt_database_t *db);
+/** starts a transaction on the shared connection, or joins the one this thread already has open.
+    other threads block in dt_database_begin() until the matching dt_database_commit(). statements
+    they run without it still land in the open transaction. */
+void dt_database_begin(const struct dt_database_t *db);
+/** ends what dt_database_begin() started, commits when the outermost one ends. */
+void dt_database_commit(const struct dt_database_t *db);
+/** with -d sqlprofile: remember the source location sql is prepared at, used by the DT_DEBUG_SQLITE3 macros. */
+void dt_database_profile_site(const struct dt_database_t *db, const char *sql, const char *file, int line);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
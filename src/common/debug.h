@@ -41,15 +41,21 @@
 
 #endif
 
+/* with -d sqlprofile, remember where statements come from for the summary */
+#define __DT_DEBUG_SQL_SITE__(sql) \
+  if(darktable.unmuted & DT_DEBUG_SQL_PROFILE) dt_database_profile_site(darktable.db, (sql), __FILE__, __LINE__)
+
 #define DT_DEBUG_SQLITE3_EXEC(a,b,c,d,e)		\
   do{							\
     dt_print(DT_DEBUG_SQL, "[sql] exec \"%s\"\n", (b));	\
+    __DT_DEBUG_SQL_SITE__(b);				\
     __DT_DEBUG_ASSERT__(sqlite3_exec(a,b,c,d,e));	\
   }while(0)
 
 #define DT_DEBUG_SQLITE3_PREPARE_V2(a,b,c,d,e)			\
   do {								\
     dt_print(DT_DEBUG_SQL, "[sql] prepare \"%s\"\n", (b));	\
+    __DT_DEBUG_SQL_SITE__(b);					\
     __DT_DEBUG_ASSERT__(sqlite3_prepare_v2(a,b,c,d,e));		\
   }while(0)
 
@@ -747,6 +747,23 @@ int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size)
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
+static bool _exif_read_metadata(dt_image_t *img, Exiv2::ExifData &exifData,
+                                Exiv2::IptcData &iptcData, Exiv2::XmpData &xmpData)
+{
+  bool res;
+
+  // EXIF metadata
+  res = dt_exif_read_exif_data(img, exifData);
+
+  // IPTC metadata.
+  res = dt_exif_read_iptc_data(img, iptcData) && res;
+
+  // XMP metadata
+  res = dt_exif_read_xmp_data(img, xmpData, false, true) && res;
+
+  return res;
+}
+
 int dt_exif_read(dt_image_t *img, const char* path)
 {
   try
@@ -755,21 +772,8 @@ int dt_exif_read(dt_image_t *img, const char* path)
     image = Exiv2::ImageFactory::open(path);
     assert(image.get() != 0);
     image->readMetadata();
-    bool res;
-
-    // EXIF metadata
-    Exiv2::ExifData &exifData = image->exifData();
-    res = dt_exif_read_exif_data(img, exifData);
-
-    // IPTC metadata.
-    Exiv2::IptcData &iptcData = image->iptcData();
-    res = dt_exif_read_iptc_data(img, iptcData) && res;
-
-    // XMP metadata
-    Exiv2::XmpData &xmpData = image->xmpData();
-    res = dt_exif_read_xmp_data(img, xmpData, false, true) && res;
 
-    return res?0:1;
+    return _exif_read_metadata(img, image->exifData(), image->iptcData(), image->xmpData())?0:1;
   }
   catch (Exiv2::AnyError& e)
   {
@@ -1119,37 +1123,22 @@ static void _exif_import_tags(dt_image_t *img,Exiv2::XmpData::iterator &pos)
   // tags in array
   const int cnt = pos->count();
 
-  sqlite3_stmt *stmt_sel_id, *stmt_ins_tags, *stmt_ins_tagxtag, *stmt_upd_tagxtag, *stmt_ins_tagged, *stmt_upd_tagxtag2;
+  sqlite3_stmt *stmt_sel_id, *stmt_ins_tags;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "select id from tags where name = ?1",
                               -1, &stmt_sel_id, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "insert into tags (id, name) values (null, ?1)",
                               -1, &stmt_ins_tags, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "insert into tagxtag select id, ?1, 0 from tags",
-                              -1, &stmt_ins_tagxtag, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = 1000000 where id1 = ?1 and id2 = ?1",
-                              -1, &stmt_upd_tagxtag, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "insert into tagged_images (tagid, imgid) values (?1, ?2)",
-                              -1, &stmt_ins_tagged, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = count + 1 where "
-                              "(id1 = ?1 and id2 in (select tagid from tagged_images where imgid = ?2))"
-                              " or "
-                              "(id2 = ?1 and id1 in (select tagid from tagged_images where imgid = ?2))",
-                              -1, &stmt_upd_tagxtag2, NULL);
   for (int i=0; i<cnt; i++)
   {
     char tagbuf[1024];
     const char *tag2 = pos->toString(i).c_str();
     strncpy(tagbuf, tag2, 1024);
-    int tagid = -1;
     char *tag = tagbuf;
     while(tag)
     {
+      int tagid = -1;
       char *next_tag = strstr(tag, ",");
       if(next_tag) *(next_tag++) = 0;
       // check if tag is available, get its id:
@@ -1161,22 +1150,7 @@ static void _exif_import_tags(dt_image_t *img,Exiv2::XmpData::iterator &pos)
         sqlite3_reset(stmt_sel_id);
         sqlite3_clear_bindings(stmt_sel_id);
 
-        if (tagid > 0)
-        {
-          if (k == 1)
-          {
-            DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagxtag, 1, tagid);
-            sqlite3_step(stmt_ins_tagxtag);
-            sqlite3_reset(stmt_ins_tagxtag);
-            sqlite3_clear_bindings(stmt_ins_tagxtag);
-
-            DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_tagxtag, 1, tagid);
-            sqlite3_step(stmt_upd_tagxtag);
-            sqlite3_reset(stmt_upd_tagxtag);
-            sqlite3_clear_bindings(stmt_upd_tagxtag);
-          }
-          break;
-        }
+        if (tagid > 0) break;
         fprintf(stderr,"[xmp_import] creating tag: %s\n", tag);
         // create this tag (increment id, leave icon empty), retry.
         DT_DEBUG_SQLITE3_BIND_TEXT(stmt_ins_tags, 1, tag, strlen(tag), SQLITE_TRANSIENT);
@@ -1184,230 +1158,214 @@ static void _exif_import_tags(dt_image_t *img,Exiv2::XmpData::iterator &pos)
         sqlite3_reset(stmt_ins_tags);
         sqlite3_clear_bindings(stmt_ins_tags);
       }
-      // associate image and tag.
-      DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagged, 1, tagid);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagged, 2, img->id);
-      sqlite3_step(stmt_ins_tagged);
-      sqlite3_reset(stmt_ins_tagged);
-      sqlite3_clear_bindings(stmt_ins_tagged);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_tagxtag2, 1, tagid);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_tagxtag2, 2, img->id);
-      sqlite3_step(stmt_upd_tagxtag2);
-      sqlite3_reset(stmt_upd_tagxtag2);
-      sqlite3_clear_bindings(stmt_upd_tagxtag2);
+      // associate image and tag, this also counts the new pairs in tagxtag.
+      if (tagid > 0) dt_tag_attach(tagid, img->id);
 
       tag = next_tag;
     }
   }
   sqlite3_finalize(stmt_sel_id);
   sqlite3_finalize(stmt_ins_tags);
-  sqlite3_finalize(stmt_ins_tagxtag);
-  sqlite3_finalize(stmt_upd_tagxtag);
-  sqlite3_finalize(stmt_ins_tagged);
-  sqlite3_finalize(stmt_upd_tagxtag2);
 }
 
-// need a write lock on *img (non-const) to write stars (and soon color labels).
-int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_only)
+// apply the contents of a sidecar to the image and the database. throws exiv2 exceptions.
+static void _exif_xmp_apply(dt_image_t *img, Exiv2::XmpData &xmpData, const int history_only)
 {
-  try
-  {
-    // read xmp sidecar
-    Exiv2::Image::AutoPtr image;
-    image = Exiv2::ImageFactory::open(filename);
-    assert(image.get() != 0);
-    image->readMetadata();
-    Exiv2::XmpData &xmpData = image->xmpData();
-
-    sqlite3_stmt *stmt;
-
-    // get rid of old meta data
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "delete from meta_data where id = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    // consistency: strip all tags from image (tagged_image, tagxtag)
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "update tagxtag set count = count - 1 where "
-                                "(id2 in (select tagid from tagged_images where imgid = ?2)) or "
-                                "(id1 in (select tagid from tagged_images where imgid = ?2))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "delete from tagged_images where imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    if(!history_only)
-      dt_exif_read_xmp_data(img, xmpData, true, false);
+  sqlite3_stmt *stmt;
 
-    Exiv2::XmpData::iterator pos;
+  // get rid of old meta data
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "delete from meta_data where id = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 
-    // convert legacy flip bits (will not be written anymore, convert to flip history item here):
-    if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.raw_params"))) != xmpData.end() )
-    {
-      int32_t i = pos->toLong();
-      dt_image_raw_parameters_t raw_params = *(dt_image_raw_parameters_t *)&i;
-      int32_t user_flip = raw_params.user_flip;
-      img->legacy_flip.user_flip = user_flip;
-      img->legacy_flip.legacy = 0;
-    }
+  // consistency: strip all tags from image (tagged_image, tagxtag)
+  dt_tag_count_image(img->id, -1);
 
-    // GPS data
-    if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.exif.GPSLatitude"))) != xmpData.end() )
-    {
-      img->latitude = _gps_string_to_number(pos->toString().c_str());
-    }
+  // remove from tagged_images
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "delete from tagged_images where imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 
-    if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.exif.GPSLongitude"))) != xmpData.end() )
-    {
-      img->longitude = _gps_string_to_number(pos->toString().c_str());
-    }
+  if(!history_only)
+    dt_exif_read_xmp_data(img, xmpData, true, false);
 
-    if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.auto_presets_applied"))) != xmpData.end() )
-    {
-      int32_t i = pos->toLong();
-      // set or clear bit in image struct
-      if(i == 1) img->flags |= DT_IMAGE_AUTO_PRESETS_APPLIED;
-      if(i == 0) img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
-      // in any case, this is no legacy image.
-      img->flags |= DT_IMAGE_NO_LEGACY_PRESETS;
-    }
-    else
-    {
-      // not found means 0 (old xmp)
-      img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
-      // so we are legacy (thus have to clear the no-legacy flag)
-      img->flags &= ~DT_IMAGE_NO_LEGACY_PRESETS;
-    }
-    // when we are reading the xmp data it doesn't make sense to flag the image as removed
-    img->flags &= ~DT_IMAGE_REMOVE;
-
-    // history
-    Exiv2::XmpData::iterator ver;
-    Exiv2::XmpData::iterator en;
-    Exiv2::XmpData::iterator op;
-    Exiv2::XmpData::iterator param;
-    Exiv2::XmpData::iterator blendop = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.blendop_params"));
-    Exiv2::XmpData::iterator blendop_version = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.blendop_version"));
-    Exiv2::XmpData::iterator multi_priority = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.multi_priority"));
-    Exiv2::XmpData::iterator multi_name = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.multi_name"));
-
-    if ( (ver=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_modversion"))) != xmpData.end() &&
-         (en=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_enabled")))     != xmpData.end() &&
-         (op=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_operation")))   != xmpData.end() &&
-         (param=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_params")))   != xmpData.end() )
+  Exiv2::XmpData::iterator pos;
+
+  // convert legacy flip bits (will not be written anymore, convert to flip history item here):
+  if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.raw_params"))) != xmpData.end() )
+  {
+    int32_t i = pos->toLong();
+    dt_image_raw_parameters_t raw_params = *(dt_image_raw_parameters_t *)&i;
+    int32_t user_flip = raw_params.user_flip;
+    img->legacy_flip.user_flip = user_flip;
+    img->legacy_flip.legacy = 0;
+  }
+
+  // GPS data
+  if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.exif.GPSLatitude"))) != xmpData.end() )
+  {
+    img->latitude = _gps_string_to_number(pos->toString().c_str());
+  }
+
+  if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.exif.GPSLongitude"))) != xmpData.end() )
+  {
+    img->longitude = _gps_string_to_number(pos->toString().c_str());
+  }
+
+  if ((pos=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.auto_presets_applied"))) != xmpData.end() )
+  {
+    int32_t i = pos->toLong();
+    // set or clear bit in image struct
+    if(i == 1) img->flags |= DT_IMAGE_AUTO_PRESETS_APPLIED;
+    if(i == 0) img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
+    // in any case, this is no legacy image.
+    img->flags |= DT_IMAGE_NO_LEGACY_PRESETS;
+  }
+  else
+  {
+    // not found means 0 (old xmp)
+    img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
+    // so we are legacy (thus have to clear the no-legacy flag)
+    img->flags &= ~DT_IMAGE_NO_LEGACY_PRESETS;
+  }
+  // when we are reading the xmp data it doesn't make sense to flag the image as removed
+  img->flags &= ~DT_IMAGE_REMOVE;
+
+  // history
+  Exiv2::XmpData::iterator ver;
+  Exiv2::XmpData::iterator en;
+  Exiv2::XmpData::iterator op;
+  Exiv2::XmpData::iterator param;
+  Exiv2::XmpData::iterator blendop = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.blendop_params"));
+  Exiv2::XmpData::iterator blendop_version = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.blendop_version"));
+  Exiv2::XmpData::iterator multi_priority = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.multi_priority"));
+  Exiv2::XmpData::iterator multi_name = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.multi_name"));
+
+  if ( (ver=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_modversion"))) != xmpData.end() &&
+       (en=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_enabled")))     != xmpData.end() &&
+       (op=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_operation")))   != xmpData.end() &&
+       (param=xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_params")))   != xmpData.end() )
+  {
+    const int cnt = ver->count();
+    if(cnt == en->count() && cnt == op->count() && cnt == param->count())
     {
-      const int cnt = ver->count();
-      if(cnt == en->count() && cnt == op->count() && cnt == param->count())
+      // clear history
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "delete from history where imgid = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+      sqlite3_step(stmt);
+      sqlite3_finalize (stmt);
+      sqlite3_stmt *stmt_sel_num, *stmt_ins_hist, *stmt_upd_hist;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "select num from history where imgid = ?1 and num = ?2",
+                                  -1, &stmt_sel_num, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "insert into history (imgid, num) values (?1, ?2)",
+                                  -1, &stmt_ins_hist, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "update history set operation = ?1, op_params = ?2, "
+                                  "blendop_params = ?7, blendop_version = ?8, multi_priority = ?9, multi_name = ?10, module = ?3, enabled = ?4 "
+                                  "where imgid = ?5 and num = ?6", -1, &stmt_upd_hist, NULL);
+      for(int i=0; i<cnt; i++)
       {
-        // clear history
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "delete from history where imgid = ?1", -1, &stmt, NULL);
-        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-        sqlite3_step(stmt);
-        sqlite3_finalize (stmt);
-        sqlite3_stmt *stmt_sel_num, *stmt_ins_hist, *stmt_upd_hist;
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "select num from history where imgid = ?1 and num = ?2",
-                                    -1, &stmt_sel_num, NULL);
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "insert into history (imgid, num) values (?1, ?2)",
-                                    -1, &stmt_ins_hist, NULL);
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "update history set operation = ?1, op_params = ?2, "
-                                    "blendop_params = ?7, blendop_version = ?8, multi_priority = ?9, multi_name = ?10, module = ?3, enabled = ?4 "
-                                    "where imgid = ?5 and num = ?6", -1, &stmt_upd_hist, NULL);
-        for(int i=0; i<cnt; i++)
+        const int modversion = ver->toLong(i);
+        const int enabled = en->toLong(i);
+        const char *operation = op->toString(i).c_str();
+        const char *param_c = param->toString(i).c_str();
+        const int param_c_len = strlen(param_c);
+        const int params_len = param_c_len/2;
+        unsigned char *params = (unsigned char *)malloc(params_len);
+        dt_exif_xmp_decode(param_c, params, param_c_len);
+        // TODO: why this update set?
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_sel_num, 1, img->id);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_sel_num, 2, i);
+        if(sqlite3_step(stmt_sel_num) != SQLITE_ROW)
+        {
+          DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_hist, 1, img->id);
+          DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_hist, 2, i);
+          sqlite3_step (stmt_ins_hist);
+          sqlite3_reset(stmt_ins_hist);
+          sqlite3_clear_bindings(stmt_ins_hist);
+        }
+
+        DT_DEBUG_SQLITE3_BIND_TEXT(stmt_upd_hist, 1, operation, strlen(operation), SQLITE_TRANSIENT);
+        DT_DEBUG_SQLITE3_BIND_BLOB(stmt_upd_hist, 2, params, params_len, SQLITE_TRANSIENT);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 3, modversion);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 4, enabled);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 5, img->id);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 6, i);
+
+        /* check if we got blendop from xmp */
+        unsigned char *blendop_params = NULL;
+        unsigned int blendop_size = 0;
+        if(blendop != xmpData.end() && blendop->size() > 0 && blendop->count () > i && blendop->toString(i).c_str() != NULL)
         {
-          const int modversion = ver->toLong(i);
-          const int enabled = en->toLong(i);
-          const char *operation = op->toString(i).c_str();
-          const char *param_c = param->toString(i).c_str();
-          const int param_c_len = strlen(param_c);
-          const int params_len = param_c_len/2;
-          unsigned char *params = (unsigned char *)malloc(params_len);
-          dt_exif_xmp_decode(param_c, params, param_c_len);
-          // TODO: why this update set?
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_sel_num, 1, img->id);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_sel_num, 2, i);
-          if(sqlite3_step(stmt_sel_num) != SQLITE_ROW)
-          {
-            DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_hist, 1, img->id);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_hist, 2, i);
-            sqlite3_step (stmt_ins_hist);
-            sqlite3_reset(stmt_ins_hist);
-            sqlite3_clear_bindings(stmt_ins_hist);
-          }
-
-          DT_DEBUG_SQLITE3_BIND_TEXT(stmt_upd_hist, 1, operation, strlen(operation), SQLITE_TRANSIENT);
-          DT_DEBUG_SQLITE3_BIND_BLOB(stmt_upd_hist, 2, params, params_len, SQLITE_TRANSIENT);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 3, modversion);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 4, enabled);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 5, img->id);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 6, i);
-
-          /* check if we got blendop from xmp */
-          unsigned char *blendop_params = NULL;
-          unsigned int blendop_size = 0;
-          if(blendop != xmpData.end() && blendop->size() > 0 && blendop->count () > i && blendop->toString(i).c_str() != NULL)
-          {
-            blendop_size = strlen(blendop->toString(i).c_str())/2;
-            blendop_params = (unsigned char *)malloc(blendop_size);
-            dt_exif_xmp_decode(blendop->toString(i).c_str(),blendop_params,strlen(blendop->toString(i).c_str()));
-            DT_DEBUG_SQLITE3_BIND_BLOB(stmt_upd_hist, 7, blendop_params, blendop_size, SQLITE_TRANSIENT);
-          }
-          else
-            sqlite3_bind_null(stmt_upd_hist, 7);
-
-          /* check if we got blendop_version from xmp; if not assume 1 as default */
-          int blversion = 1;
-          if(blendop_version != xmpData.end() && blendop_version->count() > i)
-          {
-            blversion = blendop_version->toLong(i);
-          }
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 8, blversion);
-
-          /* multi instances */
-          int mprio = 0;
-          if (multi_priority != xmpData.end() && multi_priority->count() > i)  mprio = multi_priority->toLong(i);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 9, mprio);
-          if(multi_name != xmpData.end() && multi_name->size() > 0 &&
-             multi_name->count() > i && multi_name->toString(i).c_str() != NULL)
-          {
-            const char *mname = multi_name->toString(i).c_str();
-            DT_DEBUG_SQLITE3_BIND_TEXT(stmt_upd_hist, 10, mname, strlen(mname), SQLITE_TRANSIENT);
-          }
-          else
-          {
-            const char *mname = "0";
-            DT_DEBUG_SQLITE3_BIND_TEXT(stmt_upd_hist, 10, mname, strlen(mname), SQLITE_TRANSIENT);
-          }
-
-
-          sqlite3_step (stmt_upd_hist);
-          free(params);
-          free(blendop_params);
-
-          sqlite3_reset(stmt_sel_num);
-          sqlite3_clear_bindings(stmt_sel_num);
-          sqlite3_reset(stmt_upd_hist);
-          sqlite3_clear_bindings(stmt_upd_hist);
+          blendop_size = strlen(blendop->toString(i).c_str())/2;
+          blendop_params = (unsigned char *)malloc(blendop_size);
+          dt_exif_xmp_decode(blendop->toString(i).c_str(),blendop_params,strlen(blendop->toString(i).c_str()));
+          DT_DEBUG_SQLITE3_BIND_BLOB(stmt_upd_hist, 7, blendop_params, blendop_size, SQLITE_TRANSIENT);
+        }
+        else
+          sqlite3_bind_null(stmt_upd_hist, 7);
 
+        /* check if we got blendop_version from xmp; if not assume 1 as default */
+        int blversion = 1;
+        if(blendop_version != xmpData.end() && blendop_version->count() > i)
+        {
+          blversion = blendop_version->toLong(i);
         }
-        sqlite3_finalize(stmt_sel_num);
-        sqlite3_finalize(stmt_ins_hist);
-        sqlite3_finalize(stmt_upd_hist);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 8, blversion);
+
+        /* multi instances */
+        int mprio = 0;
+        if (multi_priority != xmpData.end() && multi_priority->count() > i)  mprio = multi_priority->toLong(i);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt_upd_hist, 9, mprio);
+        if(multi_name != xmpData.end() && multi_name->size() > 0 &&
+           multi_name->count() > i && multi_name->toString(i).c_str() != NULL)
+        {
+          const char *mname = multi_name->toString(i).c_str();
+          DT_DEBUG_SQLITE3_BIND_TEXT(stmt_upd_hist, 10, mname, strlen(mname), SQLITE_TRANSIENT);
+        }
+        else
+        {
+          const char *mname = "0";
+          DT_DEBUG_SQLITE3_BIND_TEXT(stmt_upd_hist, 10, mname, strlen(mname), SQLITE_TRANSIENT);
+        }
+
+
+        sqlite3_step (stmt_upd_hist);
+        free(params);
+        free(blendop_params);
+
+        sqlite3_reset(stmt_sel_num);
+        sqlite3_clear_bindings(stmt_sel_num);
+        sqlite3_reset(stmt_upd_hist);
+        sqlite3_clear_bindings(stmt_upd_hist);
+
       }
+      sqlite3_finalize(stmt_sel_num);
+      sqlite3_finalize(stmt_ins_hist);
+      sqlite3_finalize(stmt_upd_hist);
     }
   }
+}
+
+// need a write lock on *img (non-const) to write stars (and soon color labels).
+int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_only)
+{
+  try
+  {
+    // read xmp sidecar
+    Exiv2::Image::AutoPtr image;
+    image = Exiv2::ImageFactory::open(filename);
+    assert(image.get() != 0);
+    image->readMetadata();
+    _exif_xmp_apply(img, image->xmpData(), history_only);
+  }
   catch (Exiv2::AnyError& e)
   {
     // actually nobody's interested in that if the file doesn't exist:
@@ -1417,6 +1375,85 @@ int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_o
   return 0;
 }
 
+struct dt_exif_prefetch_t
+{
+  bool have_image;
+  Exiv2::ExifData exifData;
+  Exiv2::IptcData iptcData;
+  Exiv2::XmpData xmpData;
+  bool have_sidecar;
+  Exiv2::XmpData sidecarData;
+};
+
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path, const char *xmp_path)
+{
+  dt_exif_prefetch_t *p = new dt_exif_prefetch_t;
+  p->have_image = p->have_sidecar = false;
+  try
+  {
+    Exiv2::Image::AutoPtr image;
+    image = Exiv2::ImageFactory::open(path);
+    assert(image.get() != 0);
+    image->readMetadata();
+    p->exifData = image->exifData();
+    p->iptcData = image->iptcData();
+    p->xmpData = image->xmpData();
+    p->have_image = true;
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << path << ": " << s << std::endl;
+  }
+  if(xmp_path) try
+  {
+    Exiv2::Image::AutoPtr sidecar;
+    sidecar = Exiv2::ImageFactory::open(xmp_path);
+    assert(sidecar.get() != 0);
+    sidecar->readMetadata();
+    p->sidecarData = sidecar->xmpData();
+    p->have_sidecar = true;
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    // no sidecar is the common case on import, stay quiet.
+  }
+  return p;
+}
+
+int dt_exif_read_prefetched(dt_image_t *img, dt_exif_prefetch_t *p)
+{
+  if(!p->have_image) return 1;
+  try
+  {
+    return _exif_read_metadata(img, p->exifData, p->iptcData, p->xmpData)?0:1;
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << s << std::endl;
+    return 1;
+  }
+}
+
+int dt_exif_xmp_read_prefetched(dt_image_t *img, dt_exif_prefetch_t *p, const int history_only)
+{
+  if(!p->have_sidecar) return 0;
+  try
+  {
+    _exif_xmp_apply(img, p->sidecarData, history_only);
+  }
+  catch (Exiv2::AnyError& e)
+  {
+  }
+  return 0;
+}
+
+void dt_exif_prefetch_free(dt_exif_prefetch_t *p)
+{
+  delete p;
+}
+
 // helper to create an xmp data thing. throws exiv2 exceptions if stuff goes wrong.
 static void
 dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
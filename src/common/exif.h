@@ -48,6 +48,20 @@ extern "C"
   /** read xmp sidecar file. */
   int dt_exif_xmp_read (dt_image_t * img, const char* filename, const int history_only);
 
+  /** metadata of an image and its sidecar, parsed ahead of time without touching the database. */
+  typedef struct dt_exif_prefetch_t dt_exif_prefetch_t;
+
+  /** parse the metadata of the image at path and of the sidecar at xmp_path (may be NULL). thread safe, never returns NULL. */
+  dt_exif_prefetch_t *dt_exif_prefetch(const char *path, const char *xmp_path);
+
+  /** same as dt_exif_read(), but from prefetched data. */
+  int dt_exif_read_prefetched(dt_image_t *img, dt_exif_prefetch_t *p);
+
+  /** same as dt_exif_xmp_read(), but from prefetched data. */
+  int dt_exif_xmp_read_prefetched(dt_image_t *img, dt_exif_prefetch_t *p, const int history_only);
+
+  void dt_exif_prefetch_free(dt_exif_prefetch_t *p);
+
   /** thread safe init and cleanup. */
   void dt_exif_init();
   void dt_exif_cleanup();
@@ -21,10 +21,12 @@
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "common/film.h"
+#include "common/tags.h"
 #include "common/dtpthread.h"
 #include "common/collection.h"
 #include "common/image_cache.h"
 #include "common/debug.h"
+#include "common/exif.h"
 #include "views/view.h"
 
 #include <stdio.h>
@@ -410,6 +412,83 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return g_strcmp0(g_path_get_basename(a), g_path_get_basename(b));
 }
 
+/* the import is split into a pool of parsers and a single writer: parsing exif and
+   sidecars is independent per file and dominated by disk latency, while all database
+   work has to go through one connection and is much cheaper when batched. */
+
+/* how many files the parsers may run ahead of the writer, bounds the memory held by parsed metadata */
+#define DT_FILM_IMPORT_WINDOW 64
+/* rows inserted per database transaction */
+#define DT_FILM_IMPORT_BATCH 32
+
+typedef struct _film_import_queue_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;        // signalled when a file was parsed or the writer moved on
+  gchar **files;
+  dt_exif_prefetch_t **meta;  // parsed metadata, NULL until the parser is done with the file
+  uint32_t total;
+  uint32_t next;              // next file to be handed to a parser
+  uint32_t written;           // files already consumed by the writer
+  int parsers;                // parser threads started, the writer parses on its own if there are none
+}
+_film_import_queue_t;
+
+static dt_exif_prefetch_t *_film_import_parse(const gchar *filename)
+{
+  /* a new image has version 0, which means its sidecar is just filename.xmp */
+  gchar *xmp = g_strconcat(filename, ".xmp", NULL);
+  dt_exif_prefetch_t *meta = dt_exif_prefetch(filename, xmp);
+  g_free(xmp);
+  return meta;
+}
+
+static void *_film_import_parser(void *arg)
+{
+  _film_import_queue_t *q = (_film_import_queue_t *)arg;
+  dt_pthread_mutex_lock(&q->lock);
+  while(q->next < q->total)
+  {
+    /* backpressure: don't hold more than the window of parsed files in memory */
+    if(q->next >= q->written + DT_FILM_IMPORT_WINDOW)
+    {
+      dt_pthread_cond_wait(&q->cond, &q->lock);
+      continue;
+    }
+    const uint32_t i = q->next++;
+    dt_pthread_mutex_unlock(&q->lock);
+
+    dt_exif_prefetch_t *meta = _film_import_parse(q->files[i]);
+
+    dt_pthread_mutex_lock(&q->lock);
+    q->meta[i] = meta;
+    pthread_cond_broadcast(&q->cond);
+  }
+  dt_pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+static int _film_same_dir(const gchar *filename, const gchar *dirname)
+{
+  gchar *dn = g_path_get_dirname(filename);
+  const int same = !g_strcmp0(dn, dirname);
+  g_free(dn);
+  return same;
+}
+
+static dt_exif_prefetch_t *_film_import_wait(_film_import_queue_t *q, const uint32_t i)
+{
+  if(!q->parsers) return _film_import_parse(q->files[i]);
+  dt_pthread_mutex_lock(&q->lock);
+  while(!q->meta[i]) dt_pthread_cond_wait(&q->cond, &q->lock);
+  dt_exif_prefetch_t *meta = q->meta[i];
+  q->meta[i] = NULL;
+  q->written = i + 1;
+  pthread_cond_broadcast(&q->cond);
+  dt_pthread_mutex_unlock(&q->lock);
+  return meta;
+}
+
 void dt_film_import1(dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -434,17 +513,35 @@ void dt_film_import1(dt_film_t *film)
              ngettext("importing %d image","importing %d images", total), total);
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
 
+  /* start the parsers, they work through the sorted list in order */
+  _film_import_queue_t q;
+  dt_pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.cond, NULL);
+  q.total = total;
+  q.next = q.written = 0;
+  q.files = (gchar **)g_malloc(sizeof(gchar *) * total);
+  q.meta = (dt_exif_prefetch_t **)g_malloc0(sizeof(dt_exif_prefetch_t *) * total);
+  uint32_t k = 0;
+  for(GList *l = images; l; l = g_list_next(l)) q.files[k++] = (gchar *)l->data;
+  const int max_parsers = MAX(1, MIN(dt_get_num_threads(), (int)total));
+  pthread_t *parsers = (pthread_t *)g_malloc(sizeof(pthread_t) * max_parsers);
+  int num_parsers = 0;
+  for(int t = 0; t < max_parsers; t++)
+    if(!pthread_create(&parsers[num_parsers], NULL, _film_import_parser, &q)) num_parsers++;
+  if(num_parsers < max_parsers)
+    fprintf(stderr, "[film_import] could only start %d of %d parser threads\n", num_parsers, max_parsers);
+  q.parsers = num_parsers;
+
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+  dt_exif_prefetch_t *batch[DT_FILM_IMPORT_BATCH];
+  for(uint32_t i = 0; i < total;)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+    gchar *cdn = g_path_get_dirname(q.files[i]);
 
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
     {
-
 #if GLIB_CHECK_VERSION (2, 26, 0)
       if(cfr && cfr->dir)
       {
@@ -480,14 +577,38 @@ void dt_film_import1(dt_film_t *film)
       dt_film_new(cfr, cdn);
     }
 
-    /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
-
-    fraction+=1.0/total;
+    /* the batch is the next few images of the same film roll. wait for all of them to be
+       parsed before the transaction is opened, the connection is shared with other threads. */
+    uint32_t num = 0;
+    do
+    {
+      batch[num] = _film_import_wait(&q, i + num);
+      num++;
+    }
+    while(num < DT_FILM_IMPORT_BATCH && i + num < total && _film_same_dir(q.files[i + num], cdn));
+    g_free(cdn);
+
+    /* import images */
+    dt_database_begin(darktable.db);
+    for(uint32_t j = 0; j < num; j++)
+      dt_image_import_prefetched(cfr->id, q.files[i + j], FALSE, batch[j]);
+    dt_database_commit(darktable.db);
+    for(uint32_t j = 0; j < num; j++)
+      dt_exif_prefetch_free(batch[j]);
+
+    i += num;
+    fraction += (double)num/total;
     dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
-
   }
-  while( (image = g_list_next(image)) != NULL);
+
+  for(int t = 0; t < num_parsers; t++)
+    pthread_join(parsers[t], NULL);
+  g_free(parsers);
+  pthread_cond_destroy(&q.cond);
+  dt_pthread_mutex_destroy(&q.lock);
+  g_free(q.meta);
+  g_free(q.files);
+  g_list_free_full(images, g_free);
 
   // only redraw at the end, to not spam the cpu with exposure events
   dt_control_queue_redraw_center();
@@ -559,15 +680,7 @@ int dt_film_is_empty(const int id)
 void dt_film_remove(const int id)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = count - 1 where "
-                              "(id2 in (select tagid from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1))) or (id1 in "
-                              "(select tagid from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1)))", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_tag_count_film(id, -1);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "delete from tagged_images where imgid in "
                               "(select id from images where film_id = ?1)", -1, &stmt, NULL);
@@ -624,6 +737,7 @@ void dt_film_remove(const int id)
   sqlite3_finalize(stmt);
   // dt_control_update_recent_films();
   dt_control_signal_raise(darktable.signals , DT_SIGNAL_FILMROLLS_CHANGED);
+  dt_collection_invalidate();
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
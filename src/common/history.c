@@ -17,6 +17,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/collection.h"
 #include "common/darktable.h"
 #include "develop/develop.h"
 #include "control/control.h"
@@ -61,6 +62,7 @@ void dt_history_delete_on_image(int32_t imgid)
 
   /* remove darktable|style|* tags */
   dt_tag_detach_by_string("darktable|style%", imgid);
+  dt_collection_invalidate();
 }
 
 void
@@ -182,6 +184,7 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
 
   dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
 
+  dt_collection_invalidate();
   return 0;
 }
 
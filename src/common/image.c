@@ -25,6 +25,7 @@
 #include "common/imageio.h"
 #include "common/grouping.h"
 #include "common/mipmap_cache.h"
+#include "common/similarity.h"
 #include "common/tags.h"
 #include "control/control.h"
 #include "control/conf.h"
@@ -207,7 +208,7 @@ void dt_image_set_flip(const int32_t imgid, const int32_t orientation)
   sqlite3_finalize(stmt);
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
   // write that through to xmp:
-  dt_image_write_sidecar_file(imgid);
+  dt_image_cache_write_sidecar(darktable.image_cache, imgid);
 }
 
 void dt_image_flip(const int32_t imgid, const int32_t cw)
@@ -297,14 +298,7 @@ int32_t dt_image_duplicate(const int32_t imgid)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "update tagxtag set count = count + 1 where "
-                                "(id1 in (select tagid from tagged_images where imgid = ?1)) or "
-                                "(id2 in (select tagid from tagged_images where imgid = ?1))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_tag_count_image(newid, 1);
     if(darktable.gui && darktable.gui->grouping)
     {
       const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, newid);
@@ -313,6 +307,7 @@ int32_t dt_image_duplicate(const int32_t imgid)
       dt_collection_update_query(darktable.collection);
     }
   }
+  dt_collection_invalidate();
   return newid;
 }
 
@@ -335,14 +330,7 @@ void dt_image_remove(const int32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = count - 1 where "
-                              "(id2 in (select tagid from tagged_images where imgid = ?1)) or "
-                              "(id1 in (select tagid from tagged_images where imgid = ?1))",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_tag_count_image(imgid, -1);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "delete from tagged_images where imgid = ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
@@ -368,8 +356,14 @@ void dt_image_remove(const int32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "delete from similarity_queue where imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
   // also clear all thumbnails in mipmap_cache.
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_collection_invalidate();
 }
 
 int dt_image_altered(const uint32_t imgid)
@@ -388,7 +382,8 @@ int dt_image_altered(const uint32_t imgid)
 }
 
 
-uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
+static uint32_t _image_import_internal(const int32_t film_id, const char *filename,
+                                       gboolean override_ignore_jpegs, dt_exif_prefetch_t *meta)
 {
   if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR))
     return 0;
@@ -474,6 +469,9 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
 
+  // let the indexer compute the similarity features:
+  dt_similarity_image_dirty(id);
+
   // Try to find out if this should be grouped already.
   gchar *basename = g_strdup(imgfname);
   gchar *cc2 = basename + strlen(basename);
@@ -550,13 +548,22 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   img->group_id = group_id;
 
   // read dttags and exif for database queries!
-  (void) dt_exif_read(img, filename);
-  char dtfilename[DT_MAX_PATH_LEN];
-  g_strlcpy(dtfilename, filename, DT_MAX_PATH_LEN);
-  dt_image_path_append_version(id, dtfilename, DT_MAX_PATH_LEN);
-  char *c = dtfilename + strlen(dtfilename);
-  sprintf(c, ".xmp");
-  (void)dt_exif_xmp_read(img, dtfilename, 0);
+  if(meta)
+  {
+    // a freshly inserted image has version 0, so the sidecar the caller parsed is the right one.
+    (void)dt_exif_read_prefetched(img, meta);
+    (void)dt_exif_xmp_read_prefetched(img, meta, 0);
+  }
+  else
+  {
+    (void) dt_exif_read(img, filename);
+    char dtfilename[DT_MAX_PATH_LEN];
+    g_strlcpy(dtfilename, filename, DT_MAX_PATH_LEN);
+    dt_image_path_append_version(id, dtfilename, DT_MAX_PATH_LEN);
+    char *c = dtfilename + strlen(dtfilename);
+    sprintf(c, ".xmp");
+    (void)dt_exif_xmp_read(img, dtfilename, 0);
+  }
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -612,9 +619,21 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   g_free(globbuf);
 
   dt_control_signal_raise(darktable.signals,DT_SIGNAL_IMAGE_IMPORT,id);
+  dt_collection_invalidate();
   return id;
 }
 
+uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
+{
+  return _image_import_internal(film_id, filename, override_ignore_jpegs, NULL);
+}
+
+uint32_t dt_image_import_prefetched(const int32_t film_id, const char *filename,
+                                    gboolean override_ignore_jpegs, dt_exif_prefetch_t *meta)
+{
+  return _image_import_internal(film_id, filename, override_ignore_jpegs, meta);
+}
+
 void dt_image_init(dt_image_t *img)
 {
   img->width = img->height = 0;
@@ -835,14 +854,7 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
         sqlite3_step(stmt);
         sqlite3_finalize(stmt);
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "update tagxtag set count = count + 1 where "
-                                    "(id1 in (select tagid from tagged_images where imgid = ?1)) or "
-                                    "(id2 in (select tagid from tagged_images where imgid = ?1))",
-                                    -1, &stmt, NULL);
-        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newid);
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        dt_tag_count_image(newid, 1);
 
         // write xmp file
         dt_image_write_sidecar_file(newid);
@@ -883,7 +895,7 @@ void dt_image_synch_xmp(const int selected)
 {
   if(selected > 0)
   {
-    dt_image_write_sidecar_file(selected);
+    dt_image_cache_write_sidecar(darktable.image_cache, selected);
   }
   else if(dt_conf_get_bool("write_sidecar_files"))
   {
@@ -893,7 +905,7 @@ void dt_image_synch_xmp(const int selected)
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
+      dt_image_cache_write_sidecar(darktable.image_cache, imgid);
     }
     sqlite3_finalize(stmt);
   }
@@ -135,6 +135,10 @@ void dt_image_path_append_version(int imgid, char *pathname, const int len);
 void dt_image_print_exif(const dt_image_t *img, char *line, int len);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. */
 uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
+/** same as dt_image_import(), with exif and sidecar data already parsed by dt_exif_prefetch(). */
+struct dt_exif_prefetch_t;
+uint32_t dt_image_import_prefetched(const int32_t film_id, const char *filename,
+                                    gboolean override_ignore_jpegs, struct dt_exif_prefetch_t *meta);
 /** removes the given image from the database. */
 void dt_image_remove(const int32_t imgid);
 /** duplicates the given image in the database. */
@@ -17,6 +17,7 @@
 */
 
 #include "common/darktable.h"
+#include "common/collection.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/image.h"
@@ -26,6 +27,233 @@
 
 #include <sqlite3.h>
 
+// a sidecar is written this long after the last request for it, but not later than
+// DT_IMAGE_CACHE_XMP_MAX_DELAY after the first one (all in microseconds):
+#define DT_IMAGE_CACHE_XMP_DELAY      500000
+#define DT_IMAGE_CACHE_XMP_MAX_DELAY 5000000
+
+typedef struct dt_image_cache_xmp_t
+{
+  gint64 first, due;
+}
+dt_image_cache_xmp_t;
+
+// fnv-1a over the properties a collection can filter or sort on, to tell if a write changed any.
+static inline uint64_t
+_image_cache_hash(uint64_t hash, const void *data, const size_t size)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  for(size_t k=0; k<size; k++) hash = (hash ^ bytes[k]) * 0x100000001b3ull;
+  return hash;
+}
+
+static uint64_t
+_image_cache_collection_key(const dt_image_t *img)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = _image_cache_hash(hash, &img->flags, sizeof(img->flags));
+  hash = _image_cache_hash(hash, &img->film_id, sizeof(img->film_id));
+  hash = _image_cache_hash(hash, &img->group_id, sizeof(img->group_id));
+  hash = _image_cache_hash(hash, &img->exif_iso, sizeof(img->exif_iso));
+  hash = _image_cache_hash(hash, &img->exif_aperture, sizeof(img->exif_aperture));
+  hash = _image_cache_hash(hash, img->exif_datetime_taken, strlen(img->exif_datetime_taken));
+  hash = _image_cache_hash(hash, img->exif_maker, strlen(img->exif_maker));
+  hash = _image_cache_hash(hash, img->exif_model, strlen(img->exif_model));
+  hash = _image_cache_hash(hash, img->exif_lens, strlen(img->exif_lens));
+  hash = _image_cache_hash(hash, img->filename, strlen(img->filename));
+  return hash;
+}
+
+// writes the sql row of img, needs write_mutex.
+static void
+_image_cache_update(dt_image_cache_t *cache, const dt_image_t *img)
+{
+  if(!cache->update_stmt)
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "update images set width = ?1, height = ?2, maker = ?3, model = ?4, "
+                                "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
+                                "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
+                                "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
+                                "latitude = ?19, color_matrix = ?20, colorspace = ?21 where id = ?22", -1, &cache->update_stmt, NULL);
+  sqlite3_stmt *stmt = cache->update_stmt;
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->exif_maker, strlen(img->exif_maker), SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, img->exif_model, strlen(img->exif_model), SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, img->exif_lens,  strlen(img->exif_lens),  SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, img->exif_exposure);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, img->exif_aperture);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, img->exif_iso);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, img->exif_focal_length);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, img->exif_focus_distance);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, img->film_id);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 12, img->exif_datetime_taken, strlen(img->exif_datetime_taken), SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 13, img->flags);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 14, img->exif_crop);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 15, img->orientation);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 16, *(uint32_t*)(&img->legacy_flip));
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 17, img->group_id);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 18, img->longitude);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 19, img->latitude);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 20, &img->d65_color_matrix, sizeof(img->d65_color_matrix), SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 21, img->colorspace);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 22, img->id);
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
+  DT_DEBUG_SQLITE3_RESET(stmt);
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
+}
+
+// nesting depth of dt_image_cache_batch_begin() in this thread:
+static __thread int _image_cache_batch = 0;
+
+// writes all deferred rows in one transaction. needs dt_database_begin() and then write_mutex,
+// in that order, the same as everyone else who writes inside a transaction.
+static void
+_image_cache_flush(dt_image_cache_t *cache)
+{
+  if(g_hash_table_size(cache->pending) == 0) return;
+  dt_print(DT_DEBUG_CACHE, "[image_cache] writing %d images\n", g_hash_table_size(cache->pending));
+  GHashTableIter it;
+  gpointer key, value;
+  g_hash_table_iter_init(&it, cache->pending);
+  while(g_hash_table_iter_next(&it, &key, &value))
+    _image_cache_update(cache, (const dt_image_t *)value);
+  g_hash_table_remove_all(cache->pending);
+}
+
+static void
+_image_cache_write_sidecars(dt_image_cache_t *cache, GArray *imgids)
+{
+  if(imgids->len == 0) return;
+  // the sidecar is generated from the database:
+  dt_image_cache_flush(cache);
+  for(int k=0; k<imgids->len; k++)
+    dt_image_write_sidecar_file(g_array_index(imgids, uint32_t, k));
+}
+
+static void*
+_image_cache_xmp_thread(void *data)
+{
+  dt_image_cache_t *cache = (dt_image_cache_t *)data;
+  GArray *due = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  dt_pthread_mutex_lock(&cache->xmp_mutex);
+  while(cache->xmp_running)
+  {
+    // collect what is due, and find out when the next one will be:
+    const gint64 now = g_get_monotonic_time();
+    gint64 next = G_MAXINT64;
+    GHashTableIter it;
+    gpointer key, value;
+    g_hash_table_iter_init(&it, cache->xmp_pending);
+    while(g_hash_table_iter_next(&it, &key, &value))
+    {
+      const dt_image_cache_xmp_t *xmp = (const dt_image_cache_xmp_t *)value;
+      if(xmp->due <= now)
+      {
+        const uint32_t imgid = GPOINTER_TO_INT(key);
+        g_array_append_val(due, imgid);
+        g_hash_table_iter_remove(&it);
+      }
+      else next = MIN(next, xmp->due);
+    }
+
+    if(due->len)
+    {
+      dt_pthread_mutex_unlock(&cache->xmp_mutex);
+      _image_cache_write_sidecars(cache, due);
+      g_array_set_size(due, 0);
+      dt_pthread_mutex_lock(&cache->xmp_mutex);
+    }
+    else if(next == G_MAXINT64)
+    {
+      dt_pthread_cond_wait(&cache->xmp_cond, &cache->xmp_mutex);
+    }
+    else
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      const gint64 wake = ts.tv_nsec/1000 + (next - now);
+      ts.tv_sec  += wake / 1000000;
+      ts.tv_nsec  = (wake % 1000000) * 1000;
+      dt_pthread_cond_timedwait(&cache->xmp_cond, &cache->xmp_mutex, &ts);
+    }
+  }
+  dt_pthread_mutex_unlock(&cache->xmp_mutex);
+  g_array_free(due, TRUE);
+  return NULL;
+}
+
+// the columns _image_cache_load_row() expects:
+#define DT_IMAGE_CACHE_COLUMNS "id, group_id, film_id, width, height, filename, maker, model, lens, exposure, " \
+  "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, raw_parameters, " \
+  "longitude, latitude, color_matrix, colorspace"
+
+// fills img from the current row of stmt, which selected DT_IMAGE_CACHE_COLUMNS.
+static void
+_image_cache_load_row(dt_image_t *img, sqlite3_stmt *stmt)
+{
+  char *str;
+  img->id      = sqlite3_column_int(stmt, 0);
+  img->group_id = sqlite3_column_int(stmt, 1);
+  img->film_id = sqlite3_column_int(stmt, 2);
+  img->width   = sqlite3_column_int(stmt, 3);
+  img->height  = sqlite3_column_int(stmt, 4);
+  img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0] =
+      img->exif_datetime_taken[0] = '\0';
+  str = (char *)sqlite3_column_text(stmt, 5);
+  if(str) g_strlcpy(img->filename,   str, 512);
+  str = (char *)sqlite3_column_text(stmt, 6);
+  if(str) g_strlcpy(img->exif_maker, str, 32);
+  str = (char *)sqlite3_column_text(stmt, 7);
+  if(str) g_strlcpy(img->exif_model, str, 32);
+  str = (char *)sqlite3_column_text(stmt, 8);
+  if(str) g_strlcpy(img->exif_lens,  str, 52);
+  img->exif_exposure = sqlite3_column_double(stmt, 9);
+  img->exif_aperture = sqlite3_column_double(stmt, 10);
+  img->exif_iso = sqlite3_column_double(stmt, 11);
+  img->exif_focal_length = sqlite3_column_double(stmt, 12);
+  str = (char *)sqlite3_column_text(stmt, 13);
+  if(str) g_strlcpy(img->exif_datetime_taken, str, 20);
+  img->flags = sqlite3_column_int(stmt, 14);
+  img->exif_crop = sqlite3_column_double(stmt, 15);
+  img->orientation = sqlite3_column_int(stmt, 16);
+  img->exif_focus_distance = sqlite3_column_double(stmt,17);
+  if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
+  uint32_t tmp = sqlite3_column_int(stmt, 18);
+  memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
+  if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
+    img->longitude = sqlite3_column_double(stmt, 19);
+  else
+    img->longitude = NAN;
+  if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
+    img->latitude = sqlite3_column_double(stmt, 20);
+  else
+    img->latitude = NAN;
+  const void *color_matrix = sqlite3_column_blob(stmt, 21);
+  if(color_matrix)
+    memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
+  else
+    img->d65_color_matrix[0] = NAN;
+  g_free(img->profile);
+  img->profile = NULL;
+  img->profile_size = 0;
+  img->colorspace = sqlite3_column_int(stmt, 22);
+
+  // buffer size?
+  if(img->flags & DT_IMAGE_LDR)
+    img->bpp = 4*sizeof(float);
+  else if(img->flags & DT_IMAGE_HDR)
+  {
+    if(img->flags & DT_IMAGE_RAW)
+      img->bpp = sizeof(float);
+    else
+      img->bpp = 4*sizeof(float);
+  }
+  else // raw
+    img->bpp = sizeof(uint16_t);
+}
+
 int32_t
 dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **buf)
 {
@@ -35,71 +263,38 @@ dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **bu
   *cost = sizeof(dt_image_t);
 
   dt_image_t *img = c->images + slot;
+  *buf = c->images + slot;
+
+  // dt_image_cache_preload() might have fetched it already:
+  dt_pthread_mutex_lock(&c->preload_mutex);
+  const dt_image_t *preloaded = (const dt_image_t *)g_hash_table_lookup(c->preloaded, GINT_TO_POINTER(key));
+  const int found = (preloaded != NULL);
+  if(found)
+  {
+    g_free(img->profile);
+    memcpy(img, preloaded, sizeof(dt_image_t));
+    g_hash_table_remove(c->preloaded, GINT_TO_POINTER(key));
+  }
+  dt_pthread_mutex_unlock(&c->preload_mutex);
+  if(found) return 0;
+
+  // changes of a running batch might not have made it to the db yet. this runs under the
+  // cache bucket lock, so don't wait for the transaction here, just write out this one row:
+  dt_pthread_mutex_lock(&c->write_mutex);
+  const dt_image_t *pending = (const dt_image_t *)g_hash_table_lookup(c->pending, GINT_TO_POINTER(key));
+  if(pending)
+  {
+    _image_cache_update(c, pending);
+    g_hash_table_remove(c->pending, GINT_TO_POINTER(key));
+  }
+  dt_pthread_mutex_unlock(&c->write_mutex);
   // load stuff from db and store in cache:
-  char *str;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id, group_id, film_id, width, height, filename, maker, model, lens, exposure, aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, raw_parameters, longitude, latitude, color_matrix, colorspace from images where id = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select " DT_IMAGE_CACHE_COLUMNS " from images where id = ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    img->id      = sqlite3_column_int(stmt, 0);
-    img->group_id = sqlite3_column_int(stmt, 1);
-    img->film_id = sqlite3_column_int(stmt, 2);
-    img->width   = sqlite3_column_int(stmt, 3);
-    img->height  = sqlite3_column_int(stmt, 4);
-    img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0] =
-        img->exif_datetime_taken[0] = '\0';
-    str = (char *)sqlite3_column_text(stmt, 5);
-    if(str) g_strlcpy(img->filename,   str, 512);
-    str = (char *)sqlite3_column_text(stmt, 6);
-    if(str) g_strlcpy(img->exif_maker, str, 32);
-    str = (char *)sqlite3_column_text(stmt, 7);
-    if(str) g_strlcpy(img->exif_model, str, 32);
-    str = (char *)sqlite3_column_text(stmt, 8);
-    if(str) g_strlcpy(img->exif_lens,  str, 52);
-    img->exif_exposure = sqlite3_column_double(stmt, 9);
-    img->exif_aperture = sqlite3_column_double(stmt, 10);
-    img->exif_iso = sqlite3_column_double(stmt, 11);
-    img->exif_focal_length = sqlite3_column_double(stmt, 12);
-    str = (char *)sqlite3_column_text(stmt, 13);
-    if(str) g_strlcpy(img->exif_datetime_taken, str, 20);
-    img->flags = sqlite3_column_int(stmt, 14);
-    img->exif_crop = sqlite3_column_double(stmt, 15);
-    img->orientation = sqlite3_column_int(stmt, 16);
-    img->exif_focus_distance = sqlite3_column_double(stmt,17);
-    if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
-    uint32_t tmp = sqlite3_column_int(stmt, 18);
-    memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
-    if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
-      img->longitude = sqlite3_column_double(stmt, 19);
-    else
-      img->longitude = NAN;
-    if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
-      img->latitude = sqlite3_column_double(stmt, 20);
-    else
-      img->latitude = NAN;
-    const void *color_matrix = sqlite3_column_blob(stmt, 21);
-    if(color_matrix)
-      memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
-    else
-      img->d65_color_matrix[0] = NAN;
-    g_free(img->profile);
-    img->profile = NULL;
-    img->profile_size = 0;
-    img->colorspace = sqlite3_column_int(stmt, 22);
-
-    // buffer size?
-    if(img->flags & DT_IMAGE_LDR)
-      img->bpp = 4*sizeof(float);
-    else if(img->flags & DT_IMAGE_HDR)
-    {
-      if(img->flags & DT_IMAGE_RAW)
-        img->bpp = sizeof(float);
-      else
-        img->bpp = 4*sizeof(float);
-    }
-    else // raw
-      img->bpp = sizeof(uint16_t);
+    _image_cache_load_row(img, stmt);
   }
   else
   {
@@ -108,7 +303,6 @@ dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **bu
   }
   sqlite3_finalize(stmt);
 
-  *buf = c->images + slot;
   return 0; // no write lock required, we inited it all right here.
 }
 
@@ -148,6 +342,7 @@ dt_image_cache_init(dt_image_cache_t *cache)
   num = dt_cache_capacity(&cache->cache);
   cache->images = dt_alloc_align(64, sizeof(dt_image_t)*num);
   memset(cache->images, 0, sizeof(dt_image_t)*num);
+  cache->collection_key = (uint64_t *)calloc(num, sizeof(uint64_t));
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
   // initialize first image as empty data:
   dt_image_init(cache->images);
@@ -156,13 +351,56 @@ dt_image_cache_init(dt_image_cache_t *cache)
     // optimized initialization (avoid accessing conf):
     memcpy(cache->images + k, cache->images, sizeof(dt_image_t));
   }
+
+  dt_pthread_mutex_init(&cache->write_mutex, NULL);
+  cache->update_stmt = NULL;
+  cache->pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+  dt_pthread_mutex_init(&cache->preload_mutex, NULL);
+  cache->preloaded = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+  dt_pthread_mutex_init(&cache->xmp_mutex, NULL);
+  pthread_cond_init(&cache->xmp_cond, NULL);
+  cache->xmp_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  cache->xmp_running = 1;
+  pthread_create(&cache->xmp_thread, NULL, &_image_cache_xmp_thread, cache);
 }
 
 void
 dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
+  // stop the sidecar writer and write what it didn't get to yet:
+  dt_pthread_mutex_lock(&cache->xmp_mutex);
+  cache->xmp_running = 0;
+  pthread_cond_signal(&cache->xmp_cond);
+  dt_pthread_mutex_unlock(&cache->xmp_mutex);
+  pthread_join(cache->xmp_thread, NULL);
+
+  GArray *left = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  GHashTableIter it;
+  gpointer key;
+  g_hash_table_iter_init(&it, cache->xmp_pending);
+  while(g_hash_table_iter_next(&it, &key, NULL))
+  {
+    const uint32_t imgid = GPOINTER_TO_INT(key);
+    g_array_append_val(left, imgid);
+  }
+  _image_cache_write_sidecars(cache, left);
+  g_array_free(left, TRUE);
+  dt_image_cache_flush(cache);
+
+  g_hash_table_destroy(cache->xmp_pending);
+  pthread_cond_destroy(&cache->xmp_cond);
+  dt_pthread_mutex_destroy(&cache->xmp_mutex);
+  g_hash_table_destroy(cache->preloaded);
+  dt_pthread_mutex_destroy(&cache->preload_mutex);
+  g_hash_table_destroy(cache->pending);
+  if(cache->update_stmt) sqlite3_finalize(cache->update_stmt);
+  dt_pthread_mutex_destroy(&cache->write_mutex);
+
   dt_cache_cleanup(&cache->cache);
   free(cache->images);
+  free(cache->collection_key);
 }
 
 void dt_image_cache_print(dt_image_cache_t *cache)
@@ -172,6 +410,67 @@ void dt_image_cache_print(dt_image_cache_t *cache)
          (float)cache->cache.cost/(float)cache->cache.cost_quota);
 }
 
+void
+dt_image_cache_preload(
+  dt_image_cache_t *cache,
+  const int32_t *imgids,
+  const int num)
+{
+  // only fetch what isn't there yet, as literal list, the number of ids isn't bounded:
+  GString *query = g_string_new("select " DT_IMAGE_CACHE_COLUMNS " from images where id in (");
+  int missing = 0;
+  for(int k=0; k<num; k++)
+  {
+    if(imgids[k] <= 0 || dt_cache_contains(&cache->cache, imgids[k])) continue;
+    g_string_append_printf(query, missing++ ? ",%d" : "%d", imgids[k]);
+  }
+  g_string_append(query, ")");
+  if(missing == 0)
+  {
+    g_string_free(query, TRUE);
+    return;
+  }
+
+  // the rows have to be up to date:
+  dt_image_cache_flush(cache);
+
+  // an initialized struct to start every image from, like the cache lines are:
+  dt_image_t empty;
+  dt_image_init(&empty);
+
+  GArray *loaded = g_array_sized_new(FALSE, FALSE, sizeof(int32_t), missing);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query->str, -1, &stmt, NULL);
+  dt_pthread_mutex_lock(&cache->preload_mutex);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+    memcpy(img, &empty, sizeof(dt_image_t));
+    _image_cache_load_row(img, stmt);
+    g_hash_table_insert(cache->preloaded, GINT_TO_POINTER(img->id), img);
+    g_array_append_val(loaded, img->id);
+  }
+  dt_pthread_mutex_unlock(&cache->preload_mutex);
+  sqlite3_finalize(stmt);
+  g_string_free(query, TRUE);
+  dt_print(DT_DEBUG_CACHE, "[image_cache] preloaded %d of %d images\n", loaded->len, num);
+
+  // now pull them into the cache, the allocate callback picks them up without a query:
+  for(int k=0; k<loaded->len; k++)
+  {
+    const int32_t imgid = g_array_index(loaded, int32_t, k);
+    const dt_image_t *img = dt_image_cache_read_get(cache, imgid);
+    dt_image_cache_read_release(cache, img);
+  }
+
+  // drop what got loaded some other way meanwhile:
+  dt_pthread_mutex_lock(&cache->preload_mutex);
+  for(int k=0; k<loaded->len; k++)
+    g_hash_table_remove(cache->preloaded, GINT_TO_POINTER(g_array_index(loaded, int32_t, k)));
+  dt_pthread_mutex_unlock(&cache->preload_mutex);
+  g_array_free(loaded, TRUE);
+}
+
 const dt_image_t*
 dt_image_cache_read_get(
   dt_image_cache_t *cache,
@@ -211,13 +510,15 @@ dt_image_cache_write_get(
 {
   if(!img) return NULL;
   // just force the dt_image_t struct to make sure it has been locked for reading before.
-  return (dt_image_t *)dt_cache_write_get(&cache->cache, img->id);
+  dt_image_t *wimg = (dt_image_t *)dt_cache_write_get(&cache->cache, img->id);
+  if(wimg) cache->collection_key[wimg - cache->images] = _image_cache_collection_key(wimg);
+  return wimg;
 }
 
 
 // drops the write priviledges on an image struct.
-// this triggers a write-through to sql, and if the setting
-// is present, also to xmp sidecar files (safe setting).
+// this triggers a write-through to sql, deferred to the end of a batch,
+// and if the setting is present, also queues the xmp sidecar file (safe setting).
 void
 dt_image_cache_write_release(
   dt_image_cache_t *cache,
@@ -225,49 +526,84 @@ dt_image_cache_write_release(
   dt_image_cache_write_mode_t mode)
 {
   if(img->id <= 0) return;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update images set width = ?1, height = ?2, maker = ?3, model = ?4, "
-                              "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
-                              "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
-                              "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
-                              "latitude = ?19, color_matrix = ?20, colorspace = ?21 where id = ?22", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->exif_maker, strlen(img->exif_maker), SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, img->exif_model, strlen(img->exif_model), SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, img->exif_lens,  strlen(img->exif_lens),  SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, img->exif_exposure);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, img->exif_aperture);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, img->exif_iso);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, img->exif_focal_length);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, img->exif_focus_distance);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, img->film_id);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 12, img->exif_datetime_taken, strlen(img->exif_datetime_taken), SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 13, img->flags);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 14, img->exif_crop);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 15, img->orientation);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 16, *(uint32_t*)(&img->legacy_flip));
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 17, img->group_id);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 18, img->longitude);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 19, img->latitude);
-  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 20, &img->d65_color_matrix, sizeof(img->d65_color_matrix), SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 21, img->colorspace);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 22, img->id);
-  int rc = sqlite3_step(stmt);
-  if (rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  if(_image_cache_batch > 0)
+  {
+    // keep a copy, the cache line might be reused before the batch ends:
+    dt_image_t *copy = (dt_image_t *)g_hash_table_lookup(cache->pending, GINT_TO_POINTER(img->id));
+    if(!copy)
+    {
+      copy = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+      g_hash_table_insert(cache->pending, GINT_TO_POINTER(img->id), copy);
+    }
+    memcpy(copy, img, sizeof(dt_image_t));
+  }
+  else
+  {
+    // a batch of another thread may still hold an older copy, which must not overwrite this:
+    g_hash_table_remove(cache->pending, GINT_TO_POINTER(img->id));
+    _image_cache_update(cache, img);
+  }
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+
+  // rating, time taken and such might move the image in or out of the collection:
+  if(cache->collection_key[img - cache->images] != _image_cache_collection_key(img))
+    dt_collection_invalidate();
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
     // rest about sidecars:
     // also synch dttags file:
-    dt_image_write_sidecar_file(img->id);
+    dt_image_cache_write_sidecar(cache, img->id);
   }
   dt_cache_write_release(&cache->cache, img->id);
 }
 
+void
+dt_image_cache_batch_begin(dt_image_cache_t *cache)
+{
+  _image_cache_batch++;
+}
+
+void
+dt_image_cache_batch_end(dt_image_cache_t *cache)
+{
+  if(--_image_cache_batch > 0) return;
+  dt_image_cache_flush(cache);
+}
+
+void
+dt_image_cache_flush(dt_image_cache_t *cache)
+{
+  dt_database_begin(darktable.db);
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  _image_cache_flush(cache);
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+  dt_database_commit(darktable.db);
+}
+
+void
+dt_image_cache_write_sidecar(
+  dt_image_cache_t *cache,
+  const uint32_t imgid)
+{
+  if(imgid <= 0) return;
+  const gint64 now = g_get_monotonic_time();
+  dt_pthread_mutex_lock(&cache->xmp_mutex);
+  dt_image_cache_xmp_t *xmp = (dt_image_cache_xmp_t *)g_hash_table_lookup(cache->xmp_pending, GINT_TO_POINTER(imgid));
+  if(!xmp)
+  {
+    xmp = (dt_image_cache_xmp_t *)g_malloc(sizeof(dt_image_cache_xmp_t));
+    xmp->first = now;
+    g_hash_table_insert(cache->xmp_pending, GINT_TO_POINTER(imgid), xmp);
+    pthread_cond_signal(&cache->xmp_cond);
+  }
+  // push it out a bit further while the image keeps changing:
+  xmp->due = MIN(now + DT_IMAGE_CACHE_XMP_DELAY, xmp->first + DT_IMAGE_CACHE_XMP_MAX_DELAY);
+  dt_pthread_mutex_unlock(&cache->xmp_mutex);
+}
+
 
 // remove the image from the cache
 void
@@ -275,6 +611,14 @@ dt_image_cache_remove(
   dt_image_cache_t *cache,
   const uint32_t imgid)
 {
+  // nothing left to write for this one:
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  g_hash_table_remove(cache->pending, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+  dt_pthread_mutex_lock(&cache->xmp_mutex);
+  g_hash_table_remove(cache->xmp_pending, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->xmp_mutex);
+
   dt_cache_remove(&cache->cache, imgid);
 }
 
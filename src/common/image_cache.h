@@ -19,13 +19,34 @@
 #define DT_IMAGE_CACHE_H
 
 #include "common/cache.h"
+#include "common/dtpthread.h"
 #include "common/image.h"
 
+#include <sqlite3.h>
+
 typedef struct dt_image_cache_t
 {
   // one fat block of dt_image_t, to assign `dynamic' void* in cache to.
   dt_image_t *images;
   dt_cache_t cache;
+  // hash of what collections filter and sort on, per image, taken at write_get:
+  uint64_t *collection_key;
+
+  // write-behind to the images table, protected by write_mutex:
+  dt_pthread_mutex_t write_mutex;
+  sqlite3_stmt *update_stmt;   // the update of write_release, prepared once
+  GHashTable *pending;         // imgid -> copy of the dt_image_t, written at the end of a batch
+
+  // rows fetched by dt_image_cache_preload(), consumed by the allocate callback:
+  dt_pthread_mutex_t preload_mutex;
+  GHashTable *preloaded;       // imgid -> dt_image_t
+
+  // xmp sidecars are written by a thread of their own, protected by xmp_mutex:
+  dt_pthread_mutex_t xmp_mutex;
+  pthread_cond_t xmp_cond;
+  pthread_t xmp_thread;
+  int xmp_running;
+  GHashTable *xmp_pending;     // imgid -> dt_image_cache_xmp_t, when to write it
 }
 dt_image_cache_t;
 
@@ -56,6 +77,14 @@ dt_image_cache_read_get(
   dt_image_cache_t *cache,
   const uint32_t imgid);
 
+// loads all of the given images that aren't cached yet with one query, instead
+// of one per image as read_get would. call it before walking a list of images.
+void
+dt_image_cache_preload(
+  dt_image_cache_t *cache,
+  const int32_t *imgids,
+  const int num);
+
 // same as read_get, but doesn't block and returns NULL if the image
 // is currently unavailable.
 const dt_image_t*
@@ -78,14 +107,33 @@ dt_image_cache_write_get(
   const dt_image_t *img);
 
 // drops the write priviledges on an image struct.
-// thtis triggers a write-through to sql, and if the setting
-// is present, also to xmp sidecar files (safe setting).
+// this triggers a write-through to sql (deferred to the end of a batch, see
+// below), and if the setting is present, also queues the xmp sidecar file to
+// be written in the background (safe setting).
 void
 dt_image_cache_write_release(
   dt_image_cache_t *cache,
   dt_image_t *img,
   dt_image_cache_write_mode_t mode);
 
+// brackets a loop of write_get/write_release over many images. in between, the
+// changes only go to the cache, and are written to sql in one transaction by the
+// outermost batch_end. an image written several times is only updated once.
+// batches nest and belong to the calling thread, the writes of other threads go
+// straight through. don't query the images table for the changes before the end.
+void dt_image_cache_batch_begin(dt_image_cache_t *cache);
+void dt_image_cache_batch_end(dt_image_cache_t *cache);
+
+// writes all pending changes to sql right away.
+void dt_image_cache_flush(dt_image_cache_t *cache);
+
+// queues writing the xmp sidecar of imgid. repeated requests for the same image
+// within a short time result in one write.
+void
+dt_image_cache_write_sidecar(
+  dt_image_cache_t *cache,
+  const uint32_t imgid);
+
 // remove the image from the cache
 void
 dt_image_cache_remove(
@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "common/image_compression.h"
+#include "common/darktable.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,33 +32,34 @@ dt_image_float_int_t;
 
 void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height)
 {
-  dt_image_float_int_t L[16];
-  float chrom[4][3];
   const float fac[3] = {4., 2., 4.};
-  uint16_t L16[16];
-  int32_t n_zeroes, Lbias;
-  uint8_t r[4], b[4];
-  const uint8_t *block = in;
+  const int32_t blocks_per_row = (width + 3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, out) firstprivate(width, height, blocks_per_row, fac) schedule(static)
+#endif
   for(int j=0; j<height; j+=4)
   {
+    const uint8_t *block = in + 16*(size_t)blocks_per_row*(j/4);
     for(int i=0; i<width; i+=4)
     {
       // luma
-      Lbias = (block[0] >> 3) << 10;
-      n_zeroes = block[0] & 0x7;
+      const uint32_t Lbias = (block[0] >> 3) << 10;
+      const int n_zeroes = block[0] & 0x7;
       const int shift = 14-n_zeroes-4+1;
 
+      uint32_t L16[16];
       for(int k=0; k<8; k++)
       {
-        L16[2*k  ] = ((int)(block[1+k]>> 4) << shift) + Lbias;
-        L16[2*k+1] = ((int)(block[1+k]&0xf) << shift) + Lbias;
+        L16[2*k  ] = ((uint32_t)(block[1+k]>> 4) << shift) + Lbias;
+        L16[2*k+1] = ((uint32_t)(block[1+k]&0xf) << shift) + Lbias;
       }
+      // half float to float, without branches so this runs on all 16 at once:
+      dt_image_float_int_t L[16];
       for(int k=0; k<16; k++)
-      {
-        L[k].i  = (((int)(L16[k]) >> 10)-(15-127)) << (23);
-        L[k].i |= (L16[k] & 0x3ff)<<13;
-      }
+        L[k].i = (((L16[k] >> 10)-(15-127)) << 23) | ((L16[k] & 0x3ff) << 13);
+
       // chroma
+      uint8_t r[4], b[4];
       r[0] =                              block[ 9] >> 1;
       b[0] = ((block[ 9] & 0x01) << 6) | (block[10] >> 2);
       r[1] = ((block[10] & 0x03) << 5) | (block[11] >> 3);
@@ -67,15 +69,26 @@ void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, con
       r[3] = ((block[14] & 0x3f) << 1) | (block[15] >> 7);
       b[3] =   block[15] & 0x7f;
 
+      // fac are powers of two, so folding them into the chroma doesn't change the rounding:
+      float chrom[4][3];
       for(int q=0; q<4; q++)
       {
         chrom[q][0] = r[q]*(1./127.);
         chrom[q][2] = b[q]*(1./127.);
         chrom[q][1] = 1. - chrom[q][0] - chrom[q][2];
+        for(int k=0; k<3; k++) chrom[q][k] *= fac[k];
+      }
+      // one row of the block at a time, the two chroma samples of its half are fixed:
+      for(int pj=0; pj<4; pj++)
+      {
+        const float *const c0 = chrom[(pj>>1)<<1], *const c1 = chrom[((pj>>1)<<1)|1];
+        float *const o = out + 3*((size_t)width*(j + pj) + i);
+        for(int pi=0; pi<4; pi++)
+        {
+          const float *const c = pi < 2 ? c0 : c1;
+          for(int k=0; k<3; k++) o[3*pi + k] = L[4*pj + pi].f*c[k];
+        }
       }
-      for(int k=0; k<16; k++)
-        for(int c=0; c<3; c++)
-          out[3*(i + (k & 3) + width*(j + (k>>2))) + c] = L[k].f*fac[c]*chrom[((k>>3)<<1)|((k&3)>>1)][c];
       block += 16*sizeof(uint8_t);
     }
   }
@@ -83,14 +96,36 @@ void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, con
 
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height)
 {
-  dt_image_float_int_t L[16];
-  int16_t Lmin, Lmax, n_zeroes, L16[16];
-  uint8_t *block = out, r[4], b[4];
+  const int32_t blocks_per_row = (width + 3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, out) firstprivate(width, height, blocks_per_row) schedule(static)
+#endif
   for(int j=0; j<height; j+=4)
   {
+    uint8_t *block = out + 16*(size_t)blocks_per_row*(j/4);
     for(int i=0; i<width; i+=4)
     {
-      Lmin = 0x7fff;
+      // luminance of the whole block first, this part is the same for all pixels:
+      dt_image_float_int_t L[16];
+      for(int pj=0; pj<4; pj++)
+      {
+        const float *const px = in + 3*((size_t)width*(j + pj) + i);
+        for(int pi=0; pi<4; pi++)
+          L[4*pj + pi].f = (px[3*pi + 0] + 2*px[3*pi + 1] + px[3*pi + 2])*.25;
+      }
+      int16_t L16[16];
+      for(int k=0; k<16; k++)
+      {
+        int e = ((L[k].i >> (23))-(127-15));
+        e = e > 0 ? e : 0;
+        e = e > 30 ? 30 : e;
+        L16[k] = ((L[k].i>>13)&0x3ff) | (e<<10);
+      }
+      int16_t Lmin = 0x7fff;
+      for(int k=0; k<16; k++) Lmin = Lmin < L16[k] ? Lmin : L16[k];
+
+      // luminance weighted chroma, one sample per 2x2 quadrant:
+      uint8_t r[4], b[4];
       for(int q=0; q<4; q++)
       {
         float chrom[3] = {0,0,0};
@@ -99,16 +134,8 @@ void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const
           for(int pi=0; pi<2; pi++)
           {
             const int io = (pi+((q&1)<<1)), jo = (pj+(q&2));
-            const int ii = i + io, jj = j + jo;
-
-            L[io+4*jo].f = (in[3*(ii+width*jj) + 0] + 2*in[3*(ii+width*jj) +1] + in[3*(ii+width*jj) +2])*.25;
-            for(int k=0; k<3; k++) chrom[k] += L[io+4*jo].f*in[3*(ii+width*jj) + k];
-            L16[io+4*jo]  =  (L[io+4*jo].i>>13)&0x3ff;
-            int e = ((L[io+4*jo].i >> (23))-(127-15));
-            e = e > 0 ? e : 0;
-            e = e > 30 ? 30 : e;
-            L16[io+4*jo] |= e<<10;
-            Lmin = Lmin < L16[io+4*jo] ? Lmin : L16[io+4*jo];
+            const float *const px = in + 3*((size_t)width*(j + jo) + i + io);
+            for(int k=0; k<3; k++) chrom[k] += L[io+4*jo].f*px[k];
           }
         }
         const float norm = 1./(chrom[0] + 2*chrom[1] + chrom[2]);
@@ -118,25 +145,23 @@ void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const
       // store luma
       Lmin &= ~0x3ff;
       block[0] = (Lmin>>10)<<3; // Lbias
-      Lmax = 0;
+      int16_t Lmax = 0;
       for(int k=0; k<16; k++)
       {
         L16[k] -= Lmin;
         Lmax = Lmax > L16[k] ? Lmax : L16[k];
       }
-      n_zeroes = 0;
+      int n_zeroes = 0;
       for(int k=1<<14; (k&Lmax)==0&&n_zeroes<7; k>>=1) n_zeroes++;
       block[0] |= n_zeroes;
       const int shift = 14-n_zeroes-4+1;
       const int off = (1<<shift)>>1;
-      for(int k=0; k<8; k++)
+      for(int k=0; k<16; k++)
       {
-        L16[2*k] = ((int)L16[2*k] + off)>>shift;
-        L16[2*k] = L16[2*k] > 0xf ? 0xf : L16[2*k];
-        L16[2*k+1] = ((int)L16[2*k+1] + off)>>shift;
-        L16[2*k+1] = L16[2*k+1] > 0xf ? 0xf : L16[2*k+1];
-        block[k+1] = L16[2*k+1] | (L16[2*k]<<4);
+        L16[k] = ((int)L16[k] + off)>>shift;
+        L16[k] = L16[k] > 0xf ? 0xf : L16[k];
       }
+      for(int k=0; k<8; k++) block[k+1] = L16[2*k+1] | (L16[2*k]<<4);
       // store chroma
       block[ 9] = (r[0] << 1) | (b[0] >> 6);
       block[10] = (b[0] << 2) | (r[1] >> 5);
@@ -150,6 +175,61 @@ void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const
   }
 }
 
+/** expands the two endpoints of a dxt1 block to the four colours, rounded exactly the way squish does. */
+static inline void _dxt1_palette(const uint8_t *block, uint32_t palette[4])
+{
+  uint8_t codes[16];
+  int value[2];
+  for(int e=0; e<2; e++)
+  {
+    value[e] = block[2*e] | (block[2*e+1] << 8);
+    const int red = (value[e] >> 11) & 0x1f, green = (value[e] >> 5) & 0x3f, blue = value[e] & 0x1f;
+    codes[4*e+0] = (red << 3) | (red >> 2);
+    codes[4*e+1] = (green << 2) | (green >> 4);
+    codes[4*e+2] = (blue << 3) | (blue >> 2);
+    codes[4*e+3] = 255;
+  }
+  // the endpoint order selects between four opaque colours and three plus transparent black:
+  const int four = value[0] > value[1];
+  for(int k=0; k<3; k++)
+  {
+    const int c = codes[k], d = codes[4+k];
+    codes[ 8+k] = four ? (2*c + d)/3 : (c + d)/2;
+    codes[12+k] = four ? (c + 2*d)/3 : 0;
+  }
+  codes[11] = 255;
+  codes[15] = four ? 255 : 0;
+  memcpy(palette, codes, sizeof(codes));
+}
+
+void dt_image_uncompress_dxt1(const uint8_t *in, uint8_t *out, const int32_t width, const int32_t height)
+{
+  const int32_t blocks_per_row = (width + 3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(in, out) firstprivate(width, height, blocks_per_row) schedule(static)
+#endif
+  for(int j=0; j<height; j+=4)
+  {
+    const uint8_t *block = in + 8*(size_t)blocks_per_row*(j/4);
+    const int rows = MIN(4, height - j);
+    for(int i=0; i<width; i+=4)
+    {
+      uint32_t palette[4];
+      _dxt1_palette(block, palette);
+      for(int pj=0; pj<rows; pj++)
+      {
+        // two bits per pixel, the first one in the lowest:
+        const uint32_t idx = block[4+pj];
+        const uint32_t px[4] = { palette[idx & 0x3], palette[(idx >> 2) & 0x3], palette[(idx >> 4) & 0x3], palette[idx >> 6] };
+        uint8_t *const o = out + 4*((size_t)width*(j + pj) + i);
+        if(i + 4 <= width) memcpy(o, px, sizeof(px));
+        else memcpy(o, px, sizeof(uint32_t)*(width - i));
+      }
+      block += 8;
+    }
+  }
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
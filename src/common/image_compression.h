@@ -16,12 +16,17 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #ifndef DT_IMAGE_COMPRESSION
+#define DT_IMAGE_COMPRESSION
 #include <inttypes.h>
 
 /** K. Roimela, T. Aarnio and J. Itäranta. High Dynamic Range Texture Compression. Proceedings of SIGGRAPH 2006. */
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height);
 void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height);
 
+/** decodes 8-bit rgba from the dxt1 blocks written by squish_compress_image(), with the same result as
+ *  squish_decompress_image() but a lot faster. this is what the thumbnail cache reads on every access. */
+void dt_image_uncompress_dxt1(const uint8_t *in, uint8_t *out, const int32_t width, const int32_t height);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
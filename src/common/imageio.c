@@ -45,6 +45,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
+#include "develop/tiling.h"
 #include "iop/colorout.h"
 #include "libraw/libraw.h"
 
@@ -489,6 +490,174 @@ void dt_imageio_to_fractional(float in, uint32_t *num, uint32_t *den)
   }
 }
 
+// the gate of the staged batch export this thread works for, if any:
+static __thread dt_imageio_export_gate_t *_export_gate = NULL;
+
+void dt_imageio_export_gate_init(dt_imageio_export_gate_t *gate, const int32_t pipes)
+{
+  dt_pthread_mutex_init(&gate->lock, NULL);
+  pthread_cond_init(&gate->cond, NULL);
+  gate->free = MAX(1, pipes);
+}
+
+void dt_imageio_export_gate_cleanup(dt_imageio_export_gate_t *gate)
+{
+  pthread_cond_destroy(&gate->cond);
+  dt_pthread_mutex_destroy(&gate->lock);
+}
+
+void dt_imageio_export_set_gate(dt_imageio_export_gate_t *gate)
+{
+  _export_gate = gate;
+}
+
+static void _export_gate_enter(dt_imageio_export_gate_t *gate)
+{
+  if(!gate) return;
+  dt_pthread_mutex_lock(&gate->lock);
+  while(gate->free <= 0) dt_pthread_cond_wait(&gate->cond, &gate->lock);
+  gate->free--;
+  dt_pthread_mutex_unlock(&gate->lock);
+}
+
+static void _export_gate_leave(dt_imageio_export_gate_t *gate)
+{
+  if(!gate) return;
+  dt_pthread_mutex_lock(&gate->lock);
+  gate->free++;
+  pthread_cond_signal(&gate->cond);
+  dt_pthread_mutex_unlock(&gate->lock);
+}
+
+// every stripe may cost this many float buffers of its size in the pipe (module input and output, cache lines, temp):
+#define DT_IMAGEIO_STREAM_BUFFERS 8
+
+// rows of context a stripe needs above and below, so that no neighbourhood filter sees the stripe edges as image
+// borders. most of them declare their reach only in tiling_callback and not in modify_roi_in, and each one widens
+// what the modules before it have to deliver, so the overlaps of all enabled modules are summed up. returns -1 if
+// the pipe can't be streamed at all, because some module needs the whole image at once.
+static int _export_stream_overlap(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const double scale)
+{
+  int overlap = 0;
+  GList *modules = dev->iop;
+  GList *pieces = pipe->nodes;
+  while(modules && pieces)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(piece->enabled)
+    {
+      // computes its statistics over the whole input:
+      if(!strcmp(module->op, "globaltonemap")) return -1;
+      dt_iop_roi_t roi = piece->buf_in;
+      roi.x = roi.y = 0;
+      roi.width  = roi.width *scale + .5f;
+      roi.height = roi.height*scale + .5f;
+      roi.scale = scale;
+      dt_develop_tiling_t tiling = { 0 };
+      module->tiling_callback(module, piece, &roi, &roi, &tiling);
+      overlap += tiling.overlap;
+    }
+    modules = g_list_next(modules);
+    pieces = g_list_next(pieces);
+  }
+  return overlap;
+}
+
+// processes the export in stripes of full rows and hands each one to the format writer before the next one is
+// processed. every stripe is processed with overlap rows of context on both sides, which are cut off again before
+// writing, so the buffers only grow with the stripe and not with the image.
+static int _export_stream(
+  dt_dev_pixelpipe_t         *pipe,
+  dt_develop_t               *dev,
+  dt_imageio_module_format_t *format,
+  dt_imageio_module_data_t   *format_params,
+  const char                 *filename,
+  const uint32_t              imgid,
+  const int32_t               ignore_exif,
+  const int                   sRGB,
+  const int                   processed_width,
+  const int                   processed_height,
+  const double                scale,
+  const int                   bpp,
+  const int                   overlap)
+{
+  const size_t limit = (size_t)dt_conf_get_int("host_memory_limit")*1024*1024;
+  const size_t row_size = 4*sizeof(float)*processed_width;
+  const int64_t fit = (int64_t)(limit / (DT_IMAGEIO_STREAM_BUFFERS*row_size)) - 2*overlap;
+  const int rows = CLAMP(fit, MIN(64, processed_height), processed_height);
+
+  int length = 0;
+  uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
+  if(!ignore_exif)
+  {
+    char pathname[1024];
+    dt_image_full_path(imgid, pathname, 1024);
+    // last param is dng mode, it's false here
+    length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
+
+  format_params->width  = processed_width;
+  format_params->height = processed_height;
+  if(format->write_image_begin(format_params, filename, imgid)) return 1;
+
+  dt_print(DT_DEBUG_DEV, "[export] streaming %dx%d image in stripes of %d rows, overlapping by %d\n",
+           processed_width, processed_height, rows, overlap);
+  dt_times_t start;
+  dt_get_times(&start);
+  int res = 0;
+  for(int y=0; y<processed_height && !res; y+=rows)
+  {
+    const int ht = MIN(rows, processed_height - y);
+    const int y0 = MAX(0, y - overlap);
+    const int y1 = MIN(processed_height, y + ht + overlap);
+    if(bpp == 8)
+      res = dt_dev_pixelpipe_process(pipe, dev, 0, y0, processed_width, y1 - y0, scale);
+    else
+      res = dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y0, processed_width, y1 - y0, scale);
+    if(res) break;
+
+    // skip the context rows, 4 channels of 8 bit or float:
+    const size_t offset = (size_t)4*processed_width*(y - y0);
+    const int pixels = processed_width*ht;
+    uint8_t *rowbuf = NULL;
+    if(bpp == 8)
+    {
+      uint8_t *const buf8 = rowbuf = pipe->backbuf + offset;
+#ifdef _OPENMP
+      #pragma omp parallel for default(none) firstprivate(buf8, pixels) schedule(static)
+#endif
+      // just flip byte order
+      for(int k=0; k<pixels; k++)
+      {
+        uint8_t tmp = buf8[4*k+0];
+        buf8[4*k+0] = buf8[4*k+2];
+        buf8[4*k+2] = tmp;
+      }
+    }
+    else if(bpp == 16)
+    {
+      // uint16_t per color channel, in place
+      float    *buff  = (float *)   pipe->backbuf + offset;
+      uint16_t *buf16 = (uint16_t *)buff;
+      for(int k=0; k<pixels; k++)
+        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
+      rowbuf = (uint8_t *)buf16;
+    }
+    res = format->write_image_rows(format_params, rowbuf, ht);
+  }
+  dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing", NULL);
+
+  const int end = format->write_image_end(format_params, filename, (ignore_exif || res) ? NULL : exif_profile, length);
+  if(res)
+  {
+    // don't leave a truncated file behind
+    g_unlink(filename);
+    return 1;
+  }
+  return end;
+}
+
 int dt_imageio_export(
   const uint32_t              imgid,
   const char                 *filename,
@@ -516,6 +685,10 @@ int dt_imageio_export_with_flags(
   const int32_t               thumbnail_export,
   const char                 *filter)
 {
+  // thumbnails are not part of a batch export, never hold them back:
+  dt_imageio_export_gate_t *gate = thumbnail_export ? NULL : _export_gate;
+  _export_gate_enter(gate);
+
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_mipmap_buffer_t buf;
@@ -530,15 +703,24 @@ int dt_imageio_export_with_flags(
 
   int res = 0;
 
+  // images which would need full size buffers beyond the memory limit are streamed to the file in stripes,
+  // if the format can write them and isn't floating point. the pipe then starts with small cache lines,
+  // which grow to the stripe size as needed.
+  const size_t memory_limit = (size_t)dt_conf_get_int("host_memory_limit")*1024*1024;
+  const size_t full_size = 4*sizeof(float)*(size_t)wd*ht;
+  const int stream = !thumbnail_export && !display_byteorder && format->write_image_begin && memory_limit &&
+                     format->bpp(format_params) <= 16 && DT_IMAGEIO_STREAM_BUFFERS*full_size > memory_limit;
+
   dt_times_t start;
   dt_get_times(&start);
   dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, stream ? MIN(ht, 64) : ht, format->levels(format_params));
   if(!res)
   {
     dt_control_log(_("failed to allocate memory for export, please lower the threads used for export or buy more memory."));
     dt_dev_cleanup(&dev);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    _export_gate_leave(gate);
     return 1;
   }
 
@@ -547,6 +729,7 @@ int dt_imageio_export_with_flags(
     dt_control_log(_("image `%s' is not available!"), img->filename);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
     dt_dev_cleanup(&dev);
+    _export_gate_leave(gate);
     return 1;
   }
 
@@ -563,6 +746,7 @@ int dt_imageio_export_with_flags(
       dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
       dt_dev_cleanup(&dev);
       dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      _export_gate_leave(gate);
       return 1;
     }
 
@@ -654,41 +838,79 @@ int dt_imageio_export_with_flags(
   int processed_height = scale*pipe.processed_height + .5f;
   const int bpp = format->bpp(format_params);
 
+  // the high quality downsampling needs the whole image:
+  const int overlap = (stream && !high_quality_processing) ? _export_stream_overlap(&pipe, &dev, scale) : -1;
+  if(overlap >= 0)
+  {
+    res = _export_stream(&pipe, &dev, format, format_params, filename, imgid, ignore_exif, sRGB,
+                         processed_width, processed_height, scale, bpp, overlap);
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    _export_gate_leave(gate);
+    return res;
+  }
+  // not streamed after all, the pipe needs its full size buffers:
+  if(stream && !dt_dev_pixelpipe_cache_reserve(&pipe.cache, full_size))
+  {
+    dt_control_log(_("failed to allocate memory for export, please lower the threads used for export or buy more memory."));
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    _export_gate_leave(gate);
+    return 1;
+  }
+
   // downsampling done last, if high quality processing was requested:
   uint8_t *outbuf = pipe.backbuf;
   uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
   dt_get_times(&start);
+  int failed = 0;
   if(high_quality_processing)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    failed = dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
     const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe.processed_height, 1.0) : 1.0;
     const double scale = fminf(scalex, scaley);
     processed_width  = scale*pipe.processed_width  + .5f;
     processed_height = scale*pipe.processed_height + .5f;
-    moutbuf = (uint8_t *)dt_alloc_align(64, sizeof(float)*processed_width*processed_height*4);
+    if(!failed) moutbuf = (uint8_t *)dt_alloc_align(64, sizeof(float)*processed_width*processed_height*4);
     outbuf = moutbuf;
-    // now downscale into the new buffer:
-    dt_iop_roi_t roi_in, roi_out;
-    roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
-    roi_in.scale = 1.0;
-    roi_out.scale = scale;
-    roi_in.width = pipe.processed_width;
-    roi_in.height = pipe.processed_height;
-    roi_out.width = processed_width;
-    roi_out.height = processed_height;
-    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    if(outbuf)
+    {
+      // now downscale into the new buffer:
+      dt_iop_roi_t roi_in, roi_out;
+      roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
+      roi_in.scale = 1.0;
+      roi_out.scale = scale;
+      roi_in.width = pipe.processed_width;
+      roi_in.height = pipe.processed_height;
+      roi_out.width = processed_width;
+      roi_out.height = processed_height;
+      dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    }
   }
   else
   {
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
     if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      failed = dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      failed = dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     outbuf = pipe.backbuf;
   }
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
+  if(failed || !outbuf)
+  {
+    // the cache lines couldn't grow as needed:
+    dt_control_log(_("failed to allocate memory for export, please lower the threads used for export or buy more memory."));
+    free(moutbuf);
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    _export_gate_leave(gate);
+    return 1;
+  }
 
   // downconversion to low-precision formats:
   if(bpp == 8 && !display_byteorder)
@@ -740,6 +962,31 @@ int dt_imageio_export_with_flags(
   format_params->width  = processed_width;
   format_params->height = processed_height;
 
+  // staged export: the pixels are done, let the next image have the pipe while we encode.
+  // this needs the output outside of the pipe's cache.
+  int pipe_released = 0;
+  if(gate)
+  {
+    if(!moutbuf)
+    {
+      const size_t size = (size_t)processed_width*processed_height*4*(bpp/8);
+      moutbuf = (uint8_t *)dt_alloc_align(64, size);
+      if(moutbuf)
+      {
+        memcpy(moutbuf, outbuf, size);
+        outbuf = moutbuf;
+      }
+    }
+    if(moutbuf)
+    {
+      dt_dev_pixelpipe_cleanup(&pipe);
+      dt_dev_cleanup(&dev);
+      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      pipe_released = 1;
+    }
+    _export_gate_leave(gate);
+  }
+
   if(!ignore_exif)
   {
     int length;
@@ -756,9 +1003,12 @@ int dt_imageio_export_with_flags(
     res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
   }
 
-  dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
-  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  if(!pipe_released)
+  {
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  }
   free(moutbuf);
   return res;
 }
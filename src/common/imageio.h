@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include "common/image.h"
 #include "common/mipmap_cache.h"
+#include "common/dtpthread.h"
 
 #include <inttypes.h>
 
@@ -72,6 +73,22 @@ dt_imageio_export_with_flags(
   const int32_t                      thumbnail_export,
   const char                        *filter);
 
+/** bounds the number of export pixelpipes running at the same time. a staged batch export
+ *  runs more threads than pipes: once a pipe is done, its thread gives up the pixelpipe,
+ *  the input buffer and its gate slot, and encodes and stores while the next image is processed. */
+typedef struct dt_imageio_export_gate_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int32_t free;
+}
+dt_imageio_export_gate_t;
+
+void dt_imageio_export_gate_init(dt_imageio_export_gate_t *gate, const int32_t pipes);
+void dt_imageio_export_gate_cleanup(dt_imageio_export_gate_t *gate);
+/** non-thumbnail exports on the calling thread go through gate from now on, NULL to stop. */
+void dt_imageio_export_set_gate(dt_imageio_export_gate_t *gate);
+
 int dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht, int orientation);
 
 // general, efficient buffer flipping function using memcopies
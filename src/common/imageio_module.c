@@ -94,6 +94,11 @@ dt_imageio_load_module_format (dt_imageio_module_format_t *module, const char *l
   if(!g_module_symbol(module->module, "decompress",                   (gpointer)&(module->decompress)))                   module->decompress = NULL;
   if(!g_module_symbol(module->module, "compress",                     (gpointer)&(module->compress)))                     module->compress = NULL;
 
+  if(!g_module_symbol(module->module, "write_image_begin",            (gpointer)&(module->write_image_begin)))            module->write_image_begin = NULL;
+  if(!g_module_symbol(module->module, "write_image_rows",             (gpointer)&(module->write_image_rows)))             module->write_image_rows = NULL;
+  if(!g_module_symbol(module->module, "write_image_end",              (gpointer)&(module->write_image_end)))              module->write_image_end = NULL;
+  if(!module->write_image_rows || !module->write_image_end) module->write_image_begin = NULL;
+
   if(!g_module_symbol(module->module, "read_header",                  (gpointer)&(module->read_header)))                  module->read_header = NULL;
   if(!g_module_symbol(module->module, "read_image",                   (gpointer)&(module->read_image)))                   module->read_image = NULL;
 
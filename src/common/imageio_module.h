@@ -101,6 +101,13 @@ typedef struct dt_imageio_module_format_t
   int (*bpp)(dt_imageio_module_data_t *data);
   /* write to file, with exif if not NULL, and icc profile if supported. */
   int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid);
+  // optional: writing the image in stripes of rows, for exports too large to be processed in one go:
+  /* open the file for an image of data->width x data->height. */
+  int (*write_image_begin)(dt_imageio_module_data_t *data, const char *filename, int imgid);
+  /* append the next rows, in the same layout as the buffer passed to write_image. */
+  int (*write_image_rows)(dt_imageio_module_data_t *data, const void *in, int rows);
+  /* close the file and attach exif if not NULL. */
+  int (*write_image_end)(dt_imageio_module_data_t *data, const char *filename, void *exif, int exif_len);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
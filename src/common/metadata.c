@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/collection.h"
 #include "common/metadata.h"
 #include "common/debug.h"
 
@@ -391,6 +392,7 @@ void dt_metadata_set(int id, const char* key, const char* value)
     dt_metadata_set_xmp(id, key, value);
   else if(strncmp(key, "Exif.", 5) == 0)
     dt_metadata_set_exif(id, key, value);
+  dt_collection_invalidate();
 }
 
 GList* dt_metadata_get(int id, const char* key, uint32_t* count)
@@ -422,6 +424,7 @@ void dt_metadata_clear(int id)
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
   }
+  dt_collection_invalidate();
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -18,6 +18,7 @@
 
 #include "common/darktable.h"
 #include "common/image_cache.h"
+#include "common/image_compression.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
@@ -33,6 +34,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <limits.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -40,11 +43,17 @@
 #include <xmmintrin.h>
 
 #define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
-#define DT_MIPMAP_CACHE_FILE_VERSION 22
+#define DT_MIPMAP_CACHE_FILE_VERSION 24
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
 
 #define DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE (1<<0)
 
+// how many turns of the cache's clock a buffer survives unused once it's hot, see dt_cache_set_weight().
+// by how expensive it is to recreate:
+#define DT_MIPMAP_WEIGHT_DISK      1 // read back from the thumbnail store
+#define DT_MIPMAP_WEIGHT_EMBEDDED  2 // decoded from the embedded thumbnail or the jpg itself
+#define DT_MIPMAP_WEIGHT_PROCESSED 6 // raw loaded, and for thumbnails processed by the full pixelpipe
+
 struct dt_mipmap_buffer_dsc
 {
   uint32_t width;
@@ -149,62 +158,6 @@ get_size(const uint32_t key)
   return (dt_mipmap_size_t)(key >> 29);
 }
 
-typedef struct _iterate_data_t
-{
-  FILE *f;
-  uint8_t *blob;
-  int compression_type;
-  dt_mipmap_size_t mip;
-}
-_iterate_data_t;
-
-static int
-_write_buffer(const uint32_t key, const void *data, void *user_data)
-{
-  if(!data) return 1;
-  struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)data;
-  // too small to write. no error, but don't write.
-  if(dsc->width <= 8 && dsc->height <= 8) return 0;
-
-  _iterate_data_t *d = (_iterate_data_t *)user_data;
-  int written = fwrite(&(d->mip), sizeof(dt_mipmap_size_t), 1, d->f);
-  if(written != 1) return 1;
-  written = fwrite(&key, sizeof(uint32_t), 1, d->f);
-  if(written != 1) return 1;
-
-  if(d->compression_type)
-  {
-    // write buffer size, wd, ht and the full blob, as it is in memory.
-    const int32_t length = compressed_buffer_size(d->compression_type, dsc->width, dsc->height);
-    written = fwrite(&length, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(&dsc->width, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(&dsc->height, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(dsc+1, sizeof(uint8_t), length, d->f);
-    if(written != length) return 1;
-  }
-  else
-  {
-    dt_mipmap_buffer_t buf;
-    buf.width  = dsc->width;
-    buf.height = dsc->height;
-    buf.imgid  = get_imgid(key);
-    buf.size   = get_size(key);
-    // skip to next 8-byte alignment, for sse buffers.
-    buf.buf    = (uint8_t *)(dsc+1);
-
-    const int32_t length = dt_imageio_jpeg_compress(buf.buf, d->blob, buf.width, buf.height, MIN(100, MAX(10, dt_conf_get_int("database_cache_quality"))));
-    written = fwrite(&length, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(d->blob, sizeof(uint8_t), length, d->f);
-    if(written != length) return 1;
-  }
-
-  return 0;
-}
-
 static int
 dt_mipmap_cache_get_filename(
   gchar* mipmapfilename, size_t size)
@@ -250,217 +203,415 @@ exit:
   return r;
 }
 
+// the small thumbnails (up to DT_MIPMAP_2) are kept on disk between sessions in two files:
+// an index, memory mapped and directly addressed by image id and level, and a data file
+// the thumbnails are appended to as they are generated. nothing is read at startup, entries
+// are looked up when the cache misses them, and invalidated one by one.
+#define DT_MIPMAP_STORE_LEVELS (DT_MIPMAP_2+1)
+
+typedef struct dt_mipmap_store_header_t
+{
+  int32_t  magic;
+  int32_t  compression_type;
+  int32_t  max_width[DT_MIPMAP_STORE_LEVELS];
+  int32_t  max_height[DT_MIPMAP_STORE_LEVELS];
+  uint32_t num_images;  // capacity of the index
+  uint64_t data_end;    // next free byte in the data file
+  uint64_t wasted;      // bytes in the data file no entry refers to any more
+}
+__attribute__((packed)) dt_mipmap_store_header_t;
+
+typedef struct dt_mipmap_store_entry_t
+{
+  uint64_t offset;
+  uint32_t length;      // 0 means there is no thumbnail
+  uint16_t width, height;
+  uint16_t generation;  // bumped on every change, writes in flight check it before they publish
+}
+__attribute__((packed)) dt_mipmap_store_entry_t;
+
+typedef struct dt_mipmap_store_t
+{
+  int idx_fd, dat_fd;
+  size_t map_size;
+  dt_mipmap_store_header_t *header; // the whole mapped index file
+  dt_mipmap_store_entry_t  *entries;
+  char idx_filename[DT_MAX_PATH_LEN];
+  char dat_filename[DT_MAX_PATH_LEN];
+}
+dt_mipmap_store_t;
+
+static inline size_t
+_store_map_size(const uint32_t num_images)
+{
+  return sizeof(dt_mipmap_store_header_t) + sizeof(dt_mipmap_store_entry_t)*DT_MIPMAP_STORE_LEVELS*(size_t)num_images;
+}
+
+static inline dt_mipmap_store_entry_t *
+_store_entry(dt_mipmap_store_t *store, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  if(imgid < 1 || imgid > store->header->num_images) return NULL;
+  return store->entries + (size_t)(imgid-1)*DT_MIPMAP_STORE_LEVELS + mip;
+}
+
+// (re-)maps the index for the given capacity. the old mapping stays valid on failure.
 static int
-dt_mipmap_cache_serialize(dt_mipmap_cache_t *cache)
+_store_map(dt_mipmap_store_t *store, const uint32_t num_images)
 {
-  gchar dbfilename[DT_MAX_PATH_LEN];
-  if (dt_mipmap_cache_get_filename(dbfilename, sizeof(dbfilename)))
+  const size_t size = _store_map_size(num_images);
+  if(size > store->map_size && ftruncate(store->idx_fd, size)) return 1;
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->idx_fd, 0);
+  if(map == MAP_FAILED) return 1;
+  if(store->header) munmap(store->header, store->map_size);
+  store->map_size = size;
+  store->header = (dt_mipmap_store_header_t *)map;
+  store->entries = (dt_mipmap_store_entry_t *)(store->header + 1);
+  store->header->num_images = num_images;
+  return 0;
+}
+
+static void
+_store_close(dt_mipmap_store_t *store)
+{
+  if(store->header)
   {
-    fprintf(stderr, "[mipmap_cache] could not retrieve cache filename; not serializing\n");
-    return 1;
+    msync(store->header, store->map_size, MS_SYNC);
+    munmap(store->header, store->map_size);
   }
-  if (!strcmp(dbfilename, ":memory:"))
+  if(store->idx_fd >= 0) close(store->idx_fd);
+  if(store->dat_fd >= 0) close(store->dat_fd);
+  free(store);
+}
+
+static dt_mipmap_store_t *
+_store_open(dt_mipmap_cache_t *cache)
+{
+  gchar filename[DT_MAX_PATH_LEN];
+  if(dt_mipmap_cache_get_filename(filename, sizeof(filename)))
   {
-    // fprintf(stderr, "[mipmap_cache] library is in memory; not serializing\n");
-    return 0;
+    fprintf(stderr, "[mipmap_cache] could not retrieve cache filename; not using the disk cache\n");
+    return NULL;
   }
+  // library is in memory, don't leave anything behind either.
+  if(!strcmp(filename, ":memory:")) return NULL;
 
-  // only store smallest thumbs.
-  const dt_mipmap_size_t mip = DT_MIPMAP_2;
+  // get rid of the monolithic cache file of older versions:
+  g_unlink(filename);
 
-  _iterate_data_t d;
-  d.f = NULL;
-  d.blob = (uint8_t *)malloc(cache->mip[mip].buffer_size);
-  int written = 0;
-  FILE *f = fopen(dbfilename, "wb");
-  if(!f) goto write_error;
-  d.f = f;
-  // fprintf(stderr, "[mipmap_cache] serializing to `%s'\n", dbfilename);
+  dt_mipmap_store_t *store = (dt_mipmap_store_t *)malloc(sizeof(dt_mipmap_store_t));
+  memset(store, 0, sizeof(dt_mipmap_store_t));
+  snprintf(store->idx_filename, sizeof(store->idx_filename), "%s.idx", filename);
+  snprintf(store->dat_filename, sizeof(store->dat_filename), "%s.dat", filename);
+  store->idx_fd = open(store->idx_filename, O_RDWR | O_CREAT, 0644);
+  store->dat_fd = open(store->dat_filename, O_RDWR | O_CREAT, 0644);
+  if(store->idx_fd < 0 || store->dat_fd < 0) goto open_error;
 
-  // write version info:
   const int32_t magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
-  written = fwrite(&magic, sizeof(int32_t), 1, f);
-  if(written != 1) goto write_error;
-
-  // store compression type
-  written = fwrite(&cache->compression_type, sizeof(int32_t), 1, f);
-  if(written != 1) goto write_error;
-
-  for(int i=0; i<=mip; i++)
+  struct stat st;
+  if(fstat(store->idx_fd, &st)) goto open_error;
+  int valid = 0;
+  if(st.st_size >= sizeof(dt_mipmap_store_header_t))
+  {
+    dt_mipmap_store_header_t header;
+    if(pread(store->idx_fd, &header, sizeof(header), 0) == sizeof(header) &&
+        st.st_size >= _store_map_size(header.num_images))
+    {
+      valid = 1;
+      if(header.magic != magic)
+      {
+        fprintf(stderr, "[mipmap_cache] invalid or outdated cache file, dropping `%s'\n", store->idx_filename);
+        valid = 0;
+      }
+      else if(header.compression_type != cache->compression_type)
+      {
+        fprintf(stderr, "[mipmap_cache] cache compression settings changed, dropping `%s'\n", store->idx_filename);
+        valid = 0;
+      }
+      else for(int k=0; k<DT_MIPMAP_STORE_LEVELS; k++)
+        {
+          if(header.max_width[k] != cache->mip[k].max_width || header.max_height[k] != cache->mip[k].max_height)
+          {
+            fprintf(stderr, "[mipmap_cache] cache settings changed, dropping `%s'\n", store->idx_filename);
+            valid = 0;
+            break;
+          }
+        }
+      if(valid && _store_map(store, header.num_images)) goto open_error;
+    }
+  }
+  if(!valid)
   {
-    // print max sizes for this cache
-    written = fwrite(&cache->mip[i].max_width, sizeof(int32_t), 1, f);
-    if(written != 1) goto write_error;
-    written = fwrite(&cache->mip[i].max_height, sizeof(int32_t), 1, f);
-    if(written != 1) goto write_error;
+    // start from scratch:
+    if(store->header) munmap(store->header, store->map_size);
+    store->header = NULL;
+    store->map_size = 0;
+    if(ftruncate(store->idx_fd, 0) || ftruncate(store->dat_fd, 0)) goto open_error;
+    if(_store_map(store, 1024)) goto open_error;
+    store->header->compression_type = cache->compression_type;
+    for(int k=0; k<DT_MIPMAP_STORE_LEVELS; k++)
+    {
+      store->header->max_width[k]  = cache->mip[k].max_width;
+      store->header->max_height[k] = cache->mip[k].max_height;
+    }
+    store->header->data_end = 0;
+    store->header->wasted = 0;
+    store->header->magic = magic;
   }
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] using disk cache `%s' for %u images (%.02f MB, %.02f MB unused)\n",
+           store->idx_filename, store->header->num_images, store->header->data_end/(1024.0*1024.0),
+           store->header->wasted/(1024.0*1024.0));
+  return store;
+
+open_error:
+  fprintf(stderr, "[mipmap_cache] failed to open the disk cache `%s'\n", filename);
+  _store_close(store);
+  return NULL;
+}
 
-  for(int i=0; i<=mip; i++)
+// returns the disk store, opens it on first use. has to be called with store_mutex held.
+static dt_mipmap_store_t *
+_store_get(dt_mipmap_cache_t *cache)
+{
+  if(!cache->store_opened)
   {
-    d.mip = (dt_mipmap_size_t)i;
-    d.compression_type = cache->compression_type;
-    if(dt_cache_for_all(&cache->mip[i].cache, _write_buffer, &d)) goto write_error;
+    cache->store = _store_open(cache);
+    cache->store_opened = 1;
   }
-
-  free(d.blob);
-  fclose(f);
-  return 0;
-
-write_error:
-  fprintf(stderr, "[mipmap_cache] serialization to `%s' failed!\n", dbfilename);
-  if(f) fclose(f);
-  free(d.blob);
-  return 1;
+  return cache->store;
 }
 
 static int
-dt_mipmap_cache_deserialize(dt_mipmap_cache_t *cache)
+_store_contains(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
 {
-  int32_t rd = 0;
-  const dt_mipmap_size_t mip = DT_MIPMAP_2;
-  uint8_t *blob = NULL;
-  int file_width[mip+1], file_height[mip+1];
+  if(mip >= DT_MIPMAP_STORE_LEVELS) return 0;
+  dt_pthread_mutex_lock(&cache->store_mutex);
+  dt_mipmap_store_t *store = _store_get(cache);
+  const dt_mipmap_store_entry_t *entry = store ? _store_entry(store, imgid, mip) : NULL;
+  const int found = entry && entry->length;
+  dt_pthread_mutex_unlock(&cache->store_mutex);
+  return found;
+}
 
-  gchar dbfilename[DT_MAX_PATH_LEN];
-  if (dt_mipmap_cache_get_filename(dbfilename, sizeof(dbfilename)))
+// the version of the entry, taken before a thumbnail is generated and handed to _store_write().
+static uint16_t
+_store_generation(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  if(mip >= DT_MIPMAP_STORE_LEVELS) return 0;
+  dt_pthread_mutex_lock(&cache->store_mutex);
+  dt_mipmap_store_t *store = _store_get(cache);
+  const dt_mipmap_store_entry_t *entry = store ? _store_entry(store, imgid, mip) : NULL;
+  const uint16_t generation = entry ? entry->generation : 0;
+  dt_pthread_mutex_unlock(&cache->store_mutex);
+  return generation;
+}
+
+static void
+_store_invalidate(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  dt_pthread_mutex_lock(&cache->store_mutex);
+  dt_mipmap_store_t *store = _store_get(cache);
+  dt_mipmap_store_entry_t *entry = store ? _store_entry(store, imgid, mip) : NULL;
+  if(entry)
   {
-    fprintf(stderr, "[mipmap_cache] could not retrieve cache filename; not deserializing\n");
-    return 1;
+    store->header->wasted += entry->length;
+    entry->length = 0;
+    entry->generation++;
   }
-  if (!strcmp(dbfilename, ":memory:"))
+  dt_pthread_mutex_unlock(&cache->store_mutex);
+}
+
+// fills the (write locked) buffer from disk. returns 0 on success.
+static int
+_store_read(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip, struct dt_mipmap_buffer_dsc *dsc)
+{
+  if(mip >= DT_MIPMAP_STORE_LEVELS) return 1;
+  dt_pthread_mutex_lock(&cache->store_mutex);
+  dt_mipmap_store_t *store = _store_get(cache);
+  dt_mipmap_store_entry_t *e = store ? _store_entry(store, imgid, mip) : NULL;
+  const dt_mipmap_store_entry_t entry = e ? *e : (dt_mipmap_store_entry_t)
   {
-    // fprintf(stderr, "[mipmap_cache] library is in memory; not deserializing\n");
-    return 0;
-  }
+    0, 0, 0, 0
+  };
+  dt_pthread_mutex_unlock(&cache->store_mutex);
+  if(!entry.length) return 1;
 
-  FILE *f = fopen(dbfilename, "rb");
-  if(!f)
+  int err = 1;
+  uint8_t *data = (uint8_t *)(dsc+1);
+  if(cache->compression_type)
   {
-    if (errno == ENOENT)
+    // blocks are stored exactly as they are in memory, read them in place:
+    if(entry.width <= cache->mip[mip].max_width && entry.height <= cache->mip[mip].max_height &&
+        entry.length == compressed_buffer_size(cache->compression_type, entry.width, entry.height) &&
+        pread(store->dat_fd, data, entry.length, entry.offset) == entry.length)
     {
-      fprintf(stderr, "[mipmap_cache] cache is empty, file `%s' doesn't exist\n", dbfilename);
+      dsc->width  = entry.width;
+      dsc->height = entry.height;
+      err = 0;
     }
-    else
+  }
+  else
+  {
+    // no compression, the image is still compressed on disk, as jpg
+    uint8_t *blob = (uint8_t *)malloc(entry.length);
+    dt_imageio_jpeg_t jpg;
+    if(blob && pread(store->dat_fd, blob, entry.length, entry.offset) == entry.length &&
+        !dt_imageio_jpeg_decompress_header(blob, entry.length, &jpg) &&
+        jpg.width <= cache->mip[mip].max_width && jpg.height <= cache->mip[mip].max_height &&
+        !dt_imageio_jpeg_decompress(&jpg, data))
     {
-      fprintf(stderr, "[mipmap_cache] failed to open the cache from `%s'\n", dbfilename);
+      dsc->width  = jpg.width;
+      dsc->height = jpg.height;
+      err = 0;
     }
-    goto read_finalize;
+    free(blob);
   }
-
-  // read version info:
-  const int32_t magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
-  int32_t magic_file = 0;
-  rd = fread(&magic_file, sizeof(int32_t), 1, f);
-  if(rd != 1) goto read_error;
-  if(magic_file != magic)
+  if(err)
   {
-    if(magic_file > DT_MIPMAP_CACHE_FILE_MAGIC && magic_file < magic)
-      fprintf(stderr, "[mipmap_cache] cache version too old, dropping `%s' cache\n", dbfilename);
-    else
-      fprintf(stderr, "[mipmap_cache] invalid cache file, dropping `%s' cache\n", dbfilename);
-    goto read_finalize;
+    fprintf(stderr, "[mipmap_cache] failed to read thumbnail for image %d from disk!\n", imgid);
+    _store_invalidate(cache, imgid, mip);
   }
+  return err;
+}
 
-  // also read compression type and yell out on missmatch.
-  int32_t compression = -1;
-  rd = fread(&compression, sizeof(int32_t), 1, f);
-  if(rd != 1) goto read_error;
-  if(compression != cache->compression_type)
+// appends the freshly generated buffer to the disk cache. generation is what _store_generation()
+// returned before the buffer was generated, if the entry changed since, the buffer is outdated.
+static void
+_store_write(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+             const struct dt_mipmap_buffer_dsc *dsc, const uint16_t generation)
+{
+  if(mip >= DT_MIPMAP_STORE_LEVELS) return;
+  // don't store skulls:
+  if(dsc->width <= 8 && dsc->height <= 8) return;
+
+  const uint8_t *data = (const uint8_t *)(dsc+1);
+  uint8_t *blob = NULL;
+  int32_t length = 0;
+  if(cache->compression_type)
   {
-    fprintf(stderr, "[mipmap_cache] cache is %s, but settings say we should use %s, dropping `%s' cache\n",
-            compression == 0 ? "uncompressed" : (compression == 1 ? "low quality compressed" : "high quality compressed"),
-            cache->compression_type == 0 ? "no compression" : (cache->compression_type == 1 ? "low quality compression" : "high quality compression"),
-            dbfilename);
-    goto read_finalize;
+    length = compressed_buffer_size(cache->compression_type, dsc->width, dsc->height);
   }
-
-  for (int i=0; i<=mip; i++)
+  else
   {
-    rd = fread(&file_width[i], sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-    rd = fread(&file_height[i], sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-    if(file_width[i]  != cache->mip[i].max_width ||
-        file_height[i] != cache->mip[i].max_height)
+    blob = (uint8_t *)malloc(cache->mip[mip].buffer_size);
+    if(!blob) return;
+    length = dt_imageio_jpeg_compress(data, blob, dsc->width, dsc->height, MIN(100, MAX(10, dt_conf_get_int("database_cache_quality"))));
+    // 1 means error
+    if(length <= 1)
     {
-      fprintf(stderr, "[mipmap_cache] cache settings changed, dropping `%s' cache\n", dbfilename);
-      goto read_finalize;
+      free(blob);
+      return;
     }
+    data = blob;
   }
 
-  if(cache->compression_type) blob = NULL;
-  else blob = malloc(sizeof(uint32_t)*file_width[mip]*file_height[mip]);
+  // reserve space at the end of the data file
+  dt_pthread_mutex_lock(&cache->store_mutex);
+  dt_mipmap_store_t *store = _store_get(cache);
+  if(store && imgid > store->header->num_images)
+  {
+    uint32_t num_images = store->header->num_images;
+    while(num_images < imgid) num_images *= 2;
+    if(_store_map(store, num_images))
+    {
+      fprintf(stderr, "[mipmap_cache] failed to grow the disk cache `%s'\n", store->idx_filename);
+      store = NULL;
+    }
+  }
+  uint64_t offset = 0;
+  if(store)
+  {
+    offset = store->header->data_end;
+    store->header->data_end += length;
+  }
+  dt_pthread_mutex_unlock(&cache->store_mutex);
 
-  while(!feof(f))
+  // write outside the lock, then publish the entry:
+  if(store && pwrite(store->dat_fd, data, length, offset) == length)
   {
-    int level = 0;
-    rd = fread(&level, sizeof(int), 1, f);
-    if (level > mip) break;
-
-    int32_t key = 0;
-    rd = fread(&key, sizeof(int32_t), 1, f);
-    if(rd != 1) break; // first value is break only, goes to eof.
-    int32_t length = 0;
-    rd = fread(&length, sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-
-    uint8_t *data = (uint8_t *)dt_cache_read_get(&cache->mip[level].cache, key);
-    struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)data;
-    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
+    dt_pthread_mutex_lock(&cache->store_mutex);
+    dt_mipmap_store_entry_t *entry = _store_entry(store, imgid, mip);
+    if(entry && entry->generation == generation)
     {
-      if(cache->compression_type)
-      {
-        int32_t wd, ht;
-        rd = fread(&wd, sizeof(int32_t), 1, f);
-        if(rd != 1) goto read_error;
-        rd = fread(&ht, sizeof(int32_t), 1, f);
-        if(rd != 1) goto read_error;
-        dsc->width = wd;
-        dsc->height = ht;
-        if(length != compressed_buffer_size(cache->compression_type, wd, ht)) goto read_error;
-        // directly read from disk into cache:
-        rd = fread(data + sizeof(*dsc), 1, length, f);
-        if(rd != length) goto read_error;
-      }
-      else
-      {
-        // jpg too large?
-        if(length > sizeof(uint32_t)*file_width[mip]*file_height[mip]) goto read_error;
-        rd = fread(blob, sizeof(uint8_t), length, f);
-        if(rd != length) goto read_error;
-        // no compression, the image is still compressed on disk, as jpg
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, length, &jpg) ||
-            (jpg.width > file_width[level] || jpg.height > file_height[level]) ||
-            dt_imageio_jpeg_decompress(&jpg, data+sizeof(*dsc)))
-        {
-          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d!\n", get_imgid(key));
-        }
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-      }
-      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
-      // these come write locked in case idata[3] == 1, so release that!
-      dt_cache_write_release(&cache->mip[level].cache, key);
+      store->header->wasted += entry->length;
+      entry->offset = offset;
+      entry->length = length;
+      entry->width  = dsc->width;
+      entry->height = dsc->height;
+      entry->generation++;
+    }
+    else
+    {
+      // invalidated (or written by someone else) in the meantime, this one is outdated:
+      store->header->wasted += length;
     }
-    dt_cache_read_release(&cache->mip[level].cache, key);
+    dt_pthread_mutex_unlock(&cache->store_mutex);
   }
+  else if(store)
+  {
+    dt_pthread_mutex_lock(&cache->store_mutex);
+    store->header->wasted += length;
+    dt_pthread_mutex_unlock(&cache->store_mutex);
+  }
+  free(blob);
+}
 
-  fclose(f);
+// rewrite the data file without the holes left by invalidated thumbnails.
+static int
+_store_compact(dt_mipmap_store_t *store)
+{
+  const int32_t magic = store->header->magic;
+  const size_t num = (size_t)store->header->num_images*DT_MIPMAP_STORE_LEVELS;
+  uint64_t *offsets = (uint64_t *)malloc(sizeof(uint64_t)*num);
+  uint8_t *blob = NULL;
+  char tmp_filename[DT_MAX_PATH_LEN];
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", store->dat_filename);
+  int fd = open(tmp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0 || !offsets) goto compact_error;
+
+  uint64_t end = 0;
+  for(size_t k=0; k<num; k++)
+  {
+    const dt_mipmap_store_entry_t *entry = store->entries + k;
+    if(!entry->length) continue;
+    uint8_t *b = (uint8_t *)realloc(blob, entry->length);
+    if(!b) goto compact_error;
+    blob = b;
+    if(pread(store->dat_fd, blob, entry->length, entry->offset) != entry->length) goto compact_error;
+    if(write(fd, blob, entry->length) != entry->length) goto compact_error;
+    offsets[k] = end;
+    end += entry->length;
+  }
+  if(fsync(fd)) goto compact_error;
+
+  // invalidate the index until the offsets are updated, in case we crash in between:
+  store->header->magic = 0;
+  msync(store->header, store->map_size, MS_SYNC);
+  if(rename(tmp_filename, store->dat_filename)) goto compact_error;
+  for(size_t k=0; k<num; k++) if(store->entries[k].length) store->entries[k].offset = offsets[k];
+  close(store->dat_fd);
+  store->dat_fd = fd;
+  store->header->data_end = end;
+  store->header->wasted = 0;
+  store->header->magic = magic;
+  free(offsets);
   free(blob);
   return 0;
 
-read_error:
-  fprintf(stderr, "[mipmap_cache] failed to recover the cache from `%s'\n", dbfilename);
-read_finalize:
-  if(f) fclose(f);
+compact_error:
+  fprintf(stderr, "[mipmap_cache] failed to compact the disk cache `%s'\n", store->dat_filename);
+  store->header->magic = magic;
+  if(fd >= 0)
+  {
+    close(fd);
+    g_unlink(tmp_filename);
+  }
+  free(offsets);
   free(blob);
-  g_unlink(dbfilename);
   return 1;
 }
 
 static void _init_f(float   *buf, uint32_t *width, uint32_t *height, const uint32_t imgid);
-static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, const uint32_t imgid, const dt_mipmap_size_t size);
+static int  _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, const uint32_t imgid, const dt_mipmap_size_t size);
 
 static int32_t
 scratchmem_allocate(void *data, const uint32_t key, int32_t *cost, void **buf)
@@ -737,12 +888,26 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip[DT_MIPMAP_F].size = DT_MIPMAP_F;
   cache->mip[DT_MIPMAP_F].buf = NULL;
 
-  dt_mipmap_cache_deserialize(cache);
+  // the disk cache is opened on first access:
+  dt_pthread_mutex_init(&cache->store_mutex, NULL);
+  cache->store = NULL;
+  cache->store_opened = 0;
 }
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
-  dt_mipmap_cache_serialize(cache);
+  // how well did the caches do this session?
+  if(darktable.unmuted & DT_DEBUG_CACHE)
+    dt_mipmap_cache_print(cache);
+  if(cache->store)
+  {
+    // only worth it if more than half of the file is dead.
+    if(cache->store->header->wasted > (16u<<20) && 2*cache->store->header->wasted > cache->store->header->data_end)
+      _store_compact(cache->store);
+    _store_close(cache->store);
+    cache->store = NULL;
+  }
+  dt_pthread_mutex_destroy(&cache->store_mutex);
   for(int k=0; k<DT_MIPMAP_F; k++)
   {
     dt_cache_cleanup(&cache->mip[k].cache);
@@ -760,8 +925,20 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
   }
 }
 
+static void
+_print_stats(const char *level, dt_cache_t *cache)
+{
+  dt_cache_stats_t stats;
+  dt_cache_get_stats(cache, &stats);
+  const uint64_t lookups = stats.hits + stats.misses;
+  printf("[mipmap_cache] level %s hits %"PRIu64" misses %"PRIu64" (%.2f%% hit rate), evictions %"PRIu64", hot %.2f%%\n",
+         level, stats.hits, stats.misses, lookups ? 100.0*stats.hits/lookups : 0.0, stats.evictions,
+         cache->cost ? 100.0f*(float)cache->hot_cost/(float)cache->cost : 0.0f);
+}
+
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
 {
+  char level[16];
   for(int k=0; k<(int)DT_MIPMAP_F; k++)
   {
     printf("[mipmap_cache] level %d fill %.2f/%.2f MB (%.2f%% in %u/%u buffers)\n", k, cache->mip[k].cache.cost/(1024.0*1024.0),
@@ -769,6 +946,8 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
            100.0f*(float)cache->mip[k].cache.cost/(float)cache->mip[k].cache.cost_quota,
            dt_cache_size(&cache->mip[k].cache),
            dt_cache_capacity(&cache->mip[k].cache));
+    snprintf(level, sizeof(level), "%d", k);
+    _print_stats(level, &cache->mip[k].cache);
   }
   for(int k=(int)DT_MIPMAP_F; k<=(int)DT_MIPMAP_FULL; k++)
   {
@@ -777,6 +956,8 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
            100.0f*(float)cache->mip[k].cache.cost/(float)cache->mip[k].cache.cost_quota,
            dt_cache_size(&cache->mip[k].cache),
            dt_cache_capacity(&cache->mip[k].cache));
+    snprintf(level, sizeof(level), "[f%d]", k);
+    _print_stats(level, &cache->mip[k].cache);
   }
   if(cache->compression_type)
   {
@@ -857,6 +1038,7 @@ dt_mipmap_cache_read_get(
         // fprintf(stderr, "[mipmap cache get] now initializing buffer for img %u mip %d!\n", imgid, mip);
         // we're write locked here, as requested by the alloc callback.
         // now fill it with data:
+        int weight = DT_MIPMAP_WEIGHT_PROCESSED;
         if(mip == DT_MIPMAP_FULL)
         {
           // load the image:
@@ -908,28 +1090,42 @@ dt_mipmap_cache_read_get(
         else
         {
           // 8-bit thumbs, possibly need to be compressed:
-          if(cache->compression_type)
+          if(!_store_read(cache, imgid, mip, dsc))
           {
-            // get per-thread temporary storage without malloc from a separate cache:
-            const int key = dt_control_get_threadid();
-            // const void *cbuf =
-            dt_cache_read_get(&cache->scratchmem.cache, key);
-            uint8_t *scratchmem = (uint8_t *)dt_cache_write_get(&cache->scratchmem.cache, key);
-            _init_8(scratchmem, &dsc->width, &dsc->height, imgid, mip);
-            buf->width  = dsc->width;
-            buf->height = dsc->height;
-            buf->imgid  = imgid;
-            buf->size   = mip;
-            buf->buf = (uint8_t *)(dsc+1);
-            dt_mipmap_cache_compress(buf, scratchmem);
-            dt_cache_write_release(&cache->scratchmem.cache, key);
-            dt_cache_read_release(&cache->scratchmem.cache, key);
+            // found on disk, nothing else to do.
+            weight = DT_MIPMAP_WEIGHT_DISK;
           }
           else
           {
-            _init_8((uint8_t *)(dsc+1), &dsc->width, &dsc->height, imgid, mip);
+            // an invalidation while the thumbnail is generated makes it outdated:
+            const uint16_t generation = _store_generation(cache, imgid, mip);
+            if(cache->compression_type)
+            {
+              // get per-thread temporary storage without malloc from a separate cache:
+              const int key = dt_control_get_threadid();
+              // const void *cbuf =
+              dt_cache_read_get(&cache->scratchmem.cache, key);
+              uint8_t *scratchmem = (uint8_t *)dt_cache_write_get(&cache->scratchmem.cache, key);
+              weight = _init_8(scratchmem, &dsc->width, &dsc->height, imgid, mip);
+              buf->width  = dsc->width;
+              buf->height = dsc->height;
+              buf->imgid  = imgid;
+              buf->size   = mip;
+              buf->buf = (uint8_t *)(dsc+1);
+              dt_mipmap_cache_compress(buf, scratchmem);
+              dt_cache_write_release(&cache->scratchmem.cache, key);
+              dt_cache_read_release(&cache->scratchmem.cache, key);
+            }
+            else
+            {
+              weight = _init_8((uint8_t *)(dsc+1), &dsc->width, &dsc->height, imgid, mip);
+            }
+            _store_write(cache, imgid, mip, dsc, generation);
+            if(_store_contains(cache, imgid, mip)) weight = DT_MIPMAP_WEIGHT_DISK;
           }
         }
+        // so the cache keeps what took long to make longer:
+        dt_cache_set_weight(&cache->mip[mip].cache, key, weight);
         dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
         // drop the write lock
         dt_cache_write_release(&cache->mip[mip].cache, key);
@@ -960,6 +1156,13 @@ dt_mipmap_cache_read_get(
       // already loaded?
       dt_mipmap_cache_read_get(cache, buf, imgid, k, DT_MIPMAP_TESTLOCK);
       if(buf->buf && buf->width > 0 && buf->height > 0) return;
+      // on disk? that's quick enough to just load it.
+      if(mip == k && _store_contains(cache, imgid, k))
+      {
+        dt_mipmap_cache_read_get(cache, buf, imgid, k, DT_MIPMAP_BLOCKING);
+        if(buf->buf && buf->width > 0 && buf->height > 0) return;
+        dt_mipmap_cache_read_release(cache, buf);
+      }
       // didn't succeed the first time? prefetch for later!
       if(mip == k)
         dt_mipmap_cache_read_get(cache, buf, imgid, mip, DT_MIPMAP_PREFETCH);
@@ -1055,6 +1258,7 @@ dt_mipmap_cache_remove(
   {
     const uint32_t key = get_key(imgid, k);
     dt_cache_remove(&cache->mip[k].cache, key);
+    _store_invalidate(cache, imgid, k);
   }
 }
 
@@ -1160,7 +1364,8 @@ _write_image(
   return 0;
 }
 
-static void
+// returns the weight for the cache, by how the thumbnail was made.
+static int
 _init_8(
   uint8_t                *buf,
   uint32_t               *width,
@@ -1176,11 +1381,12 @@ _init_8(
   if (strlen(filename) == 0 || !g_file_test(filename, G_FILE_TEST_EXISTS))
   {
     *width = *height = 0;
-    return;
+    return DT_MIPMAP_WEIGHT_EMBEDDED;
   }
 
   const int altered = dt_image_altered(imgid);
   int res = 1;
+  int weight = DT_MIPMAP_WEIGHT_EMBEDDED;
 
   const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
   const int orientation = dt_image_orientation(cimg);
@@ -1203,6 +1409,8 @@ _init_8(
       dt_imageio_jpeg_t jpg;
       if(!dt_imageio_jpeg_read_header(filename, &jpg))
       {
+        // let libjpeg decode close to the size we need:
+        dt_imageio_jpeg_set_scale(&jpg, (orientation & 4) ? ht : wd, (orientation & 4) ? wd : ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t)*jpg.width*jpg.height*4);
         if(!dt_imageio_jpeg_read(&jpg, tmp))
         {
@@ -1215,24 +1423,35 @@ _init_8(
     }
     else
     {
-      // raw image thumbnail
+      // raw image thumbnail. libraw parses the mapped file, which only pages in the headers
+      // and the embedded preview, and copies out the latter. the raw data is never unpacked.
       libraw_data_t *raw = libraw_init(0);
-      libraw_processed_image_t *image = NULL;
-      ret = libraw_open_file(raw, filename);
+      void *map = MAP_FAILED;
+      size_t map_size = 0;
+      const int fd = open(filename, O_RDONLY);
+      if(fd >= 0)
+      {
+        struct stat st;
+        if(!fstat(fd, &st) && st.st_size > 0)
+        {
+          map_size = st.st_size;
+          map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+      }
+      if(map != MAP_FAILED) ret = libraw_open_buffer(raw, map, map_size);
+      else ret = libraw_open_file(raw, filename);
       if(ret) goto libraw_fail;
       ret = libraw_unpack_thumb(raw);
       if(ret) goto libraw_fail;
-      ret = libraw_adjust_sizes_info_only(raw);
-      if(ret) goto libraw_fail;
 
-      image = libraw_dcraw_make_mem_thumb(raw, &ret);
-      if(!image || ret) goto libraw_fail;
       const int orientation = raw->sizes.flip;
-      if(image->type == LIBRAW_IMAGE_JPEG)
+      if(raw->thumbnail.tformat == LIBRAW_THUMBNAIL_JPEG)
       {
-        // JPEG: decode (directly rescaled to mip4)
+        // JPEG: decode directly from libraw's copy, scaled down in the dct domain
         dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(image->data, image->data_size, &jpg)) goto libraw_fail;
+        if(dt_imageio_jpeg_decompress_header(raw->thumbnail.thumb, raw->thumbnail.tlength, &jpg)) goto libraw_fail;
+        dt_imageio_jpeg_set_scale(&jpg, (orientation & 4) ? ht : wd, (orientation & 4) ? wd : ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t)*jpg.width*jpg.height*4);
         if(dt_imageio_jpeg_decompress(&jpg, tmp))
         {
@@ -1247,9 +1466,7 @@ _init_8(
       }
 
       // clean up raw stuff.
-      libraw_recycle(raw);
       libraw_close(raw);
-      free(image);
       if(0)
       {
 libraw_fail:
@@ -1257,11 +1474,13 @@ libraw_fail:
         libraw_close(raw);
         res = 1;
       }
+      if(map != MAP_FAILED) munmap(map, map_size);
     }
   }
 
   if(res)
   {
+    weight = DT_MIPMAP_WEIGHT_PROCESSED;
     // try the real thing: rawspeed + pixelpipe
     dt_imageio_module_format_t format;
     _dummy_data_t dat;
@@ -1287,13 +1506,14 @@ libraw_fail:
   {
     // fprintf(stderr, "[mipmap_cache] could not process thumbnail!\n");
     *width = *height = 0;
-    return;
+    return weight;
   }
 
   // TODO: various speed optimizations:
   // TODO: also init all smaller mips!
   // TODO: use mipf, but:
   // TODO: if output is cropped, don't use mipf!
+  return weight;
 }
 
 // compression stuff: alloc a buffer if needed
@@ -1323,7 +1543,7 @@ dt_mipmap_cache_decompress(
 {
   if(darktable.mipmap_cache->compression_type && buf->width > 8 && buf->height > 8)
   {
-    squish_decompress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    dt_image_uncompress_dxt1(buf->buf, scratchmem, buf->width, buf->height);
     return scratchmem;
   }
   else
@@ -1346,7 +1566,7 @@ dt_mipmap_cache_compress(
     int flags = squish_dxt1;
     // low quality:
     if(darktable.mipmap_cache->compression_type == 1) flags |= squish_colour_range_fit;
-    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, flags);
   }
 }
 
@@ -102,6 +102,10 @@ typedef struct dt_mipmap_cache_t
   int compression_type; // 0 - none, 1 - low quality, 2 - slow
   // per-thread cache of uncompressed buffers, in case compression is requested.
   dt_mipmap_cache_one_t scratchmem;
+  // persistent copy of the small thumbnails on disk, opened on first access.
+  struct dt_mipmap_store_t *store;
+  int store_opened;
+  dt_pthread_mutex_t store_mutex;
 }
 dt_mipmap_cache_t;
 
@@ -42,6 +42,7 @@ void dt_ratings_apply_to_selection (int rating)
     /* for each selected image update rating */
     sqlite3_stmt *stmt;
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images", -1, &stmt, NULL);
+    dt_image_cache_batch_begin(darktable.image_cache);
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, sqlite3_column_int(stmt, 0));
@@ -52,6 +53,7 @@ void dt_ratings_apply_to_selection (int rating)
       dt_image_cache_read_release(darktable.image_cache, image);
     }
     sqlite3_finalize(stmt);
+    dt_image_cache_batch_end(darktable.image_cache);
 
     /* redraw view */
     dt_control_queue_redraw_center();
@@ -21,6 +21,36 @@
 #include "common/debug.h"
 #include "common/darktable.h"
 #include "common/similarity.h"
+#include "common/dtpthread.h"
+#include "control/jobs/control_jobs.h"
+
+#include <emmintrin.h>
+
+/* the features of all images, loaded from the database once and kept up to date by the
+   store/dirty functions below. every feature kind lives in its own contiguous array, the
+   lightmap is split into one plane per channel so a whole channel is compared with psadbw. */
+#define DT_SIMILARITY_MAP_PIXELS (DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE)
+#define DT_SIMILARITY_MAP_STRIDE ((DT_SIMILARITY_MAP_PIXELS + 15) & ~15)
+#define DT_SIMILARITY_HISTOGRAM_STRIDE (DT_SIMILARITY_HISTOGRAM_BUCKETS*3)
+
+#define DT_SIMILARITY_VALID_HISTOGRAM 1
+#define DT_SIMILARITY_VALID_LIGHTMAP  2
+
+typedef struct dt_similarity_index_t
+{
+  dt_pthread_mutex_t lock;
+  int loaded;
+  uint32_t count, alloc;
+  uint32_t *id;
+  uint8_t *valid;
+  float *histogram;   // rgb of each bucket, DT_SIMILARITY_HISTOGRAM_STRIDE per image
+  uint8_t *map[4];    // r, g, b and light planes, DT_SIMILARITY_MAP_STRIDE per image, zero padded
+  GHashTable *slot;   // imgid -> slot + 1
+  uint32_t edited;    // marked by dt_similarity_image_edited() and not indexed since
+}
+dt_similarity_index_t;
+
+static dt_similarity_index_t _index;
 
 #ifdef _DEBUG
 static void _similarity_dump_histogram(uint32_t imgid, const dt_similarity_histogram_t *histogram)
@@ -32,200 +62,254 @@ static void _similarity_dump_histogram(uint32_t imgid, const dt_similarity_histo
 }
 #endif
 
-/* matches the rgb histogram and returns a score for the match  */
-static float _similarity_match_histogram_rgb(dt_similarity_t *data, const dt_similarity_histogram_t *target, const dt_similarity_histogram_t *source)
+void dt_similarity_init()
 {
-  float score=0;
-
-  for(int k=0; k<DT_SIMILARITY_HISTOGRAM_BUCKETS; k++)
-    for(int j=0; j<3; j++)
-      score += fabs(target->rgbl[k][j] - source->rgbl[k][j])/3.0;
-
-  score/=DT_SIMILARITY_HISTOGRAM_BUCKETS;
-
-  return 1.0 - score;
+  memset(&_index, 0, sizeof(_index));
+  dt_pthread_mutex_init(&_index.lock, NULL);
+  _index.slot = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
-/* scoring match of lightmap */
-static float _similarity_match_lightmap(dt_similarity_t *data, const dt_similarity_lightmap_t *target, const dt_similarity_lightmap_t *source)
+void dt_similarity_cleanup()
 {
-  float score=0;
-  int channel = 3;
-
-  /* sum up the score */
-  for(int j=0; j<(DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE); j++)
-    score += fabs((float)(target->pixels[4*j+channel] - source->pixels[4*j+channel]) / 0xff);
+  g_hash_table_destroy(_index.slot);
+  free(_index.id);
+  free(_index.valid);
+  free(_index.histogram);
+  for(int c=0; c<4; c++) free(_index.map[c]);
+  dt_pthread_mutex_destroy(&_index.lock);
+}
 
-  /* scale down score */
-  score /= (DT_SIMILARITY_LIGHTMAP_SIZE * DT_SIMILARITY_LIGHTMAP_SIZE);
+/* returns the slot of imgid, appending a new one if needed. needs the lock. */
+static int _similarity_index_slot(uint32_t imgid, gboolean create)
+{
+  const int slot = GPOINTER_TO_INT(g_hash_table_lookup(_index.slot, GINT_TO_POINTER(imgid))) - 1;
+  if(slot >= 0 || !create) return slot;
 
-  return 1.0 - score;
+  if(_index.count == _index.alloc)
+  {
+    const uint32_t alloc = MAX(1024, 2*_index.alloc);
+    _index.id = realloc(_index.id, sizeof(uint32_t)*alloc);
+    _index.valid = realloc(_index.valid, alloc);
+    _index.histogram = realloc(_index.histogram, sizeof(float)*DT_SIMILARITY_HISTOGRAM_STRIDE*alloc);
+    for(int c=0; c<4; c++)
+      _index.map[c] = realloc(_index.map[c], (size_t)DT_SIMILARITY_MAP_STRIDE*alloc);
+    _index.alloc = alloc;
+  }
+  const uint32_t k = _index.count++;
+  _index.id[k] = imgid;
+  _index.valid[k] = 0;
+  g_hash_table_insert(_index.slot, GINT_TO_POINTER(imgid), GINT_TO_POINTER(k+1));
+  return k;
 }
 
-/* scoring match of colormap */
-static float _similarity_match_colormap(dt_similarity_t *data, const dt_similarity_lightmap_t *target, const dt_similarity_lightmap_t *source)
+static void _similarity_index_set_histogram(int slot, const dt_similarity_histogram_t *histogram)
 {
-  float redscore = 0;
-  float greenscore = 0;
-  float bluescore = 0;
-  float score = 0;
+  float *h = _index.histogram + (size_t)DT_SIMILARITY_HISTOGRAM_STRIDE*slot;
+  for(int k=0; k<DT_SIMILARITY_HISTOGRAM_BUCKETS; k++)
+    for(int j=0; j<3; j++)
+      h[3*k+j] = histogram->rgbl[k][j];
+  _index.valid[slot] |= DT_SIMILARITY_VALID_HISTOGRAM;
+}
 
-  /* sum up the score */
-  for (int j=0; j<(DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE); j++)
+static void _similarity_index_set_lightmap(int slot, const dt_similarity_lightmap_t *lightmap)
+{
+  for(int c=0; c<4; c++)
   {
-    redscore    +=  fabs((float)(target->pixels[4*j+0] - source->pixels[4*j+0]) / 0xff);
-    greenscore  += fabs((float)(target->pixels[4*j+1] - source->pixels[4*j+1]) / 0xff);
-    bluescore   += fabs((float)(target->pixels[4*j+2] - source->pixels[4*j+2]) / 0xff);
+    uint8_t *m = _index.map[c] + (size_t)DT_SIMILARITY_MAP_STRIDE*slot;
+    for(int j=0; j<DT_SIMILARITY_MAP_PIXELS; j++)
+      m[j] = lightmap->pixels[4*j+c];
+    memset(m + DT_SIMILARITY_MAP_PIXELS, 0, DT_SIMILARITY_MAP_STRIDE - DT_SIMILARITY_MAP_PIXELS);
   }
+  _index.valid[slot] |= DT_SIMILARITY_VALID_LIGHTMAP;
+}
 
-  /* scale down score */
-  redscore    /= (DT_SIMILARITY_LIGHTMAP_SIZE * DT_SIMILARITY_LIGHTMAP_SIZE);
-  greenscore  /= (DT_SIMILARITY_LIGHTMAP_SIZE * DT_SIMILARITY_LIGHTMAP_SIZE);
-  bluescore   /= (DT_SIMILARITY_LIGHTMAP_SIZE * DT_SIMILARITY_LIGHTMAP_SIZE);
+/* reads all features from the database, once. needs the lock. */
+static void _similarity_index_load()
+{
+  if(_index.loaded) return;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id,histogram,lightmap from images", -1, &stmt, NULL);
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int slot = _similarity_index_slot(sqlite3_column_int(stmt, 0), TRUE);
+    if(sqlite3_column_bytes(stmt,1) == sizeof(dt_similarity_histogram_t))
+      _similarity_index_set_histogram(slot, sqlite3_column_blob(stmt, 1));
+    if(sqlite3_column_bytes(stmt,2) == sizeof(dt_similarity_lightmap_t))
+      _similarity_index_set_lightmap(slot, sqlite3_column_blob(stmt, 2));
+  }
+  sqlite3_finalize (stmt);
+  _index.loaded = 1;
+  dt_print(DT_DEBUG_PERF, "[similarity] loaded features of %d images\n", _index.count);
+}
 
-  //  fprintf(stderr,"weight: %f\n",data->redmap_weight+data->bluemap_weight+data->greenmap_weight);
-  score = ((redscore*data->redmap_weight) + (greenscore * data->greenmap_weight) + (bluescore*data->bluemap_weight)) / 3.0;
+/* sum of absolute differences of one zero padded map plane */
+static inline uint32_t _similarity_sad(const uint8_t *a, const uint8_t *b)
+{
+  __m128i sum = _mm_setzero_si128();
+  for(int j=0; j<DT_SIMILARITY_MAP_STRIDE; j+=16)
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_load_si128((const __m128i *)(a+j)), _mm_loadu_si128((const __m128i *)(b+j))));
+  return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+}
 
-  /* now we have each score for r,g and b channel, lets weight them and calculate
-      a main score for the match. */
-  // fprintf(stderr,"Color score %f,%f,%f total weighted score = %f\n",redscore,greenscore,bluescore,score);
+/* scores every indexed image against the target in slot t. each feature scores 1 minus its mean
+   absolute difference: the rgb histogram, the light plane and the weighted mean of the color planes.
+   the final score multiplies the three raised to their weights. */
+static void _similarity_index_score(const dt_similarity_t *data, const int t, float *score)
+{
+  const float *th = _index.histogram + (size_t)DT_SIMILARITY_HISTOGRAM_STRIDE*t;
+  uint8_t target[4][DT_SIMILARITY_MAP_STRIDE] __attribute__((aligned(16)));
+  for(int c=0; c<4; c++)
+    memcpy(target[c], _index.map[c] + (size_t)DT_SIMILARITY_MAP_STRIDE*t, DT_SIMILARITY_MAP_STRIDE);
+  const __m128 signmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const int n = _index.count;
+  const float map_norm = 1.0f/(0xff * DT_SIMILARITY_MAP_PIXELS);
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(data, target, th, score, _index) firstprivate(n, map_norm, signmask) schedule(static)
+#endif
+  for(int k=0; k<n; k++)
+  {
+    if(_index.valid[k] != (DT_SIMILARITY_VALID_HISTOGRAM|DT_SIMILARITY_VALID_LIGHTMAP))
+    {
+      score[k] = 0.0f;
+      continue;
+    }
 
-  return 1.0 - score;
+    const float *h = _index.histogram + (size_t)DT_SIMILARITY_HISTOGRAM_STRIDE*k;
+    __m128 hsum = _mm_setzero_ps();
+    for(int j=0; j<DT_SIMILARITY_HISTOGRAM_STRIDE; j+=4)
+      hsum = _mm_add_ps(hsum, _mm_and_ps(signmask, _mm_sub_ps(_mm_loadu_ps(th+j), _mm_loadu_ps(h+j))));
+    float hs[4];
+    _mm_storeu_ps(hs, hsum);
+    const float score_histogram = 1.0f - (hs[0]+hs[1]+hs[2]+hs[3])/(3.0f*DT_SIMILARITY_HISTOGRAM_BUCKETS);
+
+    float map[4];
+    for(int c=0; c<4; c++)
+      map[c] = _similarity_sad(target[c], _index.map[c] + (size_t)DT_SIMILARITY_MAP_STRIDE*k) * map_norm;
+    const float score_lightmap = 1.0f - map[3];
+    const float score_colormap = 1.0f - (map[0]*data->redmap_weight + map[1]*data->greenmap_weight + map[2]*data->bluemap_weight) / 3.0f;
+
+    score[k] = powf(score_histogram, data->histogram_weight) *
+               powf(score_lightmap, data->lightmap_weight) *
+               powf(score_colormap, data->redmap_weight);
+  }
 }
 
 void dt_similarity_match_image(uint32_t imgid,dt_similarity_t *data)
 {
   sqlite3_stmt *stmt;
-  gboolean all_ok_for_match = TRUE;
-  dt_similarity_histogram_t orginal_histogram,test_histogram;
-  dt_similarity_lightmap_t orginal_lightmap,test_lightmap;
 
   /* create temporary mem table for matches */
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "create temporary table if not exists similar_images (id integer,score real)", NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from similar_images", NULL, NULL, NULL);
+
+  dt_pthread_mutex_lock(&_index.lock);
+  _similarity_index_load();
 
   /*
    * get the histogram and lightmap data for image to match against
    */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select histogram,lightmap from images where id = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
+  const int t = _similarity_index_slot(imgid, FALSE);
+  if(t < 0 || _index.valid[t] != (DT_SIMILARITY_VALID_HISTOGRAM|DT_SIMILARITY_VALID_LIGHTMAP))
   {
-    /* get the histogram data */
-    uint32_t size = sqlite3_column_bytes(stmt,0);
-    if (size!=sizeof(dt_similarity_histogram_t))
-    {
-      all_ok_for_match = FALSE;
-      dt_control_log(_("this image has not been indexed yet."));
-    }
-    else
-      memcpy(&orginal_histogram, sqlite3_column_blob(stmt, 0), sizeof(dt_similarity_histogram_t));
-
-    /* get the lightmap data */
-    size = sqlite3_column_bytes(stmt,1);
-    if (size!=sizeof(dt_similarity_lightmap_t))
-    {
-      all_ok_for_match = FALSE;
-      dt_control_log(_("this image has not been indexed yet."));
-    }
-    else
-      memcpy(&orginal_lightmap, sqlite3_column_blob(stmt, 1), sizeof(dt_similarity_lightmap_t));
-
-  }
-  else
-  {
-    all_ok_for_match = FALSE;
+    dt_pthread_mutex_unlock(&_index.lock);
     dt_control_log(_("this image has not been indexed yet."));
+    return;
   }
-  sqlite3_reset(stmt);
-  sqlite3_clear_bindings(stmt);
 
+  /* score all images at once, then collect the matches */
+  const double start = dt_get_wtime();
+  float *score = malloc(sizeof(float)*_index.count);
+  _similarity_index_score(data, t, score);
+
+  // keep the ids, the index might be reloaded as soon as the lock is dropped:
+  uint32_t *match = malloc(sizeof(uint32_t)*_index.count);
+  int num_matches = 0;
+  for(int k=0; k<_index.count; k++)
+    if(score[k] >= 0.92 && k != t)
+    {
+      match[num_matches] = _index.id[k];
+      score[num_matches++] = score[k];
+    }
+  const int count = _index.count;
+  dt_pthread_mutex_unlock(&_index.lock);
 
   /*
-   * if all ok lets begin matching
+   * insert the result in one transaction, target image with 100.0 in score to ensure it always shown in top.
+   * this is done without _index.lock, the indexer takes it inside its transaction.
    */
-  if (all_ok_for_match)
+  dt_database_begin(darktable.db);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from similar_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert into similar_images(id,score) values(?1,?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_bind_double(stmt, 2, 100.0);
+  sqlite3_step(stmt);
+  for(int k=0; k<num_matches; k++)
   {
-    char query[4096]= {0};
-
-    /* add target image with 100.0 in score into result to ensure it always shown in top */
-    sprintf(query,"insert into similar_images(id,score) values(%d,%f)",imgid,100.0);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
-
+    sqlite3_reset(stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, match[k]);
+    sqlite3_bind_double(stmt, 2, score[k]);
+    sqlite3_step(stmt);
+  }
+  sqlite3_finalize (stmt);
+  dt_database_commit(darktable.db);
+  dt_print(DT_DEBUG_PERF, "[similarity] matched %d of %d images in %.3f secs\n", num_matches, count, dt_get_wtime() - start);
+  free(match);
+  free(score);
+
+  /* set an extended collection query for viewing the result of match */
+  dt_collection_set_extended_where(darktable.collection, ", similar_images where images.id = similar_images.id order by similar_images.score desc");
+  dt_collection_set_query_flags( darktable.collection,
+                                 dt_collection_get_query_flags(darktable.collection) | COLLECTION_QUERY_USE_ONLY_WHERE_EXT);
+  dt_collection_update(darktable.collection);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+
+  /* lets redraw the view */
+  dt_control_queue_redraw_center();
+}
 
-    /* set an extended collection query for viewing the result of match */
-    dt_collection_set_extended_where(darktable.collection, ", similar_images where images.id = similar_images.id order by similar_images.score desc");
-    dt_collection_set_query_flags( darktable.collection,
-                                   dt_collection_get_query_flags(darktable.collection) | COLLECTION_QUERY_USE_ONLY_WHERE_EXT);
-    dt_collection_update(darktable.collection);
-    dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+/* queues imgid for the indexer, and starts it if asked to. the stamp changes with every call, so
+   an image dirtied again while the indexer is busy with it won't be dequeued with the outdated features. */
+static void _similarity_queue(uint32_t imgid, const int start)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert or replace into similarity_queue (imgid, stamp) values (?1, ?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_bind_int64(stmt, 2, g_get_real_time());
+  sqlite3_step(stmt);
+  sqlite3_finalize (stmt);
 
+  if(start && dt_control_running()) dt_control_start_indexer();
+}
 
-    /* loop thru images and generate score table */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id,histogram,lightmap from images", -1, &stmt, NULL);
-    while (sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      float score_histogram=0, score_lightmap=0, score_colormap=0;
-
-      /* verify size of histogram and lightmap blob of test image */
-      if (
-        (sqlite3_column_bytes(stmt,1) == sizeof(dt_similarity_histogram_t)) &&
-        (sqlite3_column_bytes(stmt,2) == sizeof(dt_similarity_lightmap_t))
-      )
-      {
-        /*
-         * Get the histogram blob and calculate the similarity score
-         */
-        memcpy(&test_histogram, sqlite3_column_blob(stmt, 1), sizeof(dt_similarity_histogram_t));
-        score_histogram = _similarity_match_histogram_rgb(data, &orginal_histogram, &test_histogram);
-
-        /*
-         * Get the lightmap blob and calculate the similarity score
-         *  1.08 is a tuned constant that works well with threshold
-         */
-        memcpy(&test_lightmap, sqlite3_column_blob(stmt, 2), sizeof(dt_similarity_lightmap_t));
-        score_lightmap = _similarity_match_lightmap(data, &orginal_lightmap, &test_lightmap);
-
-        /*
-         * then calculate the colormap similarity score
-         */
-        score_colormap = _similarity_match_colormap(data, &orginal_lightmap, &test_lightmap);
-
-
-        /*
-         * calculate the similarity score
-         */
-        float score =  (pow(score_histogram, data->histogram_weight) *
-                        pow(score_lightmap, data->lightmap_weight) *
-                        pow(score_colormap, data->redmap_weight));
-
-        // fprintf(stderr,"score: %f, histo: %f, light: %f, color: %f\n",score,score_histogram,score_lightmap,score_colormap);
-
-
-        /*
-         * If current images scored, lets add it to similar_images table
-         */
-        if(score >= 0.92)
-        {
-          sprintf(query,"insert into similar_images(id,score) values(%d,%f)",sqlite3_column_int(stmt, 0),score);
-          DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
-
-          /* lets redraw the view */
-          dt_control_queue_redraw_center();
-        }
-      }
-      else
-        fprintf(stderr,"Image has inconsisten similarity matching data..\n");
-    }
-  }
+static void _similarity_image_mark(uint32_t imgid, const int start)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "update images set histogram = NULL, lightmap = NULL where id = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
   sqlite3_finalize (stmt);
 
+  dt_pthread_mutex_lock(&_index.lock);
+  const int slot = _similarity_index_slot(imgid, FALSE);
+  if(slot >= 0) _index.valid[slot] = 0;
+  dt_pthread_mutex_unlock(&_index.lock);
+
+  _similarity_queue(imgid, start);
 }
 
 void dt_similarity_image_dirty(uint32_t imgid)
 {
-  dt_similarity_histogram_dirty(imgid);
-  dt_similarity_lightmap_dirty(imgid);
+  _similarity_image_mark(imgid, 1);
+}
+
+void dt_similarity_image_edited(uint32_t imgid)
+{
+  // the develop paths call this on every change, the image only needs to be marked once:
+  dt_pthread_mutex_lock(&_index.lock);
+  const int marked = (_index.edited == imgid);
+  _index.edited = imgid;
+  dt_pthread_mutex_unlock(&_index.lock);
+  if(!marked) _similarity_image_mark(imgid, 0);
 }
 
 void dt_similarity_histogram_dirty(uint32_t imgid)
@@ -235,6 +319,13 @@ void dt_similarity_histogram_dirty(uint32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize (stmt);
+
+  dt_pthread_mutex_lock(&_index.lock);
+  const int slot = _similarity_index_slot(imgid, FALSE);
+  if(slot >= 0) _index.valid[slot] &= ~DT_SIMILARITY_VALID_HISTOGRAM;
+  dt_pthread_mutex_unlock(&_index.lock);
+
+  _similarity_queue(imgid, 1);
 }
 
 void dt_similarity_histogram_store(uint32_t imgid, const dt_similarity_histogram_t *histogram)
@@ -245,6 +336,13 @@ void dt_similarity_histogram_store(uint32_t imgid, const dt_similarity_histogram
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize (stmt);
+
+  /* before the first match the index isn't loaded, it will pick this up from the database */
+  dt_pthread_mutex_lock(&_index.lock);
+  if(_index.loaded) _similarity_index_set_histogram(_similarity_index_slot(imgid, TRUE), histogram);
+  // further edits have to mark the image again:
+  if(_index.edited == imgid) _index.edited = 0;
+  dt_pthread_mutex_unlock(&_index.lock);
 #ifdef _DEBUG
   _similarity_dump_histogram(imgid,histogram);
 #endif
@@ -258,6 +356,11 @@ void dt_similarity_lightmap_store(uint32_t imgid, const dt_similarity_lightmap_t
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize (stmt);
+
+  dt_pthread_mutex_lock(&_index.lock);
+  if(_index.loaded) _similarity_index_set_lightmap(_similarity_index_slot(imgid, TRUE), lightmap);
+  if(_index.edited == imgid) _index.edited = 0;
+  dt_pthread_mutex_unlock(&_index.lock);
 }
 
 void dt_similarity_lightmap_dirty(uint32_t imgid)
@@ -267,6 +370,13 @@ void dt_similarity_lightmap_dirty(uint32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize (stmt);
+
+  dt_pthread_mutex_lock(&_index.lock);
+  const int slot = _similarity_index_slot(imgid, FALSE);
+  if(slot >= 0) _index.valid[slot] &= ~DT_SIMILARITY_VALID_LIGHTMAP;
+  dt_pthread_mutex_unlock(&_index.lock);
+
+  _similarity_queue(imgid, 1);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -41,14 +41,22 @@ typedef struct dt_similarity_imagemap_t
   uint8_t pixels[DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE*4];
 } dt_similarity_lightmap_t;
 
+/** sets up and frees the in-memory feature index used for matching. */
+void dt_similarity_init();
+void dt_similarity_cleanup();
+
+/** clears all features of imgid and queues it for the indexer. */
 void dt_similarity_image_dirty(uint32_t imgid);
+/** same, for the develop paths which call this on every change: doesn't start the indexer,
+    leaving darkroom does that. the image is marked only once until it gets indexed. */
+void dt_similarity_image_edited(uint32_t imgid);
 
 /** \brief stores the histogram with the imgid to database
 	\note a histogram is generated in a DT_SIMILARITY_HISTOGRAM_BUCKETSx4 float array.
 	\see dt_dev_pixelpipe_process_rec()
 */
 void dt_similarity_histogram_store(uint32_t imgid, const dt_similarity_histogram_t *histogram);
-/** marks histogram data for imgid as dirty and will be regenerated at next indexing. */
+/** marks histogram data for imgid as dirty and queues the image, it will be regenerated at next indexing. */
 void dt_similarity_histogram_dirty(uint32_t imgid);
 
 void dt_similarity_lightmap_store(uint32_t imgid, const dt_similarity_lightmap_t *lightmap);
@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/collection.h"
 #include "common/darktable.h"
 #include "develop/develop.h"
 #include "control/control.h"
@@ -400,6 +401,7 @@ dt_styles_apply_to_image(const char *name,gboolean duplicate, int32_t imgid)
     /* redraw center view to update visible mipmaps */
     dt_control_queue_redraw_center();
   }
+  dt_collection_invalidate();
 }
 
 
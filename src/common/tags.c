@@ -17,12 +17,93 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/collection.h"
 #include "common/darktable.h"
 #include "common/tags.h"
 #include "common/debug.h"
 #include "control/conf.h"
 #include "control/control.h"
 
+/*
+ * tagxtag counts how often two tags were attached to the same image, for the
+ * suggestions. it is sparse: there is one row per pair of tags that are on an image
+ * together, with id1 < id2, and no row for all the pairs that never met. changes are
+ * collected in memory.tagxtag_delta (signed) and then applied in one go. that table is shared
+ * by all threads, so it is only ever touched between dt_database_begin() and dt_database_commit().
+ */
+
+static void _tag_apply_delta()
+{
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "INSERT OR IGNORE INTO tagxtag (id1, id2, count) "
+                        "SELECT id1, id2, 0 FROM memory.tagxtag_delta WHERE count > 0",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "UPDATE tagxtag SET count = count + "
+                        "(SELECT D.count FROM memory.tagxtag_delta D WHERE D.id1 = tagxtag.id1 AND D.id2 = tagxtag.id2) "
+                        "WHERE rowid IN (SELECT T.rowid FROM tagxtag T JOIN memory.tagxtag_delta D "
+                        "ON T.id1 = D.id1 AND T.id2 = D.id2)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "DELETE FROM tagxtag WHERE count <= 0 AND rowid IN "
+                        "(SELECT T.rowid FROM tagxtag T JOIN memory.tagxtag_delta D "
+                        "ON T.id1 = D.id1 AND T.id2 = D.id2 WHERE D.count < 0)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "DELETE FROM memory.tagxtag_delta", NULL, NULL, NULL);
+}
+
+// counts the pairs of tagid with the other tags of imgid (or the selected images, if < 0),
+// for the images which don't have tagid yet (sign > 0) or which have it (sign < 0).
+static void _tag_count_tag(const guint tagid, const gint imgid, const int sign)
+{
+  sqlite3_stmt *stmt;
+  char query[1024];
+  snprintf(query, sizeof(query),
+           "INSERT INTO memory.tagxtag_delta (id1, id2, count) "
+           "SELECT MIN(?1, tagid), MAX(?1, tagid), ?3 * COUNT(*) FROM tagged_images "
+           "WHERE tagid != ?1 AND imgid IN (%s) "
+           "AND imgid %s IN (SELECT imgid FROM tagged_images WHERE tagid = ?1) GROUP BY tagid",
+           imgid > 0 ? "?2" : "SELECT imgid FROM selected_images", sign > 0 ? "NOT" : "");
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+  if(imgid > 0) DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, sign);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  _tag_apply_delta();
+}
+
+// counts all pairs of tags on the images returned by the images subquery, which takes id as ?1.
+static void _tag_count_images(const char *images, const gint id, const int sign)
+{
+  sqlite3_stmt *stmt;
+  char query[1024];
+  snprintf(query, sizeof(query),
+           "INSERT INTO memory.tagxtag_delta (id1, id2, count) "
+           "SELECT A.tagid, B.tagid, ?2 * COUNT(*) FROM tagged_images A JOIN tagged_images B "
+           "ON A.imgid = B.imgid AND A.tagid < B.tagid WHERE A.imgid IN (%s) GROUP BY A.tagid, B.tagid",
+           images);
+  dt_database_begin(darktable.db);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, sign);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  _tag_apply_delta();
+  dt_database_commit(darktable.db);
+}
+
+void dt_tag_count_image(gint imgid, int sign)
+{
+  _tag_count_images("?1", imgid, sign);
+}
+
+void dt_tag_count_film(gint filmid, int sign)
+{
+  _tag_count_images("SELECT id FROM images WHERE film_id = ?1", filmid, sign);
+}
+
 gboolean dt_tag_new(const char *name,guint *tagid)
 {
   int rt;
@@ -59,18 +140,6 @@ gboolean dt_tag_new(const char *name,guint *tagid)
     id = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO tagxtag SELECT id, ?1, 0 FROM tags", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "UPDATE tagxtag SET count = 1000000 WHERE id1 = ?1 AND id2 = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
   if( tagid != NULL)
     *tagid=id;
 
@@ -117,6 +186,7 @@ guint dt_tag_remove(const guint tagid, gboolean final)
 
   }
 
+  dt_collection_invalidate();
   return count;
 }
 
@@ -185,10 +255,12 @@ gboolean dt_tag_exists(const char *name,guint *tagid)
   return FALSE;
 }
 
-//FIXME: shall we increment count in tagxtag if the image was already tagged?
 void dt_tag_attach(guint tagid,gint imgid)
 {
   sqlite3_stmt *stmt;
+  // count the new pairs before the images get the tag, so that the ones which have it already are skipped:
+  dt_database_begin(darktable.db);
+  _tag_count_tag(tagid, imgid, 1);
   if(imgid > 0)
   {
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -198,17 +270,6 @@ void dt_tag_attach(guint tagid,gint imgid)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE "
-                                "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) "
-                                "OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
   }
   else
   {
@@ -219,28 +280,22 @@ void dt_tag_attach(guint tagid,gint imgid)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM selected_images JOIN tagged_images)) OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM selected_images "
-                                "JOIN tagged_images))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
   }
+  dt_database_commit(darktable.db);
+  dt_collection_invalidate();
 }
 
 void dt_tag_attach_list(GList *tags,gint imgid)
 {
   GList *child=NULL;
+  dt_database_begin(darktable.db);
   if( (child=g_list_first(tags))!=NULL )
     do
     {
       dt_tag_attach((guint)(long int)child->data,imgid);
     }
     while( (child=g_list_next(child)) !=NULL);
+  dt_database_commit(darktable.db);
 }
 
 void dt_tag_attach_string_list(const gchar *tags, gint imgid)
@@ -272,20 +327,11 @@ void dt_tag_attach_string_list(const gchar *tags, gint imgid)
 void dt_tag_detach(guint tagid,gint imgid)
 {
   sqlite3_stmt *stmt;
+  dt_database_begin(darktable.db);
+  _tag_count_tag(tagid, imgid, -1);
   if(imgid > 0)
   {
     // remove from specified image by id
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count - 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM tagged_images WHERE imgid = ?2)) OR (id2 = ?1 "
-                                "AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    // remove from tagged_images
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2",
                                 -1, &stmt, NULL);
@@ -297,16 +343,6 @@ void dt_tag_detach(guint tagid,gint imgid)
   else
   {
     // remove from all selected images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "update tagxtag set count = count - 1 where (id1 = ?1 and id2 in "
-                                "(select tagid from selected_images join tagged_images)) or (id2 = ?1 "
-                                "and id1 in (select tagid from selected_images join tagged_images))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    // remove from tagged_images
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "delete from tagged_images where tagid = ?1 and imgid in "
                                 "(select imgid from selected_images)", -1, &stmt, NULL);
@@ -314,6 +350,8 @@ void dt_tag_detach(guint tagid,gint imgid)
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
   }
+  dt_database_commit(darktable.db);
+  dt_collection_invalidate();
 }
 
 void dt_tag_detach_by_string(const char *name, gint imgid)
@@ -322,8 +360,13 @@ void dt_tag_detach_by_string(const char *name, gint imgid)
   g_snprintf(query, sizeof(query),
              "DELETE FROM tagged_images WHERE tagid IN (SELECT id FROM "
              "tags WHERE name LIKE '%s') AND imgid = %d;", name, imgid);
+  // recount the pairs of the image, we don't know which tags match:
+  dt_database_begin(darktable.db);
+  dt_tag_count_image(imgid, -1);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query,
                         NULL, NULL, NULL);
+  dt_tag_count_image(imgid, 1);
+  dt_database_commit(darktable.db);
 }
 
 
@@ -452,7 +495,7 @@ gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
  *
  * We do not suggest tags which have not yet been matched up in tagxtag,
  * because it is up to the user to add new tags to the list and thereby
- * make the association.
+ * make the association. The tags matching the keyword are listed, too.
  *
  * Expressing these as separate queries avoids making the sqlite3 engine
  * do a large number of operations and thus makes the user experience
@@ -517,6 +560,12 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
                         "ORDER BY TXT.count DESC",
                         NULL, NULL, NULL);
 
+  /* tagxtag doesn't pair tags with themselves, add the matches directly */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "INSERT OR REPLACE INTO memory.taglist (id, count) "
+                        "SELECT id, 1000000 FROM memory.tagq",
+                        NULL, NULL, NULL);
+
   /* Now put all the bits together */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT T.name, T.id, MT.count FROM tags T JOIN memory.taglist MT ON "
@@ -73,6 +73,12 @@ uint32_t dt_tag_get_recent_used(GList **result);
 /** frees the memory of a result set. */
 void dt_tag_free_result(GList **result);
 
+/** adds (sign > 0) or removes (sign < 0) the pairs of tags of an image to the co-occurrence counts the suggestions are made from. call it after tags were copied onto a new image, or before the image's tags are removed. */
+void dt_tag_count_image(gint imgid, int sign);
+
+/** same as dt_tag_count_image(), for all images of a film roll. */
+void dt_tag_count_film(gint filmid, int sign);
+
 /** reorgnize tags */
 void dt_tag_reorganize(const gchar *source, const gchar *dest);
 
@@ -65,6 +65,19 @@ static void * _control_worker_kicker(void *ptr);
 /* redraw mutex to synchronize redraws */
 static dt_pthread_mutex_t _control_gdk_lock_threads_mutex;
 
+/* a shard of the job queue. every worker owns one and prefers it, but takes work from the
+   others whenever they hold something more urgent, so no priority ever waits behind a lower one. */
+typedef struct dt_control_deque_t
+{
+  dt_pthread_mutex_t lock;
+  GQueue queue[DT_JOB_PRIORITY_COUNT]; // head is served first
+  GHashTable *jobs;                    // queued dt_job_t -> its link in queue[], for dedup and revive
+}
+dt_control_deque_t;
+
+static guint _control_job_hash(gconstpointer key);
+static gboolean _control_job_equal(gconstpointer a, gconstpointer b);
+
 void dt_ctl_settings_default(dt_control_t *c)
 {
   dt_conf_set_string ("database", "library.db");
@@ -181,6 +194,10 @@ static void dt_control_sanitize_database()
                         "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT REPLACE, "
                         "count INTEGER)",
                         NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "CREATE TABLE memory.tagxtag_delta (id1 INTEGER, id2 INTEGER, count INTEGER, "
+                        "PRIMARY KEY (id1, id2))",
+                        NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "CREATE TABLE memory.history (imgid integer, num integer, module integer, "
                         "operation varchar(256) UNIQUE ON CONFLICT REPLACE, op_params blob, enabled integer, "
@@ -412,6 +429,8 @@ void dt_control_create_database_schema()
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table tagxtag (id1 integer, id2 integer, count integer, "
                         "primary key(id1, id2))", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "create index tagxtag_id2_index on tagxtag (id2)", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table tagged_images (imgid integer, tagid integer, "
                         "primary key(imgid, tagid))", NULL, NULL, NULL);
@@ -427,6 +446,10 @@ void dt_control_create_database_schema()
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table meta_data (id integer,key integer,value varchar)",
                         NULL, NULL, NULL);
+  // images waiting for the similarity indexer:
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "create table similarity_queue (imgid integer primary key, stamp integer)",
+                        NULL, NULL, NULL);
   // quick hack to detect if the db is already used by another process
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table lock (id integer)",
@@ -458,6 +481,7 @@ void dt_control_init(dt_control_t *s)
     dt_ctl_settings_default(s);
 
   pthread_cond_init(&s->cond, NULL);
+  pthread_cond_init(&s->queue_space, NULL);
   dt_pthread_mutex_init(&s->cond_mutex, NULL);
   dt_pthread_mutex_init(&s->queue_mutex, NULL);
   dt_pthread_mutex_init(&s->run_mutex, NULL);
@@ -466,6 +490,19 @@ void dt_control_init(dt_control_t *s)
   // start threads
   s->num_threads = CLAMP(dt_conf_get_int ("worker_threads"), 1, 8);
   s->thread = (pthread_t *)malloc(sizeof(pthread_t)*s->num_threads);
+  s->deque = (dt_control_deque_t *)malloc(sizeof(dt_control_deque_t)*s->num_threads);
+  for(int k=0; k<s->num_threads; k++)
+  {
+    dt_pthread_mutex_init(&s->deque[k].lock, NULL);
+    for(int p=0; p<DT_JOB_PRIORITY_COUNT; p++)
+      g_queue_init(&s->deque[k].queue[p]);
+    s->deque[k].jobs = g_hash_table_new(_control_job_hash, _control_job_equal);
+  }
+  for(int p=0; p<DT_JOB_PRIORITY_COUNT; p++)
+    s->queued[p] = 0;
+  s->job_seq = 0;
+  s->delayed = NULL;
+  s->num_delayed = 0;
   dt_pthread_mutex_lock(&s->run_mutex);
   s->running = 1;
   dt_pthread_mutex_unlock(&s->run_mutex);
@@ -550,6 +587,8 @@ void dt_control_init(dt_control_t *s)
                    "drop table style_items", NULL, NULL, NULL);
       sqlite3_exec(dt_database_get(darktable.db),
                    "drop table meta_data", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db),
+                   "drop table similarity_queue", NULL, NULL, NULL);
       sqlite3_exec(dt_database_get(darktable.db),
                    "drop index imgid_index", NULL, NULL, NULL);
       sqlite3_exec(dt_database_get(darktable.db),
@@ -655,6 +694,29 @@ void dt_control_init(dt_control_t *s)
       sqlite3_exec(dt_database_get(darktable.db),
                    "alter table images add column lightmap blob",
                    NULL, NULL, NULL);
+      // queue for the similarity indexer, seeded with what it used to find by scanning all images:
+      if(sqlite3_exec(dt_database_get(darktable.db),
+                      "create table similarity_queue (imgid integer primary key, stamp integer)",
+                      NULL, NULL, NULL) == SQLITE_OK)
+        sqlite3_exec(dt_database_get(darktable.db),
+                     "insert into similarity_queue (imgid, stamp) select id, 0 from images "
+                     "where histogram is null or lightmap is null",
+                     NULL, NULL, NULL);
+      // tagxtag used to hold a row for every pair of tags. keep only the pairs that are on
+      // an image together, recounted from scratch, and index the other direction, too:
+      if(sqlite3_exec(dt_database_get(darktable.db),
+                      "create index tagxtag_id2_index on tagxtag (id2)",
+                      NULL, NULL, NULL) == SQLITE_OK)
+      {
+        sqlite3_exec(dt_database_get(darktable.db), "begin transaction", NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db), "delete from tagxtag", NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db),
+                     "insert into tagxtag (id1, id2, count) select A.tagid, B.tagid, count(*) "
+                     "from tagged_images A join tagged_images B on A.imgid = B.imgid and A.tagid < B.tagid "
+                     "group by A.tagid, B.tagid",
+                     NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+      }
 /*      sqlite3_exec(dt_database_get(darktable.db),
                    "alter table film_rolls add column external_drive varchar(1024)",
                    NULL, NULL, NULL);
@@ -838,6 +900,21 @@ void dt_control_cleanup(dt_control_t *s)
   // vacuum TODO: optional?
   // DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "PRAGMA incremental_vacuum(0)", NULL, NULL, NULL);
   // DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "vacuum", NULL, NULL, NULL);
+  // drop whatever is left in the queue, the workers are gone already.
+  for(int k=0; k<s->num_threads; k++)
+  {
+    for(int p=0; p<DT_JOB_PRIORITY_COUNT; p++)
+    {
+      dt_job_t *j;
+      while((j = g_queue_pop_head(&s->deque[k].queue[p]))) g_free(j);
+    }
+    g_hash_table_destroy(s->deque[k].jobs);
+    dt_pthread_mutex_destroy(&s->deque[k].lock);
+  }
+  free(s->deque);
+  for(GList *l = s->delayed; l; l = g_list_next(l)) g_free(l->data);
+  g_list_free(s->delayed);
+  pthread_cond_destroy(&s->queue_space);
   dt_pthread_mutex_destroy(&s->queue_mutex);
   dt_pthread_mutex_destroy(&s->cond_mutex);
   dt_pthread_mutex_destroy(&s->log_mutex);
@@ -861,6 +938,7 @@ void dt_control_job_init(dt_job_t *j, const char *msg, ...)
   va_end(ap);
 #endif
   j->state = DT_JOB_STATE_INITIALIZED;
+  j->priority = DT_JOB_PRIORITY_NORMAL;
   dt_pthread_mutex_init (&j->state_mutex,NULL);
   dt_pthread_mutex_init (&j->wait_mutex,NULL);
 }
@@ -871,6 +949,11 @@ void dt_control_job_set_state_callback(dt_job_t *j,dt_job_state_change_callback
   j->user_data = user_data;
 }
 
+void dt_control_job_set_priority(dt_job_t *j, dt_job_priority_t priority)
+{
+  j->priority = CLAMP(priority, DT_JOB_PRIORITY_BACKGROUND, DT_JOB_PRIORITY_COUNT-1);
+}
+
 
 void dt_control_job_print(dt_job_t *j)
 {
@@ -950,55 +1033,143 @@ int32_t dt_control_run_job_res(dt_control_t *s, int32_t res)
 }
 
 
-int32_t dt_control_run_job(dt_control_t *s)
+/* two jobs are equivalent if they would do the same work: same function, same parameters,
+   same callback and the same delay. the state, timestamps and mutexes don't matter. */
+static guint _control_job_hash(gconstpointer key)
 {
-  dt_job_t *j=NULL,*bj=NULL;
-  dt_pthread_mutex_lock(&s->queue_mutex);
+  const dt_job_t *j = (const dt_job_t *)key;
+  guint hash = 5381;
+  hash = ((hash << 5) + hash) ^ (guint)(size_t)j->execute;
+  hash = ((hash << 5) + hash) ^ (guint)(size_t)j->state_changed_cb;
+  hash = ((hash << 5) + hash) ^ (guint)(size_t)j->user_data;
+  hash = ((hash << 5) + hash) ^ (guint)(j->ts_execute > j->ts_added ? j->ts_execute - j->ts_added : 0);
+  const uint8_t *param = (const uint8_t *)j->param;
+  for(int k=0; k<sizeof(j->param); k++)
+    hash = ((hash << 5) + hash) ^ param[k];
+  return hash;
+}
 
-  /* check if queue is empty */
-  if(g_list_length(s->queue) == 0)
+static gboolean _control_job_equal(gconstpointer a, gconstpointer b)
+{
+  const dt_job_t *ja = (const dt_job_t *)a, *jb = (const dt_job_t *)b;
+  const time_t da = ja->ts_execute > ja->ts_added ? ja->ts_execute - ja->ts_added : 0;
+  const time_t db = jb->ts_execute > jb->ts_added ? jb->ts_execute - jb->ts_added : 0;
+  return ja->execute == jb->execute && ja->state_changed_cb == jb->state_changed_cb &&
+         ja->user_data == jb->user_data && da == db && !memcmp(ja->param, jb->param, sizeof(ja->param));
+}
+
+static inline dt_control_deque_t *_control_job_deque(dt_control_t *s, const dt_job_t *j)
+{
+  return s->deque + _control_job_hash(j) % s->num_threads;
+}
+
+/* a job left the queue: wake up producers that are throttled on this priority. */
+static void _control_job_dequeued(dt_control_t *s, const dt_job_priority_t p)
+{
+  if(__sync_fetch_and_sub(&s->queued[p], 1) >= DT_CONTROL_MAX_JOBS)
   {
+    dt_pthread_mutex_lock(&s->queue_mutex);
+    pthread_cond_broadcast(&s->queue_space);
     dt_pthread_mutex_unlock(&s->queue_mutex);
-    return -1;
   }
+}
 
-  /* go thru the queue and find one normal job and a background job
-      that is up for execution.*/
-  time_t ts_now = time(NULL);
-  GList *jobitem=g_list_first(s->queue);
-  if(jobitem)
-    do
+/* take the most urgent job, looking at the own deque first and stealing from the others after. */
+static dt_job_t *_control_pop_job(dt_control_t *s)
+{
+  int self = dt_control_get_threadid();
+  if(self >= s->num_threads) self = 0;
+  for(int p=DT_JOB_PRIORITY_COUNT-1; p>=0; p--)
+  {
+    if(!s->queued[p]) continue;
+    for(int k=0; k<s->num_threads; k++)
     {
-      dt_job_t *tj = jobitem->data;
-
-      /* check if it's a scheduled job and is waiting to be executed */
-      if(!bj && (tj->ts_execute > tj->ts_added) && tj->ts_execute <= ts_now)
-        bj = tj;
-      else if ((tj->ts_execute < tj->ts_added) && !j)
-        j = tj;
-
-      /* if we got a normal job, and a background job, we are finished */
-      if(bj && j) break;
-
+      dt_control_deque_t *d = s->deque + (self + k) % s->num_threads;
+      dt_pthread_mutex_lock(&d->lock);
+      dt_job_t *j = g_queue_pop_head(&d->queue[p]);
+      if(j) g_hash_table_remove(d->jobs, j);
+      dt_pthread_mutex_unlock(&d->lock);
+      if(j)
+      {
+        _control_job_dequeued(s, p);
+        return j;
+      }
     }
-    while ((jobitem = g_list_next(jobitem)));
+  }
+  return NULL;
+}
 
-  /* remove the found jobs from queue */
-  if (bj)
-    s->queue = g_list_remove(s->queue, bj);
+/* removes the job of priority p that was queued or revived longest ago from the shard holding the most of them, other than keep. */
+static dt_job_t *_control_evict_oldest(dt_control_t *s, const dt_job_priority_t p, const dt_job_t *keep)
+{
+  // the lengths are only a hint, we don't lock all shards at once:
+  dt_control_deque_t *fullest = NULL;
+  guint length = 0;
+  for(int k=0; k<s->num_threads; k++)
+  {
+    const guint l = g_queue_get_length(&s->deque[k].queue[p]);
+    if(l > length)
+    {
+      length = l;
+      fullest = s->deque + k;
+    }
+  }
+  if(!fullest) return NULL;
 
-  if (j)
-    s->queue = g_list_remove(s->queue, j);
+  // revived jobs are pushed to the head, so the head is not the oldest. go by the
+  // sequence number instead, which revival refreshes:
+  dt_pthread_mutex_lock(&fullest->lock);
+  GList *oldest = NULL;
+  for(GList *l = fullest->queue[p].head; l; l = g_list_next(l))
+  {
+    const dt_job_t *c = (const dt_job_t *)l->data;
+    if(c != keep && (!oldest || (int32_t)(c->seq - ((const dt_job_t *)oldest->data)->seq) < 0)) oldest = l;
+  }
+  dt_job_t *j = NULL;
+  if(oldest)
+  {
+    j = (dt_job_t *)oldest->data;
+    g_queue_delete_link(&fullest->queue[p], oldest);
+    g_hash_table_remove(fullest->jobs, j);
+    __sync_fetch_and_sub(&s->queued[p], 1);
+  }
+  dt_pthread_mutex_unlock(&fullest->lock);
+  return j;
+}
 
-  /* unlock the queue */
+/* hand a scheduled job whose time has come to the reserved background worker. */
+static void _control_run_delayed(dt_control_t *s)
+{
+  if(!s->num_delayed) return;
+  dt_job_t *bj = NULL;
+  const time_t ts_now = time(NULL);
+  dt_pthread_mutex_lock(&s->queue_mutex);
+  for(GList *l = s->delayed; l; l = g_list_next(l))
+  {
+    dt_job_t *tj = (dt_job_t *)l->data;
+    if(tj->ts_execute <= ts_now)
+    {
+      bj = tj;
+      s->delayed = g_list_delete_link(s->delayed, l);
+      __sync_fetch_and_sub(&s->num_delayed, 1);
+      break;
+    }
+  }
   dt_pthread_mutex_unlock(&s->queue_mutex);
 
-  /* push background job on reserved backgruond worker */
   if(bj)
   {
     dt_control_add_job_res(s,bj,DT_CTL_WORKER_7);
     g_free (bj);
   }
+}
+
+int32_t dt_control_run_job(dt_control_t *s)
+{
+  _control_run_delayed(s);
+
+  dt_job_t *j = _control_pop_job(s);
+
   /* dont continue if we dont have have a job to execute */
   if(!j)
     return -1;
@@ -1065,52 +1236,111 @@ int32_t dt_control_add_background_job(dt_control_t *s, dt_job_t *job, time_t del
   return dt_control_add_job(s,job);
 }
 
+/* only threads that can't hold up the workers may be throttled: the gui thread might hold
+   the gdk lock a job is waiting for, and a worker would wait for itself. */
+static int _control_may_throttle(dt_control_t *s)
+{
+  if(pthread_equal(s->gui_thread, pthread_self())) return 0;
+  if(dt_control_get_threadid() < s->num_threads) return 0;
+  if(dt_control_get_threadid_res() < DT_CTL_WORKER_RESERVED) return 0;
+  return 1;
+}
+
+static int32_t _control_add_delayed_job(dt_control_t *s, dt_job_t *job)
+{
+  dt_pthread_mutex_lock(&s->queue_mutex);
+  for(GList *l = s->delayed; l; l = g_list_next(l))
+  {
+    if(_control_job_equal(job, l->data))
+    {
+      dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue\n");
+      _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
+      dt_pthread_mutex_unlock(&s->queue_mutex);
+      return -1;
+    }
+  }
+  dt_job_t *thejob = g_malloc(sizeof(dt_job_t));
+  memcpy(thejob,job,sizeof(dt_job_t));
+  _control_job_set_state (thejob,DT_JOB_STATE_QUEUED);
+  s->delayed = g_list_append(s->delayed, thejob);
+  __sync_fetch_and_add(&s->num_delayed, 1);
+  dt_pthread_mutex_unlock(&s->queue_mutex);
+  return 0;
+}
+
 int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
 {
   /* set ts_added if unset */
   if (job->ts_added == 0)
     job->ts_added = time(NULL);
 
-  dt_pthread_mutex_lock(&s->queue_mutex);
+  if(job->ts_execute > job->ts_added)
+    return _control_add_delayed_job(s, job);
 
-  /* check if equivalent job exist in queue, and discard job
-      if duplicate found .*/
-  GList *jobitem = g_list_first(s->queue);
-  if(jobitem)
-    do
+  const dt_job_priority_t p = job->priority;
+
+  /* backpressure: rather than dropping work, hold up producers until the workers caught up.
+     interactive jobs are never held up, stale ones are evicted instead (see below). */
+  if(p != DT_JOB_PRIORITY_INTERACTIVE && s->queued[p] >= DT_CONTROL_MAX_JOBS && _control_may_throttle(s))
+  {
+    dt_print(DT_DEBUG_CONTROL, "[add_job] queue full, waiting\n");
+    dt_pthread_mutex_lock(&s->queue_mutex);
+    while(s->queued[p] >= DT_CONTROL_MAX_JOBS && dt_control_running())
     {
-      if(!memcmp(job, jobitem->data, sizeof(dt_job_t)))
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 100000000;
+      if(ts.tv_nsec >= 1000000000)
       {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue\n");
-        _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
-        dt_pthread_mutex_unlock(&s->queue_mutex);
-        return -1;
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
       }
+      dt_pthread_cond_timedwait(&s->queue_space, &s->queue_mutex, &ts);
     }
-    while((jobitem=g_list_next(jobitem)));
-
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %d ", g_list_length(s->queue));
-  dt_control_job_print(job);
-  dt_print(DT_DEBUG_CONTROL, "\n");
-
-  /* add job to queue if not full, otherwise discard the job */
-  if( g_list_length(s->queue) < DT_CONTROL_MAX_JOBS)
-  {
-    /* allocate storage for the job, and set job state */
-    dt_job_t *thejob = g_malloc(sizeof(dt_job_t));
-    memcpy(thejob,job,sizeof(dt_job_t));
-    _control_job_set_state (thejob,DT_JOB_STATE_QUEUED);
-    s->queue = g_list_append(s->queue, thejob);
     dt_pthread_mutex_unlock(&s->queue_mutex);
   }
-  else
+
+  dt_control_deque_t *d = _control_job_deque(s, job);
+  dt_job_t *evicted = NULL;
+  dt_pthread_mutex_lock(&d->lock);
+
+  /* check if equivalent job exist in queue, and discard job
+      if duplicate found .*/
+  if(g_hash_table_lookup(d->jobs, job))
   {
-    dt_print(DT_DEBUG_CONTROL, "[add_job] too many jobs in queue!\n");
+    dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue\n");
     _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
-    dt_pthread_mutex_unlock(&s->queue_mutex);
+    dt_pthread_mutex_unlock(&d->lock);
     return -1;
   }
 
+  dt_print(DT_DEBUG_CONTROL, "[add_job] %d ", s->queued[p]);
+  dt_control_job_print(job);
+  dt_print(DT_DEBUG_CONTROL, "\n");
+
+  /* allocate storage for the job, and set job state */
+  dt_job_t *thejob = g_malloc(sizeof(dt_job_t));
+  memcpy(thejob,job,sizeof(dt_job_t));
+  _control_job_set_state (thejob,DT_JOB_STATE_QUEUED);
+  thejob->seq = __sync_add_and_fetch(&s->job_seq, 1);
+  g_queue_push_tail(&d->queue[p], thejob);
+  g_hash_table_insert(d->jobs, thejob, g_queue_peek_tail_link(&d->queue[p]));
+  __sync_fetch_and_add(&s->queued[p], 1);
+  dt_pthread_mutex_unlock(&d->lock);
+
+  /* too many interactive jobs: the oldest one is least likely to still be on screen */
+  if(p == DT_JOB_PRIORITY_INTERACTIVE && s->queued[p] > DT_CONTROL_MAX_JOBS)
+    evicted = _control_evict_oldest(s, p, thejob);
+
+  if(evicted)
+  {
+    dt_print(DT_DEBUG_CONTROL, "[add_job] too many jobs in queue, evicting ");
+    dt_control_job_print(evicted);
+    dt_print(DT_DEBUG_CONTROL, "\n");
+    _control_job_set_state (evicted,DT_JOB_STATE_DISCARDED);
+    g_free(evicted);
+  }
+
   // notify workers
   dt_pthread_mutex_lock(&s->cond_mutex);
   pthread_cond_broadcast(&s->cond);
@@ -1121,29 +1351,33 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
 int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job)
 {
   int32_t found_j = -1;
-  dt_pthread_mutex_lock(&s->queue_mutex);
   dt_print(DT_DEBUG_CONTROL, "[revive_job] ");
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
   /* find equivalent job and move it to top of the stack */
-  GList *jobitem = g_list_first(s->queue);
-  if (jobitem)
-    do
+  dt_control_deque_t *d = _control_job_deque(s, job);
+  dt_pthread_mutex_lock(&d->lock);
+  GList *link = g_hash_table_lookup(d->jobs, job);
+  dt_job_priority_t raised_from = DT_JOB_PRIORITY_COUNT;
+  if(link)
+  {
+    dt_job_t *queued = (dt_job_t *)link->data;
+    g_queue_unlink(&d->queue[queued->priority], link);
+    /* asked for more urgently than when it was queued (a prefetched thumbnail came into view, say) */
+    if(job->priority > queued->priority)
     {
-      if(!memcmp(job, jobitem->data, sizeof(dt_job_t)))
-      {
-        s->queue = g_list_remove_link(s->queue, jobitem);
-        s->queue = g_list_insert(s->queue, jobitem->data, 0);
-        g_free(jobitem);
-        found_j = 1;
-        break;
-      }
+      raised_from = queued->priority;
+      queued->priority = job->priority;
+      __sync_fetch_and_add(&s->queued[queued->priority], 1);
     }
-    while((jobitem=g_list_next(jobitem)));
-
-  /* unlock the queue */
-  dt_pthread_mutex_unlock(&s->queue_mutex);
+    g_queue_push_head_link(&d->queue[queued->priority], link);
+    // asked for just now, so it is the youngest as far as eviction goes:
+    queued->seq = __sync_add_and_fetch(&s->job_seq, 1);
+    found_j = 1;
+  }
+  dt_pthread_mutex_unlock(&d->lock);
+  if(raised_from != DT_JOB_PRIORITY_COUNT) _control_job_dequeued(s, raised_from);
 
   /* notify workers */
   dt_pthread_mutex_lock(&s->cond_mutex);
@@ -1152,6 +1386,30 @@ int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job)
   return found_j;
 }
 
+int32_t dt_control_remove_job(dt_control_t *s, dt_job_t *job)
+{
+  dt_job_t *removed = NULL;
+  dt_control_deque_t *d = _control_job_deque(s, job);
+  dt_pthread_mutex_lock(&d->lock);
+  GList *link = g_hash_table_lookup(d->jobs, job);
+  if(link)
+  {
+    removed = (dt_job_t *)link->data;
+    g_hash_table_remove(d->jobs, removed);
+    g_queue_delete_link(&d->queue[removed->priority], link);
+  }
+  dt_pthread_mutex_unlock(&d->lock);
+  if(!removed) return -1;
+
+  dt_print(DT_DEBUG_CONTROL, "[remove_job] ");
+  dt_control_job_print(removed);
+  dt_print(DT_DEBUG_CONTROL, "\n");
+  _control_job_dequeued(s, removed->priority);
+  _control_job_set_state (removed,DT_JOB_STATE_DISCARDED);
+  g_free(removed);
+  return 0;
+}
+
 int32_t dt_control_get_threadid()
 {
   for(int k=0; k<darktable.control->num_threads; k++)
@@ -33,7 +33,8 @@
 #include "libs/lib.h"
 // #include "control/job.def"
 
-#define DT_CONTROL_MAX_JOBS 30
+// queued jobs per priority before interactive jobs get evicted and other producers are throttled
+#define DT_CONTROL_MAX_JOBS 64
 #define DT_CONTROL_JOB_DEBUG
 #define DT_CONTROL_DESCRIPTION_LEN 256
 // reserved workers
@@ -148,16 +149,28 @@ typedef void (*dt_job_state_change_callback)(struct dt_job_t*,int state);
 #define DT_JOB_STATE_FINISHED		3
 #define DT_JOB_STATE_CANCELLED		4
 #define DT_JOB_STATE_DISCARDED		5
+/** job priorities, the workers always pick the highest one first. */
+typedef enum dt_job_priority_t
+{
+  DT_JOB_PRIORITY_BACKGROUND = 0, // indexing and other housekeeping
+  DT_JOB_PRIORITY_NORMAL,         // exports, file operations, imports
+  DT_JOB_PRIORITY_INTERACTIVE,    // thumbnails and anything else the user waits to see
+  DT_JOB_PRIORITY_COUNT
+}
+dt_job_priority_t;
 typedef struct dt_job_t
 {
   int32_t (*execute) (struct dt_job_t *job);
   int32_t result;
+  dt_job_priority_t priority;
 
   /* timestamp of job added to queue */
   time_t ts_added;
   /* if job is a delayed job it will be run as a backgroundjob
       and ts_execute will be the timestamp of when to start job */
   time_t ts_execute;
+  /* when the job was queued or last revived, in dt_control_t.job_seq ticks */
+  uint32_t seq;
 
   dt_pthread_mutex_t state_mutex;
   dt_pthread_mutex_t wait_mutex;
@@ -177,6 +190,8 @@ dt_job_t;
 void dt_control_job_init(dt_job_t *j, const char *msg, ...);
 /** setup a state callback for job. */
 void dt_control_job_set_state_callback(dt_job_t *j,dt_job_state_change_callback cb,void *user_data);
+/** set the priority of a job, defaults to DT_JOB_PRIORITY_NORMAL. */
+void dt_control_job_set_priority(dt_job_t *j, dt_job_priority_t priority);
 void dt_control_job_print(dt_job_t *j);
 /** cancel a job, running or in queue. */
 void dt_control_job_cancel(dt_job_t *j);
@@ -255,7 +270,17 @@ typedef struct dt_control_t
   pthread_cond_t cond;
   int32_t num_threads;
   pthread_t *thread,kick_on_workers_thread;
-  GList *queue;
+  // one deque per worker, jobs are sharded by their hash so duplicates meet in the same deque.
+  struct dt_control_deque_t *deque;
+  // jobs currently queued per priority, updated atomically.
+  int32_t queued[DT_JOB_PRIORITY_COUNT];
+  // ticks on every queued or revived job, updated atomically.
+  uint32_t job_seq;
+  // throttled producers wait here (with queue_mutex) for the queue to drain.
+  pthread_cond_t queue_space;
+  // scheduled background jobs, protected by queue_mutex.
+  GList *delayed;
+  int32_t num_delayed;
   dt_job_t job_res[DT_CTL_WORKER_RESERVED];
   uint8_t new_res[DT_CTL_WORKER_RESERVED];
   pthread_t thread_res[DT_CTL_WORKER_RESERVED];
@@ -300,7 +325,10 @@ int32_t dt_control_run_job(dt_control_t *s);
 int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job);
 /** adds a job to queue tagged as background job and with a delay */
 int32_t dt_control_add_background_job(dt_control_t *s, dt_job_t *job, time_t delay);
+/** moves an equivalent queued job to the front of its queue, raising it to the priority of job. returns -1 if none is queued. */
 int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job);
+/** takes an equivalent job out of the queue, unless it has started already. returns -1 if none is queued. */
+int32_t dt_control_remove_job(dt_control_t *s, dt_job_t *job);
 int32_t dt_control_run_job_res(dt_control_t *s, int32_t res);
 int32_t dt_control_add_job_res(dt_control_t *s, dt_job_t *job, int32_t res);
 
@@ -103,74 +103,174 @@ int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
 }
 
 
-#define _INDEXER_UPDATE_HISTOGRAM		1
-#define _INDEXER_UPDATE_LIGHTMAP		2
-#define _INDEXER_IMAGE_FILE_REMOVED		4
+/* the indexer works through the similarity_queue table that dt_similarity_*_dirty() fill.
+   images are processed in batches: the features of a batch are computed in parallel, then
+   written together with the removal of their queue entries in one transaction. images which
+   have no thumbnail keep their entry with a negative stamp, and wait until they are dirtied again. */
+#define DT_INDEXER_BATCH 64
 
 typedef struct _control_indexer_img_t
 {
   uint32_t id;
-  uint32_t flags;
+  int64_t stamp;
+  int done;
+  uint8_t *pixels;   // decompressed thumbnail, only between fetch and compute
+  int width, height;
+  dt_similarity_histogram_t histogram;
+  dt_similarity_lightmap_t lightmap;
 } _control_indexer_img_t;
 
-int32_t dt_control_indexer_job_run(dt_job_t *job)
+/* gets the decompressed thumbnail of one image, returns 0 if there is none. this may generate
+   the thumbnail, which uses per thread scratch memory of the mipmap cache keyed on the job
+   thread, so it must not run in the openmp loop. */
+static int _control_indexer_fetch(_control_indexer_img_t *idximg, uint8_t *scratchmem)
 {
-  // if no indexing was requested, bail out:
-  if(!dt_conf_get_bool("run_similarity_indexer")) return 0;
+  idximg->pixels = NULL;
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, idximg->id, DT_MIPMAP_2, DT_MIPMAP_BLOCKING);
+  if(buf.buf && buf.width * buf.height)
+  {
+    idximg->width = buf.width;
+    idximg->height = buf.height;
+    idximg->pixels = g_malloc(4*buf.width*buf.height);
+    // pointer owned by the cache or == scratchmem, no need to free this one:
+    memcpy(idximg->pixels, dt_mipmap_cache_decompress(&buf, scratchmem), 4*buf.width*buf.height);
+  }
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return idximg->pixels != NULL;
+}
+
+/* computes histogram and lightmap of one fetched image and drops its pixels. */
+static void _control_indexer_compute(_control_indexer_img_t *idximg)
+{
+  const int width = idximg->width, height = idximg->height;
+  const uint8_t *buf_decompressed = idximg->pixels;
 
   /*
-   * First pass run thru ALL images and collect the ones who needs to update
-   *  \TODO in the future lets have a indexer table with ids filed with images
-   *  thats need some kind of reindexing.. all mark dirty functions adds image
-   *  to this table--
+   * Generate similarity histogram data
    */
-  // temp memory for uncompressed images:
-  uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-
-  GList *images=NULL;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select images.id,film_rolls.folder||'/'||images.filename,images.histogram,images.lightmap from images,film_rolls where film_rolls.id = images.film_id", -1, &stmt, NULL);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  dt_similarity_histogram_t *histogram = &idximg->histogram;
+  memset(histogram, 0, sizeof(dt_similarity_histogram_t));
+  float bucketscale = (float)DT_SIMILARITY_HISTOGRAM_BUCKETS/(float)0xff;
+  for(int j=0; j<(4*width*height); j+=4)
   {
-    _control_indexer_img_t *idximg=g_malloc(sizeof( _control_indexer_img_t));
-    memset(idximg,0,sizeof(_control_indexer_img_t));
-    idximg->id = sqlite3_column_int(stmt,0);
+    /* swap rgb and scale to bucket index */
+    uint8_t rgb[3];
 
-    /* first check if image file exists on disk */
-    const char *filename = (const char *)sqlite3_column_text(stmt, 1);
-    if (filename && !g_file_test(filename, G_FILE_TEST_IS_REGULAR))
-      idximg->flags |= _INDEXER_IMAGE_FILE_REMOVED;
+    for(int k=0; k<3; k++)
+      rgb[k] = (int)((buf_decompressed[j+2-k]/(float)0xff) * bucketscale);
 
+    /* distribute rgb into buckets */
+    for(int k=0; k<3; k++)
+      histogram->rgbl[rgb[k]][k]++;
 
-    /* check if histogram should be updated */
-    if (sqlite3_column_bytes(stmt, 2) != sizeof(dt_similarity_histogram_t))
-      idximg->flags |= _INDEXER_UPDATE_HISTOGRAM;
+    /* distribute lum into buckets */
+    uint8_t lum = MAX(MAX(rgb[0], rgb[1]), rgb[2]);
+    histogram->rgbl[lum][3]++;
+  }
 
-    /* check if lightmap should be updated */
-    if (sqlite3_column_bytes(stmt, 3) != sizeof(dt_similarity_lightmap_t))
-      idximg->flags |= _INDEXER_UPDATE_LIGHTMAP;
+  for(int k=0; k<DT_SIMILARITY_HISTOGRAM_BUCKETS; k++)
+    for (int j=0; j<4; j++)
+      histogram->rgbl[k][j] /= (width*height);
 
+  /*
+   * Generate scaledowned similarity lightness map
+   */
+  dt_similarity_lightmap_t *lightmap = &idximg->lightmap;
+  memset(lightmap,0,sizeof(dt_similarity_lightmap_t));
 
-    /* if image is flagged add to collection */
-    if (idximg->flags != 0)
-      images = g_list_append(images, idximg);
-    else
-      g_free(idximg);
+  /*
+   * create a pixbuf out of the image for downscaling
+   */
+
+  /* first of setup a standard rgb buffer, swap bgr in same routine */
+  uint8_t *rgbbuf = g_malloc(width*height*3);
+  for(int j=0; j<(width*height); j++)
+    for(int k=0; k<3; k++)
+      rgbbuf[3*j+k] = buf_decompressed[4*j+2-k];
+
+
+  /* then create pixbuf and scale down to lightmap size */
+  GdkPixbuf *source = gdk_pixbuf_new_from_data(rgbbuf,GDK_COLORSPACE_RGB,FALSE,8,width,height,(width*3),NULL,NULL);
+  GdkPixbuf *scaled = gdk_pixbuf_scale_simple(source,DT_SIMILARITY_LIGHTMAP_SIZE,DT_SIMILARITY_LIGHTMAP_SIZE,GDK_INTERP_HYPER);
+
+  /* copy scaled data into lightmap */
+  uint8_t min=0xff,max=0;
+  uint8_t *spixels = gdk_pixbuf_get_pixels(scaled);
+
+  for(int j=0; j<(DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE); j++)
+  {
+    /* copy rgb */
+    for(int k=0; k<3; k++)
+      lightmap->pixels[4*j+k] = spixels[3*j+k];
+
+    /* average intensity into 4th channel */
+    lightmap->pixels[4*j+3] =  (lightmap->pixels[4*j+0]+ lightmap->pixels[4*j+1]+ lightmap->pixels[4*j+2])/3.0;
+    min = MIN(min, lightmap->pixels[4*j+3]);
+    max = MAX(max, lightmap->pixels[4*j+3]);
   }
-  sqlite3_finalize(stmt);
 
+  /* contrast stretch each channel in lightmap
+   *  TODO: do we want this...
+   */
+  float scale=0;
+  int range = max-min;
+  if(range==0)
+    scale = 1.0;
+  else
+    scale = 0xff/range;
+  for(int j=0; j<(DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE); j++)
+  {
+    for(int k=0; k<4; k++)
+      lightmap->pixels[4*j+k] = (lightmap->pixels[4*j+k]-min)*scale;
+  }
+
+  /* free some resources */
+  g_object_unref(scaled);
+  g_object_unref(source);
+
+  g_free(rgbbuf);
+
+  g_free(idximg->pixels);
+  idximg->pixels = NULL;
+}
+
+int32_t dt_control_indexer_job_run(dt_job_t *job)
+{
+  // if no indexing was requested, bail out:
+  if(!dt_conf_get_bool("run_similarity_indexer")) return 0;
 
   /*
-   * Second pass, run thru collected images thats
-   *  need reindexing...
+   * Collect the queued images, entries of images which have been removed
+   * from the library meanwhile are dropped right away. the ones that failed
+   * before are skipped.
    */
-  GList *imgitem = g_list_first(images);
-  if(imgitem)
+  GArray *images = g_array_new(FALSE, FALSE, sizeof(_control_indexer_img_t));
+  int orphans = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select q.imgid, q.stamp, i.id from similarity_queue as q left join images as i on i.id = q.imgid where q.stamp >= 0 order by q.imgid", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    char message[512]= {0};
-    double fraction=0;
-    int total = g_list_length(images);
+    if(sqlite3_column_type(stmt, 2) == SQLITE_NULL)
+    {
+      orphans++;
+      continue;
+    }
+    _control_indexer_img_t idximg;
+    idximg.id = sqlite3_column_int(stmt, 0);
+    idximg.stamp = sqlite3_column_int64(stmt, 1);
+    idximg.done = 0;
+    g_array_append_val(images, idximg);
+  }
+  sqlite3_finalize(stmt);
+  if(orphans)
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from similarity_queue where imgid not in (select id from images)", NULL, NULL, NULL);
 
+  const int total = images->len;
+  int processed = 0;
+  if(total > 0)
+  {
+    char message[512]= {0};
     guint *jid = NULL;
 
     /* background job plate only if more then one image is reindexed */
@@ -180,179 +280,83 @@ int32_t dt_control_indexer_job_run(dt_job_t *job)
       jid = (guint *)dt_control_backgroundjobs_create(darktable.control, 0, message);
     }
 
-    do
+    // temp memory for uncompressed images. the thumbnails are fetched a few at a time,
+    // one per worker, so not too many of them are held at once:
+    const int threads = MIN(dt_get_num_threads(), DT_INDEXER_BATCH);
+    uint8_t *scratch = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+
+    _control_indexer_img_t *items = (_control_indexer_img_t *)images->data;
+    sqlite3_stmt *dequeue, *failed;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from similarity_queue where imgid = ?1 and stamp = ?2", -1, &dequeue, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "update similarity_queue set stamp = -1 where imgid = ?1 and stamp = ?2", -1, &failed, NULL);
+
+    while(processed < total)
     {
       // bail out if we're shutting down:
       if(!dt_control_running()) break;
       // if indexer was switched off during runtime, respect that as soon as we can:
       if(!dt_conf_get_bool("run_similarity_indexer")) break;
+      if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) break;
 
-      /* get the _control_indexer_img_t pointer */
-      _control_indexer_img_t *idximg = imgitem->data;
+      _control_indexer_img_t *batch = items + processed;
+      const int cnt = MIN(DT_INDEXER_BATCH, total - processed);
 
-      /*
-       * Check if image has been delete from disk
-       */
-      if ((idximg->flags&_INDEXER_IMAGE_FILE_REMOVED))
+      for(int j=0; j<cnt; j+=threads)
       {
-        /* file does not exist on disk lets delete image reference from database */
-        //char query[512]={0};
-
-        // \TODO dont delete move to an temp table and let user to revalidate
-
-        /*sprintf(query,"delete from history where imgid=%d",idximg->id);
-          DT_DEBUG_SQLITE3_EXEC(darktable.db, query, NULL, NULL, NULL);
-          sprintf(query,"delete from tagged_images where imgid=%d",idximg->id);
-          DT_DEBUG_SQLITE3_EXEC(darktable.db, query, NULL, NULL, NULL);
-          sprintf(query,"delete from images where id=%d",idximg->id);
-          DT_DEBUG_SQLITE3_EXEC(darktable.db, query, NULL, NULL, NULL);*/
-
-        /* no need to additional work */
-        continue;
+        const int num = MIN(threads, cnt - j);
+        for(int k=j; k<j+num; k++)
+          batch[k].done = _control_indexer_fetch(batch + k, scratch);
+#ifdef _OPENMP
+        #pragma omp parallel for default(none) shared(batch) firstprivate(j, num) schedule(dynamic) num_threads(threads)
+#endif
+        for(int k=j; k<j+num; k++)
+          if(batch[k].done) _control_indexer_compute(batch + k);
       }
 
-
-      /*
-       *  Check if image histogram or lightmap should be updated.
-       *   those indexing that involves a image pipe should fall into this
-       */
-      if ( (idximg->flags&_INDEXER_UPDATE_HISTOGRAM) ||  (idximg->flags&_INDEXER_UPDATE_LIGHTMAP) )
+      /* store the features and dequeue the images in one transaction. an entry whose stamp changed meanwhile was dirtied
+         again while we computed and stays queued. images without thumbnail (file missing)
+         are marked failed, so later runs don't try them over and over. */
+      dt_database_begin(darktable.db);
+      for(int k=0; k<cnt; k++)
       {
-        /* get a mipmap of image to analyse */
-        dt_mipmap_buffer_t buf;
-        dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, idximg->id, DT_MIPMAP_2, DT_MIPMAP_BLOCKING);
-        // pointer owned by the cache or == scratchmem, no need to free this one:
-        uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-        if (!(buf.width * buf.height))
-          continue;
-
-        /*
-         * Generate similarity histogram data if requested
-         */
-        if ( (idximg->flags&_INDEXER_UPDATE_HISTOGRAM) )
+        sqlite3_stmt *entry = dequeue;
+        if(batch[k].done)
         {
-          dt_similarity_histogram_t histogram;
-          float bucketscale = (float)DT_SIMILARITY_HISTOGRAM_BUCKETS/(float)0xff;
-          for(int j=0; j<(4*buf.width*buf.height); j+=4)
-          {
-            /* swap rgb and scale to bucket index */
-            uint8_t rgb[3];
-
-            for(int k=0; k<3; k++)
-              rgb[k] = (int)((buf_decompressed[j+2-k]/(float)0xff) * bucketscale);
-
-            /* distribute rgb into buckets */
-            for(int k=0; k<3; k++)
-              histogram.rgbl[rgb[k]][k]++;
-
-            /* distribute lum into buckets */
-            uint8_t lum = MAX(MAX(rgb[0], rgb[1]), rgb[2]);
-            histogram.rgbl[lum][3]++;
-          }
-
-          for(int k=0; k<DT_SIMILARITY_HISTOGRAM_BUCKETS; k++)
-            for (int j=0; j<4; j++)
-              histogram.rgbl[k][j] /= (buf.width*buf.height);
-
-          /* store the histogram data */
-          dt_similarity_histogram_store(idximg->id, &histogram);
-
-        }
-
-        /*
-         * Generate scaledowned similarity lightness map if requested
-         */
-        if ( (idximg->flags&_INDEXER_UPDATE_LIGHTMAP) )
-        {
-          dt_similarity_lightmap_t lightmap;
-          memset(&lightmap,0,sizeof(dt_similarity_lightmap_t));
-
-          /*
-           * create a pixbuf out of the image for downscaling
-           */
-
-          /* first of setup a standard rgb buffer, swap bgr in same routine */
-          uint8_t *rgbbuf = g_malloc(buf.width*buf.height*3);
-          for(int j=0; j<(buf.width*buf.height); j++)
-            for(int k=0; k<3; k++)
-              rgbbuf[3*j+k] = buf_decompressed[4*j+2-k];
-
-
-          /* then create pixbuf and scale down to lightmap size */
-          GdkPixbuf *source = gdk_pixbuf_new_from_data(rgbbuf,GDK_COLORSPACE_RGB,FALSE,8,buf.width,buf.height,(buf.width*3),NULL,NULL);
-          GdkPixbuf *scaled = gdk_pixbuf_scale_simple(source,DT_SIMILARITY_LIGHTMAP_SIZE,DT_SIMILARITY_LIGHTMAP_SIZE,GDK_INTERP_HYPER);
-
-          /* copy scaled data into lightmap */
-          uint8_t min=0xff,max=0;
-          uint8_t *spixels = gdk_pixbuf_get_pixels(scaled);
-
-          for(int j=0; j<(DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE); j++)
-          {
-            /* copy rgb */
-            for(int k=0; k<3; k++)
-              lightmap.pixels[4*j+k] = spixels[3*j+k];
-
-            /* average intensity into 4th channel */
-            lightmap.pixels[4*j+3] =  (lightmap.pixels[4*j+0]+ lightmap.pixels[4*j+1]+ lightmap.pixels[4*j+2])/3.0;
-            min = MIN(min, lightmap.pixels[4*j+3]);
-            max = MAX(max, lightmap.pixels[4*j+3]);
-          }
-
-          /* contrast stretch each channel in lightmap
-           *  TODO: do we want this...
-           */
-          float scale=0;
-          int range = max-min;
-          if(range==0)
-            scale = 1.0;
-          else
-            scale = 0xff/range;
-          for(int j=0; j<(DT_SIMILARITY_LIGHTMAP_SIZE*DT_SIMILARITY_LIGHTMAP_SIZE); j++)
-          {
-            for(int k=0; k<4; k++)
-              lightmap.pixels[4*j+k] = (lightmap.pixels[4*j+k]-min)*scale;
-          }
-
-          /* free some resources */
-          g_object_unref(scaled);
-          g_object_unref(source);
-
-          g_free(rgbbuf);
-
-          /* store the lightmap */
-          dt_similarity_lightmap_store(idximg->id, &lightmap);
+          dt_similarity_histogram_store(batch[k].id, &batch[k].histogram);
+          dt_similarity_lightmap_store(batch[k].id, &batch[k].lightmap);
         }
-
-
-        /* no use for buffer anymore release the mipmap */
-        dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-
+        else entry = failed;
+        DT_DEBUG_SQLITE3_BIND_INT(entry, 1, batch[k].id);
+        sqlite3_bind_int64(entry, 2, batch[k].stamp);
+        sqlite3_step(entry);
+        DT_DEBUG_SQLITE3_RESET(entry);
+        DT_DEBUG_SQLITE3_CLEAR_BINDINGS(entry);
       }
+      dt_database_commit(darktable.db);
+
+      processed += cnt;
 
       /* update background progress */
       if (jid)
-      {
-        fraction+=1.0/total;
-        dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
-      }
-
+        dt_control_backgroundjobs_progress(darktable.control, jid, processed/(double)total);
     }
-    while ((imgitem=g_list_next(imgitem)) && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED);
-
 
     /* cleanup */
+    sqlite3_finalize(dequeue);
+    sqlite3_finalize(failed);
+    free(scratch);
+
     if (jid)
       dt_control_backgroundjobs_destroy(darktable.control, jid);
   }
 
-  free(scratchmem);
+  g_array_free(images, TRUE);
 
   /*
-   * Indexing opertions finished, lets reschedule the indexer
-   * unless control is shutting down...
+   * Images dirtied from now on reschedule the indexer themselves, only
+   * pick up where we stopped if we were interrupted before the end.
    */
-  if(dt_control_running())
+  if(processed < total && dt_control_running() && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
     dt_control_start_indexer();
 
   return 0;
@@ -578,14 +582,17 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job)
   char message[512]= {0};
   snprintf(message, 512, ngettext ("flipping %d image", "flipping %d images", total), total );
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
+  // one transaction for all the history entries:
+  dt_database_begin(darktable.db);
   while(t)
   {
     imgid = (long int)t->data;
     dt_image_flip(imgid, cw);
     t = g_list_delete_link(t, t);
-    fraction=1.0/total;
+    fraction+=1.0/total;
     dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
   }
+  dt_database_commit(darktable.db);
   dt_control_backgroundjobs_destroy(darktable.control, jid);
   dt_control_queue_redraw_center();
   return 0;
@@ -745,6 +752,7 @@ int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
   GTimeZone *tz_utc = g_time_zone_new_utc();
 
   /* go thru each selected image and lookup location in gpx */
+  dt_image_cache_batch_begin(darktable.image_cache);
   do
   {
     GTimeVal timestamp;
@@ -801,6 +809,7 @@ int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
 
   }
   while((t = g_list_next(t)) != NULL);
+  dt_image_cache_batch_end(darktable.image_cache);
 
   dt_control_log(_("applied matched gpx location onto %d image(s)"), cntr);
 
@@ -860,6 +869,7 @@ void dt_control_indexer_job_init(dt_job_t *job)
 {
   dt_control_job_init(job, "image indexer");
   job->execute = &dt_control_indexer_job_run;
+  dt_control_job_set_priority(job, DT_JOB_PRIORITY_BACKGROUND);
 }
 
 void dt_control_match_similar_job_init(dt_job_t *job, uint32_t imgid,dt_similarity_t *data)
@@ -1209,6 +1219,58 @@ int32_t dt_control_copy_images_job_run(dt_job_t *job)
          "copying %d image", "copying %d images");
 }
 
+/** what the threads of a batch export share: the images, and how far they are decoded and exported. */
+typedef struct dt_control_export_queue_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int32_t *imgid;
+  int32_t total;
+  int32_t next;     // next image to be exported
+  int32_t decoded;  // next image to be decoded
+  int32_t depth;    // how far decoding may run ahead, bounds the full buffers held
+  int32_t stop;
+}
+dt_control_export_queue_t;
+
+/** first stage of a batch export: pulls the full buffers of the next images into the mipmap cache. */
+static void *
+_control_export_prefetch(void *arg)
+{
+  dt_control_export_queue_t *q = (dt_control_export_queue_t *)arg;
+  dt_pthread_mutex_lock(&q->lock);
+  while(!q->stop)
+  {
+    // no point in decoding what the exporters have already taken:
+    q->decoded = MAX(q->decoded, q->next);
+    if(q->decoded >= q->total) break;
+    if(q->decoded >= q->next + q->depth)
+    {
+      dt_pthread_cond_wait(&q->cond, &q->lock);
+      continue;
+    }
+    const int32_t imgid = q->imgid[q->decoded++];
+    dt_pthread_mutex_unlock(&q->lock);
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_pthread_mutex_lock(&q->lock);
+  }
+  dt_pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+/** index of the next image to export, or -1 if there is none left. */
+static int32_t
+_control_export_queue_pop(dt_control_export_queue_t *q)
+{
+  dt_pthread_mutex_lock(&q->lock);
+  const int32_t k = q->next < q->total ? q->next++ : -1;
+  pthread_cond_signal(&q->cond);
+  dt_pthread_mutex_unlock(&q->lock);
+  return k;
+}
+
 int32_t dt_control_export_job_run(dt_job_t *job)
 {
   long int imgid = -1;
@@ -1252,20 +1314,46 @@ int32_t dt_control_export_job_run(dt_job_t *job)
   const dt_control_t *control = darktable.control;
 
   double fraction=0;
-#ifdef _OPENMP
-  // limit this to num threads = num full buffers - 1 (keep one for darkroom mode)
+  // the export runs in stages: one thread decodes ahead into the mipmap cache, at most
+  // num_pipes threads run a pixelpipe, and the rest encode and store the finished images.
+  // limit the pipes to num full buffers - 1 (keep one for darkroom mode),
   // use min of user request and mipmap cache entries
-  const int full_entries = dt_conf_get_int ("parallel_export");
+  const int num_pipes = MAX(1, MIN(dt_conf_get_int ("parallel_export"), 8));
+  dt_imageio_export_gate_t gate;
+  dt_imageio_export_gate_init(&gate, num_pipes);
+
+  dt_control_export_queue_t q;
+  dt_pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.cond, NULL);
+  q.imgid = (int32_t *)malloc(sizeof(int32_t) * MAX(1, total));
+  q.total = 0;
+  for(GList *l = t; l; l = g_list_next(l)) q.imgid[q.total++] = (long int)l->data;
+  g_list_free(t);
+  dt_image_cache_preload(darktable.image_cache, q.imgid, q.total);
+  t1->index = NULL;
+  q.next = q.decoded = 0;
+  // the decoded buffers share the full mipmap cache (one unit of cost each) with the running
+  // pipes and darkroom, so don't decode further ahead than there are slots left:
+  const int full_entries = darktable.mipmap_cache->mip[DT_MIPMAP_FULL].cache.cost_quota;
+  q.depth = MIN(num_pipes, full_entries - num_pipes - 1);
+  q.stop = 0;
+  pthread_t prefetch;
+  const int prefetching = q.depth > 0 && !pthread_create(&prefetch, NULL, _control_export_prefetch, &q);
+
+#ifdef _OPENMP
+  // one thread more than pipes, so there is always one to encode while the others process.
+  // a single pipe exports serially, so it keeps all cores for its iops.
   // GCC won't accept that this variable is used in a macro, considers
   // it set but not used, which makes for instance Fedora break.
-  const __attribute__((__unused__)) int num_threads = MAX(1, MIN(full_entries, 8));
+  const __attribute__((__unused__)) int num_threads = num_pipes + 1;
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
-  #pragma omp parallel default(none) private(imgid, size) shared(control, fraction, w, h, stderr, mformat, mstorage, t, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
+  #pragma omp parallel default(none) private(imgid, size) shared(control, fraction, w, h, stderr, mformat, mstorage, q, gate, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_pipes > 1)
 #else
-  #pragma omp parallel private(imgid, size) shared(control, fraction, w, h, mformat, mstorage, t, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
+  #pragma omp parallel private(imgid, size) shared(control, fraction, w, h, mformat, mstorage, q, gate, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_pipes > 1)
 #endif
   {
 #endif
+    dt_imageio_export_set_gate(&gate);
     // get a thread-safe fdata struct (one jpeg struct per thread etc):
     dt_imageio_module_data_t *fdata = mformat->get_params(mformat, &size);
     fdata->max_width = settings->max_width;
@@ -1280,21 +1368,11 @@ int32_t dt_control_export_job_run(dt_job_t *job)
     dt_tag_new("darktable|changed",&tagid);
     dt_tag_new("darktable|exported",&etagid);
 
-    while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+    int32_t k;
+    while(dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED && (k = _control_export_queue_pop(&q)) >= 0)
     {
-#ifdef _OPENMP
-      #pragma omp critical
-#endif
-      {
-        if(!t)
-          imgid = 0;
-        else
-        {
-          imgid = (long int)t->data;
-          t = g_list_delete_link(t, t);
-          num = total - g_list_length(t);
-        }
-      }
+      imgid = q.imgid[k];
+      num = k + 1;
       // remove 'changed' tag from image
       dt_tag_detach(tagid, imgid);
       // make sure the 'exported' tag is set on the image
@@ -1337,9 +1415,22 @@ int32_t dt_control_export_job_run(dt_job_t *job)
     }
     // all threads free their fdata
     mformat->free_params (mformat, fdata);
+    dt_imageio_export_set_gate(NULL);
 #ifdef _OPENMP
   }
 #endif
+  if(prefetching)
+  {
+    dt_pthread_mutex_lock(&q.lock);
+    q.stop = 1;
+    pthread_cond_signal(&q.cond);
+    dt_pthread_mutex_unlock(&q.lock);
+    pthread_join(prefetch, NULL);
+  }
+  free(q.imgid);
+  pthread_cond_destroy(&q.cond);
+  dt_pthread_mutex_destroy(&q.lock);
+  dt_imageio_export_gate_cleanup(&gate);
   g_free(t1->data);
   return 0;
 }
@@ -1627,6 +1718,7 @@ int32_t dt_control_time_offset_job_run(dt_job_t *job)
   }
 
   /* go thru each selected image and update datetime_taken */
+  dt_image_cache_batch_begin(darktable.image_cache);
   do
   {
     uint32_t imgid = (long int)t->data;
@@ -1641,6 +1733,7 @@ int32_t dt_control_time_offset_job_run(dt_job_t *job)
     }
   }
   while ((t = g_list_next(t)) != NULL);
+  dt_image_cache_batch_end(darktable.image_cache);
 
   dt_control_log(_("added time offset to %d image(s)"), cntr);
 
@@ -30,6 +30,7 @@ void dt_dev_process_preview_job_init(dt_job_t *job, dt_develop_t *dev)
 {
   dt_control_job_init(job, "develop process preview");
   job->execute = &dt_dev_process_preview_job_run;
+  dt_control_job_set_priority(job, DT_JOB_PRIORITY_INTERACTIVE);
   dt_dev_process_t *t = (dt_dev_process_t *)job->param;
   t->dev = dev;
 }
@@ -45,6 +46,7 @@ void dt_dev_process_image_job_init(dt_job_t *job, dt_develop_t *dev)
 {
   dt_control_job_init(job, "develop process image");
   job->execute = &dt_dev_process_image_job_run;
+  dt_control_job_set_priority(job, DT_JOB_PRIORITY_INTERACTIVE);
   dt_dev_process_t *t = (dt_dev_process_t *)job->param;
   t->dev = dev;
 }
@@ -24,6 +24,7 @@ void dt_image_load_job_init(dt_job_t *job, int32_t id, dt_mipmap_size_t mip)
 {
   dt_control_job_init(job, "load image %d mip %d", id, mip);
   job->execute = &dt_image_load_job_run;
+  dt_control_job_set_priority(job, DT_JOB_PRIORITY_INTERACTIVE);
   dt_image_load_t *t = (dt_image_load_t *)job->param;
   t->imgid = id;
   t->mip = mip;
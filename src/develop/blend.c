@@ -18,12 +18,14 @@
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/tiling.h"
+#include "common/cpu_dispatch.h"
 #include "common/gaussian.h"
 #include "blend.h"
 
 #define CLAMP_RANGE(x,y,z)      (CLAMP(x,y,z))
 
-typedef void (_blend_row_func)(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag);
+typedef void (_blend_row_func)(const float *a, float *b, const float *mask, int stride, int flag);
+typedef void (_blend_mask_func)(const unsigned int blendif, const float *blendif_parameters, const float opacity, const float *a, const float *b, float *mask, int stride);
 
 static inline void _RGB_2_HSL(const float *RGB, float *HSL)
 {
@@ -299,9 +301,16 @@ static inline void _blend_Lab_rescale(const float *i, float *o)
 
 
 /* generate blend mask */
-static void _blend_make_mask(dt_iop_colorspace_type_t cst,const unsigned int blendif,const float *blendif_parameters,const float opacity,const float *a, const float *b, float *mask, int stride)
+DT_CPU_KERNEL void _blend_make_mask(const dt_iop_colorspace_type_t cst,const unsigned int blendif,const float *blendif_parameters,const float opacity,const float *a, const float *b, float *mask, int stride)
 {
- 
+  /* without conditional blending (never done in raw) the mask is just the opacity */
+  if(cst == iop_cs_RAW || !(blendif & (1<<DEVELOP_BLENDIF_active)))
+  {
+    for(int i=0, j=0; j<stride; i++, j+=4)
+      mask[i] = opacity;
+    return;
+  }
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
     mask[i] = opacity*_blendif_factor(cst,&a[j],&b[j],blendif,blendif_parameters);
@@ -311,7 +320,7 @@ static void _blend_make_mask(dt_iop_colorspace_type_t cst,const unsigned int ble
 
 
 /* normal blend */
-static void _blend_normal(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_normal(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -352,7 +361,7 @@ static void _blend_normal(dt_iop_colorspace_type_t cst,const float *a, float *b,
 }
 
 /* normal blend without any clamping */
-static void _blend_unbounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_unbounded(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -395,7 +404,7 @@ static void _blend_unbounded(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* lighten */
-static void _blend_lighten(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_lighten(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   int channels = _blend_colorspace_channels(cst);
   float ta[3], tb[3], tbo;
@@ -437,7 +446,7 @@ static void _blend_lighten(dt_iop_colorspace_type_t cst,const float *a, float *b
 }
 
 /* darken */
-static void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_darken(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   int channels = _blend_colorspace_channels(cst);
   float ta[3], tb[3], tbo;
@@ -481,7 +490,7 @@ static void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b,
 
 
 /* multiply */
-static void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_multiply(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -544,7 +553,7 @@ static void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *
 
 
 /* average */
-static void _blend_average(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_average(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -587,7 +596,7 @@ static void _blend_average(dt_iop_colorspace_type_t cst,const float *a, float *b
 
 
 /* add */
-static void _blend_add(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_add(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -633,7 +642,7 @@ static void _blend_add(dt_iop_colorspace_type_t cst,const float *a, float *b, co
 
 
 /* substract */
-static void _blend_substract(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_substract(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -680,7 +689,7 @@ static void _blend_substract(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* difference */
-static void _blend_difference(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_difference(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -741,7 +750,7 @@ static void _blend_difference(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* screen */
-static void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_screen(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -807,7 +816,7 @@ static void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b,
 }
 
 /* overlay */
-static void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_overlay(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -885,7 +894,7 @@ static void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b
 }
 
 /* softlight */
-static void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_softlight(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -959,7 +968,7 @@ static void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* hardlight */
-static void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_hardlight(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1039,7 +1048,7 @@ static void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* vividlight */
-static void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_vividlight(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1116,7 +1125,7 @@ static void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* linearlight */
-static void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_linearlight(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1187,7 +1196,7 @@ static void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, floa
 }
 
 /* pinlight */
-static void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_pinlight(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1250,7 +1259,7 @@ static void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *
 
 
 /* lightness blend */
-static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_lightness(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1304,7 +1313,7 @@ static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* chroma blend */
-static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_chroma(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1362,7 +1371,7 @@ static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b,
 
 
 /* hue blend */
-static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_hue(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1426,7 +1435,7 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
 
 
 /* color blend; blend hue and chroma, but not lightness */
-static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_color(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1491,7 +1500,7 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
 }
 
 /* color adjustment; blend hue and chroma; take lightness from module output */
-static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_coloradjust(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1557,7 +1566,7 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
 
 
 /* inverse blend */
-static void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
+DT_CPU_KERNEL void _blend_inverse(const dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1598,6 +1607,51 @@ static void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b
   }
 }
 
+/* each blend mode and the mask specialized per colorspace, which turns the colorspace checks and channel
+   ranges into constants, and every one of those compiled for the wider instruction sets. picked once per piece. */
+#define _BLEND_ROW_PARAMS (const float *const a, float *const b, const float *const mask, const int stride, const int flag)
+#define _BLEND_ROW_ARGS (a, b, mask, stride, flag)
+#define _BLEND_MASK_PARAMS (const unsigned int blendif, const float *const blendif_parameters, const float opacity, \
+                            const float *const a, const float *const b, float *const mask, const int stride)
+#define _BLEND_MASK_ARGS (blendif, blendif_parameters, opacity, a, b, mask, stride)
+
+#define _BLEND_SPECIALIZE(name, params, args)                                    \
+  DT_CPU_KERNEL void name##_RAW params { name(iop_cs_RAW, _BLEND_UNPACK args); } \
+  DT_CPU_KERNEL void name##_Lab params { name(iop_cs_Lab, _BLEND_UNPACK args); } \
+  DT_CPU_KERNEL void name##_rgb params { name(iop_cs_rgb, _BLEND_UNPACK args); } \
+  DT_CPU_CLONES(name##_RAW, params, args)                                        \
+  DT_CPU_CLONES(name##_Lab, params, args)                                        \
+  DT_CPU_CLONES(name##_rgb, params, args)
+#define _BLEND_UNPACK(...) __VA_ARGS__
+
+#define _BLEND_SELECT(name, cst)                                                 \
+  ((cst) == iop_cs_RAW ? DT_CPU_SELECT(name##_RAW) :                             \
+   (cst) == iop_cs_Lab ? DT_CPU_SELECT(name##_Lab) : DT_CPU_SELECT(name##_rgb))
+
+_BLEND_SPECIALIZE(_blend_make_mask, _BLEND_MASK_PARAMS, _BLEND_MASK_ARGS)
+_BLEND_SPECIALIZE(_blend_normal, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_unbounded, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_lighten, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_darken, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_multiply, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_average, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_add, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_substract, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_difference, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_screen, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_overlay, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_softlight, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_hardlight, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_vividlight, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_linearlight, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_pinlight, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_lightness, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_chroma, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_hue, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_color, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_coloradjust, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+_BLEND_SPECIALIZE(_blend_inverse, _BLEND_ROW_PARAMS, _BLEND_ROW_ARGS)
+
 void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out)
 {
 
@@ -1608,77 +1662,80 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
   /* check if blend is disabled */
   if (!d || d->mode==0) return;
 
+  /* get channel max values depending on colorspace */
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(self);
+
   /* select the blend operator */
   switch (d->mode)
   {
     case DEVELOP_BLEND_LIGHTEN:
-      blend = _blend_lighten;
+      blend = _BLEND_SELECT(_blend_lighten, cst);
       break;
     case DEVELOP_BLEND_DARKEN:
-      blend = _blend_darken;
+      blend = _BLEND_SELECT(_blend_darken, cst);
       break;
     case DEVELOP_BLEND_MULTIPLY:
-      blend = _blend_multiply;
+      blend = _BLEND_SELECT(_blend_multiply, cst);
       break;
     case DEVELOP_BLEND_AVERAGE:
-      blend = _blend_average;
+      blend = _BLEND_SELECT(_blend_average, cst);
       break;
     case DEVELOP_BLEND_ADD:
-      blend = _blend_add;
+      blend = _BLEND_SELECT(_blend_add, cst);
       break;
     case DEVELOP_BLEND_SUBSTRACT:
-      blend = _blend_substract;
+      blend = _BLEND_SELECT(_blend_substract, cst);
       break;
     case DEVELOP_BLEND_DIFFERENCE:
-      blend = _blend_difference;
+      blend = _BLEND_SELECT(_blend_difference, cst);
       break;
     case DEVELOP_BLEND_SCREEN:
-      blend = _blend_screen;
+      blend = _BLEND_SELECT(_blend_screen, cst);
       break;
     case DEVELOP_BLEND_OVERLAY:
-      blend = _blend_overlay;
+      blend = _BLEND_SELECT(_blend_overlay, cst);
       break;
     case DEVELOP_BLEND_SOFTLIGHT:
-      blend = _blend_softlight;
+      blend = _BLEND_SELECT(_blend_softlight, cst);
       break;
     case DEVELOP_BLEND_HARDLIGHT:
-      blend = _blend_hardlight;
+      blend = _BLEND_SELECT(_blend_hardlight, cst);
       break;
     case DEVELOP_BLEND_VIVIDLIGHT:
-      blend = _blend_vividlight;
+      blend = _BLEND_SELECT(_blend_vividlight, cst);
       break;
     case DEVELOP_BLEND_LINEARLIGHT:
-      blend = _blend_linearlight;
+      blend = _BLEND_SELECT(_blend_linearlight, cst);
       break;
     case DEVELOP_BLEND_PINLIGHT:
-      blend = _blend_pinlight;
+      blend = _BLEND_SELECT(_blend_pinlight, cst);
       break;
     case DEVELOP_BLEND_LIGHTNESS:
-      blend = _blend_lightness;
+      blend = _BLEND_SELECT(_blend_lightness, cst);
       break;
     case DEVELOP_BLEND_CHROMA:
-      blend = _blend_chroma;
+      blend = _BLEND_SELECT(_blend_chroma, cst);
       break;
     case DEVELOP_BLEND_HUE:
-      blend = _blend_hue;
+      blend = _BLEND_SELECT(_blend_hue, cst);
       break;
     case DEVELOP_BLEND_COLOR:
-      blend = _blend_color;
+      blend = _BLEND_SELECT(_blend_color, cst);
       break;
     case DEVELOP_BLEND_INVERSE:
-      blend = _blend_inverse;
+      blend = _BLEND_SELECT(_blend_inverse, cst);
       break;
     case DEVELOP_BLEND_UNBOUNDED:
-      blend = _blend_unbounded;
+      blend = _BLEND_SELECT(_blend_unbounded, cst);
       break;
     case DEVELOP_BLEND_COLORADJUST:
-      blend = _blend_coloradjust;
+      blend = _BLEND_SELECT(_blend_coloradjust, cst);
       break;
 
       /* fallback to normal blend */
     case DEVELOP_BLEND_NORMAL:
     default:
-      blend = _blend_normal;
+      blend = _BLEND_SELECT(_blend_normal, cst);
       break;
   }
 
@@ -1697,9 +1754,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
     const int gaussian = d->radius > 0.0f ? 1 : 0;
     const float radius = fabs(d->radius);
-
-    /* get channel max values depending on colorspace */
-    const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(self);
+    _blend_mask_func *make_mask = _BLEND_SELECT(_blend_make_mask, cst);
 
     /* check if we only should blend lightness channel. will affect only Lab space */
     const int blendflag = self->flags() & IOP_FLAGS_BLEND_ONLY_LIGHTNESS;
@@ -1715,9 +1770,9 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
 
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
+    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,make_mask,d,stderr,ch)
 #else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
+    #pragma omp parallel for shared(i,roi_out,o,mask,make_mask,d,ch)
 #endif
 
 #endif
@@ -1728,7 +1783,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       float *in = (float *)i + index;
       float *out = (float *)o + index;
       float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(cst, d->blendif, d->blendif_parameters, opacity, in, out, m, stride);
+      make_mask(d->blendif, d->blendif_parameters, opacity, in, out, m, stride);
     }
 
     if(maskblur)
@@ -1787,7 +1842,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       float *in = (float *)i + index;
       float *out = (float *)o + index;
       float *m = (float *)mask + y * roi_out->width;
-      blend(cst, in, out, m, stride, blendflag);
+      blend(in, out, m, stride, blendflag);
 
       if(mask_display && cst != iop_cs_RAW)
         for(int j=0; j<stride; j+=4)
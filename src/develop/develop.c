@@ -27,6 +27,7 @@
 #include "common/mipmap_cache.h"
 #include "common/imageio.h"
 #include "common/tags.h"
+#include "common/collection.h"
 #include "common/debug.h"
 #include "common/similarity.h"
 #include "gui/gtk.h"
@@ -543,8 +544,12 @@ void dt_dev_add_history_item(dt_develop_t *dev, dt_iop_module_t *module, gboolea
   }
 #endif
 
+  // only the edited module and what comes after it needs to be reprocessed:
+  dt_dev_pixelpipe_mark_dirty(dev->pipe, module);
+  dt_dev_pixelpipe_mark_dirty(dev->preview_pipe, module);
+
   /* invalidate image data*/
-  dt_similarity_image_dirty(dev->image_storage.id);
+  dt_similarity_image_edited(dev->image_storage.id);
 
   // invalidate buffers and force redraw of darkroom
   dt_dev_invalidate_all(dev);
@@ -698,6 +703,7 @@ void dt_dev_write_history(dt_develop_t *dev)
   else
     dt_tag_detach(tagid, dev->image_storage.id);
 
+  dt_collection_invalidate();
 }
 
 static void
@@ -785,6 +791,7 @@ auto_apply_presets(dt_develop_t *dev)
             "blendop_params, blendop_version, multi_priority, multi_name from memory.history",
           -1, &stmt, NULL);
         sqlite3_step(stmt);
+        dt_collection_invalidate();
       }
     }
   }
@@ -952,7 +959,7 @@ void dt_dev_reprocess_all(dt_develop_t *dev)
     dev->pipe->cache_obsolete = 1;
     dev->preview_pipe->cache_obsolete = 1;
 
-    dt_similarity_image_dirty(dev->image_storage.id);
+    dt_similarity_image_edited(dev->image_storage.id);
 
     // invalidate buffers and force redraw of darkroom
     dt_dev_invalidate_all(dev);
@@ -970,7 +977,7 @@ void dt_dev_reprocess_center(dt_develop_t *dev)
     dev->pipe->changed |= DT_DEV_PIPE_SYNCH;
     dev->pipe->cache_obsolete = 1;
 
-    dt_similarity_image_dirty(dev->image_storage.id);
+    dt_similarity_image_edited(dev->image_storage.id);
 
     // invalidate buffers and force redraw of darkroom
     dt_dev_invalidate_all(dev);
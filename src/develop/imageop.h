@@ -62,6 +62,8 @@ struct dt_develop_tiling_t;
 #define IOP_FLAGS_TILING_FULL_ROI      64                       // Tiling code has to expect arbitrary roi's for this module (incl. flipping, mirroring etc.)
 #define IOP_FLAGS_ONE_INSTANCE        128     // The module doesn't support multiple instances
 #define IOP_FLAGS_PREVIEW_NON_OPENCL  256     // Preview pixelpipe of this module must not run on GPU but always on CPU
+#define IOP_FLAGS_POINTWISE           512     // Output pixels only depend on the input pixel at the same position and roi_in == roi_out, runs of such modules may be fused
+#define IOP_FLAGS_PIPE_TYPE_DEPENDENT 1024    // Output differs between pipe types (demosaic quality and such), buffers after it are only shared between pipes of the same type
 /** status of a module*/
 typedef enum dt_iop_module_state_t
 {
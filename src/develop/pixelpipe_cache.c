@@ -22,16 +22,7 @@
 #include <stdlib.h>
 
 
-// TODO: make cache global (needs to be thread safe then)
-// plan:
-// - look at mipmap_cache.c, for the full buffer allocs
-// - do that, but for `large' and `regular' buffers (full + export/dr mode), so 2 caches
-//   (in fact, maybe 3, one for preview pipes?)
-// - have at most 3 read locks all the time per pipe, get them at create time
-//   ping, pong, and priority buffer (focused plugin)
-// - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
-
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, int size)
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
 {
   cache->entries = entries;
   cache->data = (void **)malloc(sizeof(void *)*entries);
@@ -51,6 +42,7 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, in
     cache->hash[k] = -1;
     cache->used[k] = 0;
   }
+  cache->pinned = -1;
   cache->queries = cache->misses = 0;
   return 1;
 
@@ -70,6 +62,20 @@ alloc_memory_fail:
 
 }
 
+int dt_dev_pixelpipe_cache_reserve(dt_dev_pixelpipe_cache_t *cache, size_t size)
+{
+  for(int k=0; k<cache->entries; k++)
+  {
+    if(cache->size[k] >= size) continue;
+    free(cache->data[k]);
+    cache->data[k] = (void *)dt_alloc_align(16, size);
+    cache->size[k] = cache->data[k] ? size : 0;
+    cache->hash[k] = -1;
+    if(!cache->data[k]) return 0;
+  }
+  return 1;
+}
+
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k=0; k<cache->entries; k++) free(cache->data[k]);
@@ -79,10 +85,8 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
   free(cache->size);
 }
 
-uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
+static uint64_t _dev_pixelpipe_cache_hash_seeded(uint64_t hash, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
 {
-  // bernstein hash (djb2)
-  uint64_t hash = 5381 + imgid;
   // go through all modules up to module and compute a weird hash using the operation and params.
   GList *pieces = pipe->nodes;
   for(int k=0; k<module&&pieces; k++)
@@ -114,6 +118,12 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_
   return hash;
 }
 
+uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
+{
+  // bernstein hash (djb2)
+  return _dev_pixelpipe_cache_hash_seeded(5381 + imgid, roi, pipe, module);
+}
+
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
   // search for hash in cache
@@ -131,6 +141,16 @@ int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t h
   return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, 0);
 }
 
+int dt_dev_pixelpipe_cache_get_line(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data)
+{
+  // the lookup is accounted for by the global cache, don't count it here as well:
+  const uint64_t queries = cache->queries, misses = cache->misses;
+  const int ret = dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, 0);
+  cache->queries = queries;
+  cache->misses = misses;
+  return ret;
+}
+
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data, int weight)
 {
   cache->queries ++;
@@ -140,32 +160,42 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
   for(int k=0; k<cache->entries; k++)
   {
     // search for hash in cache
-    if(cache->used[k] > max_used)
+    if(k != cache->pinned)
     {
-      max_used = cache->used[k];
-      max = k;
+      if(cache->used[k] > max_used)
+      {
+        max_used = cache->used[k];
+        max = k;
+      }
+      cache->used[k]++; // age all entries
     }
-    cache->used[k]++; // age all entries
     if(cache->hash[k] == hash)
     {
       *data = cache->data[k];
       sz = cache->size[k];
-      cache->used[k] = weight; // this is the MRU entry
+      if(k != cache->pinned) cache->used[k] = weight; // this is the MRU entry
     }
   }
 
   if(!*data || sz < size)
   {
+    // a pinned line which is too small has to be given up:
+    if(*data && cache->pinned >= 0 && *data == cache->data[cache->pinned])
+    {
+      max = cache->pinned;
+      cache->pinned = -1;
+    }
     // kill LRU entry
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries, weight);
     if(cache->size[max] < size)
     {
       free(cache->data[max]);
       cache->data[max] = (void *)dt_alloc_align(16, size);
-      cache->size[max] = size;
+      // out of memory: the caller gets NULL, and the empty line is grown again next time.
+      cache->size[max] = cache->data[max] ? size : 0;
     }
     *data = cache->data[max];
-    cache->hash[max] = hash;
+    cache->hash[max] = *data ? hash : -1;
     cache->used[max] = weight;
     cache->misses++;
     return 1;
@@ -180,6 +210,7 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
     cache->hash[k] = -1;
     cache->used[k] = 0;
   }
+  cache->pinned = -1;
 }
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
@@ -193,6 +224,24 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
   }
 }
 
+int dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  // we need at least ping, pong and the base buffer besides the pinned line.
+  if(cache->entries < 4) return 0;
+  for(int k=0; k<cache->entries; k++)
+  {
+    if(cache->data[k] == data && cache->hash[k] != (uint64_t)-1)
+    {
+      // the previously pinned line goes back into the lru:
+      if(cache->pinned >= 0) cache->used[cache->pinned] = 0;
+      cache->pinned = k;
+      cache->used[k] = -cache->entries;
+      return 1;
+    }
+  }
+  return 0;
+}
+
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
   for(int k=0; k<cache->entries; k++)
@@ -200,6 +249,7 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
     if(cache->data[k] == data)
     {
       cache->hash[k] = -1;
+      if(k == cache->pinned) cache->pinned = -1;
     }
   }
 }
@@ -209,12 +259,261 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
   for(int k=0; k<cache->entries; k++)
   {
     printf("pixelpipe cacheline %d ", k);
-    printf("used %d by %"PRIu64"", cache->used[k], cache->hash[k]);
+    printf("used %d by %"PRIu64"%s", cache->used[k], cache->hash[k], k == cache->pinned ? " (pinned)" : "");
     printf("\n");
   }
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses)/(float)cache->queries);
 }
 
+uint64_t dt_dev_pixelpipe_cache_global_image_key(dt_dev_pixelpipe_t *pipe)
+{
+  // virtual copies share the raw data, so key on the file instead of the image id:
+  uint64_t hash = 5381 + pipe->image.film_id;
+  for(const char *c = pipe->image.filename; *c; c++) hash = ((hash << 5) + hash) ^ *c;
+  return hash;
+}
+
+uint64_t dt_dev_pixelpipe_cache_global_hash(const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
+{
+  uint64_t hash = dt_dev_pixelpipe_cache_global_image_key(pipe);
+  // the input buffer might be the downscaled mip_f or the full buffer:
+  const int input[3] = { dt_dev_pixelpipe_uses_downsampled_input(pipe), pipe->iwidth, pipe->iheight };
+  const char *str = (const char *)input;
+  for(int i=0; i<sizeof(input); i++) hash = ((hash << 5) + hash) ^ str[i];
+  // the pipe type only matters once a module which specializes on it (demosaic quality for
+  // example) has run, the buffers before that are the same in all pipes:
+  GList *pieces = pipe->nodes;
+  for(int k=0; k<module&&pieces; k++, pieces = g_list_next(pieces))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(piece->enabled && (piece->module->flags() & IOP_FLAGS_PIPE_TYPE_DEPENDENT))
+    {
+      hash = ((hash << 5) + hash) ^ pipe->type;
+      break;
+    }
+  }
+  return _dev_pixelpipe_cache_hash_seeded(hash, roi, pipe, module);
+}
+
+void dt_dev_pixelpipe_cache_global_init(dt_dev_pixelpipe_cache_global_t *cache, size_t max_bytes)
+{
+  for(int k=0; k<DT_DEV_PIXELPIPE_CACHE_STRIPES; k++)
+  {
+    dt_pthread_mutex_init(&cache->stripe[k].lock, NULL);
+    cache->stripe[k].lines = NULL;
+  }
+  cache->cost = 0;
+  cache->cost_quota = max_bytes;
+  cache->clock = 0;
+  cache->queries = cache->misses = 0;
+}
+
+static void _global_line_free(dt_dev_pixelpipe_cache_line_t *line)
+{
+  free(line->data);
+  free(line);
+}
+
+void dt_dev_pixelpipe_cache_global_cleanup(dt_dev_pixelpipe_cache_global_t *cache)
+{
+  for(int k=0; k<DT_DEV_PIXELPIPE_CACHE_STRIPES; k++)
+  {
+    g_list_free_full(cache->stripe[k].lines, (GDestroyNotify)_global_line_free);
+    cache->stripe[k].lines = NULL;
+    dt_pthread_mutex_destroy(&cache->stripe[k].lock);
+  }
+  cache->cost = 0;
+}
+
+static inline dt_dev_pixelpipe_cache_stripe_t *_global_stripe(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash)
+{
+  // low bits of djb2 are dominated by the roi, mix in the upper half:
+  return cache->stripe + ((hash ^ (hash >> 32)) % DT_DEV_PIXELPIPE_CACHE_STRIPES);
+}
+
+static dt_dev_pixelpipe_cache_line_t *_global_find(dt_dev_pixelpipe_cache_stripe_t *stripe, const uint64_t hash)
+{
+  for(GList *l = stripe->lines; l; l = g_list_next(l))
+  {
+    dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+    if(line->hash == hash) return line;
+  }
+  return NULL;
+}
+
+// removes the given list node from the stripe. has to be called with the stripe locked.
+static void _global_remove(dt_dev_pixelpipe_cache_global_t *cache, dt_dev_pixelpipe_cache_stripe_t *stripe, GList *l)
+{
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+  __sync_fetch_and_sub(&cache->cost, line->size);
+  stripe->lines = g_list_delete_link(stripe->lines, l);
+  _global_line_free(line);
+}
+
+int dt_dev_pixelpipe_cache_global_available(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash, const size_t size)
+{
+  if(!cache || !cache->cost_quota) return 0;
+  __sync_fetch_and_add(&cache->queries, 1);
+  dt_dev_pixelpipe_cache_stripe_t *stripe = _global_stripe(cache, hash);
+  dt_pthread_mutex_lock(&stripe->lock);
+  dt_dev_pixelpipe_cache_line_t *line = _global_find(stripe, hash);
+  const int available = line && line->size >= size;
+  dt_pthread_mutex_unlock(&stripe->lock);
+  if(!available) __sync_fetch_and_add(&cache->misses, 1);
+  return available;
+}
+
+int dt_dev_pixelpipe_cache_global_fetch(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash, const size_t size, void *data, float *processed_maximum)
+{
+  if(!cache || !cache->cost_quota) return 1;
+  dt_dev_pixelpipe_cache_stripe_t *stripe = _global_stripe(cache, hash);
+
+  dt_pthread_mutex_lock(&stripe->lock);
+  dt_dev_pixelpipe_cache_line_t *line = _global_find(stripe, hash);
+  if(!line || line->size < size)
+  {
+    dt_pthread_mutex_unlock(&stripe->lock);
+    __sync_fetch_and_add(&cache->misses, 1);
+    return 1;
+  }
+  // pin the line, so it won't be evicted while we copy outside the lock:
+  line->readers++;
+  line->used = __sync_add_and_fetch(&cache->clock, 1);
+  dt_pthread_mutex_unlock(&stripe->lock);
+
+  memcpy(data, line->data, size);
+  for(int k=0; k<3; k++) processed_maximum[k] = line->processed_maximum[k];
+
+  dt_pthread_mutex_lock(&stripe->lock);
+  line->readers--;
+  dt_pthread_mutex_unlock(&stripe->lock);
+  return 0;
+}
+
+// evict least recently used, unpinned lines until size more bytes fit into the budget.
+// never holds more than one stripe lock at a time. returns non-zero if that is not possible.
+static int _global_make_room(dt_dev_pixelpipe_cache_global_t *cache, const size_t size)
+{
+  while(cache->cost + size > cache->cost_quota)
+  {
+    int victim = -1;
+    uint64_t oldest = UINT64_MAX;
+    for(int k=0; k<DT_DEV_PIXELPIPE_CACHE_STRIPES; k++)
+    {
+      dt_pthread_mutex_lock(&cache->stripe[k].lock);
+      for(GList *l = cache->stripe[k].lines; l; l = g_list_next(l))
+      {
+        dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+        if(!line->readers && line->used < oldest)
+        {
+          oldest = line->used;
+          victim = k;
+        }
+      }
+      dt_pthread_mutex_unlock(&cache->stripe[k].lock);
+    }
+    if(victim < 0) return 1;
+
+    // someone might have touched the stripe in between, just drop its current lru line.
+    dt_dev_pixelpipe_cache_stripe_t *stripe = cache->stripe + victim;
+    dt_pthread_mutex_lock(&stripe->lock);
+    GList *lru = NULL;
+    for(GList *l = stripe->lines; l; l = g_list_next(l))
+    {
+      dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+      if(line->readers) continue;
+      if(!lru || line->used < ((dt_dev_pixelpipe_cache_line_t *)lru->data)->used) lru = l;
+    }
+    if(lru) _global_remove(cache, stripe, lru);
+    dt_pthread_mutex_unlock(&stripe->lock);
+  }
+  return 0;
+}
+
+void dt_dev_pixelpipe_cache_global_store(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash, const uint64_t image, const size_t size, const void *data, const float *processed_maximum)
+{
+  if(!cache || size > cache->cost_quota) return;
+  dt_dev_pixelpipe_cache_stripe_t *stripe = _global_stripe(cache, hash);
+
+  dt_pthread_mutex_lock(&stripe->lock);
+  const int found = (_global_find(stripe, hash) != NULL);
+  dt_pthread_mutex_unlock(&stripe->lock);
+  if(found) return;
+
+  if(_global_make_room(cache, size)) return;
+
+  // copy outside the lock, other pipes might want to read from this stripe meanwhile:
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)malloc(sizeof(dt_dev_pixelpipe_cache_line_t));
+  if(!line) return;
+  line->data = dt_alloc_align(16, size);
+  if(!line->data)
+  {
+    free(line);
+    return;
+  }
+  memcpy(line->data, data, size);
+  line->hash = hash;
+  line->image = image;
+  line->size = size;
+  line->readers = 0;
+  for(int k=0; k<3; k++) line->processed_maximum[k] = processed_maximum[k];
+
+  dt_pthread_mutex_lock(&stripe->lock);
+  if(_global_find(stripe, hash))
+  {
+    // another pipe was quicker.
+    dt_pthread_mutex_unlock(&stripe->lock);
+    _global_line_free(line);
+    return;
+  }
+  line->used = __sync_add_and_fetch(&cache->clock, 1);
+  stripe->lines = g_list_prepend(stripe->lines, line);
+  __sync_fetch_and_add(&cache->cost, size);
+  dt_pthread_mutex_unlock(&stripe->lock);
+}
+
+void dt_dev_pixelpipe_cache_global_invalidate(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t image)
+{
+  if(!cache) return;
+  for(int k=0; k<DT_DEV_PIXELPIPE_CACHE_STRIPES; k++)
+  {
+    dt_dev_pixelpipe_cache_stripe_t *stripe = cache->stripe + k;
+    dt_pthread_mutex_lock(&stripe->lock);
+    GList *l = stripe->lines;
+    while(l)
+    {
+      GList *next = g_list_next(l);
+      dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+      if(!image || line->image == image)
+      {
+        if(line->readers)
+        {
+          // still being copied from, just make it unfindable. eviction will free it.
+          line->hash = -1;
+          line->used = 0;
+        }
+        else _global_remove(cache, stripe, l);
+      }
+      l = next;
+    }
+    dt_pthread_mutex_unlock(&stripe->lock);
+  }
+}
+
+void dt_dev_pixelpipe_cache_global_print(dt_dev_pixelpipe_cache_global_t *cache)
+{
+  if(!cache) return;
+  int lines = 0;
+  for(int k=0; k<DT_DEV_PIXELPIPE_CACHE_STRIPES; k++)
+  {
+    dt_pthread_mutex_lock(&cache->stripe[k].lock);
+    lines += g_list_length(cache->stripe[k].lines);
+    dt_pthread_mutex_unlock(&cache->stripe[k].lock);
+  }
+  printf("global pixelpipe cache: %d lines, %.1f/%.1f MB\n", lines, cache->cost/(1024.0*1024.0), cache->cost_quota/(1024.0*1024.0));
+  printf("global cache hit rate so far: %.3f\n", (cache->queries - cache->misses)/(float)MAX(1, cache->queries));
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
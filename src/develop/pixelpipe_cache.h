@@ -18,6 +18,7 @@
 #ifndef DT_PIXELPIPE_CACHE_H
 #define DT_PIXELPIPE_CACHE_H
 
+#include "common/dtpthread.h"
 #include <inttypes.h>
 /**
  * implements a simple pixel cache suitable for caching float images
@@ -32,6 +33,7 @@ typedef struct dt_dev_pixelpipe_cache_t
   size_t   *size;
   uint64_t *hash;
   int32_t  *used;
+  int32_t   pinned;  // cache line which is never aged nor evicted, -1 if none.
 #ifdef HAVE_OPENCL
   void    **gpu_mem;
 #endif
@@ -44,8 +46,10 @@ dt_dev_pixelpipe_cache_t;
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
 	\param[out] returns 0 if fail to allocate mem cache.
 */
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, int size);
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
+/** grows all cache lines to at least size bytes up front, returns 0 if that fails. */
+int dt_dev_pixelpipe_cache_reserve(dt_dev_pixelpipe_cache_t *cache, size_t size);
 
 struct dt_iop_roi_t;
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
@@ -53,10 +57,12 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi,
 
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
   * cache line, the least recently used cache line will be cleared and an empty buffer is returned
-  * together with a non-zero return value. */
+  * together with a non-zero return value. the buffer is NULL if it had to grow and that failed. */
 int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data);
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data);
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data, int weight);
+/** same as dt_dev_pixelpipe_cache_get(), for a line that is filled from the global cache. not counted as a lookup. */
+int dt_dev_pixelpipe_cache_get_line(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data);
 
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
@@ -67,12 +73,85 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** keeps this buffer until another one is pinned or the cache is flushed. only one line can be pinned at a time.
+ *  returns 0 if the buffer is not in the cache or the cache is too small to give away a line. */
+int dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data);
+
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
+
+/**
+ * process wide second level cache, shared by all pipes (full, preview, export, ..).
+ * the per-pipe cache above stays the working set of a pipe, this one keeps
+ * copies of intermediate buffers around so that other pipes (virtual copies
+ * being exported in parallel, re-created export pipes, ..) don't have to
+ * recompute identical prefixes of the module stack.
+ * it is bounded by a byte budget and split into stripes, each protected by
+ * its own mutex, so concurrent pipes rarely contend. no more than one stripe
+ * lock is ever held at a time.
+ */
+#define DT_DEV_PIXELPIPE_CACHE_STRIPES 16
+
+typedef struct dt_dev_pixelpipe_cache_line_t
+{
+  uint64_t hash;
+  uint64_t image;               // key of the source image, to invalidate per image
+  size_t   size;
+  void    *data;
+  float    processed_maximum[3];
+  int32_t  readers;             // number of threads currently copying out of data
+  uint64_t used;                // global clock value of last access, for lru eviction
+}
+dt_dev_pixelpipe_cache_line_t;
+
+typedef struct dt_dev_pixelpipe_cache_stripe_t
+{
+  dt_pthread_mutex_t lock;
+  GList  *lines;                // list of dt_dev_pixelpipe_cache_line_t
+}
+dt_dev_pixelpipe_cache_stripe_t;
+
+typedef struct dt_dev_pixelpipe_cache_global_t
+{
+  dt_dev_pixelpipe_cache_stripe_t stripe[DT_DEV_PIXELPIPE_CACHE_STRIPES];
+  size_t   cost;                // bytes currently allocated
+  size_t   cost_quota;          // byte budget
+  uint64_t clock;
+  // profiling:
+  uint64_t queries;
+  uint64_t misses;
+}
+dt_dev_pixelpipe_cache_global_t;
+
+/** init the global cache with the given byte budget. a budget of 0 disables it. */
+void dt_dev_pixelpipe_cache_global_init(dt_dev_pixelpipe_cache_global_t *cache, size_t max_bytes);
+void dt_dev_pixelpipe_cache_global_cleanup(dt_dev_pixelpipe_cache_global_t *cache);
+
+/** hash identifying the buffer after the module-th module independently of the pipe it was computed in. */
+uint64_t dt_dev_pixelpipe_cache_global_hash(const struct dt_iop_roi_t *roi, struct dt_dev_pixelpipe_t *pipe, int module);
+
+/** key of the source image of the pipe, as used for per-image invalidation. */
+uint64_t dt_dev_pixelpipe_cache_global_image_key(struct dt_dev_pixelpipe_t *pipe);
+
+/** test availability of a cache line, also counts towards the hit rate. */
+int dt_dev_pixelpipe_cache_global_available(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash, const size_t size);
+
+/** copies the cached buffer into data, if available. returns 0 on hit, non-zero otherwise. */
+int dt_dev_pixelpipe_cache_global_fetch(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash, const size_t size, void *data, float *processed_maximum);
+
+/** stores a copy of data for other pipes to find. might silently refuse if the budget is exhausted. */
+void dt_dev_pixelpipe_cache_global_store(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t hash, const uint64_t image, const size_t size, const void *data, const float *processed_maximum);
+
+/** drops all unused lines belonging to the given image key (0 means all lines). */
+void dt_dev_pixelpipe_cache_global_invalidate(dt_dev_pixelpipe_cache_global_t *cache, const uint64_t image);
+
+/** print out statistics (debug). */
+void dt_dev_pixelpipe_cache_global_print(dt_dev_pixelpipe_cache_global_t *cache);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -19,6 +19,7 @@
 #include "develop/pixelpipe.h"
 #include "develop/blend.h"
 #include "develop/tiling.h"
+#include "develop/pixelpipe_profile.h"
 #include "gui/gtk.h"
 #include "control/control.h"
 #include "control/signal.h"
@@ -64,6 +65,39 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
+// thumbnails are processed one image after the other, there is nothing to share.
+static inline int _pipe_shares_cache(const dt_dev_pixelpipe_t *pipe)
+{
+  return pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL && darktable.pixelpipe_cache && darktable.pixelpipe_cache->cost_quota;
+}
+
+// only worth publishing a buffer if recomputing it is slower than copying it around (assuming ~1GB/s).
+static inline int _pipe_worth_sharing(const dt_times_t *start, const size_t bufsize)
+{
+  dt_times_t end;
+  dt_get_times(&end);
+  return end.clock - start->clock > bufsize * (1.0/(1u<<30));
+}
+
+// hand one module run (or cache hit) to the profiler, if it is switched on.
+static void _pipe_profile(const dt_dev_pixelpipe_t *pipe, const char *name, const double start, const size_t bytes,
+                          const int opencl, const int tiles, const int cached)
+{
+  if(!darktable.pixelpipe_profile) return;
+  dt_dev_pixelpipe_profile_event_t ev;
+  memset(&ev, 0, sizeof(ev));
+  g_strlcpy(ev.name, name, sizeof(ev.name));
+  ev.pipe = _pipe_type_to_str(pipe->type);
+  ev.imgid = pipe->image.id;
+  ev.opencl = opencl;
+  ev.cached = cached;
+  ev.tiles = tiles;
+  ev.bytes = bytes;
+  ev.start = start;
+  ev.end = dt_get_wtime();
+  dt_dev_pixelpipe_profile_record(darktable.pixelpipe_profile, &ev);
+}
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels)
 {
   int res = dt_dev_pixelpipe_init_cached(pipe, 4*sizeof(float)*width*height, 2);
@@ -93,7 +127,7 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t entries)
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
@@ -104,6 +138,8 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size))
     return 0;
   pipe->cache_obsolete = 0;
+  pipe->dirty_from = 0;
+  pipe->dirty_count = 0;
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
@@ -190,6 +226,29 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     }
     modules = g_list_next(modules);
   }
+  pipe->dirty_from = 0;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+}
+
+// needs busy_mutex.
+static inline void _pipe_set_dirty(dt_dev_pixelpipe_t *pipe, const int pos)
+{
+  if(pipe->dirty_from < 0 || pos < pipe->dirty_from) pipe->dirty_from = pos;
+  pipe->dirty_count++;
+}
+
+void dt_dev_pixelpipe_mark_dirty(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module)
+{
+  int pos = 0;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes), pos++)
+  {
+    if(((dt_dev_pixelpipe_iop_t *)nodes->data)->module == module)
+    {
+      _pipe_set_dirty(pipe, pos);
+      break;
+    }
+  }
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -200,38 +259,61 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
   // find piece in nodes list
   GList *nodes = pipe->nodes;
   dt_dev_pixelpipe_iop_t *piece = NULL;
+  int pos = 0;
   while(nodes)
   {
     piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
     if(piece->module == hist->module)
     {
+      const uint64_t hash = piece->hash;
       piece->enabled = hist->enabled;
       dt_iop_commit_params(hist->module, hist->params, hist->blend_params, pipe, piece);
+      if(piece->hash != hash) _pipe_set_dirty(pipe, pos);
     }
     nodes = g_list_next(nodes);
+    pos++;
   }
 }
 
 void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
+  // remember the old hashes, the reset below would make every node look changed.
+  const int num_nodes = g_list_length(pipe->nodes);
+  uint64_t *hashes = (uint64_t *)malloc(sizeof(uint64_t)*(num_nodes+1));
   // call reset_params on all pieces first.
   GList *nodes = pipe->nodes;
-  while(nodes)
+  for(int k=0; nodes; k++)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(hashes) hashes[k] = piece->hash;
     piece->hash = 0;
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params, pipe, piece);
     nodes = g_list_next(nodes);
   }
   // go through all history items and adjust params
+  const int dirty_from = pipe->dirty_from;
   GList *history = dev->history;
   for(int k=0; k<dev->history_end && history; k++)
   {
     dt_dev_pixelpipe_synch(pipe, dev, history);
     history = g_list_next(history);
   }
+  // now find the first node which really changed, or start over if we couldn't remember:
+  pipe->dirty_from = dirty_from;
+  nodes = pipe->nodes;
+  if(!hashes) _pipe_set_dirty(pipe, 0);
+  for(int k=0; hashes && nodes; k++)
+  {
+    if(((dt_dev_pixelpipe_iop_t *)nodes->data)->hash != hashes[k])
+    {
+      _pipe_set_dirty(pipe, k);
+      break;
+    }
+    nodes = g_list_next(nodes);
+  }
+  free(hashes);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -415,6 +497,151 @@ pixelpipe_picker_cl(int devid, dt_iop_module_t *module, cl_mem img, const dt_iop
 #endif
 
 
+static int
+dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output, int *out_bpp,
+                             const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// longest run of pointwise modules evaluated in one go:
+#define DT_PIPE_FUSE_MAX 32
+// stripe buffer per thread, small enough to stay in cache between the modules of a run:
+#define DT_PIPE_FUSE_STRIPE_BYTES (256<<10)
+
+// only for pipes nobody looks into: the gui pipes pick colors and histograms from intermediate buffers.
+// fused runs are cpu only, on the gpu each module keeps its buffer in device memory anyway.
+static inline int _pipe_fuses(const dt_dev_pixelpipe_t *pipe)
+{
+  return (pipe->type == DT_DEV_PIXELPIPE_EXPORT || pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)
+         && !(pipe->opencl_enabled && pipe->devid >= 0)
+         && dt_conf_get_bool("pixelpipe_fuse_pointwise");
+}
+
+static inline int _piece_fusable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_develop_blend_params_t *b = (const dt_develop_blend_params_t *)piece->blendop_data;
+  return (piece->module->flags() & IOP_FLAGS_POINTWISE) && (!b || b->mode == 0)
+         && get_output_bpp(piece->module, pipe, piece, dev) == 4*sizeof(float);
+}
+
+// runs the pointwise modules ending in `modules' together, one stripe of rows at a time, and only
+// writes the output of the last one to the cache. returns 1 if it did, 0 if there is nothing to fuse,
+// and -1 on error or shutdown.
+static int
+_pipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, const dt_iop_roi_t *roi_out,
+                    GList *modules, GList *pieces, int pos, const uint64_t hash, const size_t bufsize,
+                    const int shared, const uint64_t global_hash)
+{
+  dt_iop_module_t *module[DT_PIPE_FUSE_MAX];
+  dt_dev_pixelpipe_iop_t *piece[DT_PIPE_FUSE_MAX];
+  int n = 0;
+  // collect the run backwards, disabled pieces don't interrupt it:
+  while(modules && n < DT_PIPE_FUSE_MAX)
+  {
+    dt_dev_pixelpipe_iop_t *p = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(p->enabled)
+    {
+      if(!_piece_fusable(pipe, dev, p)) break;
+      piece[n] = p;
+      module[n] = p->module;
+      n++;
+    }
+    modules = g_list_previous(modules);
+    pieces = g_list_previous(pieces);
+    pos--;
+  }
+  if(n < 2) return 0;
+  // needs float input, from the last enabled module in front of the run or from the base buffer:
+  GList *pm = modules, *pp = pieces;
+  while(pm && !((dt_dev_pixelpipe_iop_t *)pp->data)->enabled)
+  {
+    pm = g_list_previous(pm);
+    pp = g_list_previous(pp);
+  }
+  if(get_output_bpp(pm ? (dt_iop_module_t *)pm->data : NULL, pipe, pp ? (dt_dev_pixelpipe_iop_t *)pp->data : NULL, dev) != 4*sizeof(float))
+    return 0;
+  for(int k=0; k<n/2; k++)
+  {
+    dt_iop_module_t *m = module[k];
+    module[k] = module[n-1-k];
+    module[n-1-k] = m;
+    dt_dev_pixelpipe_iop_t *p = piece[k];
+    piece[k] = piece[n-1-k];
+    piece[n-1-k] = p;
+  }
+
+  // pointwise modules don't change the roi:
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  int input_bpp;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_bpp, roi_out, modules, pieces, pos)) return -1;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown || cl_mem_input)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return -1;
+  }
+  (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+  if(!*output)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return -1;
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  const int wd = roi_out->width, ht = roi_out->height;
+  const size_t stride = (size_t)4*wd;
+  const int threads = dt_get_num_threads();
+  const int rows = CLAMP((int)(threads * (size_t)DT_PIPE_FUSE_STRIPE_BYTES / (stride*sizeof(float))), MIN(threads, ht), ht);
+  float *tmp[2] = { NULL, NULL };
+  for(int k=0; k<MIN(2, n-1); k++)
+    if(!(tmp[k] = (float *)dt_alloc_align(64, sizeof(float)*stride*rows)))
+    {
+      free(tmp[0]);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return -1;
+    }
+
+  // modules may scale processed_maximum in process(), every stripe has to start from the same values:
+  float max_in[DT_PIPE_FUSE_MAX][3];
+  int stripes = 0;
+  for(int y=0; y<ht && !pipe->shutdown; y+=rows, stripes++)
+  {
+    const dt_iop_roi_t roi = { roi_out->x, roi_out->y + y, wd, MIN(rows, ht-y), roi_out->scale };
+    float *in = (float *)input + stride*y;
+    for(int k=0; k<n; k++)
+    {
+      float *out = k == n-1 ? (float *)*output + stride*y : tmp[k&1];
+      if(y == 0) for(int c=0; c<3; c++) max_in[k][c] = pipe->processed_maximum[c];
+      else       for(int c=0; c<3; c++) pipe->processed_maximum[c] = max_in[k][c];
+      module[k]->process(module[k], piece[k], in, out, &roi, &roi);
+      in = out;
+    }
+  }
+  free(tmp[0]);
+  free(tmp[1]);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return -1;
+  }
+
+  // what each piece would have seen, in case its output gets looked up later:
+  for(int k=0; k<n; k++)
+    for(int c=0; c<3; c++)
+      piece[k]->processed_maximum[c] = k < n-1 ? max_in[k+1][c] : pipe->processed_maximum[c];
+
+  dt_show_times(&start, "[dev_pixelpipe]", "processing `%s' to `%s' fused in %d stripes [%s]", module[0]->name(),
+                module[n-1]->name(), stripes, _pipe_type_to_str(pipe->type));
+  if(shared && _pipe_worth_sharing(&start, bufsize))
+    dt_dev_pixelpipe_cache_global_store(darktable.pixelpipe_cache, global_hash, dt_dev_pixelpipe_cache_global_image_key(pipe),
+                                        bufsize, *output, pipe->processed_maximum);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  _pipe_profile(pipe, module[n-1]->op, start.clock, bufsize + MIN(2, n-1)*sizeof(float)*stride*rows, 0, stripes, 0);
+  return 1;
+}
+
 // recursive helper for process:
 static int
 dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output, int *out_bpp,
@@ -439,6 +666,8 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
   const int bpp = get_output_bpp(module, pipe, piece, dev);
   *out_bpp = bpp;
   const size_t bufsize = bpp*roi_out->width*roi_out->height;
+  // cache lookups don't recurse, so this is their start time:
+  const double lookup_start = darktable.pixelpipe_profile ? dt_get_wtime() : 0.0;
 
 
   // 1) if cached buffer is still available, return data
@@ -457,12 +686,45 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     else      for(int k=0; k<3; k++) pipe->processed_maximum[k] = 1.0f;
     (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    if(!*output) return 1;
+    _pipe_profile(pipe, module ? module->op : "input", lookup_start, 0, 0, 0, 1);
     if(!modules) return 0;
     // go to post-collect directly:
     goto post_process_collect_info;
   }
   else dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
+  // 1b) maybe another pipe has computed the same buffer already
+  const int shared = modules && _pipe_shares_cache(pipe);
+  const uint64_t global_hash = shared ? dt_dev_pixelpipe_cache_global_hash(roi_out, pipe, pos) : 0;
+  if(shared && dt_dev_pixelpipe_cache_global_available(darktable.pixelpipe_cache, global_hash, bufsize))
+  {
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    if(pipe->shutdown)
+    {
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+    float processed_maximum[3];
+    (void) dt_dev_pixelpipe_cache_get_line(&(pipe->cache), hash, bufsize, output);
+    if(!*output)
+    {
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+    if(!dt_dev_pixelpipe_cache_global_fetch(darktable.pixelpipe_cache, global_hash, bufsize, *output, processed_maximum))
+    {
+      for(int k=0; k<3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k] = processed_maximum[k];
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      _pipe_profile(pipe, module->op, lookup_start, 0, 0, 0, 1);
+      goto post_process_collect_info;
+    }
+    // evicted in the meantime, don't leave garbage behind this hash:
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    *output = NULL;
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
+
   // 2) if history changed or exit event, abort processing?
   // preview pipe: abort on all but zoom events (same buffer anyways)
   if(dt_iop_breakpoint(dev, pipe)) return 1;
@@ -491,9 +753,9 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       {
         *output = pipe->input;
       }
-      else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output))
+      else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output) && *output)
       {
-        memset(*output, 0, pipe->backbuf_size);
+        memset(*output, 0, bufsize);
         if(roi_in.scale == 1.0f)
         {
           // fast branch for 1:1 pixel copies.
@@ -530,7 +792,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     else
     {
       // reserve new cache line: output
-      if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output))
+      if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output) && *output)
       {
         roi_in.x /= roi_out->scale;
         roi_in.y /= roi_out->scale;
@@ -542,11 +804,21 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     }
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    if(!*output) return 1;
+    _pipe_profile(pipe, "input", start.clock, bufsize, 0, 0, 0);
   }
   else
   {
     // 3b) recurse and obtain output array in &input
 
+    // or, if this ends a run of pointwise modules, process all of them at once:
+    if(_pipe_fuses(pipe))
+    {
+      const int fused = _pipe_process_fused(pipe, dev, output, roi_out, modules, pieces, pos, hash, bufsize, shared, global_hash);
+      if(fused < 0) return 1;
+      if(fused) goto post_process_collect_info;
+    }
+
     // get region of interest which is needed in input
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     if(pipe->shutdown)
@@ -574,6 +846,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     else
       (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    if(!*output) return 1;
 
     // if(module) printf("reserving new buf in cache for module %s %s: %ld buf %lX\n", module->op, pipe == dev->preview_pipe ? "[preview]" : "", hash, (long int)*output);
 
@@ -625,6 +898,10 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
     dt_times_t start;
     dt_get_times(&start);
+    // filled in by the tiling code, if it gets used:
+    piece->tiles = 0;
+    piece->tile_bytes = 0;
+    int used_opencl = 0;
 
     dt_develop_tiling_t tiling = { 0 };
     dt_develop_tiling_t tiling_blendop = { 0 };
@@ -884,6 +1161,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         if (success_opencl)
         {
           /* Nice, everything went fine */
+          used_opencl = 1;
 
           /* this is reasonable on slow GPUs only, where it's more expensive to reprocess the whole pixelpipe than
              regularly copying device buffers back to host. This would slow down fast GPUs considerably. */
@@ -1196,14 +1474,23 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
     dt_show_times(&start, "[dev_pixelpipe]", "processing `%s' [%s]", module->name(),
                   _pipe_type_to_str(pipe->type));
+    _pipe_profile(pipe, module->op, start.clock, bufsize + piece->tile_bytes, used_opencl, piece->tiles, 0);
     // in case we get this buffer from the cache, also get the processed max:
     for(int k=0; k<3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k];
+    // publish for other pipes, unless the result only lives on the gpu:
+    if(shared && *cl_mem_output == NULL && _pipe_worth_sharing(&start, bufsize))
+      dt_dev_pixelpipe_cache_global_store(darktable.pixelpipe_cache, global_hash, dt_dev_pixelpipe_cache_global_image_key(pipe),
+                                          bufsize, *output, pipe->processed_maximum);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
-    if(module == darktable.develop->gui_module)
+    if(pipe->dirty_from > 0 ? pos-1 == pipe->dirty_from : module == darktable.develop->gui_module)
     {
-      // give the input buffer to the currently focussed plugin more weight.
-      // the user is likely to change that one soon, so keep it in cache.
-      dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
+      // pin the input buffer to the module being edited (or the currently focussed plugin).
+      // the user is likely to change that one again soon, and then only the modules
+      // after it have to be replayed.
+      dt_pthread_mutex_lock(&pipe->busy_mutex);
+      if(!dt_dev_pixelpipe_cache_pin(&(pipe->cache), input))
+        dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
     }
 #ifndef _DEBUG
     if(darktable.unmuted & DT_DEBUG_NAN)
@@ -1685,13 +1972,24 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
 
   if(pipe->devid >= 0) dt_opencl_events_reset(pipe->devid);
 
+  // marks made while we run are for the next run:
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const int dirty_count = pipe->dirty_count;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  const double profile_start = dt_get_wtime();
+  const uint64_t profile_queries = pipe->cache.queries, profile_misses = pipe->cache.misses;
+
   dt_iop_roi_t roi = (dt_iop_roi_t)
   {
     x, y, width, height, scale
   };
   // printf("pixelpipe homebrew process start\n");
   if(darktable.unmuted & DT_DEBUG_DEV)
+  {
     dt_dev_pixelpipe_cache_print(&pipe->cache);
+    dt_dev_pixelpipe_cache_global_print(darktable.pixelpipe_cache);
+  }
 
   //  go through list of modules from the end:
   int pos = g_list_length(dev->iop);
@@ -1761,6 +2059,26 @@ restart:
   pipe->backbuf_height = height;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
+  // everything is up to date now, unless a module was edited while we were processing:
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->dirty_count == dirty_count) pipe->dirty_from = -1;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  if(darktable.pixelpipe_profile)
+  {
+    dt_dev_pixelpipe_profile_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    g_strlcpy(ev.name, _pipe_type_to_str(pipe->type), sizeof(ev.name));
+    ev.pipe = _pipe_type_to_str(pipe->type);
+    ev.imgid = pipe->image.id;
+    ev.whole_pipe = 1;
+    ev.cache_queries = pipe->cache.queries - profile_queries;
+    ev.cache_misses = pipe->cache.misses - profile_misses;
+    ev.start = profile_start;
+    ev.end = dt_get_wtime();
+    dt_dev_pixelpipe_profile_record(darktable.pixelpipe_profile, &ev);
+  }
+
   // printf("pixelpipe homebrew process end\n");
   pipe->processing = 0;
   return 0;
@@ -1769,6 +2087,8 @@ restart:
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  // input pixels changed, so the copies other pipes would find are stale, too:
+  dt_dev_pixelpipe_cache_global_invalidate(darktable.pixelpipe_cache, dt_dev_pixelpipe_cache_global_image_key(pipe));
 }
 
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in, int height_in, int *width, int *height)
@@ -56,6 +56,8 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t buf_in, buf_out;    // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;            // set this to 0 in commit_params to temporarily disable the use of process_cl
   float processed_maximum[3];      // sensor saturation after this iop, used internally for caching
+  int tiles;                       // number of tiles of the last run, 0 if it was not tiled. for profiling
+  size_t tile_bytes;               // peak size of the tile buffers held at once in the last run. for profiling
 }
 dt_dev_pixelpipe_iop_t;
 
@@ -90,6 +92,11 @@ typedef struct dt_dev_pixelpipe_t
   dt_dev_pixelpipe_cache_t cache;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
+  // position of the first node whose output changed since the last complete run, -1 if none.
+  // the input of this node is pinned in the cache, so only the suffix of the pipe is replayed.
+  int dirty_from;
+  // bumped whenever dirty_from is lowered, so a run only marks the pipe clean if nothing changed meanwhile.
+  int dirty_count;
   // input buffer
   float *input;
   // width and height of input buffer
@@ -108,7 +115,7 @@ typedef struct dt_dev_pixelpipe_t
   dt_dev_pixelpipe_change_t changed;
   // backbuffer (output)
   uint8_t *backbuf;
-  int backbuf_size;
+  size_t backbuf_size;
   int backbuf_width, backbuf_height;
   uint64_t backbuf_hash;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
@@ -147,7 +154,7 @@ int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_
 // inits the pixelpipe with settings optimized for thumbnail export (no history stack cache)
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
 // inits the pixelpipe with given cacheline size and number of entries.
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t entries);
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
 // constructs a new input gegl_buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width, int height, float iscale);
 
@@ -164,6 +171,8 @@ void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe);
 void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // cleanup all gegl nodes except clean input/output
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe);
+// marks the output of the given module and everything after it as outdated.
+void dt_dev_pixelpipe_mark_dirty(dt_dev_pixelpipe_t *pipe, struct dt_iop_module_t *module);
 // sync with develop_t history stack from scratch (new node added, have to pop old ones)
 void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // sync with develop_t history stack by just copying the top item params (same op, new params on top)
@@ -0,0 +1,204 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_profile.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the aggregated stats are kept for all events, but the trace stops growing here (~20MB):
+#define DT_PIXELPIPE_PROFILE_MAX_EVENTS (1<<18)
+
+typedef struct dt_dev_pixelpipe_profile_stats_t
+{
+  char name[32];
+  const char *pipe;
+  int32_t whole_pipe;
+  uint64_t runs, cached, opencl, tiled, tiles;
+  uint64_t max_bytes, cache_queries, cache_misses;
+  double time, max_time;
+}
+dt_dev_pixelpipe_profile_stats_t;
+
+typedef struct dt_dev_pixelpipe_profile_t
+{
+  dt_pthread_mutex_t lock;
+  double start;
+  gchar *json_filename, *trace_filename;
+  GArray *events;        // dt_dev_pixelpipe_profile_event_t, in recording order
+  GHashTable *threads;   // pthread_t -> small id for the trace
+  GArray *tid;           // small id of every event
+  uint64_t dropped;
+  GHashTable *stats;     // "pipe/name" -> dt_dev_pixelpipe_profile_stats_t
+}
+dt_dev_pixelpipe_profile_t;
+
+dt_dev_pixelpipe_profile_t *dt_dev_pixelpipe_profile_init(const char *json_filename, const char *trace_filename)
+{
+  dt_dev_pixelpipe_profile_t *p = (dt_dev_pixelpipe_profile_t *)malloc(sizeof(dt_dev_pixelpipe_profile_t));
+  dt_pthread_mutex_init(&p->lock, NULL);
+  p->start = dt_get_wtime();
+  p->json_filename = g_strdup(json_filename);
+  p->trace_filename = g_strdup(trace_filename);
+  p->events = g_array_new(FALSE, FALSE, sizeof(dt_dev_pixelpipe_profile_event_t));
+  p->tid = g_array_new(FALSE, FALSE, sizeof(int32_t));
+  p->threads = g_hash_table_new(g_direct_hash, g_direct_equal);
+  p->dropped = 0;
+  p->stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  return p;
+}
+
+void dt_dev_pixelpipe_profile_cleanup(dt_dev_pixelpipe_profile_t *p)
+{
+  if(!p) return;
+  if(p->json_filename && dt_dev_pixelpipe_profile_write_json(p, p->json_filename))
+    fprintf(stderr, "[pixelpipe_profile] could not write `%s'\n", p->json_filename);
+  if(p->trace_filename && dt_dev_pixelpipe_profile_write_trace(p, p->trace_filename))
+    fprintf(stderr, "[pixelpipe_profile] could not write `%s'\n", p->trace_filename);
+  g_free(p->json_filename);
+  g_free(p->trace_filename);
+  g_array_free(p->events, TRUE);
+  g_array_free(p->tid, TRUE);
+  g_hash_table_destroy(p->threads);
+  g_hash_table_destroy(p->stats);
+  dt_pthread_mutex_destroy(&p->lock);
+  free(p);
+}
+
+void dt_dev_pixelpipe_profile_record(dt_dev_pixelpipe_profile_t *p, const dt_dev_pixelpipe_profile_event_t *ev)
+{
+  const double time = ev->end - ev->start;
+  gchar *key = g_strdup_printf("%s/%s", ev->pipe, ev->whole_pipe ? "" : ev->name);
+
+  dt_pthread_mutex_lock(&p->lock);
+  dt_dev_pixelpipe_profile_stats_t *s = (dt_dev_pixelpipe_profile_stats_t *)g_hash_table_lookup(p->stats, key);
+  if(!s)
+  {
+    s = (dt_dev_pixelpipe_profile_stats_t *)g_malloc0(sizeof(dt_dev_pixelpipe_profile_stats_t));
+    g_strlcpy(s->name, ev->name, sizeof(s->name));
+    s->pipe = ev->pipe;
+    s->whole_pipe = ev->whole_pipe;
+    g_hash_table_insert(p->stats, key, s);
+  }
+  else g_free(key);
+  s->runs++;
+  s->cached += ev->cached;
+  s->opencl += ev->opencl;
+  s->tiled += ev->tiles > 0;
+  s->tiles += ev->tiles;
+  s->max_bytes = MAX(s->max_bytes, ev->bytes);
+  s->cache_queries += ev->cache_queries;
+  s->cache_misses += ev->cache_misses;
+  s->time += time;
+  s->max_time = MAX(s->max_time, time);
+
+  if(p->events->len < DT_PIXELPIPE_PROFILE_MAX_EVENTS)
+  {
+    const gpointer self = (gpointer)pthread_self();
+    int32_t tid = GPOINTER_TO_INT(g_hash_table_lookup(p->threads, self));
+    if(!tid)
+    {
+      tid = g_hash_table_size(p->threads) + 1;
+      g_hash_table_insert(p->threads, self, GINT_TO_POINTER(tid));
+    }
+    g_array_append_val(p->events, *ev);
+    g_array_append_val(p->tid, tid);
+  }
+  else p->dropped++;
+  dt_pthread_mutex_unlock(&p->lock);
+}
+
+static gint _profile_stats_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_dev_pixelpipe_profile_stats_t *sa = (const dt_dev_pixelpipe_profile_stats_t *)a;
+  const dt_dev_pixelpipe_profile_stats_t *sb = (const dt_dev_pixelpipe_profile_stats_t *)b;
+  const int c = strcmp(sa->pipe, sb->pipe);
+  if(c) return c;
+  // most expensive first:
+  return (sa->time < sb->time) - (sa->time > sb->time);
+}
+
+static void _profile_write_stats(FILE *f, GList *stats, const int whole_pipe)
+{
+  int first = 1;
+  for(GList *l = stats; l; l = g_list_next(l))
+  {
+    const dt_dev_pixelpipe_profile_stats_t *s = (const dt_dev_pixelpipe_profile_stats_t *)l->data;
+    if(s->whole_pipe != whole_pipe) continue;
+    fprintf(f, "%s\n    {\"pipe\": \"%s\", ", first ? "" : ",", s->pipe);
+    if(!whole_pipe) fprintf(f, "\"module\": \"%s\", ", s->name);
+    fprintf(f, "\"runs\": %"PRIu64", \"time\": %.6f, \"max_time\": %.6f, \"avg_time\": %.6f, ",
+            s->runs, s->time, s->max_time, s->runs ? s->time / s->runs : 0.0);
+    if(whole_pipe)
+      fprintf(f, "\"cache_queries\": %"PRIu64", \"cache_misses\": %"PRIu64"}", s->cache_queries, s->cache_misses);
+    else
+      fprintf(f, "\"cached\": %"PRIu64", \"opencl\": %"PRIu64", \"tiled\": %"PRIu64", \"tiles\": %"PRIu64", \"max_bytes\": %"PRIu64"}",
+              s->cached, s->opencl, s->tiled, s->tiles, s->max_bytes);
+    first = 0;
+  }
+}
+
+int dt_dev_pixelpipe_profile_write_json(dt_dev_pixelpipe_profile_t *p, const char *filename)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f) return 1;
+  dt_pthread_mutex_lock(&p->lock);
+  GList *stats = g_list_sort(g_hash_table_get_values(p->stats), _profile_stats_cmp);
+  fprintf(f, "{\n  \"duration\": %.6f,\n  \"pipes\": [", dt_get_wtime() - p->start);
+  _profile_write_stats(f, stats, 1);
+  fprintf(f, "\n  ],\n  \"modules\": [");
+  _profile_write_stats(f, stats, 0);
+  fprintf(f, "\n  ]\n}\n");
+  dt_pthread_mutex_unlock(&p->lock);
+  g_list_free(stats);
+  return fclose(f) != 0;
+}
+
+int dt_dev_pixelpipe_profile_write_trace(dt_dev_pixelpipe_profile_t *p, const char *filename)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f) return 1;
+  dt_pthread_mutex_lock(&p->lock);
+  if(p->dropped)
+    fprintf(stderr, "[pixelpipe_profile] trace is incomplete, %"PRIu64" events were not recorded\n", p->dropped);
+  fprintf(f, "{\"traceEvents\": [");
+  for(int k=0; k<p->events->len; k++)
+  {
+    const dt_dev_pixelpipe_profile_event_t *ev = &g_array_index(p->events, dt_dev_pixelpipe_profile_event_t, k);
+    // complete events, timestamps in microseconds:
+    fprintf(f, "%s\n  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.1f, \"dur\": %.1f, \"pid\": 1, \"tid\": %d, ",
+            k ? "," : "", ev->name, ev->whole_pipe ? "pipe" : ev->pipe,
+            (ev->start - p->start) * 1e6, (ev->end - ev->start) * 1e6, g_array_index(p->tid, int32_t, k));
+    if(ev->whole_pipe)
+      fprintf(f, "\"args\": {\"image\": %d, \"cache_queries\": %"PRIu64", \"cache_misses\": %"PRIu64"}}",
+              ev->imgid, ev->cache_queries, ev->cache_misses);
+    else
+      fprintf(f, "\"args\": {\"image\": %d, \"cached\": %d, \"opencl\": %d, \"tiles\": %d, \"bytes\": %"PRIu64"}}",
+              ev->imgid, ev->cached, ev->opencl, ev->tiles, ev->bytes);
+  }
+  fprintf(f, "\n], \"displayTimeUnit\": \"ms\"}\n");
+  dt_pthread_mutex_unlock(&p->lock);
+  return fclose(f) != 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
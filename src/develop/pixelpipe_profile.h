@@ -0,0 +1,68 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_DEV_PIXELPIPE_PROFILE_H
+#define DT_DEV_PIXELPIPE_PROFILE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * records what the pixelpipe spends its time on: one event per module run
+ * (or cache hit) and one per complete pipe run. the events are aggregated per
+ * module and pipe type, and can be written as json summary or as chrome trace
+ * (load it in chrome://tracing) when darktable shuts down.
+ *
+ * recording is only switched on by --profile / --profile-trace, otherwise
+ * darktable.pixelpipe_profile is NULL and the pipe does not call in here.
+ */
+
+typedef struct dt_dev_pixelpipe_profile_event_t
+{
+  char name[32];            // module op, "input" for the base buffer, or the pipe type for whole pipe runs
+  const char *pipe;         // pipe type, static string
+  int32_t imgid;
+  int32_t whole_pipe;       // 1 if this is a complete pipe run instead of a single module
+  int32_t opencl;           // 1 if the module was processed on the gpu
+  int32_t cached;           // 1 if the output came from the local or the shared pixelpipe cache
+  int32_t tiles;            // number of tiles, 0 if not tiled
+  uint64_t bytes;           // peak memory: output buffer plus the tile buffers held at the same time
+  uint64_t cache_queries;   // pixelpipe cache lookups during this pipe run, whole pipe events only
+  uint64_t cache_misses;
+  double start, end;        // wall clock, dt_get_wtime()
+}
+dt_dev_pixelpipe_profile_event_t;
+
+struct dt_dev_pixelpipe_profile_t;
+
+/** start recording. the files are written by cleanup, either may be NULL. */
+struct dt_dev_pixelpipe_profile_t *dt_dev_pixelpipe_profile_init(const char *json_filename, const char *trace_filename);
+/** writes the requested files and frees everything. */
+void dt_dev_pixelpipe_profile_cleanup(struct dt_dev_pixelpipe_profile_t *profile);
+
+/** thread safe. */
+void dt_dev_pixelpipe_profile_record(struct dt_dev_pixelpipe_profile_t *profile, const dt_dev_pixelpipe_profile_event_t *ev);
+
+/** aggregated statistics per pipe type and module. returns 0 on success. */
+int dt_dev_pixelpipe_profile_write_json(struct dt_dev_pixelpipe_profile_t *profile, const char *filename);
+/** all recorded events in chrome's trace event format. returns 0 on success. */
+int dt_dev_pixelpipe_profile_write_trace(struct dt_dev_pixelpipe_profile_t *profile, const char *filename);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
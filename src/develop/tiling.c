@@ -692,6 +692,7 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] gave up tiling for module '%s'. too many tiles: %d x %d\n", self->op, tiles_x, tiles_y);
     goto error;
   }
+  piece->tiles = tiles_x * tiles_y;
 
 
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] use tiling on module '%s' for image with full size %d x %d\n", self->op, roi_in->width, roi_in->height);
@@ -699,6 +700,7 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
   /* reserve input and output buffers for tiles */
   input = dt_alloc_align(64, width*height*in_bpp);
+  piece->tile_bytes = MAX(piece->tile_bytes, (size_t)width*height*(in_bpp + out_bpp));
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n", self->op);
@@ -932,6 +934,7 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] gave up tiling for module '%s'. too many tiles: %d x %d\n", self->op, tiles_x, tiles_y);
     goto error;
   }
+  piece->tiles = tiles_x * tiles_y;
 
 
   /* calculate tile width and height excl. overlap (i.e. the good part) for output.
@@ -1039,6 +1042,7 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
       /* prepare input tile buffer */
       input = dt_alloc_align(64, iroi_full.width*iroi_full.height*in_bpp);
+      piece->tile_bytes = MAX(piece->tile_bytes, (size_t)iroi_full.width*iroi_full.height*in_bpp + (size_t)oroi_full.width*oroi_full.height*out_bpp);
       if(input == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n", self->op);
@@ -1226,6 +1230,7 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
     dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] aborted tiling for module '%s'. too many tiles: %d x %d\n", self->op, tiles_x, tiles_y);
     return FALSE;
   }
+  piece->tiles = tiles_x * tiles_y;
 
 
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] use tiling on module '%s' for image with full size %d x %d\n", self->op, roi_in->width, roi_in->height);
@@ -1269,6 +1274,7 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
 
       /* get input and output buffers */
       input = dt_opencl_alloc_device(devid, wd, ht, in_bpp);
+      piece->tile_bytes = MAX(piece->tile_bytes, (size_t)wd*ht*(in_bpp + out_bpp));
       if(input == NULL) goto error;
       output = dt_opencl_alloc_device(devid, wd, ht, out_bpp);
       if(output == NULL) goto error;
@@ -1452,6 +1458,7 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
     dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_roi] aborted tiling for module '%s'. too many tiles: %d x %d\n", self->op, tiles_x, tiles_y);
     return FALSE;
   }
+  piece->tiles = tiles_x * tiles_y;
 
   /* calculate tile width and height excl. overlap (i.e. the good part) for output.
      important for all following processing steps. */
@@ -1565,6 +1572,7 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
 
       /* get opencl input and output buffers */
       input = dt_opencl_alloc_device(devid, iroi_full.width, iroi_full.height, in_bpp);
+      piece->tile_bytes = MAX(piece->tile_bytes, (size_t)iroi_full.width*iroi_full.height*in_bpp + (size_t)oroi_full.width*oroi_full.height*out_bpp);
       if(input == NULL) goto error;
 
       output = dt_opencl_alloc_device(devid, oroi_full.width, oroi_full.height, out_bpp);
@@ -247,6 +247,7 @@ process_next_image()
   buf.mime = mime;
   buf.bpp = bpp;
   buf.write_image = write_image;
+  buf.write_image_begin = NULL;
   dat.max_width  = width;
   dat.max_height = height;
   strcpy(dat.style, "none");
@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <memory.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -36,7 +37,9 @@ typedef struct dt_imageio_tiff_t
   int width, height;
   char style[128];
   int bpp;
+  // not part of the params, only valid while writing:
   TIFF *handle;
+  int row;
 }
 dt_imageio_tiff_t;
 
@@ -47,12 +50,11 @@ typedef struct dt_imageio_tiff_gui_t
 dt_imageio_tiff_gui_t;
 
 
-int write_image (dt_imageio_tiff_t *d, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+int write_image_begin(dt_imageio_tiff_t *d, const char *filename, int imgid)
 {
   // Fetch colorprofile into buffer if wanted
   uint8_t *profile = NULL;
   uint32_t profile_len = 0;
-  int rc = 0;
 
   if(imgid > 0)
   {
@@ -68,6 +70,13 @@ int write_image (dt_imageio_tiff_t *d, const char *filename, const void *in_void
 
   // Create tiff image
   TIFF *tif=TIFFOpen(filename,"wb");
+  d->handle = tif;
+  d->row = 0;
+  if(!tif)
+  {
+    free(profile);
+    return 1;
+  }
   if(d->bpp == 8) TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
   else            TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
   TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
@@ -86,78 +95,70 @@ int write_image (dt_imageio_tiff_t *d, const char *filename, const void *in_void
   TIFFSetField(tif, TIFFTAG_YRESOLUTION, 300.0);
   TIFFSetField(tif, TIFFTAG_ZIPQUALITY, 9);
 
-  const uint8_t  *in8 =(const uint8_t  *)in_void;
-  const uint16_t *in16=(const uint16_t *)in_void;
-  if(d->bpp == 16)
+  // libtiff keeps its own copy
+  free(profile);
+  return 0;
+}
+
+int write_image_rows(dt_imageio_tiff_t *d, const void *in_void, int rows)
+{
+  // libtiff collects the scanlines to strips of DT_TIFFIO_STRIPE rows and compresses them,
+  // so the caller may hand in any number of rows at a time.
+  const size_t samples = (size_t)d->width*3;
+  void *rowdata = malloc(samples*(d->bpp == 16 ? sizeof(uint16_t) : sizeof(uint8_t)));
+  if(!rowdata) return 1;
+  int rc = 0;
+  for(int y = 0; y < rows && !rc; y++)
   {
-    uint32_t rowsize=(d->width*3)*sizeof(uint16_t);
-    uint32_t stripesize=rowsize*DT_TIFFIO_STRIPE;
-    uint16_t *rowdata = (uint16_t *)malloc(stripesize);
-    uint16_t *wdata = rowdata;
-    uint32_t stripe=0;
-    // uint32_t insize=((d->width*d->height)*3)*sizeof(uint16_t);
-    // while(stripedata<(in8+insize)-(stripesize)) {
-    // TIFFWriteEncodedStrip(tif,stripe++,stripedata,stripesize);
-    // stripedata+=stripesize;
-    // }
-    for (int y = 0; y < d->height; y++)
+    if(d->bpp == 16)
     {
+      const uint16_t *in16 = (const uint16_t *)in_void + (size_t)4*d->width*y;
+      uint16_t *wdata = (uint16_t *)rowdata;
       for(int x=0; x<d->width; x++)
         for(int k=0; k<3; k++)
-        {
-          (wdata)[0] = in16[4*d->width*y + 4*x + k];
-          wdata++;
-        }
-      if((wdata-stripesize/sizeof(uint16_t))==rowdata)
-      {
-        TIFFWriteEncodedStrip(tif,stripe++,rowdata,rowsize*DT_TIFFIO_STRIPE);
-        wdata=rowdata;
-      }
+          *(wdata++) = in16[4*x + k];
     }
-    if((wdata-stripesize/sizeof(uint16_t))!=rowdata)
-      TIFFWriteEncodedStrip(tif,stripe,rowdata,(wdata-rowdata)*sizeof(uint16_t));
-    TIFFClose(tif);
-    free(rowdata);
-  }
-  else
-  {
-    uint32_t rowsize=(d->width*3)*sizeof(uint8_t);
-    uint32_t stripesize=rowsize*DT_TIFFIO_STRIPE;
-    uint8_t *rowdata = (uint8_t *)malloc(stripesize);
-    uint8_t *wdata = rowdata;
-    uint32_t stripe=0;
-
-    for (int y = 0; y < d->height; y++)
+    else
     {
+      const uint8_t *in8 = (const uint8_t *)in_void + (size_t)4*d->width*y;
+      uint8_t *wdata = (uint8_t *)rowdata;
       for(int x=0; x<d->width; x++)
         for(int k=0; k<3; k++)
-        {
-          (wdata)[0] = in8[4*d->width*y + 4*x + k];
-          wdata++;
-        }
-      if((wdata-stripesize)==rowdata)
-      {
-        TIFFWriteEncodedStrip(tif,stripe++,rowdata,rowsize*DT_TIFFIO_STRIPE);
-        wdata=rowdata;
-      }
+          *(wdata++) = in8[4*x + k];
     }
-    if((wdata-stripesize)!=rowdata)
-      TIFFWriteEncodedStrip(tif,stripe,rowdata,wdata-rowdata);
-    TIFFClose(tif);
-    free(rowdata);
+    rc = TIFFWriteScanline(d->handle, rowdata, d->row++, 0) < 0;
   }
+  free(rowdata);
+  return rc;
+}
+
+int write_image_end(dt_imageio_tiff_t *d, const char *filename, void *exif, int exif_len)
+{
+  int rc = 0;
+  TIFFClose(d->handle);
+  d->handle = NULL;
 
   if(exif)
     rc = dt_exif_write_blob(exif,exif_len,filename);
 
-  free(profile);
-
   /*
    * Until we get symbolic error status codes, if rc is 1, return 0.
    */
   return ((rc == 1) ? 0 : 1);
 }
 
+int write_image (dt_imageio_tiff_t *d, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+{
+  if(write_image_begin(d, filename, imgid)) return 1;
+  if(write_image_rows(d, in_void, d->height))
+  {
+    TIFFClose(d->handle);
+    d->handle = NULL;
+    return 1;
+  }
+  return write_image_end(d, filename, exif, exif_len);
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
@@ -180,7 +181,7 @@ int dt_imageio_tiff_read(dt_imageio_tiff_t *tiff, uint8_t *out)
 void*
 get_params(dt_imageio_module_format_t *self, int *size)
 {
-  *size = sizeof(dt_imageio_tiff_t) - sizeof(TIFF*);
+  *size = offsetof(dt_imageio_tiff_t, handle);
   dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)malloc(sizeof(dt_imageio_tiff_t));
   memset(d, 0, sizeof(dt_imageio_tiff_t));
   d->bpp = dt_conf_get_int("plugins/imageio/format/tiff/bpp");
@@ -198,7 +199,7 @@ free_params(dt_imageio_module_format_t *self, void *params)
 int
 set_params(dt_imageio_module_format_t *self, void *params, int size)
 {
-  if(size != sizeof(dt_imageio_tiff_t) - sizeof(TIFF*)) return 1;
+  if(size != offsetof(dt_imageio_tiff_t, handle)) return 1;
   dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)params;
   dt_imageio_tiff_gui_t *g = (dt_imageio_tiff_gui_t *)self->gui_data;
   if(d->bpp < 12) gtk_toggle_button_set_active(g->b8, TRUE);
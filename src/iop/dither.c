@@ -108,7 +108,7 @@ groups ()
 int
 flags ()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PIPE_TYPE_DEPENDENT;
 }
 
 
@@ -52,7 +52,7 @@ groups ()
 int
 flags ()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_PREVIEW_NON_OPENCL;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_PREVIEW_NON_OPENCL | IOP_FLAGS_POINTWISE;
 }
 
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
@@ -18,6 +18,7 @@
 
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/collection.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "common/styles.h"
@@ -215,6 +216,7 @@ static void _lib_history_compress_clicked_callback (GtkWidget *widget, gpointer
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_invalidate();
 
   dt_dev_reload_history_items(darktable.develop);
   dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
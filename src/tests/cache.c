@@ -22,7 +22,8 @@
 #define dt_alloc_align(A, B) malloc(B)
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-// unit test for the concurrent hopscotch hashmap and the LRU cache built on top of it.
+// unit test for the concurrent hopscotch hashmap and the cache built on top of it,
+// and a benchmark of lookup throughput under contention.
 #include "common/cache.h"
 #include "common/cache.c"
 
@@ -42,6 +43,46 @@ alloc_dummy(void *data, const uint32_t key, int32_t *cost, void **buf)
   return 0;
 }
 
+#ifdef _OPENMP
+// spreads consecutive numbers over the key range, without shared rng state between the threads:
+static inline uint32_t
+bench_key(uint32_t k, const uint32_t working_set)
+{
+  k = (k ^ 61) ^ (k >> 16);
+  k *= 9;
+  k ^= k >> 4;
+  k *= 0x27d4eb2d;
+  k ^= k >> 15;
+  return k % working_set;
+}
+
+// throughput of read_get/read_release pairs in million per second, with keys out of
+// the given working set, for a cache which holds capacity entries. if the working set
+// is larger than that, lookups miss and run the garbage collection.
+static double
+bench(const int threads, const uint32_t working_set, const int capacity)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, capacity, 16, 64, capacity);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+
+  const int ops = 1<<20;
+  const double start = omp_get_wtime();
+  #  pragma omp parallel for default(none) schedule(static) shared(cache) firstprivate(ops, working_set) num_threads(threads)
+  for(int k=0; k<ops; k++)
+  {
+    const uint32_t key = bench_key(k, working_set);
+    const uint32_t val = (uint32_t)(long int)dt_cache_read_get(&cache, key);
+    assert(val == key);
+    dt_cache_read_release(&cache, key);
+  }
+  const double end = omp_get_wtime();
+
+  dt_cache_cleanup(&cache);
+  return ops / (end - start) * 1e-6;
+}
+#endif
+
 int main(int argc, char *arg[])
 {
   dt_cache_t cache;
@@ -73,12 +114,10 @@ int main(int argc, char *arg[])
   fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
 
   const int size = dt_cache_size(&cache);
-  const int lru_cnt   = lru_check_consistency(&cache);
-  const int lru_cnt_r = lru_check_consistency_reverse(&cache);
-  // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-  assert(size == lru_cnt);
-  assert(lru_cnt_r == lru_cnt);
-  fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
+  // every entry costs 1:
+  assert(size == cache.cost);
+  assert(size <= cache.cost_quota);
+  fprintf(stderr, "[passed] cache consistency after removals, have %d entries left.\n", size);
 
   dt_cache_cleanup(&cache);
 
@@ -115,15 +154,64 @@ int main(int argc, char *arg[])
     fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
 
     const int size = dt_cache_size(&cache2);
-    const int lru_cnt   = lru_check_consistency(&cache2);
-    const int lru_cnt_r = lru_check_consistency_reverse(&cache2);
-    // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-    assert(size == lru_cnt);
-    assert(lru_cnt_r == lru_cnt);
-    fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
+    assert(size == cache2.cost);
+    assert(size <= cache2.cost_quota);
+    fprintf(stderr, "[passed] cache consistency after removals, have %d entries left.\n", size);
     dt_cache_cleanup(&cache2);
   }
 
+  {
+    // scan resistance: entries which are used over and over survive a single pass over many more:
+    dt_cache_t cache3;
+    dt_cache_init(&cache3, 128, 1, 64, 100);
+    dt_cache_set_allocate_callback(&cache3, alloc_dummy, NULL);
+    for(int round=0; round<10; round++)
+    {
+      for(int k=0; k<50; k++)
+      {
+        dt_cache_read_get(&cache3, k);
+        dt_cache_read_release(&cache3, k);
+      }
+      // others come and go in between, so the clock hand moves:
+      for(int k=0; k<20; k++)
+      {
+        const int key = 100000 + 20*round + k;
+        dt_cache_read_get(&cache3, key);
+        dt_cache_read_release(&cache3, key);
+      }
+    }
+    for(int k=1000; k<11000; k++)
+    {
+      // looked at twice, like a thumbnail on screen:
+      dt_cache_read_get(&cache3, k);
+      dt_cache_read_release(&cache3, k);
+      dt_cache_read_get(&cache3, k);
+      dt_cache_read_release(&cache3, k);
+    }
+    int survivors = 0;
+    for(int k=0; k<50; k++) survivors += dt_cache_contains(&cache3, k);
+    assert(survivors == 50);
+    assert(cache3.cost <= cache3.cost_quota);
+    fprintf(stderr, "[passed] %d/50 frequently used entries survived scanning 10000 others\n", survivors);
+
+    dt_cache_stats_t stats;
+    dt_cache_get_stats(&cache3, &stats);
+    assert(stats.hits + stats.misses == 10*(50+20) + 2*10000);
+    assert(stats.misses >= 50 + 10*20 + 10000);
+    assert(stats.evictions == stats.misses - dt_cache_size(&cache3));
+    fprintf(stderr, "[passed] statistics: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" evictions\n",
+            stats.hits, stats.misses, stats.evictions);
+    dt_cache_cleanup(&cache3);
+  }
+
+#ifdef _OPENMP
+  // contention benchmark: lookups per second over the number of threads, once with
+  // all keys fitting into the cache and once with twice as many keys as fit.
+  fprintf(stderr, "[bench] threads  hits Mop/s  misses Mop/s\n");
+  for(int threads=1; threads<=32; threads*=2)
+    fprintf(stderr, "[bench] %7d %11.2f %13.2f\n", threads, bench(threads, 4096, 8192), bench(threads, 16384, 8192));
+#endif
+
   exit(0);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
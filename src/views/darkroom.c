@@ -1044,6 +1044,9 @@ void leave(dt_view_t *self)
     dt_image_synch_xmp(dev->image_storage.id);
   }
 
+  // the edits only marked the image for the similarity indexer, now it may run:
+  dt_control_start_indexer();
+
   // clear gui.
   dev->gui_leaving = 1;
   dt_pthread_mutex_lock(&dev->history_mutex);
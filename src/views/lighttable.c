@@ -86,7 +86,6 @@ typedef struct dt_library_t
   dt_view_image_over_t image_over;
   int full_preview;
   int32_t full_preview_id;
-  gboolean offset_changed;
   GdkColor star_color;
   int images_in_row;
 
@@ -105,6 +104,17 @@ typedef struct dt_library_t
     sqlite3_stmt *is_grouped;
   } statements;
 
+  /* thumbnails queued off screen, ahead of the scroll direction */
+  struct
+  {
+    int32_t offset;         // first visible image at the last scroll
+    double time;            // and when that happened
+    float velocity;         // smoothed scroll speed in images per second, signed
+    int32_t start, end;     // window covered by the queued jobs, visible part included
+    dt_mipmap_size_t mip;
+    GArray *imgids;         // queued by us, may have run already
+  } prefetch;
+
 }
 dt_library_t;
 
@@ -152,8 +162,6 @@ void switch_layout_to(dt_library_t *lib, int new_layout)
 
     if(lib->center) lib->offset = 0;
     lib->center = 0;
-
-    lib->offset_changed = TRUE;
   }
 }
 
@@ -212,7 +220,6 @@ static void move_view(dt_library_t *lib, direction dir)
   }
 
   lib->first_visible_filemanager = lib->offset;
-  lib->offset_changed = TRUE;
 }
 
 /* This function allows the file manager view to zoom "around" the image
@@ -246,10 +253,12 @@ void zoom_around_image(dt_library_t *lib, double pointerx, double pointery, int
 
   lib->offset = zoom_anchor_image - pi - (pj * new_images_in_row);
   lib->first_visible_filemanager = lib->offset;
-  lib->offset_changed = TRUE;
   lib->images_in_row = new_images_in_row;
 }
 
+// images of a new collection whose structs are loaded right away:
+#define DT_LIBRARY_PRELOAD_MAX 10000
+
 static void _view_lighttable_collection_listener_callback(gpointer instance, gpointer user_data)
 {
   dt_view_t *self = (dt_view_t *)user_data;
@@ -267,6 +276,12 @@ static void _view_lighttable_collection_listener_callback(gpointer instance, gpo
   /* prepare a new main query statement for collection */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &lib->statements.main_query, NULL);
 
+  /* load the image structs of the collection up front, in one query instead of one per thumbnail */
+  int32_t *ids = (int32_t *)malloc(sizeof(int32_t) * DT_LIBRARY_PRELOAD_MAX);
+  const uint32_t cnt = dt_collection_get_ids(darktable.collection, 0, DT_LIBRARY_PRELOAD_MAX, ids);
+  dt_image_cache_preload(darktable.image_cache, ids, cnt);
+  free(ids);
+
   /* set the centerview scroll to top */
   if(instance != NULL)
     lib->offset=0;
@@ -274,6 +289,11 @@ static void _view_lighttable_collection_listener_callback(gpointer instance, gpo
   dt_control_queue_redraw_center();
 }
 
+// scrolling further than this per second makes the prefetch window grow beyond one page:
+#define DT_LIBRARY_PREFETCH_HORIZON 1.0f
+// but never beyond these many pages:
+#define DT_LIBRARY_PREFETCH_MAX_PAGES 4
+
 void init(dt_view_t *self)
 {
   self->data = malloc(sizeof(dt_library_t));
@@ -291,6 +311,9 @@ void init(dt_view_t *self)
   lib->zoom_y = 0.0f;
   lib->full_preview=0;
   lib->full_preview_id=-1;
+  lib->prefetch.start = lib->prefetch.end = -1;
+  lib->prefetch.time = dt_get_wtime();
+  lib->prefetch.imgids = g_array_new(FALSE, FALSE, sizeof(int32_t));
 
   GtkStyle *style = gtk_rc_get_style_by_paths(gtk_settings_get_default(), "dt-stars", NULL, GTK_TYPE_NONE);
 
@@ -314,9 +337,98 @@ void init(dt_view_t *self)
 
 void cleanup(dt_view_t *self)
 {
+  dt_library_t *lib = (dt_library_t *)self->data;
+  g_array_free(lib->prefetch.imgids, TRUE);
   free(self->data);
 }
 
+/* takes our prefetch jobs out of the queue unless they started already, except for the images in keep (may be NULL). */
+static void _prefetch_cancel(dt_library_t *lib, GHashTable *keep)
+{
+  for(int k=0; k<lib->prefetch.imgids->len; k++)
+  {
+    const int32_t imgid = g_array_index(lib->prefetch.imgids, int32_t, k);
+    if(keep && g_hash_table_lookup(keep, GINT_TO_POINTER(imgid))) continue;
+    dt_job_t j;
+    dt_image_load_job_init(&j, imgid, lib->prefetch.mip);
+    dt_control_remove_job(darktable.control, &j);
+  }
+  g_array_set_size(lib->prefetch.imgids, 0);
+  lib->prefetch.start = lib->prefetch.end = -1;
+}
+
+static void _prefetch_queue(dt_library_t *lib, const int32_t imgid, const dt_mipmap_size_t mip)
+{
+  // don't bother the job queue with what's cached already:
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_TESTLOCK);
+  if(buf.buf)
+  {
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    return;
+  }
+  dt_job_t j;
+  dt_image_load_job_init(&j, imgid, mip);
+  dt_control_job_set_priority(&j, DT_JOB_PRIORITY_NORMAL);
+  dt_control_add_job(darktable.control, &j);
+  g_array_append_val(lib->prefetch.imgids, imgid);
+}
+
+/*
+ * queues thumbnails off screen in the direction the user scrolls, the further ahead the faster that is,
+ * and cancels the ones which were scrolled past before they were loaded. the images on screen are
+ * requested by dt_view_image_expose() at interactive priority, these go below them.
+ * called from expose, so all of this must not block: the gui thread is never throttled by the job queue.
+ */
+static void _prefetch_update(dt_library_t *lib, const int32_t offset, const int32_t visible, const int32_t stride, const dt_mipmap_size_t mip)
+{
+  const double now = dt_get_wtime();
+  if(offset != lib->prefetch.offset)
+  {
+    const double elapsed = MAX(now - lib->prefetch.time, 1e-3);
+    const float velocity = (offset - lib->prefetch.offset) / elapsed;
+    // smooth out the jitter of single expose events, but start over after a pause:
+    if(elapsed > 1.0 || velocity * lib->prefetch.velocity < 0.0f) lib->prefetch.velocity = velocity;
+    else lib->prefetch.velocity = 0.5f * (lib->prefetch.velocity + velocity);
+    lib->prefetch.offset = offset;
+    lib->prefetch.time = now;
+  }
+
+  // at least the next page, more if we would scroll past that before the horizon:
+  int32_t ahead = MAX(visible, fabsf(lib->prefetch.velocity) * DT_LIBRARY_PREFETCH_HORIZON);
+  ahead = MIN(ahead, DT_LIBRARY_PREFETCH_MAX_PAGES * visible);
+  ahead = (ahead + stride - 1) / stride * stride;
+  // and the row we just left, in case the user turns around:
+  const int32_t behind = stride;
+  const int forward = lib->prefetch.velocity >= 0.0f;
+  const int32_t start = MAX(0, offset - (forward ? behind : ahead));
+  const int32_t end = offset + visible + (forward ? ahead : behind);
+  if(start == lib->prefetch.start && end == lib->prefetch.end && mip == lib->prefetch.mip) return;
+
+  int32_t *ids = (int32_t *)malloc(sizeof(int32_t) * (end - start));
+  const int32_t cnt = dt_collection_get_ids(darktable.collection, start, end - start, ids);
+  dt_image_cache_preload(darktable.image_cache, ids, cnt);
+
+  // cancel what fell out of the window. the visible ones aren't queued again, but would be requested anyways:
+  GHashTable *keep = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for(int k=0; k<cnt; k++) g_hash_table_insert(keep, GINT_TO_POINTER(ids[k]), GINT_TO_POINTER(1));
+  _prefetch_cancel(lib, mip == lib->prefetch.mip ? keep : NULL);
+  g_hash_table_destroy(keep);
+
+  // nearest to the screen first, scroll direction before the row behind:
+  const int32_t after = offset + visible - start, before = MIN(offset, start + cnt) - start;
+  for(int k=0; k<2; k++)
+  {
+    if(forward == (k == 0)) for(int32_t i = after; i < cnt; i++) _prefetch_queue(lib, ids[i], mip);
+    else for(int32_t i = before - 1; i >= 0; i--) _prefetch_queue(lib, ids[i], mip);
+  }
+  free(ids);
+
+  lib->prefetch.start = start;
+  lib->prefetch.end = end;
+  lib->prefetch.mip = mip;
+}
+
 /**
  * \brief A helper function to convert grid coordinates to an absolute index
  *
@@ -340,8 +452,6 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
 {
   dt_library_t *lib = (dt_library_t *)self->data;
 
-  gboolean offset_changed = FALSE;
-
   /* query new collection count */
   lib->collection_count = dt_collection_get_count (darktable.collection);
 
@@ -360,8 +470,6 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   cairo_set_source_rgb (cr, .2, .2, .2);
   cairo_paint(cr);
 
-  offset_changed = lib->offset_changed;
-
   const float wd = width/(float)iir;
   const float ht = width/(float)iir;
 
@@ -440,14 +548,6 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   /* update scroll borders */
   dt_view_set_scrollbar(self, 0, 1, 1, offset, lib->collection_count, max_rows*iir);
 
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* setup offset and row for the main query */
-  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
-  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_rows*iir);
-
   if(mouse_over_id != -1)
   {
     const dt_image_t *mouse_over_image = dt_image_cache_read_get(darktable.image_cache, mouse_over_id);
@@ -464,17 +564,11 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   // prefetch the ids so that we can peek into the future to see if there are adjacent images in the same group.
   int *query_ids = (int*)calloc(max_rows*max_cols, sizeof(int));
   if(!query_ids) goto after_drawing;
-  for(int row = 0; row < max_rows; row++)
-  {
-    for(int col = 0; col < max_cols; col++)
-    {
-      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
-        query_ids[row*iir+col] = sqlite3_column_int(lib->statements.main_query, 0);
-      else goto end_query_cache;
-    }
-  }
+  // the collection keeps its ids in memory, this doesn't go to the database unless it changed:
+  const uint32_t query_cnt = dt_collection_get_ids(darktable.collection, offset, max_rows*max_cols, query_ids);
 
-end_query_cache:
+  // and the image structs of the whole page in one go:
+  dt_image_cache_preload(darktable.image_cache, query_ids, query_cnt);
   mouse_over_id = -1;
   cairo_save(cr);
   int current_image =0;
@@ -669,39 +763,12 @@ escape_image_loop:
 escape_border_loop:
   cairo_restore(cr);
 after_drawing:
-  /* check if offset was changed and we need to prefetch thumbs */
-  if (offset_changed)
   {
-    int32_t imgids_num = 0;
-    const int prefetchrows = .5*max_rows+1;
-    int32_t imgids[prefetchrows*iir];
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    /* setup offest and row for prefetch */
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset + max_rows*iir);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, prefetchrows*iir);
-
-    // prefetch jobs in inverse order: supersede previous jobs: most important last
-    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && imgids_num < prefetchrows*iir)
-      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
-
-    float imgwd = iir == 1 ? 0.97 : 0.8;
-    dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
-                             darktable.mipmap_cache,
-                             imgwd*wd, imgwd*(iir==1?height:ht));
-    while(imgids_num > 0)
-    {
-      imgids_num --;
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_read_get(
-        darktable.mipmap_cache,
-        &buf,
-        imgids[imgids_num],
-        mip,
-        DT_MIPMAP_PREFETCH);
-    }
+    const float imgwd = iir == 1 ? 0.97 : 0.8;
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
+                                   darktable.mipmap_cache,
+                                   imgwd*wd, imgwd*(iir==1?height:ht));
+    _prefetch_update(lib, MAX(0, offset), max_rows*iir, iir, mip);
   }
 
   if(query_ids)
@@ -899,17 +966,13 @@ expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, in
       continue;
     }
 
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_cols);
+    int32_t row_ids[DT_LIBRARY_MAX_ZOOM];
+    const int row_cnt = dt_collection_get_ids(darktable.collection, offset, max_cols, row_ids);
     for(int col = 0; col < max_cols; col++)
     {
-      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+      if(col < row_cnt)
       {
-        id = sqlite3_column_int(lib->statements.main_query, 0);
+        id = row_ids[col];
 
         // set mouse over id
         if((zoom == 1 && mouse_over_id < 0) || ((!pan || track) && seli == col && selj == row))
@@ -930,6 +993,15 @@ expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, in
     offset += DT_LIBRARY_MAX_ZOOM;
   }
 failure:
+  {
+    // full rows in the direction of scrolling, or the next images when flipping through at 1:1:
+    const float imgwd = zoom == 1 ? 0.97 : 0.8;
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
+                                   darktable.mipmap_cache,
+                                   imgwd*wd, imgwd*(zoom==1?height:ht));
+    if(zoom == 1) _prefetch_update(lib, MAX(0, lib->offset), 1, 1, mip);
+    else _prefetch_update(lib, DT_LIBRARY_MAX_ZOOM*MAX(0, offset_j), DT_LIBRARY_MAX_ZOOM*max_rows, DT_LIBRARY_MAX_ZOOM, mip);
+  }
 
   lib->zoom_x = zoom_x;
   lib->zoom_y = zoom_y;
@@ -1265,6 +1337,7 @@ void leave(dt_view_t *self)
 
   // clear some state variables
   dt_library_t *lib = (dt_library_t *)self->data;
+  _prefetch_cancel(lib, NULL);
   lib->button = 0;
   lib->pan = 0;
 }